@@ -1,156 +1,112 @@
 // *******************************************************************
-//  Arduino Nano 5V example code
-//  for   https://github.com/EmanuelFeru/hoverboard-firmware-hack-FOC
+//  Arduino example code for the SmartESC display protocol
+//  based on the hoverserial example of
+//  https://github.com/EmanuelFeru/hoverboard-firmware-hack-FOC
 //
 //  Copyright (C) 2019-2020 Emanuel FERU <aerdronix@gmail.com>
 //
 // *******************************************************************
 // INFO:
-// • This sketch uses the the Serial Software interface to communicate and send commands to the hoverboard
-// • The built-in (HW) Serial interface is used for debugging and visualization. In case the debugging is not needed,
-//   it is recommended to use the built-in Serial interface for full speed perfomace.
-// • The data packaging includes a Start Frame, checksum, and re-syncronization capability for reliable communication
-// 
-// CONFIGURATION on the hoverboard side in config.h:
-// • Option 1: Serial on Right Sensor cable (short wired cable) - recommended, since the USART3 pins are 5V tolerant.
-//   #define CONTROL_SERIAL_USART3
-//   #define FEEDBACK_SERIAL_USART3
-//   // #define DEBUG_SERIAL_USART3
-// • Option 2: Serial on Left Sensor cable (long wired cable) - use only with 3.3V devices! The USART2 pins are not 5V tolerant!
-//   #define CONTROL_SERIAL_USART2
-//   #define FEEDBACK_SERIAL_USART2
-//   // #define DEBUG_SERIAL_USART2
+// • The frames are encoded and parsed by the SmartEscSerial library (Arduino/libraries/SmartEscSerial).
+//   Set the sketchbook location to the Arduino folder of the repository, or copy the library to your libraries folder.
+// • This sketch sends a command frame every TIME_SEND with a throttle test ramp, and prints the feedback and
+//   telemetry frames received from the ESC.
+// • ESP32 / Mega: Serial1 is used for the ESC. Arduino Nano: SoftwareSerial on pins 2 and 3, which may lose bytes
+//   at 115200 baud: the lost frames are counted as check byte errors and skipped.
+//
+// CONFIGURATION on the ESC side in config.h:
+// • USART3_BAUD must be ESC_SERIAL_BAUD, and SERIAL_CRC_TYPE must match ESC_CHECK.
+// • Power_ON = 1 in the command frame powers the ESC off: it is left at 0 here.
 // *******************************************************************
 
 // ########################## DEFINES ##########################
-#define HOVER_SERIAL_BAUD   38400       // [-] Baud rate for HoverSerial (used to communicate with the hoverboard)
+#define ESC_SERIAL_BAUD     115200      // [-] Baud rate of the ESC link (USART3_BAUD)
+#define ESC_CHECK           CHECK_XOR   // [-] Check byte: CHECK_XOR or CHECK_CRC8 (SERIAL_CRC_TYPE)
 #define SERIAL_BAUD         115200      // [-] Baud rate for built-in Serial (used for the Serial Monitor)
-#define START_FRAME         0xABCD     	// [-] Start frme definition for reliable serial communication
-#define TIME_SEND           100         // [ms] Sending time interval
-#define SPEED_MAX_TEST      300         // [-] Maximum speed for testing
-//#define DEBUG_RX                        // [-] Debug received data. Prints all bytes to serial (comment-out to disable)
+#define TIME_SEND           50          // [ms] Sending time interval, below the SERIAL_TIMEOUT of the ESC
+#define THROTTLE_MAX_TEST   80          // [-] Maximum throttle for testing, 0..255
+#define ESP32_RX_PIN        14          // SERIAL_CNTRL_TO_ESP
+#define ESP32_TX_PIN        27          // SERIAL_ESP_TO_CNTRL
+
+#include <SmartEscSerial.h>
+using namespace smartesc;
 
+#if defined(ESP32) || defined(HAVE_HWSERIAL1)
+#define EscSerial Serial1
+#else
 #include <SoftwareSerial.h>
-SoftwareSerial HoverSerial(2,3); 		    // RX, TX
+SoftwareSerial EscSerial(2, 3);         // RX, TX
+#endif
 
 // Global variables
-uint8_t idx = 0;                        // Index for new data pointer
-uint16_t bufStartFrame;                 // Buffer Start Frame
-byte *p;                                // Pointer declaration for the new received data
-byte incomingByte;
-byte incomingBytePrev;
-
-typedef struct{
-   uint16_t	start;
-   int16_t  steer;
-   int16_t  speed;
-   uint16_t checksum;
-} SerialCommand;
-SerialCommand Command;
-
-typedef struct{
-   uint16_t start;
-   int16_t 	cmd1;
-   int16_t 	cmd2;
-   int16_t 	speedR_meas;
-   int16_t 	speedL_meas;
-   int16_t 	batVoltage;
-   int16_t 	boardTemp;
-   uint16_t cmdLed;
-   uint16_t checksum;
-} SerialFeedback;
-SerialFeedback Feedback;
-SerialFeedback NewFeedback;
+StaticRing<256> ring;
+Parser parser(ring, FROM_ESC, ESC_CHECK);
+Command command;
+Feedback feedback;
 
 // ########################## SETUP ##########################
-void setup() 
+void setup()
 {
   Serial.begin(SERIAL_BAUD);
-  Serial.println("Hoverboard Serial v1.0");
-    
-  HoverSerial.begin(HOVER_SERIAL_BAUD);
+  Serial.println("SmartESC Serial v2.0");
+
+#if defined(ESP32)
+  EscSerial.begin(ESC_SERIAL_BAUD, SERIAL_8N1, ESP32_RX_PIN, ESP32_TX_PIN);
+#else
+  EscSerial.begin(ESC_SERIAL_BAUD);
+#endif
   pinMode(LED_BUILTIN, OUTPUT);
 }
 
 // ########################## SEND ##########################
-void Send(int16_t uSteer, int16_t uSpeed)
+void Send(uint8_t throttle, uint8_t brake)
 {
-  // Create command
-  Command.start    = (uint16_t)START_FRAME;
-  Command.steer    = (int16_t)uSteer;
-  Command.speed    = (int16_t)uSpeed;
-  Command.checksum = (uint16_t)(Command.start ^ Command.steer ^ Command.speed);
-
-  // Write to Serial
-  HoverSerial.write((uint8_t *) &Command, sizeof(Command)); 
+  uint8_t frame[FRAME_TO_ESC];
+
+  command.throttle = throttle;
+  command.brake    = brake;
+  EscSerial.write(frame, encode(command, frame, ESC_CHECK));
 }
 
 // ########################## RECEIVE ##########################
 void Receive()
 {
-	// Check for new data availability in the Serial buffer
-	if (HoverSerial.available()) {
-		incomingByte 	  = HoverSerial.read();		                              // Read the incoming byte
-		bufStartFrame	= ((uint16_t)(incomingByte) << 8) | incomingBytePrev;	  // Construct the start frame		
-	}
-	else {
-		return;
-	}
-
-  // If DEBUG_RX is defined print all incoming bytes
-  #ifdef DEBUG_RX
-		Serial.print(incomingByte);
-		return;
-	#endif    	
-	
-	// Copy received data
-	if (bufStartFrame == START_FRAME) {	                    // Initialize if new data is detected
-		p 		= (byte *)&NewFeedback;
-    *p++  = incomingBytePrev;
-		*p++ 	= incomingByte;
-		idx 	= 2;	
-	} else if (idx >= 2 && idx < sizeof(SerialFeedback)) {	// Save the new received data
-		*p++ 	= incomingByte; 
-		idx++;
-	}	
-	
-	// Check if we reached the end of the package
-	if (idx == sizeof(SerialFeedback)) {  	
-		uint16_t checksum;
-		checksum = (uint16_t)(NewFeedback.start ^ NewFeedback.cmd1 ^ NewFeedback.cmd2 ^ NewFeedback.speedR_meas ^ NewFeedback.speedL_meas
-					^ NewFeedback.batVoltage ^ NewFeedback.boardTemp ^ NewFeedback.cmdLed);
-	
-		// Check validity of the new data
-		if (NewFeedback.start == START_FRAME && checksum == NewFeedback.checksum) {
-			// Copy the new data
-			memcpy(&Feedback, &NewFeedback, sizeof(SerialFeedback));
-		  
-			// Print data to built-in Serial
-			Serial.print("1: ");   Serial.print(Feedback.cmd1);
-			Serial.print(" 2: ");  Serial.print(Feedback.cmd2);
-			Serial.print(" 3: ");  Serial.print(Feedback.speedR_meas);
-			Serial.print(" 4: ");  Serial.print(Feedback.speedL_meas);
-			Serial.print(" 5: ");  Serial.print(Feedback.batVoltage);
-			Serial.print(" 6: ");  Serial.print(Feedback.boardTemp);
-			Serial.print(" 7: ");  Serial.println(Feedback.cmdLed);
-		} else {
-		  Serial.println("Non-valid data skipped");
-		}
-		idx = 0;	// Reset the index (it prevents to enter in this if condition in the next cycle)
-	}
- 	
-	// Update previous states
-	incomingBytePrev 	= incomingByte;
+  FrameView frame;
+  uint16_t room, n = 0;
+  uint8_t *dst = ring.writePtr(room);
+  uint8_t tag;
+  int32_t value;
+
+  // Read the available bytes straight into the ring
+  while (n < room && EscSerial.available()) {
+    dst[n++] = EscSerial.read();
+  }
+  ring.commit(n);
+
+  while (parser.next(frame)) {
+    if (decode(frame, feedback)) {
+      Serial.print("V: ");    Serial.print(feedback.controllerVoltage);
+      Serial.print(" I: ");   Serial.print(feedback.controllerCurrent);
+      Serial.print(" T: ");   Serial.print(feedback.mosfetTemperature);
+      Serial.print(" rpm: "); Serial.print(feedback.erpm);
+      Serial.print(" err: "); Serial.println(feedback.errors);
+    } else if (frame.type() == TYPE_TELEMETRY) {
+      TelemetryReader reader(frame);
+      while (reader.next(tag, value)) {
+        Serial.print(tag, HEX); Serial.print(": "); Serial.print(value); Serial.print(" ");
+      }
+      Serial.println();
+    }
+  }
 }
 
 // ########################## LOOP ##########################
 
 unsigned long iTimeSend = 0;
-int iTestMax = SPEED_MAX_TEST;
 int iTest = 0;
 
 void loop(void)
-{ 
+{
   unsigned long timeNow = millis();
 
   // Check for new received data
@@ -159,13 +115,18 @@ void loop(void)
   // Send commands
   if (iTimeSend > timeNow) return;
   iTimeSend = timeNow + TIME_SEND;
-  Send(0, SPEED_MAX_TEST - 2*abs(iTest));
+  Send(THROTTLE_MAX_TEST - abs(iTest), 0);
 
   // Calculate test command signal
-  iTest += 10;
-  if (iTest > iTestMax) iTest = -iTestMax;
-
-  // Blink the LED
+  iTest += 2;
+  if (iTest > THROTTLE_MAX_TEST) iTest = -THROTTLE_MAX_TEST;
+
+  // Print the link quality and blink the LED
+  if (timeNow % 5000 < TIME_SEND) {
+    Serial.print("frames: ");      Serial.print(parser.frames);
+    Serial.print(" crc errors: "); Serial.print(parser.crcErrors);
+    Serial.print(" skipped: ");    Serial.println(parser.skipped);
+  }
   digitalWrite(LED_BUILTIN, (timeNow%2000)<1000);
 }
 
@@ -0,0 +1,169 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throughput of the library on Linux: frames/s and ns/frame.
+ *
+ *   g++ -std=c++11 -O2 -I../src bench_parser.cpp ../src/SmartEscSerial.cpp -o bench_parser
+ *   ./bench_parser [frames] [chunk bytes] [crc8]
+ *
+ * - parse: a recorded-like ESC stream (feedback, telemetry and one trip frame out of 50, 1 % noise bytes) is
+ *   copied into the ring in chunks of the given size, as read() would, then parsed and decoded,
+ * - encode: command frames.
+ * The stream is built once, so only the library is timed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "SmartEscSerial.h"
+
+using namespace smartesc;
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point t0) {
+	return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+static void report(const char *name, uint32_t frames, size_t bytes, double s) {
+	printf("%-8s %9u frames %9.1f kframes/s %7.1f ns/frame %7.1f MB/s\n", name, (unsigned) frames,
+			frames / s / 1e3, s * 1e9 / frames, bytes / s / 1e6);
+}
+
+/*
+ * ESC stream of n frames
+ */
+static std::vector<uint8_t> buildStream(uint32_t n, Check check) {
+	std::vector<uint8_t> s;
+	uint8_t frame[FRAME_MAX];
+	Feedback f;
+	uint32_t seed = 1, i;
+	uint16_t len, k;
+
+	memset(&f, 0, sizeof(f));
+	for (i = 0; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		if ((seed >> 16) % 100 == 0) {
+			s.push_back((uint8_t) (seed >> 24));                // noise
+		}
+		if (i % 50 == 0) {
+			memset(frame, 0, FRAME_TRIP);
+			frame[0] = START_FROM_ESC;
+			frame[1] = TYPE_TRIP;
+			frame[trip::Total_distance] = (uint8_t) i;
+			len = FRAME_TRIP;
+			frame[len - 1] = crcUpdate(0, frame, len - 1, check);
+		} else if (i % 2) {
+			f.controllerVoltage = (uint16_t) (3600 + (seed >> 20) % 600);
+			f.controllerCurrent = (int16_t) ((seed >> 8) % 20000);
+			f.erpm = (int16_t) (i & 0x3FFF);
+			len = encode(f, frame, check);
+		} else {
+			len = TELEMETRY_HEADER;
+			frame[0] = START_FROM_ESC;
+			frame[1] = TYPE_TELEMETRY;
+			frame[len++] = tlm::SPEED;
+			frame[len++] = (uint8_t) i;
+			frame[len++] = (uint8_t) (i >> 8);
+			frame[len++] = tlm::CURRENT;
+			frame[len++] = (uint8_t) seed;
+			frame[len++] = (uint8_t) (seed >> 8);
+			frame[len++] = tlm::TEMP_BOARD;
+			frame[len++] = 41;
+			frame[2] = (uint8_t) (len - TELEMETRY_HEADER);
+			len++;
+			frame[len - 1] = crcUpdate(0, frame, len - 1, check);
+		}
+		for (k = 0; k < len; k++) {
+			s.push_back(frame[k]);
+		}
+	}
+	return s;
+}
+
+int main(int argc, char **argv) {
+	uint32_t n = (argc > 1) ? (uint32_t) strtoul(argv[1], 0, 0) : 2000000;
+	uint16_t chunk = (argc > 2) ? (uint16_t) strtoul(argv[2], 0, 0) : 64;
+	Check check = (argc > 3 && strcmp(argv[3], "crc8") == 0) ? CHECK_CRC8 : CHECK_XOR;
+	std::vector<uint8_t> stream = buildStream(n, check);
+	StaticRing<1024> ring;
+	Parser parser(ring, FROM_ESC, check);
+	FrameView v;
+	Feedback f;
+	Trip t;
+	Command c;
+	uint8_t out[FRAME_TO_ESC];
+	uint8_t tag;
+	int32_t value;
+	uint32_t decoded = 0, records = 0, i;
+	size_t pos = 0;
+	uint16_t room, len;
+	uint8_t *dst;
+	volatile uint8_t sink = 0;
+
+	if (chunk == 0 || chunk > 512) {
+		fprintf(stderr, "chunk: 1..512 bytes\n");
+		return 1;
+	}
+	printf("%u frames, %u bytes, %u-byte chunks, %s\n", (unsigned) n, (unsigned) stream.size(), (unsigned) chunk,
+			check == CHECK_CRC8 ? "CRC-8" : "XOR");
+
+	Clock::time_point t0 = Clock::now();
+	while (pos < stream.size()) {
+		dst = ring.writePtr(room);
+		len = (stream.size() - pos < chunk) ? (uint16_t) (stream.size() - pos) : chunk;
+		len = (len < room) ? len : room;
+		memcpy(dst, &stream[pos], len);
+		ring.commit(len);
+		pos += len;
+		while (parser.next(v)) {
+			if (decode(v, f)) {
+				decoded++;
+			} else if (decode(v, t)) {
+				decoded++;
+			} else {
+				TelemetryReader reader(v);
+				while (reader.next(tag, value)) {
+					records++;
+				}
+				decoded++;
+			}
+		}
+	}
+	report("parse", parser.frames, stream.size(), seconds(t0));
+	printf("         %u telemetry records\n", (unsigned) records);
+	if (parser.frames != n || decoded != n) {
+		fprintf(stderr, "%u frames parsed, %u expected (crc errors %u, skipped %u)\n", (unsigned) parser.frames,
+				(unsigned) n, (unsigned) parser.crcErrors, (unsigned) parser.skipped);
+		return 1;
+	}
+
+	memset(&c, 0, sizeof(c));
+	t0 = Clock::now();
+	for (i = 0; i < n; i++) {
+		c.throttle = (uint8_t) i;
+		c.brake = (uint8_t) (i >> 8);
+		encode(c, out, check);
+		sink ^= out[FRAME_TO_ESC - 1];
+	}
+	report("encode", n, (size_t) n * FRAME_TO_ESC, seconds(t0));
+	return 0;
+}
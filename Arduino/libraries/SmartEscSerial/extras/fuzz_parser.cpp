@@ -0,0 +1,265 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libFuzzer target: the library parser against the firmware decoder (Core/Src/protocol.c), built for the host.
+ *
+ *   FW="-DUSE_HAL_DRIVER -DSTM32F103xB -I../../../../Core/Inc -I../../../../Drivers/STM32F1xx_HAL_Driver/Inc
+ *       -I../../../../Drivers/CMSIS/Device/ST/STM32F1xx/Include -I../../../../Drivers/CMSIS/Include"
+ *   clang -c -g -O1 -fsanitize=fuzzer-no-link,address,undefined $FW ../../../../Core/Src/protocol.c
+ *   clang++ -g -O1 -fsanitize=fuzzer,address,undefined -I../src $FW fuzz_parser.cpp ../src/SmartEscSerial.cpp protocol.o
+ *   ./a.out -max_len=4096 corpus/
+ * Without libFuzzer (g++), add -DFUZZ_STANDALONE: random inputs, or the files given as arguments.
+ *
+ * Per input:
+ * - the bytes are fed one by one to protocol_parse and, in chunks of varying size, through a small ring to the
+ *   library parser (Direction TO_ESC). Both must return the same frames, in the same order, and the same counters,
+ * - the bytes are parsed as ESC frames (Direction FROM_ESC) and decoded, for the sanitizers,
+ * - a command frame encoded by the library must be the firmware frame sealed by protocol_seal.
+ * The check byte type is the SERIAL_CRC_TYPE the firmware objects were built with.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SmartEscSerial.h"
+
+#define _Static_assert static_assert
+extern "C" {
+#include "protocol.h"
+}
+
+using namespace smartesc;
+
+// Library offsets against the firmware structs
+#define SAME_OFFSET(fw, field, lib)     static_assert(offsetof(fw, field) == (lib), #fw "." #field)
+static_assert(sizeof(SerialFromDisplayToEsc) == FRAME_TO_ESC, "command frame length");
+static_assert(sizeof(SerialFromEscToDisplay) == FRAME_FEEDBACK, "feedback frame length");
+static_assert(sizeof(SerialTripFromEscToDisplay) == FRAME_TRIP, "trip frame length");
+static_assert(sizeof(SerialBaudFromEscToDisplay) == FRAME_BAUD_REPLY, "baud reply length");
+static_assert(sizeof(SerialParamFromEscToDisplay) == FRAME_PARAM_REPLY, "param reply length");
+static_assert(sizeof(SerialLogFromEscToDisplay) == FRAME_LOG_REPLY, "log reply length");
+static_assert(SERIAL_TELEMETRY_HEADER == TELEMETRY_HEADER, "telemetry header");
+SAME_OFFSET(SerialFromDisplayToEsc, Power_ON, cmd::Power_ON);
+SAME_OFFSET(SerialFromDisplayToEsc, Throttle, cmd::Throttle);
+SAME_OFFSET(SerialFromDisplayToEsc, Motor_start_speed, cmd::Motor_start_speed);
+SAME_OFFSET(SerialFromDisplayToEsc, CRC8, cmd::CRC8);
+SAME_OFFSET(SerialFromEscToDisplay, Controller_Voltage, fb::Controller_Voltage);
+SAME_OFFSET(SerialFromEscToDisplay, ERPM, fb::ERPM);
+SAME_OFFSET(SerialFromEscToDisplay, BMS_Cells_status, fb::BMS_Cells_status);
+SAME_OFFSET(SerialFromEscToDisplay, BMS_Charge_cycles_partial, fb::BMS_Charge_cycles_partial);
+SAME_OFFSET(SerialFromEscToDisplay, Errors, fb::Errors);
+SAME_OFFSET(SerialTripFromEscToDisplay, Total_distance, trip::Total_distance);
+SAME_OFFSET(SerialTripFromEscToDisplay, Total_regen_mWh, trip::Total_regen_mWh);
+SAME_OFFSET(SerialParamFromDisplayToEsc, Value, param::Value);
+SAME_OFFSET(SerialParamFromDisplayToEsc, Hold, param::Hold);
+SAME_OFFSET(SerialParamFromEscToDisplay, Value, param::ReplyValue);
+SAME_OFFSET(SerialParamFromEscToDisplay, Max, param::Max);
+SAME_OFFSET(SerialParamFromEscToDisplay, CRC8, param::ReplyCRC8);
+SAME_OFFSET(SerialLogFromDisplayToEsc, Index, eventlog::Index);
+SAME_OFFSET(SerialLogFromEscToDisplay, Count, eventlog::Count);
+SAME_OFFSET(SerialLogFromEscToDisplay, Odometer, eventlog::Odometer);
+SAME_OFFSET(SerialLogFromEscToDisplay, Temperature, eventlog::Temperature);
+SAME_OFFSET(SerialLogFromEscToDisplay, CRC8, eventlog::ReplyCRC8);
+
+#define FUZZ_ASSERT(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			abort(); \
+		} \
+	} while (0)
+
+static Check firmwareCheck(void) {
+	static const uint8_t probe = 0x80;
+	return (protocol_crc(&probe, 1) == 0x80) ? CHECK_XOR : CHECK_CRC8;
+}
+
+static void fuzzToEsc(const uint8_t *data, size_t size, Check check) {
+	static uint8_t fwFrames[4096 / FRAME_TO_ESC + 1][PROTOCOL_RX_MAX];
+	protocolParser_t fw;
+	StaticRing<256> ring;
+	Parser parser(ring, TO_ESC, check);
+	FrameView v;
+	uint8_t frame[FRAME_MAX];
+	size_t nFw = 0, nLib = 0, pos = 0, i;
+	uint16_t chunk, room;
+	uint8_t *dst;
+
+	memset(&fw, 0, sizeof(fw));
+	for (i = 0; i < size; i++) {
+		if (protocol_parse(&fw, data[i]) && nFw < sizeof(fwFrames) / sizeof(fwFrames[0])) {
+			memcpy(fwFrames[nFw++], fw.buf, PROTOCOL_RX_MAX);
+		}
+	}
+
+	while (pos < size) {
+		chunk = 1 + data[pos] % 61;             // chunks and ring wrap-around driven by the input
+		if (chunk > size - pos) {
+			chunk = (uint16_t) (size - pos);
+		}
+		dst = ring.writePtr(room);
+		if (chunk > room) {
+			chunk = room;
+		}
+		memcpy(dst, &data[pos], chunk);
+		ring.commit(chunk);
+		pos += chunk;
+		while (parser.next(v)) {
+			FUZZ_ASSERT(v.size() == FRAME_TO_ESC);
+			FUZZ_ASSERT(nLib < nFw);
+			v.copy(frame);
+			FUZZ_ASSERT(memcmp(frame, fwFrames[nLib], FRAME_TO_ESC) == 0);
+			nLib++;
+		}
+	}
+	FUZZ_ASSERT(nLib == nFw);
+	FUZZ_ASSERT(parser.frames == fw.frames);
+	FUZZ_ASSERT(parser.crcErrors == fw.crcErrors);
+	FUZZ_ASSERT(parser.lenErrors == 0);                 // any Type is a command frame to the ESC
+	FUZZ_ASSERT(parser.skipped == fw.skipped);
+	FUZZ_ASSERT(ring.size() == fw.len);
+}
+
+static void fuzzFromEsc(const uint8_t *data, size_t size, Check check) {
+	StaticRing<256> ring;
+	Parser parser(ring, FROM_ESC, check);
+	FrameView v;
+	Feedback f;
+	Trip t;
+	ParamReply r;
+	uint8_t code, status, tag;
+	int32_t value;
+	uint8_t out[FRAME_MAX];
+	uint16_t n;
+
+	while (size) {
+		n = ring.write(data, (uint16_t) (size < 97 ? size : 97));
+		data += n;
+		size -= n;
+		while (parser.next(v)) {
+			FUZZ_ASSERT(v[0] == START_FROM_ESC && v.size() <= FRAME_MAX);
+			v.copy(out);
+			FUZZ_ASSERT(crcUpdate(0, out, v.size() - 1, check) == out[v.size() - 1]);
+			FUZZ_ASSERT(!v.data() || memcmp(v.data(), out, v.size()) == 0);
+			if (decode(v, f)) {
+				FUZZ_ASSERT(encode(f, out, check) == FRAME_FEEDBACK);
+				for (n = 0; n < FRAME_FEEDBACK; n++) {
+					FUZZ_ASSERT(out[n] == v[n]);
+				}
+			}
+			decode(v, t);
+			decode(v, r);
+			decodeBaudReply(v, code, status);
+			TelemetryReader reader(v);
+			while (reader.next(tag, value)) {
+				FUZZ_ASSERT(telemetrySize(tag) != 0);
+			}
+		}
+	}
+}
+
+static void fuzzEncode(const uint8_t *data, size_t size, Check check) {
+	SerialFromDisplayToEsc fw;
+	Command c;
+	uint8_t out[FRAME_TO_ESC];
+	FrameView v(out, FRAME_TO_ESC);
+	Command back;
+
+	if (size < sizeof(c)) {
+		return;
+	}
+	memcpy(&c, data, sizeof(c));
+	memset(&fw, 0, sizeof(fw));
+	fw.Frame_start = START_TO_ESC;
+	fw.Type = TYPE_FEEDBACK;
+	memcpy(&fw.Destination, &c, sizeof(c));     // Command lists the fields in wire order
+	protocol_seal(&fw, sizeof(fw));
+	FUZZ_ASSERT(encode(c, out, check) == sizeof(fw));
+	FUZZ_ASSERT(memcmp(out, &fw, sizeof(fw)) == 0);
+	FUZZ_ASSERT(decode(v, back) && memcmp(&back, &c, sizeof(c)) == 0);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	static const Check check = firmwareCheck();
+
+	if (size > 4096) {
+		return 0;
+	}
+	fuzzToEsc(data, size, check);
+	fuzzFromEsc(data, size, check);
+	fuzzEncode(data, size, check);
+	return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+/*
+ * Random streams of valid frames, noise and corrupted bytes, or the given files
+ */
+int main(int argc, char **argv) {
+	static const uint8_t types[] = { TYPE_FEEDBACK, TYPE_TRIP, TYPE_TELEMETRY, TYPE_PARAM, TYPE_BAUD, TYPE_LOG };
+	static uint8_t buf[4096];
+	uint32_t seed = 1, runs, i;
+	size_t n;
+	FILE *f;
+	int k;
+
+	if (argc > 1) {
+		for (k = 1; k < argc; k++) {
+			f = fopen(argv[k], "rb");
+			if (f) {
+				n = fread(buf, 1, sizeof(buf), f);
+				fclose(f);
+				LLVMFuzzerTestOneInput(buf, n);
+			}
+		}
+		return 0;
+	}
+	for (runs = 0; runs < 200000; runs++) {
+		n = 0;
+		while (n + FRAME_MAX < sizeof(buf) && (seed % 97) != 0) {
+			seed = seed * 1103515245 + 12345;
+			if ((seed >> 16) % 4 == 0) {
+				buf[n++] = (uint8_t) (seed >> 24);                  // noise
+				continue;
+			}
+			uint8_t dir = (seed >> 20) & 1;
+			buf[n] = dir ? START_TO_ESC : START_FROM_ESC;
+			buf[n + 1] = types[(seed >> 8) % sizeof(types)];
+			uint16_t len = dir ? FRAME_TO_ESC : frameLength(FROM_ESC, buf[n + 1], (seed >> 12) % 30);
+			for (i = 2; i < len; i++) {
+				seed = seed * 1103515245 + 12345;
+				buf[n + i] = (uint8_t) (seed >> 24);
+			}
+			if (buf[n + 1] == TYPE_TELEMETRY) {
+				buf[n + 2] = (uint8_t) (len - TELEMETRY_HEADER - 1);
+			}
+			buf[n + len - 1] = crcUpdate(0, &buf[n], len - 1, firmwareCheck());
+			if (((seed >> 4) & 15) == 0) {
+				buf[n + (seed >> 8) % len] ^= 1 << ((seed >> 3) & 7);  // corrupted frame
+			}
+			n += ((seed >> 6) & 7) == 0 ? len / 2 : len;            // truncated frame
+		}
+		seed = seed * 1103515245 + 12345;
+		LLVMFuzzerTestOneInput(buf, n);
+	}
+	printf("%u runs ok\n", (unsigned) runs);
+	return 0;
+}
+#endif
@@ -0,0 +1,531 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host side of the SmartESC display protocol, see SmartEscSerial.h.
+ * The frame lengths and the check byte follow Core/Src/protocol.c. The CRC-8 table is the one of the firmware,
+ * kept in flash on AVR.
+ */
+
+// Includes
+#include <string.h>
+#include "SmartEscSerial.h"
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define CRC8_TABLE(i)   pgm_read_byte(&crc8Table[i])
+#else
+#define PROGMEM
+#define CRC8_TABLE(i)   crc8Table[i]
+#endif
+
+namespace smartesc {
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+static const uint8_t crc8Table[256] PROGMEM = {
+		0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+		0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+		0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5, 0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+		0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85, 0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+		0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2, 0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+		0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2, 0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+		0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32, 0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+		0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42, 0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+		0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C, 0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+		0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC, 0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+		0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C, 0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+		0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C, 0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+		0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B, 0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+		0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B, 0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+		0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB, 0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+		0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB, 0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3
+};
+
+/* =========================== Local Functions =========================== */
+
+static uint16_t put(uint8_t *out, uint16_t pos, uint32_t val, uint8_t size) {
+	while (size--) {
+		out[pos++] = (uint8_t) val;
+		val >>= 8;
+	}
+	return pos;
+}
+
+/*
+ * Frame start and Type, zero the rest up to the check byte
+ */
+static void begin(uint8_t *out, uint8_t start, uint8_t type, uint16_t size) {
+	memset(out, 0, size);
+	out[0] = start;
+	out[1] = type;
+}
+
+static uint16_t seal(uint8_t *out, uint16_t size, Check check) {
+	out[size - 1] = crcUpdate(0, out, size - 1, check);
+	return size;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Check byte continued over len more bytes (protocol_crcUpdate)
+ */
+uint8_t crcUpdate(uint8_t crc, const uint8_t *data, uint16_t len, Check check) {
+	if (check == CHECK_CRC8) {
+		while (len--) {
+			crc = CRC8_TABLE(crc ^ *data++);
+		}
+	} else {
+		while (len--) {
+			crc ^= *data++;
+		}
+	}
+	return crc;
+}
+
+/*
+ * Length of a frame from its Type and, for the telemetry, its Length byte [bytes], 0 if invalid
+ */
+uint16_t frameLength(Direction dir, uint8_t type, uint8_t lengthByte) {
+	if (dir == TO_ESC) {
+		return FRAME_TO_ESC;                    // the command frame Type is not checked (protocol_rxLength)
+	}
+	switch (type) {
+	case TYPE_FEEDBACK:
+		return FRAME_FEEDBACK;
+	case TYPE_TRIP:
+		return FRAME_TRIP;
+	case TYPE_TELEMETRY:
+		return (lengthByte <= TELEMETRY_PAYLOAD_MAX) ? TELEMETRY_HEADER + lengthByte + 1 : 0;
+	case TYPE_BAUD:
+		return FRAME_BAUD_REPLY;
+	case TYPE_PARAM:
+		return FRAME_PARAM_REPLY;
+	case TYPE_LOG:
+		return FRAME_LOG_REPLY;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Value size of a telemetry tag [bytes], 0 for an unknown tag
+ */
+uint8_t telemetrySize(uint8_t tag) {
+	switch (tag) {
+	case tlm::SPEED:
+	case tlm::CURRENT:
+	case tlm::VOLTAGE:
+	case tlm::ERRORS:
+	case tlm::VERSION:
+	case tlm::CELL_MIN:
+		return 2;
+	case tlm::THROTTLE:
+	case tlm::BRAKE:
+	case tlm::TEMP_BOARD:
+	case tlm::TEMP_MOTOR:
+	case tlm::SOC:
+	case tlm::LIMIT:
+	case tlm::RIDE_MODE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+uint8_t *RingBuffer::writePtr(uint16_t &len) {
+	uint16_t i = head & mask;
+	uint16_t free = capacity() - i;
+
+	len = (room() < free) ? room() : free;
+	return &buf[i];
+}
+
+uint16_t RingBuffer::write(const uint8_t *data, uint16_t len) {
+	uint16_t done = 0;
+	uint16_t n;
+	uint8_t *dst;
+
+	while (done < len && room()) {
+		dst = writePtr(n);
+		if (n > len - done) {
+			n = len - done;
+		}
+		memcpy(dst, data + done, n);
+		commit(n);
+		done += n;
+	}
+	return done;
+}
+
+const uint8_t *RingBuffer::span(uint16_t i, uint16_t &len) const {
+	uint16_t pos = (tail + i) & mask;
+	uint16_t max = capacity() - pos;
+
+	if (len > size() - i) {
+		len = size() - i;
+	}
+	if (len > max) {
+		len = max;
+	}
+	return &buf[pos];
+}
+
+const uint8_t *FrameView::data() const {
+	return ((uint32_t) start + len <= (uint32_t) mask + 1) ? &base[start] : 0;
+}
+
+void FrameView::copy(uint8_t *dst) const {
+	uint16_t first = (uint16_t) ((uint32_t) mask + 1 - start);
+
+	if (first >= len) {
+		memcpy(dst, &base[start], len);
+	} else {
+		memcpy(dst, &base[start], first);
+		memcpy(dst + first, base, len - first);
+	}
+}
+
+void Parser::reset() {
+	ring.clear();
+	pending = 0;
+	frames = 0;
+	crcErrors = 0;
+	lenErrors = 0;
+	skipped = 0;
+}
+
+/*
+ * Drop the bytes before the next start frame. Output: true once the start frame and the Type are received
+ */
+bool Parser::seek() {
+	uint8_t start = (dir == FROM_ESC) ? START_FROM_ESC : START_TO_ESC;
+	const uint8_t *p, *s;
+	uint16_t n;
+
+	while (ring.size()) {
+		n = ring.size();
+		p = ring.span(0, n);
+		s = (const uint8_t*) memchr(p, start, n);
+		n = s ? (uint16_t) (s - p) : n;
+		skipped += n;
+		ring.drop(n);
+		if (s) {
+			return ring.size() >= 2;
+		}
+	}
+	return false;
+}
+
+/*
+ * Drop the first byte, the search restarts from the next start frame (protocol_resync)
+ */
+void Parser::resync() {
+	skipped++;
+	ring.drop(1);
+}
+
+bool Parser::next(FrameView &frame) {
+	uint16_t need, i, n;
+	const uint8_t *p;
+	uint8_t crc;
+
+	release();
+	while (seek()) {
+		if (dir == FROM_ESC && ring[1] == TYPE_TELEMETRY && ring.size() < TELEMETRY_HEADER) {
+			return false;
+		}
+		need = frameLength(dir, ring[1], (ring.size() > 2) ? ring[2] : 0);
+		if (need == 0 || need > ring.capacity()) {
+			lenErrors++;
+			resync();
+			continue;
+		}
+		if (ring.size() < need) {
+			return false;
+		}
+
+		crc = 0;
+		for (i = 0; i < need - 1; i += n) {
+			n = need - 1 - i;
+			p = ring.span(i, n);
+			crc = crcUpdate(crc, p, n, check);
+		}
+		if (crc == ring[need - 1]) {
+			frames++;
+			frame = FrameView(ring, need);
+			pending = need;
+			return true;
+		}
+		crcErrors++;
+		resync();
+	}
+	return false;
+}
+
+uint16_t encode(const Command &c, uint8_t *out, Check check) {
+	begin(out, START_TO_ESC, TYPE_FEEDBACK, FRAME_TO_ESC);
+	out[cmd::Destination] = c.destination;
+	out[cmd::Number_of_ESC] = c.numberOfEsc;
+	out[cmd::BMS_protocol] = c.bmsProtocol;
+	out[cmd::ESC_Jumps] = c.escJumps;
+	out[cmd::Display_Version_Maj] = c.displayVersionMaj;
+	out[cmd::Display_Version_Main] = c.displayVersionMain;
+	out[cmd::Power_ON] = c.powerOn;
+	out[cmd::Throttle] = c.throttle;
+	out[cmd::Brake] = c.brake;
+	out[cmd::Torque] = c.torque;
+	out[cmd::Brake_torque] = c.brakeTorque;
+	out[cmd::Lock] = c.lock;
+	out[cmd::Regulator] = c.regulator;
+	out[cmd::Motor_direction] = c.motorDirection;
+	out[cmd::Hall_sensors_direction] = c.hallSensorsDirection;
+	out[cmd::Ligth_power] = c.ligthPower;
+	out[cmd::Max_temperature_reduce] = c.maxTemperatureReduce;
+	out[cmd::Max_temperature_shutdown] = c.maxTemperatureShutdown;
+	out[cmd::Speed_limit] = c.speedLimit;
+	out[cmd::Motor_start_speed] = c.motorStartSpeed;
+	return seal(out, FRAME_TO_ESC, check);
+}
+
+uint16_t encode(const Feedback &f, uint8_t *out, Check check) {
+	begin(out, START_FROM_ESC, TYPE_FEEDBACK, FRAME_FEEDBACK);
+	out[fb::ESC_Version_Maj] = f.escVersionMaj;
+	out[fb::ESC_Version_Min] = f.escVersionMin;
+	out[fb::Throttle] = f.throttle;
+	out[fb::Brake] = f.brake;
+	put(out, fb::Controller_Voltage, f.controllerVoltage, 2);
+	put(out, fb::Controller_Current, (uint16_t) f.controllerCurrent, 2);
+	out[fb::MOSFET_temperature] = f.mosfetTemperature;
+	put(out, fb::ERPM, (uint16_t) f.erpm, 2);
+	out[fb::Lock_status] = f.lockStatus;
+	out[fb::Ligth_status] = f.ligthStatus;
+	out[fb::Regulator_status] = f.regulatorStatus;
+	put(out, fb::Phase_1_current_max, f.phase1CurrentMax, 2);
+	put(out, fb::Phase_1_voltage_max, f.phase1VoltageMax, 2);
+	out[fb::BMS_Version_Maj] = f.bmsVersionMaj;
+	out[fb::BMS_Version_Min] = f.bmsVersionMin;
+	put(out, fb::BMS_voltage, f.bmsVoltage, 2);
+	put(out, fb::BMS_Current, (uint16_t) f.bmsCurrent, 2);
+	memcpy(&out[fb::BMS_Cells_status], f.bmsCells, sizeof(f.bmsCells));
+	out[fb::BMS_Battery_tempature_1] = f.bmsTemperature1;
+	out[fb::BMS_Battery_tempature_2] = f.bmsTemperature2;
+	put(out, fb::BMS_Charge_cycles_full, f.bmsCyclesFull, 2);
+	put(out, fb::BMS_Charge_cycles_partial, f.bmsCyclesPartial, 2);
+	put(out, fb::Errors, f.errors, 2);
+	return seal(out, FRAME_FEEDBACK, check);
+}
+
+uint16_t encodeBaud(uint8_t baudCode, uint8_t *out, Check check) {
+	begin(out, START_TO_ESC, TYPE_BAUD, FRAME_TO_ESC);
+	out[2] = baudCode;
+	return seal(out, FRAME_TO_ESC, check);
+}
+
+uint16_t encodeParam(uint8_t command, uint8_t id, int32_t value, uint8_t hold, uint8_t *out, Check check) {
+	begin(out, START_TO_ESC, TYPE_PARAM, FRAME_TO_ESC);
+	out[param::Cmd] = command;
+	out[param::Id] = id;
+	put(out, param::Value, (uint32_t) value, 4);
+	out[param::Hold] = hold;
+	return seal(out, FRAME_TO_ESC, check);
+}
+
+uint16_t encodeLog(uint8_t command, uint16_t index, uint8_t *out, Check check) {
+	begin(out, START_TO_ESC, TYPE_LOG, FRAME_TO_ESC);
+	out[eventlog::Cmd] = command;
+	put(out, eventlog::Index, index, 2);
+	return seal(out, FRAME_TO_ESC, check);
+}
+
+uint16_t encodeCurve(uint8_t rideMode, uint8_t table, uint8_t rateRise, uint8_t rateFall, const uint8_t x[8],
+		const uint8_t y[8], uint8_t *out, Check check) {
+	begin(out, START_TO_ESC, TYPE_CURVE, FRAME_TO_ESC);
+	out[2] = rideMode;
+	out[3] = table;
+	out[4] = rateRise;
+	out[5] = rateFall;
+	memcpy(&out[6], x, 8);
+	memcpy(&out[14], y, 8);
+	return seal(out, FRAME_TO_ESC, check);
+}
+
+bool decode(const FrameView &v, Command &c) {
+	switch (v.type()) {
+	case TYPE_CURVE:
+	case TYPE_BAUD:
+	case TYPE_PARAM:
+	case TYPE_LOG:
+	case TYPE_CHAIN_CMD:
+	case TYPE_CHAIN_STATUS:
+		return false;
+	}
+	if (v.size() != FRAME_TO_ESC || v[0] != START_TO_ESC) {
+		return false;
+	}
+	c.destination = v[cmd::Destination];
+	c.numberOfEsc = v[cmd::Number_of_ESC];
+	c.bmsProtocol = v[cmd::BMS_protocol];
+	c.escJumps = v[cmd::ESC_Jumps];
+	c.displayVersionMaj = v[cmd::Display_Version_Maj];
+	c.displayVersionMain = v[cmd::Display_Version_Main];
+	c.powerOn = v[cmd::Power_ON];
+	c.throttle = v[cmd::Throttle];
+	c.brake = v[cmd::Brake];
+	c.torque = v[cmd::Torque];
+	c.brakeTorque = v[cmd::Brake_torque];
+	c.lock = v[cmd::Lock];
+	c.regulator = v[cmd::Regulator];
+	c.motorDirection = v[cmd::Motor_direction];
+	c.hallSensorsDirection = v[cmd::Hall_sensors_direction];
+	c.ligthPower = v[cmd::Ligth_power];
+	c.maxTemperatureReduce = v[cmd::Max_temperature_reduce];
+	c.maxTemperatureShutdown = v[cmd::Max_temperature_shutdown];
+	c.speedLimit = v[cmd::Speed_limit];
+	c.motorStartSpeed = v[cmd::Motor_start_speed];
+	return true;
+}
+
+bool decode(const FrameView &v, Feedback &f) {
+	uint8_t i;
+
+	if (v.size() != FRAME_FEEDBACK || v[0] != START_FROM_ESC || v.type() != TYPE_FEEDBACK) {
+		return false;
+	}
+	f.escVersionMaj = v[fb::ESC_Version_Maj];
+	f.escVersionMin = v[fb::ESC_Version_Min];
+	f.throttle = v[fb::Throttle];
+	f.brake = v[fb::Brake];
+	f.controllerVoltage = v.u16(fb::Controller_Voltage);
+	f.controllerCurrent = v.i16(fb::Controller_Current);
+	f.mosfetTemperature = v[fb::MOSFET_temperature];
+	f.erpm = v.i16(fb::ERPM);
+	f.lockStatus = v[fb::Lock_status];
+	f.ligthStatus = v[fb::Ligth_status];
+	f.regulatorStatus = v[fb::Regulator_status];
+	f.phase1CurrentMax = v.u16(fb::Phase_1_current_max);
+	f.phase1VoltageMax = v.u16(fb::Phase_1_voltage_max);
+	f.bmsVersionMaj = v[fb::BMS_Version_Maj];
+	f.bmsVersionMin = v[fb::BMS_Version_Min];
+	f.bmsVoltage = v.u16(fb::BMS_voltage);
+	f.bmsCurrent = v.i16(fb::BMS_Current);
+	for (i = 0; i < sizeof(f.bmsCells); i++) {
+		f.bmsCells[i] = v[fb::BMS_Cells_status + i];
+	}
+	f.bmsTemperature1 = v[fb::BMS_Battery_tempature_1];
+	f.bmsTemperature2 = v[fb::BMS_Battery_tempature_2];
+	f.bmsCyclesFull = v.u16(fb::BMS_Charge_cycles_full);
+	f.bmsCyclesPartial = v.u16(fb::BMS_Charge_cycles_partial);
+	f.errors = v.u16(fb::Errors);
+	return true;
+}
+
+bool decode(const FrameView &v, Trip &t) {
+	if (v.size() != FRAME_TRIP || v[0] != START_FROM_ESC || v.type() != TYPE_TRIP) {
+		return false;
+	}
+	t.tripDistance = v.u32(trip::Trip_distance);
+	t.tripDrive_mAh = v.u32(trip::Trip_drive_mAh);
+	t.tripRegen_mAh = v.u32(trip::Trip_regen_mAh);
+	t.tripDrive_mWh = v.u32(trip::Trip_drive_mWh);
+	t.tripRegen_mWh = v.u32(trip::Trip_regen_mWh);
+	t.totalDistance = v.u32(trip::Total_distance);
+	t.totalDrive_mAh = v.u32(trip::Total_drive_mAh);
+	t.totalRegen_mAh = v.u32(trip::Total_regen_mAh);
+	t.totalDrive_mWh = v.u32(trip::Total_drive_mWh);
+	t.totalRegen_mWh = v.u32(trip::Total_regen_mWh);
+	return true;
+}
+
+bool decode(const FrameView &v, ParamReply &r) {
+	if (v.size() != FRAME_PARAM_REPLY || v[0] != START_FROM_ESC || v.type() != TYPE_PARAM) {
+		return false;
+	}
+	r.cmd = v[param::ReplyCmd];
+	r.status = v[param::Status];
+	r.id = v[param::ReplyId];
+	r.index = v[param::Index];
+	r.count = v[param::Count];
+	r.format = v[param::Format];
+	r.frac = v[param::Frac];
+	r.flags = v[param::Flags];
+	r.value = v.i32(param::ReplyValue);
+	r.min = v.i32(param::Min);
+	r.max = v.i32(param::Max);
+	return true;
+}
+
+bool decode(const FrameView &v, LogReply &r) {
+	if (v.size() != FRAME_LOG_REPLY || v[0] != START_FROM_ESC || v.type() != TYPE_LOG) {
+		return false;
+	}
+	r.cmd = v[eventlog::ReplyCmd];
+	r.status = v[eventlog::Status];
+	r.index = v.u16(eventlog::ReplyIndex);
+	r.count = v.u16(eventlog::Count);
+	r.seq = v.u32(eventlog::Seq);
+	r.uptime = v.u32(eventlog::Uptime);
+	r.odometer = v.u32(eventlog::Odometer);
+	r.event = v[eventlog::Event];
+	r.code = v[eventlog::Code];
+	r.speed = v.i16(eventlog::Speed);
+	r.current = v.i16(eventlog::Current);
+	r.voltage = v.u16(eventlog::Voltage);
+	r.temperature = v.i16(eventlog::Temperature);
+	return true;
+}
+
+bool decodeBaudReply(const FrameView &v, uint8_t &baudCode, uint8_t &status) {
+	if (v.size() != FRAME_BAUD_REPLY || v[0] != START_FROM_ESC || v.type() != TYPE_BAUD) {
+		return false;
+	}
+	baudCode = v[2];
+	status = v[3];
+	return true;
+}
+
+TelemetryReader::TelemetryReader(const FrameView &v) : v(v), pos(TELEMETRY_HEADER), end(0) {
+	if (v.size() >= TELEMETRY_HEADER + 1 && v[0] == START_FROM_ESC && v.type() == TYPE_TELEMETRY
+			&& v[2] == v.size() - TELEMETRY_HEADER - 1) {
+		end = v.size() - 1;
+	}
+}
+
+bool TelemetryReader::next(uint8_t &tag, int32_t &value) {
+	uint8_t size, b;
+	uint32_t raw = 0;
+
+	if (pos >= end) {
+		return false;
+	}
+	tag = v[pos];
+	size = telemetrySize(tag);
+	if (size == 0 || pos + 1 + size > end) {
+		pos = end;
+		return false;
+	}
+	for (b = 0; b < size; b++) {
+		raw |= (uint32_t) v[pos + 1 + b] << (8 * b);
+	}
+	pos += 1 + size;
+	value = (tag == tlm::SPEED || tag == tlm::CURRENT) ? (int16_t) raw : (int32_t) raw;   // signed fields
+	return true;
+}
+
+}
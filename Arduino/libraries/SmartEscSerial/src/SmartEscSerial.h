@@ -0,0 +1,358 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef SMARTESC_SERIAL_H
+#define SMARTESC_SERIAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Host side of the SmartESC display protocol (USART3), see Core/Inc/protocol.h and Core/Src/protocol.c.
+ * Portable C++11 without the standard library and without allocation: Arduino (AVR, ESP32) and Linux.
+ *
+ * Reception: the bytes are written into a RingBuffer, directly by the reader with writePtr() / commit() or with
+ * write(). Parser::next() returns the next valid frame as a FrameView on the ring storage, without copy. The
+ * view stays valid until the next call of next() or release(). Resynchronisation is the one of the firmware:
+ * on a check byte error or an unknown Type, the search restarts at the next start frame byte after the dropped
+ * frame start. The counters match protocolParser_t.
+ *
+ * Encoding: the frames are written little endian byte by byte, so the host struct layout and endianness do
+ * not matter. The field offsets below are the ones generated from the schema in protocol.h;
+ * extras/fuzz_parser.cpp checks them against the firmware structs at compile time.
+ */
+
+namespace smartesc {
+
+// Wire constants, as in Core/Inc/config.h
+const uint8_t START_FROM_ESC        = 0x5A;     // SERIAL_START_FRAME_ESC_TO_DISPLAY
+const uint8_t START_TO_ESC          = 0xA5;     // SERIAL_START_FRAME_DISPLAY_TO_ESC
+const uint8_t TYPE_FEEDBACK         = 0x01;
+const uint8_t TYPE_TRIP             = 0x02;
+const uint8_t TYPE_TELEMETRY        = 0x03;
+const uint8_t TYPE_CURVE            = 0x10;
+const uint8_t TYPE_BAUD             = 0x11;
+const uint8_t TYPE_PARAM            = 0x12;
+const uint8_t TYPE_LOG              = 0x13;
+const uint8_t TYPE_CHAIN_CMD        = 0x20;
+const uint8_t TYPE_CHAIN_STATUS     = 0x21;
+
+// Frame lengths [bytes], check byte included
+const uint8_t FRAME_TO_ESC          = 23;       // All the frames received by the ESC
+const uint8_t FRAME_FEEDBACK        = 59;
+const uint8_t FRAME_TRIP            = 43;
+const uint8_t FRAME_BAUD_REPLY      = 5;
+const uint8_t FRAME_PARAM_REPLY     = 23;
+const uint8_t FRAME_LOG_REPLY       = 31;
+const uint8_t TELEMETRY_HEADER      = 3;        // Frame_start, Type, Length
+const uint8_t TELEMETRY_PAYLOAD_MAX = 64;       // [bytes] Longest accepted record payload (TELEMETRY_PAYLOAD_MAX of the ESC is 24)
+const uint8_t FRAME_MAX             = TELEMETRY_HEADER + TELEMETRY_PAYLOAD_MAX + 1;
+
+// Check byte, SERIAL_CRC_TYPE of the firmware
+enum Check {
+	CHECK_XOR  = 0,                             // XOR of all the bytes, original displays
+	CHECK_CRC8 = 1                              // CRC-8, polynomial 0x07, init 0x00
+};
+
+// Stream direction, selects the start frame byte and the frame lengths
+enum Direction {
+	FROM_ESC = 0,                               // Display side: feedback, trip, telemetry and replies
+	TO_ESC   = 1                                // ESC side (emulator, sniffer): commands and requests
+};
+
+// Field offsets [bytes] of the command frame (SerialFromDisplayToEsc)
+namespace cmd {
+enum {
+	Type = 1, Destination, Number_of_ESC, BMS_protocol, ESC_Jumps, Display_Version_Maj, Display_Version_Main,
+	Power_ON, Throttle, Brake, Torque, Brake_torque, Lock, Regulator, Motor_direction, Hall_sensors_direction,
+	Ligth_power, Max_temperature_reduce, Max_temperature_shutdown, Speed_limit, Motor_start_speed, CRC8
+};
+}
+
+// Field offsets [bytes] of the feedback frame (SerialFromEscToDisplay)
+namespace fb {
+enum {
+	Type = 1, ESC_Version_Maj = 2, ESC_Version_Min = 3, Throttle = 4, Brake = 5, Controller_Voltage = 6,
+	Controller_Current = 8, MOSFET_temperature = 10, ERPM = 11, Lock_status = 13, Ligth_status = 14,
+	Regulator_status = 15, Phase_1_current_max = 16, Phase_1_voltage_max = 18, BMS_Version_Maj = 20,
+	BMS_Version_Min = 21, BMS_voltage = 22, BMS_Current = 24, BMS_Cells_status = 26, BMS_Battery_tempature_1 = 50,
+	BMS_Battery_tempature_2 = 51, BMS_Charge_cycles_full = 52, BMS_Charge_cycles_partial = 54, Errors = 56, CRC8 = 58
+};
+}
+
+// Field offsets [bytes] of the trip frame (SerialTripFromEscToDisplay)
+namespace trip {
+enum {
+	Trip_distance = 2, Trip_drive_mAh = 6, Trip_regen_mAh = 10, Trip_drive_mWh = 14, Trip_regen_mWh = 18,
+	Total_distance = 22, Total_drive_mAh = 26, Total_regen_mAh = 30, Total_drive_mWh = 34, Total_regen_mWh = 38,
+	CRC8 = 42
+};
+}
+
+// Field offsets [bytes] of the parameter request and reply (SerialParamFromDisplayToEsc / SerialParamFromEscToDisplay)
+namespace param {
+enum { Cmd = 2, Id = 3, Value = 4, Hold = 8 };
+enum { ReplyCmd = 2, Status = 3, ReplyId = 4, Index = 5, Count = 6, Format = 7, Frac = 8, Flags = 9,
+	ReplyValue = 10, Min = 14, Max = 18, ReplyCRC8 = 22 };
+enum { CMD_GET = 0, CMD_SET = 1, CMD_LIST = 2, CMD_SAVE = 3 };
+}
+
+// Field offsets [bytes] of the event log request and reply (SerialLogFromDisplayToEsc / SerialLogFromEscToDisplay)
+namespace eventlog {
+enum { Cmd = 2, Index = 3 };
+enum { ReplyCmd = 2, Status = 3, ReplyIndex = 4, Count = 6, Seq = 8, Uptime = 12, Odometer = 16, Event = 20,
+	Code = 21, Speed = 22, Current = 24, Voltage = 26, Temperature = 28, ReplyCRC8 = 30 };
+enum { CMD_READ = 0, CMD_CLEAR = 1 };
+enum { FAULT = 1, TIMEOUT_SERIAL = 2, TIMEOUT_ADC = 3 };
+}
+
+// Telemetry tags (SERIAL_TELEMETRY_FIELDS)
+namespace tlm {
+enum {
+	SPEED = 0x01, CURRENT = 0x02, VOLTAGE = 0x03, THROTTLE = 0x04, BRAKE = 0x05, TEMP_BOARD = 0x10,
+	TEMP_MOTOR = 0x11, ERRORS = 0x12, SOC = 0x13, LIMIT = 0x14, RIDE_MODE = 0x15, VERSION = 0x16, CELL_MIN = 0x17
+};
+}
+
+uint8_t crcUpdate(uint8_t crc, const uint8_t *data, uint16_t len, Check check);
+uint16_t frameLength(Direction dir, uint8_t type, uint8_t lengthByte);
+uint8_t telemetrySize(uint8_t tag);
+
+/*
+ * Circular byte buffer, single producer / single consumer. size must be a power of two, at most 32768.
+ * head and tail run freely, their difference is the number of stored bytes.
+ */
+class RingBuffer {
+public:
+	RingBuffer(uint8_t *storage, uint16_t size) : buf(storage), mask(size - 1), head(0), tail(0) {}
+
+	uint16_t capacity() const { return mask + 1; }
+	uint16_t size() const { return (uint16_t) (head - tail); }
+	uint16_t room() const { return (uint16_t) (capacity() - size()); }
+	uint8_t operator[](uint16_t i) const { return buf[(tail + i) & mask]; }
+
+	// Zero-copy reception: contiguous free space for the reader, then commit the bytes written there
+	uint8_t *writePtr(uint16_t &len);
+	void commit(uint16_t len) { head += len; }
+	uint16_t write(const uint8_t *data, uint16_t len);          // Output: bytes written, the rest is dropped
+	void drop(uint16_t len) { tail += (len < size()) ? len : size(); }
+	void clear() { tail = head; }
+
+	// Contiguous stored bytes from i, at most len
+	const uint8_t *span(uint16_t i, uint16_t &len) const;
+
+private:
+	friend class FrameView;
+	uint8_t *buf;
+	uint16_t mask;
+	uint16_t head;                              // [bytes] Written
+	uint16_t tail;                              // [bytes] Consumed
+};
+
+template <uint16_t N>
+class StaticRing : public RingBuffer {
+	static_assert(N >= 2 * FRAME_MAX && N <= 32768 && (N & (N - 1)) == 0, "N: power of two, at least two frames");
+public:
+	StaticRing() : RingBuffer(storage, N) {}
+private:
+	uint8_t storage[N];
+};
+
+/*
+ * A frame in a ring buffer or in a plain buffer, possibly split at the end of the ring storage
+ */
+class FrameView {
+public:
+	FrameView() : base(0), mask(0), start(0), len(0) {}
+	FrameView(const uint8_t *data, uint16_t size) : base(data), mask(0xFFFF), start(0), len(size) {}
+	FrameView(const RingBuffer &ring, uint16_t size) : base(ring.buf), mask(ring.mask), start(ring.tail & ring.mask), len(size) {}
+
+	uint16_t size() const { return len; }
+	uint8_t type() const { return len > 1 ? (*this)[1] : 0; }
+	uint8_t operator[](uint16_t i) const { return base[(uint16_t) (start + i) & mask]; }
+	uint16_t u16(uint16_t i) const { return (uint16_t) ((*this)[i] | ((*this)[i + 1] << 8)); }
+	int16_t i16(uint16_t i) const { return (int16_t) u16(i); }
+	uint32_t u32(uint16_t i) const { return u16(i) | ((uint32_t) u16(i + 2) << 16); }
+	int32_t i32(uint16_t i) const { return (int32_t) u32(i); }
+
+	const uint8_t *data() const;                 // Output: the frame bytes if contiguous, else 0
+	void copy(uint8_t *dst) const;
+
+private:
+	const uint8_t *base;
+	uint16_t mask;
+	uint16_t start;
+	uint16_t len;
+};
+
+/*
+ * Receive stream parser over a RingBuffer
+ */
+class Parser {
+public:
+	Parser(RingBuffer &ring, Direction dir, Check check = CHECK_XOR) : ring(ring), dir(dir), check(check) { reset(); }
+
+	bool next(FrameView &frame);                // Output: true with the next valid frame, false when more bytes are needed
+	void release() { ring.drop(pending); pending = 0; }
+	void reset();
+
+	uint32_t frames;                            // [-] Valid frames
+	uint32_t crcErrors;                         // [-] Frames dropped on a check byte error
+	uint32_t lenErrors;                         // [-] Frames dropped on an unknown Type or length
+	uint32_t skipped;                           // [bytes] Bytes dropped while searching for a start frame
+
+private:
+	bool seek();
+	void resync();
+
+	RingBuffer &ring;
+	Direction dir;
+	Check check;
+	uint16_t pending;                           // [bytes] Frame returned by next(), dropped at the next call
+};
+
+// Display to ESC: command frame
+struct Command {
+	uint8_t destination;
+	uint8_t numberOfEsc;
+	uint8_t bmsProtocol;
+	uint8_t escJumps;
+	uint8_t displayVersionMaj;
+	uint8_t displayVersionMain;
+	uint8_t powerOn;
+	uint8_t throttle;                           // [-] 0..255, 0 below the throttle dead band of the display
+	uint8_t brake;                              // [-] 0..255
+	uint8_t torque;
+	uint8_t brakeTorque;
+	uint8_t lock;
+	uint8_t regulator;
+	uint8_t motorDirection;
+	uint8_t hallSensorsDirection;
+	uint8_t ligthPower;
+	uint8_t maxTemperatureReduce;               // [°C]
+	uint8_t maxTemperatureShutdown;             // [°C]
+	uint8_t speedLimit;                         // [km/h]
+	uint8_t motorStartSpeed;                    // [km/h]
+};
+
+// ESC to display: feedback frame
+struct Feedback {
+	uint8_t escVersionMaj;
+	uint8_t escVersionMin;
+	uint8_t throttle;
+	uint8_t brake;
+	uint16_t controllerVoltage;                 // [0.01 V]
+	int16_t controllerCurrent;                  // [mA]
+	uint8_t mosfetTemperature;                  // [°C]
+	int16_t erpm;
+	uint8_t lockStatus;
+	uint8_t ligthStatus;
+	uint8_t regulatorStatus;
+	uint16_t phase1CurrentMax;
+	uint16_t phase1VoltageMax;
+	uint8_t bmsVersionMaj;
+	uint8_t bmsVersionMin;
+	uint16_t bmsVoltage;                        // [0.01 V]
+	int16_t bmsCurrent;                         // [10 mA] positive = discharge
+	uint8_t bmsCells[24];                       // [10 mV] above 2.00 V, 0 = no cell
+	uint8_t bmsTemperature1;                    // [°C]
+	uint8_t bmsTemperature2;                    // [°C]
+	uint16_t bmsCyclesFull;
+	uint16_t bmsCyclesPartial;
+	uint16_t errors;
+};
+
+// ESC to display: trip and lifetime counters
+struct Trip {
+	uint32_t tripDistance;                      // [m]
+	uint32_t tripDrive_mAh;
+	uint32_t tripRegen_mAh;
+	uint32_t tripDrive_mWh;
+	uint32_t tripRegen_mWh;
+	uint32_t totalDistance;                     // [m]
+	uint32_t totalDrive_mAh;
+	uint32_t totalRegen_mAh;
+	uint32_t totalDrive_mWh;
+	uint32_t totalRegen_mWh;
+};
+
+// ESC to display: parameter table reply
+struct ParamReply {
+	uint8_t cmd;
+	uint8_t status;                             // 0 = ok, see PARAM_ERR_xxx in Core/Inc/param.h
+	uint8_t id;
+	uint8_t index;
+	uint8_t count;
+	uint8_t format;
+	uint8_t frac;
+	uint8_t flags;
+	int32_t value;
+	int32_t min;
+	int32_t max;
+};
+
+// ESC to display: event log reply, one entry
+struct LogReply {
+	uint8_t cmd;
+	uint8_t status;                             // 0 = ok, see EVENTLOG_ERR_xxx in Core/Inc/eventlog.h
+	uint16_t index;                             // 0 = oldest entry
+	uint16_t count;                             // entries in the log
+	uint32_t seq;
+	uint32_t uptime;                            // [ms] since power on
+	uint32_t odometer;                          // [m]
+	uint8_t event;                              // eventlog::FAULT, TIMEOUT_SERIAL, TIMEOUT_ADC
+	uint8_t code;                               // error code or timeout flag, 0 = cleared
+	int16_t speed;                              // [rpm]
+	int16_t current;
+	uint16_t voltage;                           // [0.01 V]
+	int16_t temperature;                        // [0.1 °C]
+};
+
+// Frame encoding into out, at least the returned length [bytes]
+uint16_t encode(const Command &c, uint8_t *out, Check check = CHECK_XOR);
+uint16_t encode(const Feedback &f, uint8_t *out, Check check = CHECK_XOR);
+uint16_t encodeBaud(uint8_t baudCode, uint8_t *out, Check check = CHECK_XOR);
+uint16_t encodeParam(uint8_t cmd, uint8_t id, int32_t value, uint8_t hold, uint8_t *out, Check check = CHECK_XOR);
+uint16_t encodeLog(uint8_t cmd, uint16_t index, uint8_t *out, Check check = CHECK_XOR);
+uint16_t encodeCurve(uint8_t rideMode, uint8_t table, uint8_t rateRise, uint8_t rateFall, const uint8_t x[8],
+		const uint8_t y[8], uint8_t *out, Check check = CHECK_XOR);
+
+// Frame decoding, Output: false if the frame has another Type or length
+bool decode(const FrameView &v, Command &c);
+bool decode(const FrameView &v, Feedback &f);
+bool decode(const FrameView &v, Trip &t);
+bool decode(const FrameView &v, ParamReply &r);
+bool decode(const FrameView &v, LogReply &r);
+bool decodeBaudReply(const FrameView &v, uint8_t &baudCode, uint8_t &status);
+
+/*
+ * Telemetry records of a SERIAL_TYPE_TELEMETRY frame
+ */
+class TelemetryReader {
+public:
+	TelemetryReader(const FrameView &v);
+	bool next(uint8_t &tag, int32_t &value);    // Output: false at the end or on an unknown tag
+private:
+	FrameView v;
+	uint16_t pos;
+	uint16_t end;
+};
+
+}
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef ANTILOCK_H
+#define ANTILOCK_H
+
+#include <stdint.h>
+
+extern int16_t antilockRef;         // [rpm] Vehicle speed reference (wheel speed with bounded deceleration)
+extern uint16_t antilockScale;      // [-] Braking torque scale applied by the anti-lock, fixdt(0,16,15)
+extern uint32_t antilockCnt;        // [-] Number of detected wheel locks
+
+void antilock_reset(void);
+int16_t antilock_step(int16_t target, int16_t speedFixdt, uint8_t hall);
+
+#endif
+
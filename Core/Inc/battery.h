@@ -0,0 +1,35 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <stdint.h>
+
+extern int32_t batteryVoltage;      // [mV] Terminal voltage (fast filter)
+extern int32_t batteryOcv;          // [mV] Estimated open circuit voltage
+extern int32_t batteryResistance;   // [mOhm] Estimated pack internal resistance
+extern uint8_t batterySoc;          // [%] State of charge from the open circuit voltage
+extern uint16_t batteryScale;       // [-] Current limit scale to stay above the voltage floor, fixdt(0,16,15)
+
+void battery_init(int16_t vbat);
+void battery_update(int16_t vbat, int32_t currBat);
+int16_t battery_limit(int16_t iMax);
+
+#endif
+
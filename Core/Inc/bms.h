@@ -0,0 +1,50 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef BMS_H
+#define BMS_H
+
+#include <stdint.h>
+#include "config.h"              // BAT_CELLS
+
+// Snapshot of the BMS values, updated by bms_update() from the main loop
+typedef struct {
+	uint8_t valid;                      // [-] 1 if the BMS answered within BMS_STALE
+	uint16_t version;                   // [-] Firmware version, major in the high byte
+	uint16_t voltage;                   // [10 mV] Pack voltage
+	int16_t current;                    // [10 mA] Pack current, positive = discharge
+	uint8_t soc;                        // [%] State of charge
+	int8_t temperature[2];              // [°C]
+	uint16_t cyclesFull;                // [-] Full charge cycles
+	uint16_t cyclesPartial;             // [-] Charge count
+	uint16_t cell[BAT_CELLS];           // [mV] Cell voltages
+	uint16_t cellMin;                   // [mV] Weakest cell
+} bmsData_t;
+
+extern bmsData_t bmsData;           // BMS snapshot
+extern uint16_t bmsScale;           // [-] Current limit scale from the weakest cell, fixdt(0,16,15)
+extern uint32_t bmsReplies;         // [-] Valid replies
+extern uint32_t bmsTimeouts;        // [-] Requests without reply
+
+void bms_init(void);
+void bms_setProtocol(uint8_t protocol);
+void bms_update(void);
+int16_t bms_limit(int16_t iMax);
+
+#endif
+
@@ -0,0 +1,51 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef BUTTON_H
+#define BUTTON_H
+
+#include <stdint.h>
+
+typedef enum {
+	BTN_EVT_NONE = 0,
+	BTN_EVT_SHORT,      // single press released before BUTTON_LONG_PRESS, no second press within BUTTON_DOUBLE_GAP
+	BTN_EVT_LONG,       // press held for BUTTON_LONG_PRESS (fired while still held)
+	BTN_EVT_DOUBLE      // second press started within BUTTON_DOUBLE_GAP after a short press (fired on release)
+} btnEvent_t;
+
+typedef enum {
+	BTN_IDLE = 0,
+	BTN_PRESSED,
+	BTN_WAIT_SECOND,
+	BTN_SECOND_PRESSED,
+	BTN_WAIT_RELEASE
+} btnState_t;
+
+typedef struct {
+	btnState_t state;
+	uint8_t rawLast;        // [-] last raw sample
+	uint8_t level;          // [-] debounced level: 1 = pressed
+	uint32_t rawChange;     // [ms] tick of the last raw level change
+	uint32_t stateTime;     // [ms] tick of the last state change
+} button_t;
+
+void button_init(button_t *btn);
+btnEvent_t button_update(button_t *btn, uint8_t raw, uint32_t now);
+
+#endif
+
@@ -0,0 +1,43 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <stdint.h>
+#include "protocol.h"
+
+extern volatile uint32_t chainTick; // [PWM periods] Local time, counted by the FOC interrupt
+extern int32_t chainOffset;         // [PWM periods] Master time - local time (0 on the master)
+extern uint8_t chainSynced;         // [-] Time reference and setpoints received (always 1 on the master)
+extern uint8_t chainNbEsc;          // [-] ESCs on the chain, from the display Number_of_ESC
+extern uint32_t chainFrames;        // [-] Valid frames received on the chain
+extern uint32_t chainLost;          // [-] Slave: setpoint timeouts. Master: slave status timeouts
+extern uint32_t chainForwardDropped;// [-] Master: display frames replaced before being forwarded
+
+void chain_init(void);
+uint8_t chain_forward(const SerialFromDisplayToEsc *frame);
+void chain_update(int16_t target);
+int16_t chain_target(void);
+uint8_t chain_rxFrame(const uint8_t *buf, uint32_t stamp, uint8_t idle);
+int32_t chain_current(int32_t local);
+int16_t chain_temperature(int16_t local);
+uint16_t chain_errors(uint16_t local);
+
+#endif
+
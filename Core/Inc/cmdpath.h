@@ -0,0 +1,51 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef CMDPATH_H
+#define CMDPATH_H
+
+#include <stdint.h>
+
+#define CMDPATH_HIST_BINS   64      // [-] Latency histogram bins: 4 bins per octave, up to 65 ms
+
+// Command latency statistics: USART IDLE detection to first PWM duty cycle computed with the new command
+typedef struct {
+	uint32_t count;                 // [-] Number of measured frames
+	uint32_t p50;                   // [us] Median latency (upper bound of the histogram bin)
+	uint32_t p90;                   // [us] 90th percentile
+	uint32_t p99;                   // [us] 99th percentile
+	uint32_t max;                   // [us] Worst case latency
+} cmdLatency_t;
+
+extern cmdLatency_t cmdLatency;
+
+// Fast path
+void cmdpath_setEnable(uint8_t ena);
+void cmdpath_post(int16_t throttle, int16_t brake, int16_t min, int16_t max);
+int16_t cmdpath_step(int16_t pwmSlow);
+
+// Latency instrumentation
+void cmdpath_idle(void);
+void cmdpath_frameRx(void);
+void cmdpath_pwmSet(void);
+void cmdpath_ccrApplied(void);
+void cmdpath_updateStats(void);
+void cmdpath_resetStats(void);
+
+#endif
+
@@ -60,6 +60,16 @@
 #define BAT_LVL2                (360 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE    // Red:          gently beep at this voltage level. [V*100/cell]. In this case 3.60 V/cell
 #define BAT_LVL1                (350 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE    // Red blink:    fast beep. Your battery is almost empty. Charge now! [V*100/cell]. In this case 3.50 V/cell
 #define BAT_DEAD                (337 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE    // All leds off: undervoltage poweroff. (while not driving) [V*100/cell]. In this case 3.37 V/cell
+
+/* Battery model (see battery.c): internal resistance estimated online, open circuit voltage and state of charge.
+ * The motor current is limited so that the terminal voltage under load stays above BAT_CELL_FLOOR per cell.
+ * The battery current comes from the MOTOR_KV estimate: measure MOTOR_KV and check the limit on the vehicle before enabling.
+*/
+// #define BATTERY_MODEL_ENABLE           // [-] Flag to enable the battery model and the voltage floor current limit
+#define BAT_CELL_FLOOR          3100      // [mV] minimum cell voltage under load (keep it above the BMS undervoltage cut-out)
+#define BAT_R_INIT              150       // [mOhm] pack internal resistance used until the first estimate
+#define BAT_R_MIN               20        // [mOhm] estimate lower bound
+#define BAT_R_MAX               1000      // [mOhm] estimate upper bound
 // ######################## END OF BATTERY ###############################
 
 
@@ -82,6 +92,22 @@
 #define TEMP_WARNING            600       // annoying fast beeps [°C * 10].  Here 60.0 °C
 #define TEMP_POWEROFF_ENABLE    0         // to poweroff or not to poweroff, 1 or 0, DO NOT ACTIVITE WITHOUT CALIBRATION!
 #define TEMP_POWEROFF           650       // overheat poweroff. (while not driving) [°C * 10]. Here 65.0 °C
+
+/* Thermal derating (see thermal.c): i_max is reduced linearly between the reduce and shutdown temperatures
+ * of the estimated motor winding, and of the board NTC with THERMAL_BOARD_ENABLE, instead of a hard poweroff.
+ * Without THERMAL_BOARD_ENABLE the NTC is not used at all: the winding model starts from MOTOR_TEMP_AMBIENT.
+ * The MOTOR_xxx model values are not measured on a motor: check them against a winding temperature before enabling.
+*/
+// #define THERMAL_DERATING_ENABLE        // [-] Flag to enable the thermal derating
+// #define THERMAL_BOARD_ENABLE           // [-] Flag to also derate on the board NTC, do not activate without the TEMP_CAL calibration
+#define TEMP_REDUCE             80        // [°C] board derating start, used when the display sends 0
+#define TEMP_SHUTDOWN           100       // [°C] board temperature for zero current, used when the display sends 0
+#define MOTOR_TEMP_REDUCE       110       // [°C] estimated winding temperature for derating start
+#define MOTOR_TEMP_SHUTDOWN     140       // [°C] estimated winding temperature for zero current
+#define MOTOR_I_CONT            15        // [A] motor continuous current
+#define MOTOR_TEMP_RISE         80        // [°C] winding steady state temperature rise at MOTOR_I_CONT
+#define MOTOR_TAU               600       // [s] winding thermal time constant
+#define MOTOR_TEMP_AMBIENT      40        // [°C] winding model ambient without THERMAL_BOARD_ENABLE (hot day, warm restart)
 // ######################## END OF TEMPERATURE ###############################
 
 
@@ -136,6 +162,19 @@
 
 
 
+// ############################### MOTOR CONSTANT ###############################
+/* Motor speed constant: no-load wheel speed per volt of bus voltage. The battery current is estimated from the phase
+ * current with it, motor losses neglected: I_bat = I_phase * n / (MOTOR_KV * V_bat). The estimate is used by the
+ * regen charge current limit, the energy accounting and the battery model, and is only computed when one of them is enabled.
+ * The default is not measured: 18 rpm/V gives ~650 rpm at 36 V, the ~26 km/h top speed of a 10S scooter on 8.5" wheels.
+ * To measure it: lift the wheel, drive it in VLT_MODE at full command and divide the speed [rpm] by the battery voltage [V].
+ * A KV set too low overestimates the battery current (early regen and voltage floor limits), too high underestimates it.
+*/
+#define MOTOR_KV                18          // [rpm/V] Motor speed constant
+// ######################## END OF MOTOR CONSTANT ###############################
+
+
+
 // ############################## DEFAULT SETTINGS ############################
 #define CONTROL_SERIAL_USART3      // right sensor board cable, disable if I2C (nunchuk or lcd) is used! For Arduino control check the hoverSerial.ino
 #define FEEDBACK_SERIAL_USART3     // right sensor board cable, disable if I2C (nunchuk or lcd) is used!
@@ -178,6 +217,215 @@
 
 
 
+// ############################### POWER BUTTON ###############################
+/* The power button is sampled by the main loop scheduler and debounced, it never blocks the main loop.
+ * No gesture is reported before the button is released after power on.
+ * - short press:  ignored
+ * - long press:   power off (fired while still held)
+ * - double press: toggle the light output
+*/
+#define BUTTON_DEBOUNCE         30        // [ms] the button level must be stable for this time to be accepted
+#define BUTTON_LONG_PRESS       2000      // [ms] press duration for a long press
+#define BUTTON_DOUBLE_GAP       400       // [ms] max time between the release of the first press and the start of the second press
+// ######################## END OF POWER BUTTON ###############################
+
+
+
+// ############################### RESPONSE CURVES ###############################
+/* Per ride mode throttle / brake response curves (see curve.c). When enabled they replace the RATE / FILTER shaping
+ * and the STEER_COEFFICIENT brake gain of the mixer. Ride modes: 0 = Eco, 1 = Normal, 2 = Sport.
+ * Tables and the active ride mode can be changed over USART3 with a SERIAL_TYPE_CURVE frame.
+ * The ride changes when enabled, also in Normal mode: there is no FILTER low-pass stage, the brake is rate limited
+ * on the braking torque (after the brake curve) instead of the brake input, and cmdRate / cmdFilter are not used.
+*/
+// #define CURVE_ENGINE_ENABLE              // [-] Flag to enable the response curve engine. Comment to use RATE / FILTER
+#define CURVE_DEFAULT_MODE      1           // [-] Ride mode selected at power on
+// ######################## END OF RESPONSE CURVES ###############################
+
+
+
+// ############################### COMMAND PATH ###############################
+/* Fast command path (see cmdpath.c): valid USART3 frames are shaped in the USART interrupt and handed to the FOC
+ * interrupt within one PWM period, instead of waiting for the 5 ms main loop. The rise / fall limits of the active
+ * ride mode are applied at PWM rate. Requires CURVE_ENGINE_ENABLE.
+ * Electric brake, standstill hold and cruise control run in the main loop and are bypassed while the fast path drives the motor.
+*/
+// #define FAST_CMD_PATH_ENABLE             // [-] Flag to enable the fast command path
+#define CMD_LATENCY_MEASURE                 // [-] Flag to measure the frame to PWM latency (cmdLatency percentiles, refreshed every second)
+// ######################## END OF COMMAND PATH ###############################
+
+
+
+// ############################### TRACTION CONTROL ###############################
+/* Wheel slip detection in the FOC interrupt (see traction.c). Only active in TORQUE mode.
+ * The wheel acceleration is compared with the acceleration the commanded torque can give to the vehicle mass.
+ * The thresholds are tuned with the wheel / road model of tests_scripts/traction_sim.c (no cut on a dry road, slip
+ * limited on gravel and ice): check them on the vehicle before enabling, the model does not know the tire.
+*/
+// #define TRACTION_CONTROL_ENABLE          // [-] Flag to enable the traction control
+#define TRACTION_MASS           100         // [kg] Vehicle + rider mass
+#define TRACTION_WHEEL_RADIUS   108         // [mm] Wheel radius (8.5" tire)
+#define TRACTION_TORQUE_MAX     200         // [0.1 Nm] Motor torque at full torque request (I_MOT_MAX)
+#define TRACTION_SLIP_GAIN      3           // [-] Slip when the acceleration exceeds TRACTION_SLIP_GAIN * expected acceleration...
+#define TRACTION_SLIP_MARGIN    300         // [rpm/s] ... + TRACTION_SLIP_MARGIN
+#define TRACTION_NOISE_GAIN     2           // [-] ... + TRACTION_NOISE_GAIN * hall speed quantization over the derivative window
+#define TRACTION_SPEED_MIN      40          // [rpm] No detection below this wheel speed (hall speed steps at launch)
+#define TRACTION_SLIP_CONFIRM   2           // [ms] Slip must be detected during this time before the torque is cut
+#define TRACTION_CUT_LEVEL      15          // [%] Torque kept during a slip
+#define TRACTION_HOLD           20          // [ms] Cut hold time after the slip disappears
+#define TRACTION_RESTORE        400         // [ms] Torque restore ramp duration
+// ######################## END OF TRACTION CONTROL ###############################
+
+
+
+// ############################### REGENERATIVE BRAKING ###############################
+/* The brake pedal requests a braking torque (see regen.c), replacing the fixed brake gain of the mixer. Only for TORQUE mode.
+ * Full brake gives the display Brake_torque [%] of the full torque, REGEN_TORQUE_MAX when the display sends 0.
+ * In the FOC interrupt, the braking torque is reduced when the battery charge current or the bus voltage is too high.
+*/
+// #define REGEN_ENABLE                     // [-] Flag to enable the regenerative braking
+#define REGEN_TORQUE_MAX        300         // [-] Braking torque at full brake [0, 1000]
+#define REGEN_RATE              20          // [-/tick] Braking torque rise rate (release is immediate)
+#define REGEN_SPEED_MIN         30          // [rpm] No regen below this speed, only the friction brake
+#define REGEN_SPEED_FULL        100         // [rpm] Full regen above this speed
+#define REGEN_I_BAT_MAX         5000        // [mA] Maximum battery charge current
+#define REGEN_CELL_V_MAX        4150        // [mV] Bus voltage ceiling per cell
+// ######################## END OF REGENERATIVE BRAKING ###############################
+
+
+
+// ############################### ANTI-LOCK ###############################
+/* Wheel lock detection under electric braking in the FOC interrupt (see antilock.c). Only active in TORQUE mode.
+ * A locked wheel releases the braking torque for ANTILOCK_RELEASE, then reapplies ANTILOCK_REAPPLY_LEVEL % of the
+ * torque at the lock at once and ramps up to the full torque over ANTILOCK_REAPPLY.
+ * The thresholds and the cadence are tuned with the wheel / road model of tests_scripts/antilock_sim.c: no release on
+ * a dry road, stopping distance 4 to 9 % shorter on gravel and wet leaves, unchanged on ice.
+ * Known regression: dry road with the wheel in the air over a bump, 12.49 m -> 12.64 m (+1.2 %). The wheel locks in
+ * the air and skids after the landing; on a dry road the locked skid brakes harder than the motor torque limit, so
+ * releasing it lengthens the stop. Check the settings on the vehicle before enabling.
+*/
+// #define ANTILOCK_ENABLE                  // [-] Flag to enable the wheel lock detection and release
+#define ANTILOCK_DECEL_MAX      900         // [rpm/s] Maximum plausible vehicle deceleration (~1 g with a 108 mm wheel radius)
+#define ANTILOCK_LOCK_RATIO     40          // [%] Locked when the wheel speed is below this ratio of the speed reference
+#define ANTILOCK_SPEED_MIN      60          // [rpm] No detection below this speed reference
+#define ANTILOCK_RELEASE        5           // [ms] Braking torque release time
+#define ANTILOCK_REAPPLY        10          // [ms] Braking torque reapply ramp duration
+#define ANTILOCK_REAPPLY_LEVEL  30          // [%] Torque reapplied at once after the release, of the torque at the lock
+// ######################## END OF ANTI-LOCK ###############################
+
+
+
+// ############################### ENERGY ACCOUNTING ###############################
+/* Battery charge / energy (drive and regen) integrated in the FOC interrupt, distance counted from the hall transitions.
+ * Trip and lifetime counters can be sent to the display in a SERIAL_TYPE_TRIP frame, in place of one feedback frame
+ * every TRIP_FRAME_PERIOD: only for displays that know this frame type, the others lose these feedback frames.
+*/
+#define ENERGY_ACCOUNTING_ENABLE            // [-] Flag to enable the energy and distance accounting
+// #define TRIP_FRAME_ENABLE                // [-] Flag to send the SERIAL_TYPE_TRIP frame, requires ENERGY_ACCOUNTING_ENABLE
+#define WHEEL_CIRCUMFERENCE     678         // [mm] Wheel circumference (8.5" tire)
+#define TRIP_FRAME_PERIOD       50          // [-] One feedback frame out of TRIP_FRAME_PERIOD is a trip frame (50 * 20 ms = 1 s)
+// ######################## END OF ENERGY ACCOUNTING ###############################
+
+
+
+// ############################### SCOPE STREAM ###############################
+/* Continuous binary stream of controller signals on USART1 (PB6, TX only), see scope.c and tests_scripts/scope_decode.py.
+ * Bandwidth: (2 * signals + 13 / samples per packet) bytes per sample, 10 bits per byte on the line.
+ * 5 signals at 16 kHz / 2 = 80 kB/s, within the 200 kB/s of 2 Mbaud.
+*/
+// #define SCOPE_ENABLE                     // [-] Flag to enable the oscilloscope stream
+#define SCOPE_BAUD              2000000     // [baud] USART1 baud rate (APB2 64 MHz: up to 4000000)
+#define SCOPE_DECIMATION        2           // [-] One sample every SCOPE_DECIMATION PWM periods
+#define SCOPE_SIGNALS           0x001F      // [-] bit 0: ia, 1: ib, 2: iq, 3: id, 4: angle, 5-7: duty A/B/C, 8: speed, 9: target, 10: vbat
+// ######################## END OF SCOPE STREAM ###############################
+
+
+
+// ############################### ESC CHAIN ###############################
+/* Several ESCs on the USART1 single wire (PB6, open drain, pull-up needed), see chain.c.
+ * The ESC connected to the display is the master (address 1), it sends the torque setpoint of all the ESCs.
+ * Display frames with Destination 0 go to all the ESCs, otherwise to the ESC with this address.
+*/
+// #define CHAIN_ENABLE                     // [-] Flag to enable the ESC chain. Uses USART1: not with SCOPE_ENABLE
+#define CHAIN_ADDRESS           1           // [-] Address of this ESC: 1 = master (display on USART3), 2..CHAIN_ESC_MAX = slaves
+#define CHAIN_ESC_MAX           4           // [-] Maximum number of ESCs, the display Number_of_ESC selects fewer
+#define CHAIN_BAUD              460800      // [baud] USART1 baud rate
+#define CHAIN_LEAD              48          // [PWM periods] Setpoint sent CHAIN_LEAD periods before it is applied (3 ms)
+#define CHAIN_TIMEOUT           100         // [ms] Slave: no setpoint for CHAIN_TIMEOUT, torque 0. Master: slave status lost
+// ######################## END OF ESC CHAIN ###############################
+
+
+
+// ############################### BMS ###############################
+/* BMS client on the USART1 single wire (PB6, open drain, pull-up needed), see bms.c and tests_scripts/bms_sim.py.
+ * The display BMS_protocol selects the protocol: 0 = BMS_PROTOCOL, 1 = Xiaomi / Ninebot, 0xFF = none.
+ * Cell voltages, pack voltage, current, temperatures and cycles are sent to the display in the feedback frame.
+*/
+// #define BMS_ENABLE                       // [-] Flag to enable the BMS client. Uses USART1: not with SCOPE_ENABLE or CHAIN_ENABLE
+#define BMS_PROTOCOL            1           // [-] Protocol when the display sends 0
+#define BMS_BAUD                115200      // [baud] USART1 baud rate
+#define BMS_PERIOD              10          // [ms] Polling period of the client, one request per reply or timeout
+#define BMS_TIMEOUT             100         // [ms] Reply timeout
+#define BMS_STALE               1000        // [ms] Without valid reply for BMS_STALE, the BMS values are not used
+#define BMS_CELL_REDUCE         3300        // [mV] Weakest cell under load: the current limit is reduced below
+#define BMS_CELL_MIN            3000        // [mV] Weakest cell under load: current limit 0
+// ######################## END OF BMS ###############################
+
+
+// ############################### PARAMETER TABLE ###############################
+/* Runtime parameters over USART3 (see param.c): controller gains and limits, PWM margin, ADC trigger, filters.
+ * SERIAL_TYPE_PARAM frames get, set, list and save the parameters by ID, with their range and fixed-point format.
+ * The set values are applied together at the start of a FOC step. Save writes the EEPROM emulation, restored at boot.
+*/
+// #define PARAM_ENABLE                     // [-] Flag to enable the runtime parameter table
+#define PARAM_STAGE_MAX         8           // [-] Values set and applied together (Hold flag of the set command)
+#define PARAM_SAVE_SPEED        30          // [rpm] Save and control type change only below: a flash page erase stalls the FOC loop
+// ######################## END OF PARAMETER TABLE ###############################
+
+
+// ############################### CALIBRATION STORE ###############################
+/* Log of versioned config structs protected by a CRC, in the flash pages after the EEPROM emulation (see store.c).
+ * Records of up to a page, indexed in RAM at boot, written with the motor stopped (a page erase stalls the FOC loop).
+ * One page is kept erased for the garbage collection: the live records must fit in STORE_NB_PAGES - 1 pages.
+*/
+// #define STORE_ENABLE                     // [-] Flag to enable the calibration store
+#define STORE_PAGE_FIRST        66          // [-] First flash page, after the EEPROM emulation pages 64 and 65
+#define STORE_NB_PAGES          4           // [-] Flash pages of the log, at least 2
+#define STORE_NB_ID             16          // [-] Record IDs
+// ######################## END OF CALIBRATION STORE ###############################
+
+
+// ############################### EVENT LOG ###############################
+/* Flash log of the fault and timeout transitions with uptime, odometer, speed, current, voltage and temperature (see eventlog.c).
+ * The events are staged in RAM and written below EVENTLOG_FLUSH_SPEED, or at poweroff. Ring of two flash pages, 84 entries.
+ * SERIAL_TYPE_LOG frames read and clear the log: tests_scripts/eventlog_tool.py
+*/
+// #define EVENTLOG_ENABLE                  // [-] Flag to enable the event log
+#define EVENTLOG_PAGE_FIRST     70          // [-] First of the two flash pages, after the calibration store pages 66 to 69
+#define EVENTLOG_STAGE          8           // [-] Events staged in RAM before the flash write
+#define EVENTLOG_FLUSH_SPEED    30          // [rpm] Flash write and clear only below: programming stalls the FOC loop
+// ######################## END OF EVENT LOG ###############################
+
+
+
+// ############################### POWER-FAIL SAVE ###############################
+/* Bus collapse (battery unplugged, BMS cut-off) detected in the FOC interrupt: PWM off, then the lifetime energy and distance
+ * counters, serialized beforehand by the main loop, are written to a pre-erased flash slot on the DC link capacitor charge (see powerfail.c).
+ * Also written at poweroff. Worst-case commit: 26 half-words * 70 us (tPROG max) = 1.8 ms, plus up to 40 ms (tERASE max) when a flash
+ * page erase of the main loop is running, which only happens at standstill. The hold-up time is measured at each power fail:
+ * powerfailHoldupUs must stay well above powerfailCommitUs (read them with the debugger).
+*/
+// #define POWERFAIL_ENABLE                 // [-] Flag to enable the power-fail save, requires ENERGY_ACCOUNTING_ENABLE
+#define POWERFAIL_PAGE_FIRST    72          // [-] First of the two flash pages, after the event log pages 70 and 71
+#define POWERFAIL_DROP          30          // [%] Bus collapse: ADC samples below the bus voltage average (64 ms) minus this ratio
+#define POWERFAIL_SAMPLES       4           // [-] Consecutive PWM periods below the level (4 = 250 us at 16 kHz)
+#define POWERFAIL_VBAT_MIN      (250 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE    // [ADC] No detection with the average below 2.50 V/cell
+#define POWERFAIL_PERIOD        100         // [ms] Record serialization period: the counters of at most this time are lost
+#define POWERFAIL_STAMP_US      500         // [us] Resolution of the hold-up time measurement
+// ######################## END OF POWER-FAIL SAVE ###############################
+
+
+
 // ############################## CRUISE CONTROL SETTINGS ############################
 /* Cruise Control info:
  * enable CRUISE_CONTROL_SUPPORT and (SUPPORT_BUTTONS_LEFT or SUPPORT_BUTTONS_RIGHT depending on which cable is the button installed)
@@ -197,10 +445,31 @@
 // ########################### UART SETIINGS ############################
 #define SERIAL_START_FRAME_ESC_TO_DISPLAY      0x5A                  // [-] Start frame definition for serial commands
 #define SERIAL_START_FRAME_DISPLAY_TO_ESC      0xA5                  // [-] Start frame definition for serial commands
+#define SERIAL_TYPE_FEEDBACK                   0x01                  // [-] Frame type of the regular feedback
+#define SERIAL_TYPE_CURVE                      0x10                  // [-] Frame type of a response curve upload
+#define SERIAL_TYPE_BAUD                       0x11                  // [-] Frame type of the baud rate negotiation (both directions)
+#define SERIAL_TYPE_PARAM                      0x12                  // [-] Frame type of the parameter table access (both directions)
+#define SERIAL_TYPE_LOG                        0x13                  // [-] Frame type of the event log access (both directions)
+#define SERIAL_TYPE_TRIP                       0x02                  // [-] Frame type of the trip / lifetime counters feedback
+#define SERIAL_TYPE_TELEMETRY                  0x03                  // [-] Frame type of the compact telemetry (tag / value records)
+#define SERIAL_TYPE_CHAIN_CMD                  0x20                  // [-] Frame type of the chain setpoint / time reference (USART1)
+#define SERIAL_TYPE_CHAIN_STATUS               0x21                  // [-] Frame type of the chain slave status (USART1)
+#define SERIAL_CRC_TYPE         0                       // [-] Frame check byte: 0 = XOR of all bytes (original displays), 1 = CRC-8 (poly 0x07). See protocol.c
 #define SERIAL_BUFFER_SIZE      64                      // [bytes] Size of Serial Rx buffer. Make sure it is always larger than the structure size
 #define SERIAL_TIMEOUT          160                     // [-] Serial timeout duration for the received data. 160 ~= 0.8 sec. Calculation: 0.8 sec / 0.005 sec
-#define USART3_BAUD             115200                  // UART3 baud rate (short wired cable)
+#define USART3_BAUD             115200                  // UART3 baud rate (short wired cable). Start and fallback rate of the negotiation
+#define BAUD_NEGOTIATION_ENABLE                         // [-] Flag to let the display negotiate a higher UART3 baud rate (see link.c)
+#define LINK_BAUD_MAX           2000000                 // [baud] Highest accepted rate (APB1 limit: 2000000)
+#define LINK_CONFIRM_TIMEOUT    500                     // [ms] Confirmation time at the new rate before falling back
+#define LINK_ERROR_MAX          10                      // [-] Receive errors within LINK_ERROR_WINDOW before falling back
+#define LINK_ERROR_WINDOW       1000                    // [ms]
 #define USART3_WORDLENGTH       UART_WORDLENGTH_8B      // UART_WORDLENGTH_8B or UART_WORDLENGTH_9B
+// #define TELEMETRY_TLV_ENABLE                         // [-] Flag to send the compact telemetry every DELAY_IN_MAIN_LOOP instead of the 59-byte feedback (display support needed, see telemetry.c)
+#define TELEMETRY_PAYLOAD_MAX   24                      // [bytes] Maximum records per telemetry frame
+#define TELEMETRY_REFRESH       20                      // [frames] A fast field is sent at least once every TELEMETRY_REFRESH frames
+#define TELEMETRY_SLOW_PER_FRAME 2                      // [-] Slow fields per telemetry frame
+// #define HALF_DUPLEX_ENABLE                           // [-] Flag for a single-wire display link on PB10, open drain: pull-up needed on the line (see duplex.c)
+#define HALF_DUPLEX_CMD_PERIOD  20                      // [ms] Display command period. The command + reply round trip must fit in it
 // ########################### UART SETIINGS ############################
 
 
@@ -216,6 +485,47 @@
 // ########################### END OF APPLY DEFAULT SETTING ############################
 
 
+// ############################### VALIDATE SETTINGS ###############################
+#if defined(FAST_CMD_PATH_ENABLE) && !defined(CURVE_ENGINE_ENABLE)
+  #error FAST_CMD_PATH_ENABLE requires CURVE_ENGINE_ENABLE
+#endif
+#if defined(EVENTLOG_ENABLE) && defined(STORE_ENABLE) && EVENTLOG_PAGE_FIRST < STORE_PAGE_FIRST + STORE_NB_PAGES && EVENTLOG_PAGE_FIRST + 2 > STORE_PAGE_FIRST
+  #error EVENTLOG_PAGE_FIRST overlaps the calibration store pages
+#endif
+#if defined(THERMAL_BOARD_ENABLE) && !defined(THERMAL_DERATING_ENABLE)
+  #error THERMAL_BOARD_ENABLE requires THERMAL_DERATING_ENABLE
+#endif
+#if defined(POWERFAIL_ENABLE) && !defined(ENERGY_ACCOUNTING_ENABLE)
+  #error POWERFAIL_ENABLE requires ENERGY_ACCOUNTING_ENABLE
+#endif
+#if defined(TRIP_FRAME_ENABLE) && !defined(ENERGY_ACCOUNTING_ENABLE)
+  #error TRIP_FRAME_ENABLE requires ENERGY_ACCOUNTING_ENABLE
+#endif
+#if defined(POWERFAIL_ENABLE) && ((defined(EVENTLOG_ENABLE) && POWERFAIL_PAGE_FIRST < EVENTLOG_PAGE_FIRST + 2 && POWERFAIL_PAGE_FIRST + 2 > EVENTLOG_PAGE_FIRST) \
+		|| (defined(STORE_ENABLE) && POWERFAIL_PAGE_FIRST < STORE_PAGE_FIRST + STORE_NB_PAGES && POWERFAIL_PAGE_FIRST + 2 > STORE_PAGE_FIRST))
+  #error POWERFAIL_PAGE_FIRST overlaps the event log or calibration store pages
+#endif
+#if defined(REGEN_ENABLE) && defined(ELECTRIC_BRAKE_ENABLE)
+  #error REGEN_ENABLE and ELECTRIC_BRAKE_ENABLE are exclusive
+#endif
+#if defined(REGEN_ENABLE) && defined(FAST_CMD_PATH_ENABLE)
+  #error REGEN_ENABLE is not supported by FAST_CMD_PATH_ENABLE yet
+#endif
+#if defined(HALF_DUPLEX_ENABLE) && ((23 + 1 + 59) * 10 * 1000) / USART3_BAUD >= HALF_DUPLEX_CMD_PERIOD
+  #error HALF_DUPLEX_ENABLE: command + reply round trip longer than HALF_DUPLEX_CMD_PERIOD at USART3_BAUD
+#endif
+#if defined(CHAIN_ENABLE) && (defined(SCOPE_ENABLE) || defined(FAST_CMD_PATH_ENABLE))
+  #error CHAIN_ENABLE is exclusive with SCOPE_ENABLE (USART1) and FAST_CMD_PATH_ENABLE (setpoint source)
+#endif
+#if defined(CHAIN_ENABLE) && (CHAIN_LEAD <= ((2 * 23 + 1) * 10 * PWM_FREQ) / CHAIN_BAUD + 2 || CHAIN_LEAD >= (DELAY_IN_MAIN_LOOP * PWM_FREQ) / 1000)
+  #error CHAIN_LEAD must cover the transmission to the slaves and stay below DELAY_IN_MAIN_LOOP
+#endif
+#if defined(BMS_ENABLE) && (defined(SCOPE_ENABLE) || defined(CHAIN_ENABLE))
+  #error BMS_ENABLE, SCOPE_ENABLE and CHAIN_ENABLE all use USART1
+#endif
+#if defined(BMS_ENABLE) && BAT_CELLS > 24
+  #error BMS_ENABLE: the feedback frame has room for 24 cells
+#endif
 // ############################# END OF VALIDATE SETTINGS ############################
 
 #endif
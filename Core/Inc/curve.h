@@ -0,0 +1,65 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef CURVE_H
+#define CURVE_H
+
+#include <stdint.h>
+
+#define CURVE_NB_POINTS     8       // [-] Max breakpoints per table
+#define CURVE_NB_MODES      3       // [-] Number of ride modes
+
+// Table identifiers (also used by the serial upload frame)
+#define CURVE_TBL_THROTTLE  0       // x = throttle input / 4, y = torque request / 4
+#define CURVE_TBL_BRAKE     1       // x = brake input / 4,    y = braking torque request / 4
+#define CURVE_TBL_SPEED     2       // x = speed [10 rpm],     y = throttle torque scale in fixdt(0,8,7): 128 = 1.0
+#define CURVE_TBL_SELECT    0xFF    // no table: select the active ride mode
+
+/* Piecewise-linear table.
+ * The x breakpoints are strictly increasing, the segment slopes are computed once at load time
+ * so that the evaluation is one bounded scan and one multiplication (no division).
+ */
+typedef struct {
+	uint8_t nbPoints;               // [-] Number of valid breakpoints [2, CURVE_NB_POINTS]
+	uint8_t rateRise;               // [-/tick] Max output increase per control tick. 0 = not limited
+	uint8_t rateFall;               // [-/tick] Max output decrease per control tick. 0 = not limited
+	uint8_t x[CURVE_NB_POINTS];
+	uint8_t y[CURVE_NB_POINTS];
+	int32_t slope[CURVE_NB_POINTS]; // fixdt(1,32,8) slope of segment [i, i+1]
+} curve_t;
+
+typedef struct {
+	curve_t throttle;
+	curve_t brake;
+	curve_t speed;
+} curveMode_t;
+
+extern uint8_t curveMode;           // [-] Active ride mode
+
+void curve_init(void);
+void curve_reset(void);
+uint8_t curve_upload(uint8_t mode, uint8_t table, const uint8_t *x, const uint8_t *y,
+		uint8_t rateRise, uint8_t rateFall);
+void curve_shape(int16_t throttleIn, int16_t brakeIn, int16_t speedAbs,
+		int16_t *throttleOut, int16_t *brakeOut);
+int16_t curve_evalThrottle(int16_t throttleIn, int16_t speedAbs);
+int16_t curve_evalBrake(int16_t brakeIn);
+const curveMode_t *curve_getMode(void);
+
+#endif
+
@@ -79,6 +79,8 @@ typedef struct {
 
   int32_t curr_dc;
   int16_t curr_dc_raw;
+
+  int32_t curr_bat;     // [mA] Battery current estimate, filtered like curr_dc: > 0 drive, < 0 regen. Only with BATTERY_MODEL_ENABLE
 } analog_t;
 
 extern analog_t analog;
@@ -0,0 +1,45 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef DUPLEX_H
+#define DUPLEX_H
+
+#include <stdint.h>
+
+// Transmit priorities, 0 = highest
+#define DUPLEX_PRIO_FAULT       0   // Feedback frame with a new error code
+#define DUPLEX_PRIO_REPLY       1   // Replies to the display requests (baud rate, parameters)
+#define DUPLEX_PRIO_PERIODIC    2   // Feedback, trip and telemetry frames
+#define DUPLEX_NB_PRIO          3
+
+extern uint32_t duplexFrames;       // [-] Frames sent
+extern uint32_t duplexCollisions;   // [-] Frames corrupted on the line (echo mismatch or missing)
+extern uint32_t duplexReplaced;     // [-] Queued frames replaced by a newer one before their transmission
+extern uint32_t duplexDropped;      // [-] Frames refused or lost, collisions included
+
+void duplex_init(void);
+uint8_t duplex_send(const uint8_t *data, uint16_t len, uint8_t prio);
+uint8_t duplex_pending(uint8_t prio);
+uint8_t duplex_txDone(void);
+void duplex_txCplt(void);
+uint8_t duplex_echo(uint8_t byte);
+void duplex_frameRx(void);
+void duplex_idle(void);
+
+#endif
+
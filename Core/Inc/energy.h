@@ -0,0 +1,52 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <stdint.h>
+
+// Raw accumulators, integrated on every PWM period
+typedef struct {
+	uint64_t driveCharge;           // [mA * period] Charge drawn from the battery
+	uint64_t regenCharge;           // [mA * period] Charge returned to the battery
+	uint64_t driveEnergy;           // [mA * ADC count * period] Energy drawn from the battery
+	uint64_t regenEnergy;           // [mA * ADC count * period] Energy returned to the battery
+	uint32_t hallCnt;               // [-] Hall transitions
+} energyAcc_t;
+
+// Accumulators converted to physical units
+typedef struct {
+	uint32_t distance;              // [m]
+	uint32_t driveMah;              // [mAh]
+	uint32_t regenMah;              // [mAh]
+	uint32_t driveMwh;              // [mWh]
+	uint32_t regenMwh;              // [mWh]
+} energyReport_t;
+
+extern energyReport_t energyTrip;      // Since power on or the last trip reset
+extern energyReport_t energyLifetime;  // Lifetime base + trip
+
+void energy_init(const energyAcc_t *lifetimeBase);
+void energy_step(int32_t currBat, int16_t vbat, uint8_t hall);
+void energy_update(void);
+void energy_resetTrip(void);
+void energy_getLifetime(energyAcc_t *acc);
+
+#endif
+
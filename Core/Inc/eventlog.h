@@ -0,0 +1,63 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdint.h>
+#include "protocol.h"
+
+// Events (Event of the entry), Code 0 = cleared
+#define EVENTLOG_FAULT          1       // Code: rtY_Motor.z_errCode
+#define EVENTLOG_TIMEOUT_SERIAL 2       // Code: timeoutFlagSerial
+#define EVENTLOG_TIMEOUT_ADC    3       // Code: timeoutFlagADC
+
+// Commands
+#define EVENTLOG_CMD_READ       0       // Entry at Index, 0 = oldest
+#define EVENTLOG_CMD_CLEAR      1       // Erase the log
+
+// Reply status
+#define EVENTLOG_OK             0
+#define EVENTLOG_ERR_UNKNOWN    1       // Unknown command or no entry at Index
+#define EVENTLOG_ERR_LOCKED     2       // Clear above EVENTLOG_FLUSH_SPEED
+#define EVENTLOG_ERR_FLASH      3       // Flash erase error
+
+// Log entry, as stored in flash: 12 half-words, check last
+typedef struct {
+	uint32_t seq;                       // [-] Entry number, increasing
+	uint32_t uptime;                    // [ms] Time since power on
+	uint32_t odometer;                  // [m] Lifetime distance, 0 without ENERGY_ACCOUNTING_ENABLE
+	uint8_t event;                      // EVENTLOG_xxx
+	uint8_t code;                       // [-] New error code or timeout flag
+	int16_t speed;                      // [rpm]
+	int16_t current;                    // [-] DC current, as Controller_Current of the feedback frame
+	uint16_t voltage;                   // [0.01 V]
+	int16_t temperature;                // [0.1 °C] board
+	uint16_t check;                     // CRC-16 of the fields above
+} eventlogEntry_t;
+
+extern uint16_t eventlogCount;      // [-] Entries in flash
+extern uint32_t eventlogDropped;    // [-] Events lost with the RAM stage full
+
+void eventlog_init(void);
+void eventlog_request(const SerialLogFromDisplayToEsc *req);
+void eventlog_update(void);
+void eventlog_flush(void);
+uint8_t eventlog_read(uint16_t index, eventlogEntry_t *entry);
+
+#endif
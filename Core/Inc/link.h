@@ -0,0 +1,35 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+
+extern uint32_t linkBaud;           // [baud] Present USART3 baud rate
+extern uint32_t linkRxErrors;       // [-] USART3 receive errors (frame, noise, overrun)
+extern uint32_t linkFallbackCnt;    // [-] Number of fallbacks to USART3_BAUD
+
+void link_init(void);
+void link_request(uint8_t baudCode);
+void link_rxStatus(uint32_t sr);
+void link_update(uint8_t timeoutFlag, uint32_t crcErrors);
+uint8_t link_txAllowed(void);
+
+#endif
+
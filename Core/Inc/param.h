@@ -0,0 +1,64 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef PARAM_H
+#define PARAM_H
+
+#include <stdint.h>
+#include "protocol.h"
+
+// Value formats (Format of the reply)
+#define PARAM_U8            0
+#define PARAM_I16           1
+#define PARAM_U16           2
+#define PARAM_I32           3
+#define PARAM_U32           4
+
+// Flags
+#define PARAM_F_SAVE        0x01        // Stored by PARAM_CMD_SAVE and restored at boot
+#define PARAM_F_STOP        0x02        // Set only below PARAM_SAVE_SPEED
+
+// Commands
+#define PARAM_CMD_GET       0           // Descriptor and value of the parameter Id
+#define PARAM_CMD_SET       1           // Stage a value, applied at the next FOC step unless Hold
+#define PARAM_CMD_LIST      2           // Descriptor and value of the parameter at table index Id
+#define PARAM_CMD_SAVE      3           // Store the PARAM_F_SAVE parameters in flash
+
+// Reply status
+#define PARAM_OK            0
+#define PARAM_ERR_UNKNOWN   1           // Unknown ID, index or command
+#define PARAM_ERR_RANGE     2           // Value out of [Min, Max]
+#define PARAM_ERR_BUSY      3           // Stage full or previous values not applied yet, retry
+#define PARAM_ERR_LOCKED    4           // Save or PARAM_F_STOP set above PARAM_SAVE_SPEED
+#define PARAM_ERR_FLASH     5           // Flash write error
+
+// EEPROM emulation: virtual addresses PARAM_EE_ADDR + ID, after the 11 input calibration variables of VirtAddVarTab
+#define PARAM_EE_FIRST      11          // [-] First VirtAddVarTab index of the table
+#define PARAM_EE_NB_VAR     29          // [-] Reserved VirtAddVarTab entries: layout key + parameters
+#define PARAM_EE_ADDR       0x1400      // [-] Virtual address of the layout key, ID 0
+
+extern uint32_t paramApplied;       // [-] Values applied by the FOC loop
+extern uint32_t paramRejected;      // [-] Requests answered with an error
+
+void param_init(void);
+void param_request(const SerialParamFromDisplayToEsc *req);
+void param_update(void);
+void param_apply(void);
+
+#endif
+
@@ -0,0 +1,34 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef POWERFAIL_H
+#define POWERFAIL_H
+
+#include <stdint.h>
+
+extern uint32_t powerfailCount;     // [-] Records written, the last one restored at boot
+extern uint16_t powerfailCommitUs;  // [us] Last record: commit duration, 0 = unknown
+extern uint16_t powerfailHoldupUs;  // [us] Last record: time the CPU ran after the commit start, at least
+
+void powerfail_init(void);
+void powerfail_step(uint16_t vbat);
+void powerfail_update(void);
+void powerfail_commit(void);
+void powerfail_measure(void);
+
+#endif
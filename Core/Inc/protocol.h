@@ -0,0 +1,282 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+/*
+ * Display protocol schema. Each frame is one list of fields, in wire order:
+ *   F(name)     one byte
+ *   A(name, n)  n bytes, multi-byte values are little endian (protocol_put16 / protocol_put32)
+ * The packed frame struct and its size check are generated from the list, with the CRC8 byte appended: adding a field
+ * to a frame layout is one line. The field values are not generated: the sender writes each field (protocol_put16 /
+ * protocol_put32 for multi-byte values) and the receiver reads it (protocol_get16 / protocol_get32).
+ * Frames received by the ESC must keep the length of SerialFromDisplayToEsc (fixed length USART3 reception).
+ */
+
+// Rx: command frame
+#define SERIAL_FIELDS_DISPLAY_TO_ESC(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(Destination) \
+	F(Number_of_ESC) \
+	F(BMS_protocol) \
+	F(ESC_Jumps) \
+	F(Display_Version_Maj) \
+	F(Display_Version_Main) \
+	F(Power_ON) \
+	F(Throttle) \
+	F(Brake) \
+	F(Torque) \
+	F(Brake_torque) \
+	F(Lock) \
+	F(Regulator) \
+	F(Motor_direction) \
+	F(Hall_sensors_direction) \
+	F(Ligth_power) \
+	F(Max_temperature_reduce) \
+	F(Max_temperature_shutdown) \
+	F(Speed_limit) \
+	F(Motor_start_speed)
+
+// Rx: response curve upload (Type = SERIAL_TYPE_CURVE)
+#define SERIAL_FIELDS_CURVE(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(Ride_mode) \
+	F(Table)                            /* CURVE_TBL_xxx */ \
+	F(Rate_rise) \
+	F(Rate_fall) \
+	A(X, 8) \
+	A(Y, 8)
+
+// Rx: baud rate request / confirmation (Type = SERIAL_TYPE_BAUD)
+#define SERIAL_FIELDS_BAUD(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(Baud_code)                        /* 0: 115200, 1: 230400, 2: 460800, 3: 921600, 4: 1000000, 5: 2000000 */ \
+	A(Reserved, 19)
+
+// Rx: parameter table access (Type = SERIAL_TYPE_PARAM)
+#define SERIAL_FIELDS_PARAM(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(Cmd)                              /* PARAM_CMD_xxx */ \
+	F(Id)                               /* parameter ID, table index for PARAM_CMD_LIST */ \
+	A(Value, 4)                         /* [-] raw fixed-point value, signed */ \
+	F(Hold)                             /* PARAM_CMD_SET: 1 = keep staged, applied with the next set without Hold */ \
+	A(Reserved, 13)
+
+// Rx: event log access (Type = SERIAL_TYPE_LOG)
+#define SERIAL_FIELDS_LOG(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(Cmd)                              /* EVENTLOG_CMD_xxx */ \
+	A(Index, 2)                         /* entry index, 0 = oldest */ \
+	A(Reserved, 17)
+
+// Chain bus (USART1): master -> slaves, torque setpoint and time reference (Type = SERIAL_TYPE_CHAIN_CMD)
+#define SERIAL_FIELDS_CHAIN_CMD(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(Seq) \
+	F(Poll)                             /* address of the slave replying with its status, 0 = none */ \
+	A(Target, 2)                        /* [-] torque setpoint [-1000, 1000] */ \
+	A(Apply_tick, 4)                    /* [PWM periods] master time at which Target is applied */ \
+	A(Tx_tick, 4)                       /* [PWM periods] master time at the start of the transmission */ \
+	F(Lead_bytes)                       /* [bytes] sent before this frame in the same transmission */ \
+	A(Reserved, 7)
+
+// Chain bus (USART1): polled slave -> master, status (Type = SERIAL_TYPE_CHAIN_STATUS)
+#define SERIAL_FIELDS_CHAIN_STATUS(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(Address) \
+	F(Seq)                              /* Seq of the polling command */ \
+	A(Voltage, 2)                       /* [0.01 V] */ \
+	A(Current, 2)                       /* [mA] */ \
+	A(Speed, 2)                         /* [rpm] */ \
+	F(Temperature)                      /* [°C] */ \
+	A(Errors, 2) \
+	A(Reserved, 9)
+
+// Tx: feedback frame (Type = SERIAL_TYPE_FEEDBACK)
+#define SERIAL_FIELDS_ESC_TO_DISPLAY(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(ESC_Version_Maj) \
+	F(ESC_Version_Min) \
+	F(Throttle) \
+	F(Brake) \
+	A(Controller_Voltage, 2)            /* [0.01 V] */ \
+	A(Controller_Current, 2)            /* [mA] */ \
+	F(MOSFET_temperature)               /* [°C] */ \
+	A(ERPM, 2) \
+	F(Lock_status) \
+	F(Ligth_status) \
+	F(Regulator_status) \
+	A(Phase_1_current_max, 2) \
+	A(Phase_1_voltage_max, 2) \
+	F(BMS_Version_Maj) \
+	F(BMS_Version_Min) \
+	A(BMS_voltage, 2)                   /* [0.01 V] */ \
+	A(BMS_Current, 2)                   /* [10 mA] positive = discharge */ \
+	A(BMS_Cells_status, 24)             /* [10 mV] above 2.00 V, one byte per cell, 0 = no cell */ \
+	F(BMS_Battery_tempature_1)          /* [°C] */ \
+	F(BMS_Battery_tempature_2)          /* [°C] */ \
+	A(BMS_Charge_cycles_full, 2) \
+	A(BMS_Charge_cycles_partial, 2) \
+	A(Errors, 2)
+
+// Tx: trip and lifetime counters (Type = SERIAL_TYPE_TRIP)
+#define SERIAL_FIELDS_TRIP(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	A(Trip_distance, 4)                 /* [m] */ \
+	A(Trip_drive_mAh, 4) \
+	A(Trip_regen_mAh, 4) \
+	A(Trip_drive_mWh, 4) \
+	A(Trip_regen_mWh, 4) \
+	A(Total_distance, 4)                /* [m] */ \
+	A(Total_drive_mAh, 4) \
+	A(Total_regen_mAh, 4) \
+	A(Total_drive_mWh, 4) \
+	A(Total_regen_mWh, 4)
+
+// Tx: baud rate reply (Type = SERIAL_TYPE_BAUD)
+#define SERIAL_FIELDS_BAUD_REPLY(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(Baud_code) \
+	F(Status)                           /* 0: NACK, 1: ACK (switching), 2: CONFIRMED */
+
+// Tx: parameter table reply (Type = SERIAL_TYPE_PARAM)
+#define SERIAL_FIELDS_PARAM_REPLY(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(Cmd) \
+	F(Status)                           /* PARAM_OK, PARAM_ERR_xxx */ \
+	F(Id) \
+	F(Index)                            /* table index */ \
+	F(Count)                            /* number of parameters in the table */ \
+	F(Format)                           /* PARAM_U8, PARAM_I16, PARAM_U16, PARAM_I32, PARAM_U32 */ \
+	F(Frac)                             /* fractional bits of the fixed-point value */ \
+	F(Flags)                            /* PARAM_F_xxx */ \
+	A(Value, 4)                         /* current value, or the staged value after a set */ \
+	A(Min, 4) \
+	A(Max, 4)
+
+// Tx: event log reply (Type = SERIAL_TYPE_LOG)
+#define SERIAL_FIELDS_LOG_REPLY(F, A) \
+	F(Frame_start) \
+	F(Type) \
+	F(Cmd) \
+	F(Status)                           /* EVENTLOG_OK, EVENTLOG_ERR_xxx */ \
+	A(Index, 2) \
+	A(Count, 2)                         /* entries in the log */ \
+	A(Seq, 4)                           /* entry number, increasing */ \
+	A(Uptime, 4)                        /* [ms] since power on */ \
+	A(Odometer, 4)                      /* [m] */ \
+	F(Event)                            /* EVENTLOG_FAULT, EVENTLOG_TIMEOUT_SERIAL, EVENTLOG_TIMEOUT_ADC */ \
+	F(Code)                             /* error code or timeout flag, 0 = cleared */ \
+	A(Speed, 2)                         /* [rpm] signed */ \
+	A(Current, 2)                       /* [-] as Controller_Current */ \
+	A(Voltage, 2)                       /* [0.01 V] */ \
+	A(Temperature, 2)                   /* [0.1 °C] signed */
+
+// Tx: telemetry records (Type = SERIAL_TYPE_TELEMETRY), variable length:
+//   Frame_start, Type, Length, Length bytes of records, CRC8
+// A record is a tag followed by its value, little endian, with the size given here. Only present fields are sent.
+// X(name, tag, size, class), class: TLM_FAST = sent when changed, TLM_SLOW = rotated across the frames
+#define SERIAL_TELEMETRY_FIELDS(X) \
+	X(TLM_SPEED,        0x01, 2, TLM_FAST)  /* [rpm] signed */ \
+	X(TLM_CURRENT,      0x02, 2, TLM_FAST)  /* [mA] DC current */ \
+	X(TLM_VOLTAGE,      0x03, 2, TLM_FAST)  /* [0.01 V] battery voltage */ \
+	X(TLM_THROTTLE,     0x04, 1, TLM_FAST)  /* [-] throttle command */ \
+	X(TLM_BRAKE,        0x05, 1, TLM_FAST)  /* [-] brake command */ \
+	X(TLM_TEMP_BOARD,   0x10, 1, TLM_SLOW)  /* [°C] MOSFET temperature */ \
+	X(TLM_TEMP_MOTOR,   0x11, 1, TLM_SLOW)  /* [°C] estimated winding temperature */ \
+	X(TLM_ERRORS,       0x12, 2, TLM_SLOW)  /* [-] controller error code */ \
+	X(TLM_SOC,          0x13, 1, TLM_SLOW)  /* [%] battery state of charge */ \
+	X(TLM_LIMIT,        0x14, 1, TLM_SLOW)  /* [%] current limit after derating */ \
+	X(TLM_RIDE_MODE,    0x15, 1, TLM_SLOW)  /* [-] response curve ride mode */ \
+	X(TLM_VERSION,      0x16, 2, TLM_SLOW)  /* [-] ESC version, major / minor */ \
+	X(TLM_CELL_MIN,     0x17, 2, TLM_SLOW)  /* [mV] weakest BMS cell */
+
+#define SERIAL_TELEMETRY_HEADER     3       // [bytes] Frame_start, Type, Length
+
+// Frame generation
+#define SERIAL_STRUCT_F(name)           uint8_t name;
+#define SERIAL_STRUCT_A(name, n)        uint8_t name[n];
+#define SERIAL_SIZE_F(name)             + 1
+#define SERIAL_SIZE_A(name, n)          + (n)
+#define SERIAL_FRAME(type, fields) \
+	typedef struct { \
+		fields(SERIAL_STRUCT_F, SERIAL_STRUCT_A) \
+		uint8_t CRC8; \
+	} type; \
+	_Static_assert(sizeof(type) == 1 fields(SERIAL_SIZE_F, SERIAL_SIZE_A), #type " must be packed");
+
+SERIAL_FRAME(SerialFromDisplayToEsc, SERIAL_FIELDS_DISPLAY_TO_ESC)
+SERIAL_FRAME(SerialCurveFromDisplayToEsc, SERIAL_FIELDS_CURVE)
+SERIAL_FRAME(SerialBaudFromDisplayToEsc, SERIAL_FIELDS_BAUD)
+SERIAL_FRAME(SerialParamFromDisplayToEsc, SERIAL_FIELDS_PARAM)
+SERIAL_FRAME(SerialLogFromDisplayToEsc, SERIAL_FIELDS_LOG)
+SERIAL_FRAME(SerialChainCmd, SERIAL_FIELDS_CHAIN_CMD)
+SERIAL_FRAME(SerialChainStatus, SERIAL_FIELDS_CHAIN_STATUS)
+SERIAL_FRAME(SerialFromEscToDisplay, SERIAL_FIELDS_ESC_TO_DISPLAY)
+SERIAL_FRAME(SerialTripFromEscToDisplay, SERIAL_FIELDS_TRIP)
+SERIAL_FRAME(SerialBaudFromEscToDisplay, SERIAL_FIELDS_BAUD_REPLY)
+SERIAL_FRAME(SerialParamFromEscToDisplay, SERIAL_FIELDS_PARAM_REPLY)
+SERIAL_FRAME(SerialLogFromEscToDisplay, SERIAL_FIELDS_LOG_REPLY)
+
+_Static_assert(sizeof(SerialCurveFromDisplayToEsc) == sizeof(SerialFromDisplayToEsc), "Rx frames must have the same length");
+_Static_assert(sizeof(SerialBaudFromDisplayToEsc) == sizeof(SerialFromDisplayToEsc), "Rx frames must have the same length");
+_Static_assert(sizeof(SerialParamFromDisplayToEsc) == sizeof(SerialFromDisplayToEsc), "Rx frames must have the same length");
+_Static_assert(sizeof(SerialLogFromDisplayToEsc) == sizeof(SerialFromDisplayToEsc), "Rx frames must have the same length");
+_Static_assert(sizeof(SerialChainCmd) == sizeof(SerialFromDisplayToEsc), "Rx frames must have the same length");
+_Static_assert(sizeof(SerialChainStatus) == sizeof(SerialFromDisplayToEsc), "Rx frames must have the same length");
+
+#define PROTOCOL_RX_MAX     sizeof(SerialFromDisplayToEsc)  // [bytes] Longest frame received by the ESC
+
+// Receive stream parser
+typedef struct {
+	uint8_t buf[PROTOCOL_RX_MAX];       // Frame being assembled, complete and valid when protocol_parse returns 1
+	uint8_t len;                        // [bytes] Bytes in buf
+	uint8_t need;                       // [bytes] Expected frame length, 0 until the Type byte is received
+	uint32_t frames;                    // [-] Valid frames
+	uint32_t crcErrors;                 // [-] Frames dropped on a check byte error
+	uint32_t skipped;                   // [bytes] Bytes dropped while searching for a start frame
+} protocolParser_t;
+
+uint8_t protocol_rxLength(uint8_t type);
+void protocol_parserReset(protocolParser_t *p);
+uint8_t protocol_parse(protocolParser_t *p, uint8_t byte);
+uint8_t protocol_crc(const void *data, uint16_t len);
+uint8_t protocol_crcUpdate(uint8_t crc, const void *data, uint16_t len);
+void protocol_seal(void *frame, uint16_t size);
+uint8_t protocol_check(const void *frame, uint16_t size);
+void protocol_put16(uint8_t *dst, uint16_t val);
+void protocol_put32(uint8_t *dst, uint32_t val);
+uint16_t protocol_get16(const uint8_t *src);
+uint32_t protocol_get32(const uint8_t *src);
+
+#endif
+
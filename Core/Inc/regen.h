@@ -0,0 +1,32 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef REGEN_H
+#define REGEN_H
+
+#include <stdint.h>
+
+extern int32_t regenCurrent;        // [mA] Estimated battery charge current
+extern uint16_t regenScale;         // [-] Regen torque scale from the battery limits, fixdt(0,16,15)
+
+void regen_setMax(uint8_t brakeTorque);
+int16_t regen_request(int16_t brakeIn, int16_t speedAbs);
+int16_t regen_step(int16_t target, int16_t speed, int16_t vbat, int16_t iq);
+
+#endif
+
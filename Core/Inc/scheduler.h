@@ -0,0 +1,56 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+typedef void (*schedFcn_t)(void);
+
+// Static task descriptor. Configuration fields first, runtime statistics after.
+typedef struct {
+	const char *name;               // [-] Task name, for inspection with the debugger
+	schedFcn_t fcn;                 // [-] Task function, must return (cooperative)
+	uint16_t period;                // [ms] Release period
+	uint16_t deadline;              // [ms] Relative deadline: max time from release to completion
+	uint8_t priority;               // [-] 0 = highest priority
+
+	uint32_t release;               // [ms] Tick of the next release
+	uint32_t runCnt;                // [-] Number of executions
+	uint32_t cyclesLast;            // [cycles] Execution time of the last run
+	uint32_t cyclesMax;             // [cycles] Worst case execution time
+	uint32_t cyclesAvg;             // [cycles] Average execution time, fixdt(0,32,4)
+	uint32_t responseMax;           // [us] Worst case response time (release to completion)
+	uint32_t deadlineMiss;          // [-] Number of runs completed after their deadline
+	uint32_t releaseSkip;           // [-] Number of releases lost because the task was late by more than one period
+} schedTask_t;
+
+// Helper to declare a task: SCHED_TASK(fcn, period [ms], deadline [ms], priority)
+#define SCHED_TASK(fcn, per, dl, prio)  { #fcn, (fcn), (per), (dl), (prio), 0, 0, 0, 0, 0, 0, 0, 0 }
+
+extern uint16_t schedLoad;          // [0.1 %] CPU load of the main loop tasks over the last second
+extern uint16_t schedLoadMax;       // [0.1 %] Highest measured load
+
+void sched_init(schedTask_t *tasks, uint8_t nbTasks);
+void sched_dispatch(void);
+void sched_resetStats(void);
+uint32_t sched_cycles(void);
+
+#endif
+
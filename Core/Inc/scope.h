@@ -0,0 +1,32 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <stdint.h>
+
+extern uint16_t scopeSignals;       // [-] Streamed signals, SCOPE_SIGNALS bit mask
+extern uint8_t scopeDecimation;     // [-] One sample every scopeDecimation PWM periods
+extern uint32_t scopeDropped;       // [-] Packets dropped because the previous one was still in transmission
+
+void scope_init(void);
+void scope_sample(void);
+
+#endif
+
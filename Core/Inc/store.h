@@ -0,0 +1,44 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+#include "config.h"              // STORE_NB_ID
+
+// Status
+#define STORE_OK            0
+#define STORE_ERR_NONE      1           // No record with this ID
+#define STORE_ERR_VERSION   2           // The record has another version: see store_info
+#define STORE_ERR_SIZE      3           // Size differs from the record, or record larger than a page
+#define STORE_ERR_ID        4           // ID not below STORE_NB_ID
+#define STORE_ERR_FULL      5           // The live records do not fit the pages
+#define STORE_ERR_FLASH     6           // Flash program or erase error
+
+// Record IDs, 0 .. STORE_NB_ID - 1: a config struct keeps its ID, its version changes with its layout
+
+extern uint32_t storeErases;        // [-] Page erases since boot
+extern uint32_t storeSeq;           // [-] Sequence number of the head page, incremented at each page change
+
+void store_init(void);
+uint8_t store_info(uint8_t id, uint8_t *version, uint16_t *size);
+uint8_t store_read(uint8_t id, uint8_t version, void *data, uint16_t size);
+uint8_t store_write(uint8_t id, uint8_t version, const void *data, uint16_t size);
+
+#endif
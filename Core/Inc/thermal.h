@@ -0,0 +1,33 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef THERMAL_H
+#define THERMAL_H
+
+#include <stdint.h>
+
+extern int16_t motorTempEst;        // [0.1 °C] Estimated motor winding temperature
+extern uint16_t thermalScale;       // [-] Current limit scale applied to i_max, fixdt(0,16,15)
+
+void thermal_init(int16_t iMaxNominal, int16_t boardTemp);
+void thermal_setNominal(int16_t iMaxNominal);
+void thermal_setLimits(uint8_t reduce, uint8_t shutdown);
+int16_t thermal_update(int16_t boardTemp, int16_t iq);
+
+#endif
+
@@ -0,0 +1,33 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Define to prevent recursive inclusion
+#ifndef TRACTION_H
+#define TRACTION_H
+
+#include <stdint.h>
+
+extern int32_t tractionAccel;       // [rpm/s] Measured wheel acceleration
+extern int32_t tractionAccelMax;    // [rpm/s] Acceleration limit for the current torque request
+extern uint16_t tractionScale;      // [-] Torque scale applied by the traction control, fixdt(0,16,15)
+extern uint32_t tractionSlipCnt;    // [-] Number of detected slip events
+
+void traction_reset(void);
+int16_t traction_step(int16_t target, int16_t speedFixdt);
+
+#endif
+
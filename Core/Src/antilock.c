@@ -0,0 +1,169 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Wheel lock detection under electric braking, executed in the FOC interrupt (TORQUE mode only).
+ *
+ * The hall speed of the controller (fixdt(1,16,4)) is sampled every 1 ms. A vehicle speed reference follows the
+ * wheel speed, but decreases at most by ANTILOCK_DECEL_MAX: the vehicle cannot decelerate faster than that on the
+ * ground. The controller hall speed is only updated on a hall transition and a locked wheel keeps its last speed:
+ * the wheel speed is limited to the speed of one transition over the time elapsed since the last one.
+ * When the braking wheel drops below ANTILOCK_LOCK_RATIO % of the reference, the wheel is locked: the braking
+ * torque is released for ANTILOCK_RELEASE ms
+ * (friction brake only), then ANTILOCK_REAPPLY_LEVEL % of the torque at the lock is reapplied at once and the torque
+ * ramps up to the full request over ANTILOCK_REAPPLY ms. A lock during the reapply ramp starts a
+ * new release, giving the anti-lock cadence. Below ANTILOCK_SPEED_MIN the detection is disabled (standstill).
+ * The thresholds and the cadence are tuned with tests_scripts/antilock_sim.c (wheel and road friction model).
+ *
+ *   IDLE --lock--> RELEASE --ANTILOCK_RELEASE--> REAPPLY --scale back to 1.0--> IDLE
+ *                     ^                             |
+ *                     +------------lock-------------+
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "BLDC_controller.h"
+#include "antilock.h"
+
+//------------------------------------------------------------------------
+// Global variables set here in antilock.c
+//------------------------------------------------------------------------
+int16_t antilockRef;                    // [rpm] Vehicle speed reference (wheel speed with bounded deceleration)
+uint16_t antilockScale = 32768;         // [-] Braking torque scale applied by the anti-lock, fixdt(0,16,15)
+uint32_t antilockCnt;                   // [-] Number of detected wheel locks
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+extern P rtP_Left;
+
+#define ANTILOCK_SUBSAMPLE      (PWM_FREQ / 1000)   // [-] FOC periods per speed sample (1 ms)
+#define ANTILOCK_SCALE_ONE      32768               // [-] 1.0 in fixdt(0,16,15)
+#define ANTILOCK_REAPPLY_STEP   (ANTILOCK_SCALE_ONE / ANTILOCK_REAPPLY)     // [-/ms]
+#define ANTILOCK_REF_STEP       ((ANTILOCK_DECEL_MAX * 16) / 1000)          // [rpm/ms] fixdt(1,16,4)
+
+typedef enum {
+	AL_IDLE = 0,
+	AL_RELEASE,
+	AL_REAPPLY
+} alState_t;
+
+static alState_t alState;
+static int32_t ref;                     // [rpm] fixdt(1,32,4) Speed reference, absolute value
+static int8_t dir;                      // [-] Direction of motion: -1, 0, 1
+static uint16_t releaseCnt;             // [ms] Remaining release time
+static uint16_t edgeCnt;                // [-] PWM periods since the last hall transition
+static uint8_t hallPrev;
+static uint8_t subCnt;
+static uint16_t lockScale;              // [-] Torque scale at the last lock, fixdt(0,16,15)
+
+/* =========================== Local Functions =========================== */
+
+static void antilock_release(void) {
+	antilockCnt++;
+	lockScale = antilockScale;
+	antilockScale = 0;
+	releaseCnt = ANTILOCK_RELEASE;
+	alState = AL_RELEASE;
+}
+
+/*
+ * 1 ms sample: speed reference, lock detection and torque profile
+ */
+static void antilock_sample(int16_t target, int16_t speedFixdt) {
+	int32_t wheel;
+	uint8_t lock;
+
+	// Speed reference with bounded deceleration. cf_speedCoef = rpm * PWM periods between two hall transitions
+	wheel = MIN(ABS(speedFixdt), ((int32_t) rtP_Left.cf_speedCoef << 4) / (edgeCnt + 1));
+	if (speedFixdt != 0) {
+		dir = (speedFixdt > 0) ? 1 : -1;
+	}
+	ref = MAX(wheel, ref - ANTILOCK_REF_STEP);
+	antilockRef = (int16_t) (ref >> 4);
+
+	// Locked: braking, moving, and the wheel far below the reference
+	lock = (target != 0 && dir != 0 && (target > 0) != (dir > 0)
+			&& ref >= (ANTILOCK_SPEED_MIN << 4)
+			&& wheel * 100 < ref * ANTILOCK_LOCK_RATIO);
+
+	switch (alState) {
+	case AL_IDLE:
+		if (lock) {
+			antilock_release();
+		}
+		break;
+
+	case AL_RELEASE:
+		if (releaseCnt == 0 || --releaseCnt == 0) {
+			antilockScale = (uint16_t) (((uint32_t) lockScale * ANTILOCK_REAPPLY_LEVEL) / 100);
+			alState = AL_REAPPLY;
+		}
+		break;
+
+	case AL_REAPPLY:
+	default:
+		if (lock) {
+			antilock_release();
+		} else if (antilockScale >= ANTILOCK_SCALE_ONE - ANTILOCK_REAPPLY_STEP) {
+			antilockScale = ANTILOCK_SCALE_ONE;
+			alState = AL_IDLE;
+		} else {
+			antilockScale += ANTILOCK_REAPPLY_STEP;
+		}
+		break;
+	}
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Clear the detector, e.g. when the motor is disabled or not in TORQUE mode
+ */
+void antilock_reset(void) {
+	alState = AL_IDLE;
+	antilockScale = ANTILOCK_SCALE_ONE;
+	ref = 0;
+	dir = 0;
+	subCnt = 0;
+	edgeCnt = 0;
+}
+
+/*
+ * To be called by the FOC interrupt on every PWM period
+ * Input:  target = torque request, speedFixdt = hall speed in fixdt(1,16,4) [rpm], hall = hall sensor state
+ * Output: torque request after the anti-lock (only a braking request is scaled)
+ */
+int16_t antilock_step(int16_t target, int16_t speedFixdt, uint8_t hall) {
+	if (hall != hallPrev) {
+		hallPrev = hall;
+		edgeCnt = 0;
+	} else if (edgeCnt < UINT16_MAX) {
+		edgeCnt++;
+	}
+	if (++subCnt >= ANTILOCK_SUBSAMPLE) {
+		subCnt = 0;
+		antilock_sample(target, speedFixdt);
+	}
+	if (antilockScale >= ANTILOCK_SCALE_ONE || target == 0 || (target > 0) == (dir > 0)) {
+		return target;
+	}
+	return (int16_t) (((int32_t) target * antilockScale) >> 15);
+}
+
@@ -0,0 +1,166 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Online battery model: V = OCV - I * R
+ *
+ * - Internal resistance: the voltage and current deviations from their slow averages are correlated with a
+ *   least squares estimate with forgetting, R = -sum(dV * dI) / sum(dI^2). Only significant current steps are used.
+ * - Open circuit voltage: terminal voltage + I * R, slowly filtered. State of charge from a Li-ion OCV table.
+ * - Current limit: the DC current giving a terminal voltage at the floor is (OCV - floor) / R. The motor current
+ *   limit scale is multiplied by allowed / present DC current when the current is too high, and recovers slowly
+ *   once it is below. If the measured voltage is below the floor anyway, the scale keeps decreasing.
+ *
+ * Called from the main loop every DELAY_IN_MAIN_LOOP with the raw battery ADC value and analog.curr_bat, the battery
+ * current estimate already low-pass filtered in the FOC interrupt (~0.2 s). The fast voltage filter matches it.
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "battery.h"
+
+//------------------------------------------------------------------------
+// Global variables set here in battery.c
+//------------------------------------------------------------------------
+int32_t batteryVoltage;                 // [mV] Terminal voltage (fast filter)
+int32_t batteryOcv;                     // [mV] Estimated open circuit voltage
+int32_t batteryResistance = BAT_R_INIT; // [mOhm] Estimated pack internal resistance
+uint8_t batterySoc;                     // [%] State of charge from the open circuit voltage
+uint16_t batteryScale = 32768;          // [-] Current limit scale to stay above the voltage floor, fixdt(0,16,15)
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define BATTERY_SCALE_ONE       32768                                   // [-] 1.0 in fixdt(0,16,15)
+#define BATTERY_SCALE_RISE      (BATTERY_SCALE_ONE / (1000 / DELAY_IN_MAIN_LOOP))  // [-/tick] recovery in 1 s
+#define BATTERY_SCALE_DROP      (BATTERY_SCALE_ONE / (200 / DELAY_IN_MAIN_LOOP))   // [-/tick] extra decrease below the floor
+#define BATTERY_FLOOR           ((int32_t) BAT_CELLS * BAT_CELL_FLOOR)  // [mV]
+#define BATTERY_FILT_FAST       1600    // [-] fixdt(0,16,16) ~0.2 s at 5 ms, same as the curr_bat filter
+#define BATTERY_FILT_SLOW       164     // [-] fixdt(0,16,16) ~2 s, reference for the deviations
+#define BATTERY_FILT_OCV        33      // [-] fixdt(0,16,16) ~10 s
+#define BATTERY_DI_MIN          1000    // [mA] Minimum current deviation used for the resistance estimate
+#define BATTERY_SII_MIN         (20LL * BATTERY_DI_MIN * BATTERY_DI_MIN)   // [mA^2] Excitation needed before R is updated
+
+static int32_t vFast, vSlow, iSlow, ocvFilt;    // fixdt(1,32,8)
+static int64_t sumVI;                   // [mV * mA]
+static int64_t sumII;                   // [mA * mA]
+
+// Li-ion open circuit voltage per cell [mV] at 0, 10, ... 100 % state of charge
+static const uint16_t socTable[11] = { 3300, 3450, 3550, 3620, 3680, 3740, 3800, 3870, 3950, 4050, 4180 };
+
+/* =========================== Local Functions =========================== */
+
+static void battery_filter(int32_t u, uint16_t coef, int32_t *y) {
+	*y += (int32_t) ((((int64_t) u << 8) - *y) * coef >> 16);
+}
+
+static int32_t battery_mv(int16_t vbat) {
+	return ((int32_t) vbat * BAT_CALIB_REAL_VOLTAGE * 10) / BAT_CALIB_ADC;
+}
+
+static uint8_t battery_soc(int32_t ocv) {
+	int32_t cell = ocv / BAT_CELLS;
+	uint8_t i;
+
+	if (cell <= socTable[0]) {
+		return 0;
+	}
+	for (i = 1; i < ARRAY_LEN(socTable); i++) {
+		if (cell < socTable[i]) {
+			return (uint8_t) ((i - 1) * 10 + ((cell - socTable[i - 1]) * 10) / (socTable[i] - socTable[i - 1]));
+		}
+	}
+	return 100;
+}
+
+/* =========================== Initialization Functions =========================== */
+
+/*
+ * Input: vbat = battery ADC value at rest
+ */
+void battery_init(int16_t vbat) {
+	int32_t mv = battery_mv(vbat);
+
+	vFast = vSlow = ocvFilt = mv << 8;
+	iSlow = 0;
+	sumVI = sumII = 0;
+	batteryVoltage = batteryOcv = mv;
+	batterySoc = battery_soc(mv);
+	batteryScale = BATTERY_SCALE_ONE;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Input: vbat = battery ADC value (not filtered), currBat = battery current [mA], < 0 in regen
+ */
+void battery_update(int16_t vbat, int32_t currBat) {
+	int32_t dV, dI, iAllow;
+	uint16_t scale;
+
+	// Filters
+	battery_filter(battery_mv(vbat), BATTERY_FILT_FAST, &vFast);
+	batteryVoltage = vFast >> 8;
+	dV = batteryVoltage - (vSlow >> 8);
+	dI = currBat - (iSlow >> 8);
+	battery_filter(batteryVoltage, BATTERY_FILT_SLOW, &vSlow);
+	battery_filter(currBat, BATTERY_FILT_SLOW, &iSlow);
+
+	// Internal resistance
+	if (ABS(dI) >= BATTERY_DI_MIN) {
+		sumVI += (int64_t) dV * dI - (sumVI >> 10);
+		sumII += (int64_t) dI * dI - (sumII >> 10);
+		if (sumII >= BATTERY_SII_MIN) {
+			batteryResistance = (int32_t) CLAMP((-sumVI * 1000) / sumII, BAT_R_MIN, BAT_R_MAX);
+		}
+	}
+
+	// Open circuit voltage and state of charge
+	battery_filter(batteryVoltage + (currBat * batteryResistance) / 1000, BATTERY_FILT_OCV, &ocvFilt);
+	batteryOcv = ocvFilt >> 8;
+	batterySoc = battery_soc(batteryOcv);
+
+	// Current limit to keep the terminal voltage above the floor
+	iAllow = ((batteryOcv - BATTERY_FLOOR) * 1000) / batteryResistance;
+	if (currBat <= iAllow) {
+		scale = BATTERY_SCALE_ONE;
+	} else if (iAllow <= 0) {
+		scale = 0;
+	} else {
+		scale = (uint16_t) MIN(((int64_t) batteryScale * iAllow) / currBat, BATTERY_SCALE_ONE);
+	}
+	if (batteryVoltage < BATTERY_FLOOR) {
+		scale = MIN(scale, MAX(batteryScale - BATTERY_SCALE_DROP, 0));
+	}
+
+	if (scale < batteryScale) {
+		batteryScale = scale;
+	} else {
+		batteryScale = MIN(batteryScale + BATTERY_SCALE_RISE, scale);
+	}
+}
+
+/*
+ * Input:  iMax = motor current limit, fixdt(1,16,4)
+ * Output: limit after the battery voltage floor scale
+ */
+int16_t battery_limit(int16_t iMax) {
+	return (int16_t) (((int32_t) iMax * batteryScale) >> 15);
+}
+
@@ -28,6 +28,15 @@
 #include "util.h"
 #include "main.h"
 #include "debug.h"
+#include "cmdpath.h"
+#include "traction.h"
+#include "energy.h"
+#include "regen.h"
+#include "antilock.h"
+#include "scope.h"
+#include "chain.h"
+#include "param.h"
+#include "powerfail.h"
 
 // Matlab includes and defines - from auto-code generation
 // ###############################################################################
@@ -48,10 +57,10 @@ uint32_t counter = 0;
 // ###############################################################################
 
 #if KX
-static int16_t pwm_margin = 110;        /* This margin allows to always have a window in the PWM signal for proper Phase currents measurement */
+int16_t pwm_margin = 110;               /* This margin allows to always have a window in the PWM signal for proper Phase currents measurement */
                                         /* official firmware value */
 #else
-static int16_t pwm_margin = 110; // Xiaomi firmware value
+int16_t pwm_margin = 110; // Xiaomi firmware value
 #endif
 
 analog_t analog;
@@ -96,6 +105,9 @@ int16_t voltageTimer = 0;
 int16_t batVoltage = (400 * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE;
 static int32_t batVoltageFixdt = (400 * BAT_CELLS * BAT_CALIB_ADC)
 		/ BAT_CALIB_REAL_VOLTAGE << 16; // Fixed-point filter output initialized at 400 V*100/cell = 4 V/cell converted to fixed-point
+#if defined(ENERGY_ACCOUNTING_ENABLE) || defined(BATTERY_MODEL_ENABLE)
+static int32_t nNoLoad = (400 * BAT_CELLS * MOTOR_KV) / 100;    // [rpm] No-load speed at batVoltage, refreshed with it
+#endif
 
 // =================================
 // Init motor params
@@ -186,7 +198,13 @@ void DMA1_Channel1_IRQHandler(void) {
 	if (voltageTimer % 1000 == 0) { // Filter battery voltage at a slower sampling rate
 		filtLowPass32(adc_buffer.vbat, BAT_FILT_COEF, &batVoltageFixdt);
 		batVoltage = (int16_t) (batVoltageFixdt >> 16); // convert fixed-point to integer
+#if defined(ENERGY_ACCOUNTING_ENABLE) || defined(BATTERY_MODEL_ENABLE)
+		nNoLoad = MAX(((int32_t) batVoltage * BAT_CALIB_REAL_VOLTAGE * MOTOR_KV) / (BAT_CALIB_ADC * 100), 1);   // [rpm]
+#endif
 	}
+#ifdef POWERFAIL_ENABLE
+	powerfail_step(adc_buffer.vbat);        // Bus collapse: PWM off, counters saved, then reset
+#endif
 
 #if BLDC_CURRENT_LIMIT
 	// Disable PWM when current limit is reached (current chopping)
@@ -226,10 +244,39 @@ void DMA1_Channel1_IRQHandler(void) {
 	uint8_t hall_vl = !(HALL_B_GPIO_Port->IDR & HALL_B_Pin);
 	uint8_t hall_wl = !(HALL_C_GPIO_Port->IDR & HALL_C_Pin);
 
+#ifdef PARAM_ENABLE
+	param_apply();                          // Staged runtime parameters, before the controller step
+#endif
+
 	/* Set motor inputs here */
 	rtU_Motor.b_motEna = enableFin;
 	rtU_Motor.z_ctrlModReq = ctrlModReq;
+#if defined(CHAIN_ENABLE)
+	rtU_Motor.r_inpTgt = chain_target();    // Same setpoint in the same PWM period on all the ESCs of the chain
+#elif defined(FAST_CMD_PATH_ENABLE)
+	rtU_Motor.r_inpTgt = cmdpath_step(pwm);
+#else
 	rtU_Motor.r_inpTgt = pwm;
+#endif
+#ifdef TRACTION_CONTROL_ENABLE
+	if (ctrlModReq == TRQ_MODE && enableFin) {
+		rtU_Motor.r_inpTgt = traction_step(rtU_Motor.r_inpTgt, rtDW_Motor.Divide11); // Divide11 = hall speed in fixdt(1,16,4)
+	} else {
+		traction_reset();
+	}
+#endif
+#ifdef REGEN_ENABLE
+	if (ctrlModReq == TRQ_MODE) {
+		rtU_Motor.r_inpTgt = regen_step(rtU_Motor.r_inpTgt, rtY_Motor.n_mot, adc_buffer.vbat, rtY_Motor.iq);
+	}
+#endif
+#ifdef ANTILOCK_ENABLE
+	if (ctrlModReq == TRQ_MODE && enableFin) {
+		rtU_Motor.r_inpTgt = antilock_step(rtU_Motor.r_inpTgt, rtDW_Motor.Divide11, hall_ul | (hall_vl << 1) | (hall_wl << 2));
+	} else {
+		antilock_reset();
+	}
+#endif
 	rtU_Motor.b_hallA = hall_ul;
 	rtU_Motor.b_hallB = hall_vl;
 	rtU_Motor.b_hallC = hall_wl;
@@ -247,6 +294,24 @@ void DMA1_Channel1_IRQHandler(void) {
 	errCodeLeft = rtY_Motor.z_errCode;
 	motSpeedLeft = rtY_Motor.n_mot;
 
+#ifdef SCOPE_ENABLE
+	scope_sample();
+#endif
+
+#if defined(ENERGY_ACCOUNTING_ENABLE) || defined(BATTERY_MODEL_ENABLE)
+	// Battery current: phase current times the modulation, approximated by the ratio of the speed to the no-load
+	// speed at the bus voltage (losses neglected): I_bat = iq * n / (MOTOR_KV * V_bat). curr_dc is the phase current.
+	int32_t iqBat = ((int32_t) rtY_Motor.iq * CLAMP(rtY_Motor.n_mot, -nNoLoad, nNoLoad)) / nNoLoad;  // fixdt(1,16,4)
+#ifdef BATTERY_MODEL_ENABLE
+	static int32_t filter_bat;
+	filtLowPass32(iqBat, 20, &filter_bat);
+	analog.curr_bat = ((filter_bat >> 16) * 1000) / (A2BIT_CONV * 16);
+#endif
+#ifdef ENERGY_ACCOUNTING_ENABLE
+	energy_step((iqBat * 1000) / (A2BIT_CONV * 16), batVoltage, hall_ul | (hall_vl << 1) | (hall_wl << 2));
+#endif
+#endif
+
 #if BLDC_ENABLE_LOOP
 
 	/* Apply commands */
@@ -257,6 +322,10 @@ void DMA1_Channel1_IRQHandler(void) {
 	TIM1->CCR3 = (uint16_t) CLAMP(wl + pwm_res / 2, pwm_margin,
 			pwm_res - pwm_margin);
 
+#ifdef CMD_LATENCY_MEASURE
+	cmdpath_ccrApplied();
+#endif
+
 #endif
 
 #if DEBUG_LED == BLDC_DMA
@@ -0,0 +1,312 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * BMS client on the USART1 single wire (PB6).
+ *
+ * Non-blocking polling from the main loop (bms_update), no interrupt:
+ *   IDLE --request sent by DMA--> WAIT --reply decoded / BMS_TIMEOUT--> IDLE (next request)
+ * The receive DMA runs in circular mode, bms_update() drains the new bytes on each call. The requests are read
+ * back on the single wire and ignored by their device address.
+ *
+ * Xiaomi / Ninebot protocol (BMS_protocol 1), BMS device 0x22, replies from 0x25:
+ *   55 AA | len | addr | cmd | reg | data (len - 2 bytes) | checksum (2 bytes, little endian)
+ *   checksum = 0xFFFF ^ sum(len .. last data byte), read request: cmd 0x01, data = number of bytes to read
+ * Registers (16-bit words, little endian):
+ *   0x17 firmware version, 0x1B full charge cycles, 0x1C charge count,
+ *   0x31 remaining capacity, 0x32 state of charge, 0x33 current [10 mA], 0x34 voltage [10 mV],
+ *   0x35 temperatures (1 byte each, +20 °C), 0x40.. cell voltages [mV]
+ * The status and the cells are read in turn, the version and the cycles once every BMS_SLOW_EVERY requests.
+ *
+ * The values are kept in the bmsData snapshot for the telemetry. The weakest cell gives a current limit scale:
+ * 1.0 above BMS_CELL_REDUCE, linear down to 0 at BMS_CELL_MIN. It drops at once and recovers in 1 s.
+ * tests_scripts/bms_sim.py emulates the BMS on a serial port for bench tests.
+ */
+
+// Includes
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "bms.h"
+
+//------------------------------------------------------------------------
+// Global variables set externally
+//------------------------------------------------------------------------
+extern UART_HandleTypeDef huart1;
+
+//------------------------------------------------------------------------
+// Global variables set here in bms.c
+//------------------------------------------------------------------------
+bmsData_t bmsData;                      // BMS snapshot
+uint16_t bmsScale = 32768;              // [-] Current limit scale from the weakest cell, fixdt(0,16,15)
+uint32_t bmsReplies;                    // [-] Valid replies
+uint32_t bmsTimeouts;                   // [-] Requests without reply
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define BMS_PROTO_NONE      0xFF
+#define BMS_PROTO_XIAOMI    1
+#define BMS_ADDR_REQ        0x22        // [-] Device address of the BMS
+#define BMS_ADDR_REPLY      0x25        // [-] Address of the BMS replies
+#define BMS_CMD_READ        0x01
+#define BMS_SLOW_EVERY      16          // [-] Requests between two reads of the slow registers
+#define BMS_FRAME_MAX       (6 + 2 * BAT_CELLS + 2)     // [bytes] Longest reply
+#define BMS_RX_SIZE         128         // [bytes] Receive DMA circular buffer
+#define BMS_SCALE_ONE       32768                                       // [-] 1.0 in fixdt(0,16,15)
+#define BMS_SCALE_RISE      (BMS_SCALE_ONE / (1000 / DELAY_IN_MAIN_LOOP))  // [-/tick] recovery in 1 s
+#define BMS_TX_DMA          DMA1_Channel4       // USART1_TX
+#define BMS_RX_DMA          DMA1_Channel5       // USART1_RX
+
+typedef enum {
+	BMS_REQ_STATUS = 0,                 // 0x31..0x35
+	BMS_REQ_CELLS,                      // 0x40..
+	BMS_REQ_VERSION,                    // 0x17
+	BMS_REQ_CYCLES                      // 0x1B..0x1C
+} bmsReq_t;
+
+static const uint8_t reqReg[] = { 0x31, 0x40, 0x17, 0x1B };
+static const uint8_t reqLen[] = { 10, 2 * BAT_CELLS, 2, 4 };
+
+static uint8_t bmsProtocol = BMS_PROTOCOL;
+static uint8_t waiting;                 // [-] Request sent, reply expected
+static bmsReq_t req;
+static uint8_t reqCnt = BMS_SLOW_EVERY - 1;
+static uint16_t waitTime;               // [ms]
+static uint16_t age = BMS_STALE;        // [ms] Time since the last valid reply
+static uint8_t txBuf[9];
+static uint8_t rxBuf[BMS_RX_SIZE];
+static uint16_t rxPos;                  // [bytes] Next byte to read in rxBuf
+static uint8_t frame[BMS_FRAME_MAX];
+static uint8_t frameLen;                // [bytes] Bytes in frame
+static uint8_t frameNeed;               // [bytes] Expected frame length, 0 until the length byte
+
+/* =========================== Local Functions =========================== */
+
+static uint16_t bms_checksum(const uint8_t *data, uint8_t len) {
+	uint16_t sum = 0;
+
+	while (len--) {
+		sum += *data++;
+	}
+	return sum ^ 0xFFFF;
+}
+
+static uint16_t bms_get16(const uint8_t *src) {
+	return (uint16_t) (src[0] | (src[1] << 8));
+}
+
+static void bms_send(bmsReq_t r) {
+	uint16_t ck;
+
+	txBuf[0] = 0x55;
+	txBuf[1] = 0xAA;
+	txBuf[2] = 3;
+	txBuf[3] = BMS_ADDR_REQ;
+	txBuf[4] = BMS_CMD_READ;
+	txBuf[5] = reqReg[r];
+	txBuf[6] = reqLen[r];
+	ck = bms_checksum(&txBuf[2], 5);
+	txBuf[7] = (uint8_t) ck;
+	txBuf[8] = (uint8_t) (ck >> 8);
+
+	BMS_TX_DMA->CCR &= ~DMA_CCR_EN;
+	DMA1->IFCR = DMA_IFCR_CGIF4;
+	BMS_TX_DMA->CMAR = (uint32_t) txBuf;
+	BMS_TX_DMA->CNDTR = sizeof(txBuf);
+	BMS_TX_DMA->CCR |= DMA_CCR_EN;
+}
+
+/*
+ * Reply to the pending request, checksum verified
+ */
+static void bms_decode(const uint8_t *data, uint8_t len) {
+	uint16_t cellMin = 0xFFFF;
+	uint8_t i;
+
+	switch (req) {
+	case BMS_REQ_STATUS:
+		bmsData.soc = (uint8_t) bms_get16(&data[2]);
+		bmsData.current = (int16_t) bms_get16(&data[4]);
+		bmsData.voltage = bms_get16(&data[6]);
+		bmsData.temperature[0] = (int8_t) (data[8] - 20);
+		bmsData.temperature[1] = (int8_t) (data[9] - 20);
+		break;
+	case BMS_REQ_CELLS:
+		for (i = 0; i < len / 2; i++) {
+			bmsData.cell[i] = bms_get16(&data[2 * i]);
+			if (bmsData.cell[i] != 0) {     // 0: no cell
+				cellMin = MIN(cellMin, bmsData.cell[i]);
+			}
+		}
+		bmsData.cellMin = cellMin;
+		break;
+	case BMS_REQ_VERSION:
+		bmsData.version = bms_get16(data);
+		break;
+	case BMS_REQ_CYCLES:
+	default:
+		bmsData.cyclesFull = bms_get16(&data[0]);
+		bmsData.cyclesPartial = bms_get16(&data[2]);
+		break;
+	}
+}
+
+/*
+ * Feed one received byte to the frame assembler
+ * Output: 1 when the reply to the pending request has been decoded
+ */
+static uint8_t bms_rxByte(uint8_t byte) {
+	if ((frameLen == 0 && byte != 0x55) || (frameLen == 1 && byte != 0xAA)) {
+		frameLen = (byte == 0x55);      // resynchronize on the header
+		return 0;
+	}
+	frame[frameLen++] = byte;
+	if (frameLen == 3) {
+		frameNeed = byte + 6;
+		if (byte < 2 || frameNeed > sizeof(frame)) {
+			frameLen = 0;
+			return 0;
+		}
+	}
+	if (frameLen < 3 || frameLen < frameNeed) {
+		return 0;
+	}
+
+	frameLen = 0;
+	if (bms_get16(&frame[frameNeed - 2]) != bms_checksum(&frame[2], frameNeed - 4)
+			|| frame[3] != BMS_ADDR_REPLY || frame[5] != reqReg[req] || frame[2] - 2 != reqLen[req]) {
+		return 0;                       // corrupted, own request read back or unexpected reply
+	}
+	bms_decode(&frame[6], reqLen[req]);
+	return 1;
+}
+
+static uint16_t bms_cellScale(uint16_t cellMin) {
+	if (cellMin >= BMS_CELL_REDUCE) {
+		return BMS_SCALE_ONE;
+	}
+	if (cellMin <= BMS_CELL_MIN) {
+		return 0;
+	}
+	return (uint16_t) (((uint32_t) (cellMin - BMS_CELL_MIN) << 15) / (BMS_CELL_REDUCE - BMS_CELL_MIN));
+}
+
+/* =========================== Initialization Functions =========================== */
+
+/*
+ * USART1 at BMS_BAUD (APB2 clock), single wire from MX_USART1_UART_Init, both DMA channels driven with registers
+ */
+void bms_init(void) {
+	__HAL_UART_DISABLE(&huart1);
+	huart1.Init.BaudRate = BMS_BAUD;
+	huart1.Instance->BRR = UART_BRR_SAMPLING16(HAL_RCC_GetPCLK2Freq(), BMS_BAUD);
+	SET_BIT(huart1.Instance->CR3, USART_CR3_DMAT | USART_CR3_DMAR);
+	__HAL_UART_ENABLE(&huart1);
+
+	BMS_TX_DMA->CPAR = (uint32_t) &huart1.Instance->DR;
+
+	BMS_RX_DMA->CCR &= ~DMA_CCR_EN;
+	BMS_RX_DMA->CPAR = (uint32_t) &huart1.Instance->DR;
+	BMS_RX_DMA->CMAR = (uint32_t) rxBuf;
+	BMS_RX_DMA->CNDTR = sizeof(rxBuf);
+	BMS_RX_DMA->CCR = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_EN;    // no interrupt, polled by bms_update()
+
+	memset(&bmsData, 0, sizeof(bmsData));
+	bmsData.cellMin = 0xFFFF;           // unknown until the cells are read
+	rxPos = 0;
+	frameLen = 0;
+	waiting = 0;
+	req = BMS_REQ_STATUS;
+	reqCnt = BMS_SLOW_EVERY - 1;        // version first
+	age = BMS_STALE;
+	bmsScale = BMS_SCALE_ONE;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * BMS protocol from the display: 0 selects BMS_PROTOCOL, 0xFF disables the client
+ */
+void bms_setProtocol(uint8_t protocol) {
+	bmsProtocol = protocol ? protocol : BMS_PROTOCOL;
+}
+
+/*
+ * To be called periodically from the main loop, every BMS_PERIOD
+ */
+void bms_update(void) {
+	uint16_t pos = sizeof(rxBuf) - BMS_RX_DMA->CNDTR;
+
+	// Received bytes
+	while (rxPos != pos) {
+		if (bms_rxByte(rxBuf[rxPos]) && waiting) {
+			waiting = 0;
+			age = 0;
+			bmsData.valid = 1;
+			bmsReplies++;
+		}
+		if (++rxPos == sizeof(rxBuf)) {
+			rxPos = 0;
+		}
+	}
+
+	if (age < BMS_STALE && (age += BMS_PERIOD) >= BMS_STALE) {
+		bmsData.valid = 0;
+	}
+
+	// Next request
+	if (waiting) {
+		if ((waitTime += BMS_PERIOD) < BMS_TIMEOUT) {
+			return;
+		}
+		bmsTimeouts++;
+		waiting = 0;
+	}
+	if (bmsProtocol != BMS_PROTO_XIAOMI) {   // no other protocol implemented
+		return;
+	}
+	if (++reqCnt >= BMS_SLOW_EVERY) {
+		reqCnt = 0;
+		req = BMS_REQ_VERSION;
+	} else if (req == BMS_REQ_VERSION) {
+		req = BMS_REQ_CYCLES;
+	} else {
+		req = (req == BMS_REQ_STATUS) ? BMS_REQ_CELLS : BMS_REQ_STATUS;
+	}
+	frameLen = 0;
+	waitTime = 0;
+	waiting = 1;
+	bms_send(req);
+}
+
+/*
+ * Input:  iMax = motor current limit, fixdt(1,16,4)
+ * Output: limit after the weakest cell scale, to be called on every main loop tick
+ */
+int16_t bms_limit(int16_t iMax) {
+	uint16_t scale = bmsData.valid ? bms_cellScale(bmsData.cellMin) : BMS_SCALE_ONE;
+
+	if (scale < bmsScale) {
+		bmsScale = scale;
+	} else {
+		bmsScale = MIN(bmsScale + BMS_SCALE_RISE, scale);
+	}
+	return (int16_t) (((int32_t) iMax * bmsScale) >> 15);
+}
+
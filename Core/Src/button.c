@@ -0,0 +1,119 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Non-blocking push button state machine.
+ * The raw pin is sampled periodically (scheduler task) and debounced here, gestures are reported as events.
+ *
+ *   IDLE --press--> PRESSED --release (< long)--> WAIT_SECOND --gap expired--> IDLE         [SHORT]
+ *                      |                              |
+ *                      | held >= long  [LONG]         +--press--> SECOND_PRESSED --release--> IDLE  [DOUBLE]
+ *                      v
+ *                 WAIT_RELEASE --release--> IDLE
+ *
+ * The state machine starts in WAIT_RELEASE, so the release of the power on press is not reported.
+ */
+
+// Includes
+#include "config.h"
+#include "button.h"
+
+/* =========================== Initialization Functions =========================== */
+
+/*
+ * The button is taken as held at init (it is the press that powered the board on): no gesture is reported
+ * before a debounced release.
+ */
+void button_init(button_t *btn) {
+	btn->state = BTN_WAIT_RELEASE;
+	btn->rawLast = 1;
+	btn->level = 1;
+	btn->rawChange = 0;
+	btn->stateTime = 0;
+}
+
+/* =========================== General Functions =========================== */
+
+static void button_setState(button_t *btn, btnState_t state, uint32_t now) {
+	btn->state = state;
+	btn->stateTime = now;
+}
+
+/*
+ * Update the button state machine with a new raw sample
+ * Input:  raw = pin level (1 = pressed), now = tick [ms]
+ * Output: gesture event, BTN_EVT_NONE most of the time
+ */
+btnEvent_t button_update(button_t *btn, uint8_t raw, uint32_t now) {
+	btnEvent_t evt = BTN_EVT_NONE;
+	uint8_t edge;
+
+	// Debounce: the raw level must be stable for BUTTON_DEBOUNCE before it is accepted
+	raw = (raw != 0);
+	if (raw != btn->rawLast) {
+		btn->rawLast = raw;
+		btn->rawChange = now;
+	}
+	edge = 0;
+	if (raw != btn->level && (now - btn->rawChange) >= BUTTON_DEBOUNCE) {
+		btn->level = raw;
+		edge = 1;
+	}
+
+	switch (btn->state) {
+	case BTN_IDLE:
+		if (edge && btn->level) {
+			button_setState(btn, BTN_PRESSED, now);
+		}
+		break;
+
+	case BTN_PRESSED:
+		if (edge && !btn->level) {
+			button_setState(btn, BTN_WAIT_SECOND, now);
+		} else if ((now - btn->stateTime) >= BUTTON_LONG_PRESS) {
+			evt = BTN_EVT_LONG;
+			button_setState(btn, BTN_WAIT_RELEASE, now);
+		}
+		break;
+
+	case BTN_WAIT_SECOND:
+		if (edge && btn->level) {
+			button_setState(btn, BTN_SECOND_PRESSED, now);
+		} else if ((now - btn->stateTime) >= BUTTON_DOUBLE_GAP) {
+			evt = BTN_EVT_SHORT;
+			button_setState(btn, BTN_IDLE, now);
+		}
+		break;
+
+	case BTN_SECOND_PRESSED:
+		if (edge && !btn->level) {
+			evt = BTN_EVT_DOUBLE;
+			button_setState(btn, BTN_IDLE, now);
+		}
+		break;
+
+	case BTN_WAIT_RELEASE:
+	default:
+		if (!btn->level) {
+			button_setState(btn, BTN_IDLE, now);
+		}
+		break;
+	}
+
+	return evt;
+}
+
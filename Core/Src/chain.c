@@ -0,0 +1,385 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ESC chain: several ESCs on the USART1 single wire, one torque setpoint for all of them.
+ *
+ * The ESC connected to the display (CHAIN_ADDRESS 1) is the master. On every main loop tick it sends to the
+ * slaves one transmission, which the addressed slave answers in the gap that follows:
+ *
+ *   master  |== forwarded display frame (optional) ==|== command ==|
+ *   slave N                                                         <1 char idle> |== status ==|
+ *
+ * - Forwarding: a display command frame with Destination 0 (all ESCs) or the address of a slave is copied to
+ *   the chain with ESC_Jumps + 1. Frames with ESC_Jumps >= CHAIN_ESC_MAX are not forwarded (loop protection).
+ *   Slaves process the frames for them as if they came from a display (limits, mode, power off...).
+ * - Setpoint: the command frame carries the master torque setpoint and the master time at which it is applied,
+ *   CHAIN_LEAD PWM periods after the transmission. The master applies its own setpoint at the same time.
+ * - Time reference: each ESC counts PWM periods in the FOC interrupt (chainTick). The command frame also carries
+ *   the master time at the start of the transmission. A slave stamps the IDLE event after the command, which
+ *   occurs a known line time later (Lead_bytes + command + 1 idle character), and derives
+ *   chainOffset = master time - local time. Steps above CHAIN_SYNC_JUMP reset the offset, smaller deviations
+ *   (interrupt latency, clock drift) are filtered and move it by one period at a time.
+ *   All the ESCs then switch to a new setpoint in the same PWM period, within one period.
+ * - Telemetry: the command polls one slave in turn, its status (current, temperature, errors...) is kept by the
+ *   master and aggregated into the frames sent to the display. A slave without answer for CHAIN_TIMEOUT sets
+ *   CHAIN_ERR_LOST in the error word. A slave without setpoint for CHAIN_TIMEOUT applies torque 0.
+ *
+ * All the chain frames are display-to-ESC frames (start 0xA5, 23 bytes), so the usual receive parser is used.
+ * In single-wire mode every ESC also receives its own frames: the master ignores the command type, slaves the
+ * status type.
+ */
+
+// Includes
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "BLDC_controller.h"
+#include "protocol.h"
+#include "chain.h"
+
+//------------------------------------------------------------------------
+// Global variables set externally
+//------------------------------------------------------------------------
+extern UART_HandleTypeDef huart1;
+extern DMA_HandleTypeDef hdma_usart1_rx;
+extern ExtY rtY_Motor;
+extern int16_t batVoltage;
+extern int16_t board_temp_deg_c;
+
+//------------------------------------------------------------------------
+// Global variables set here in chain.c
+//------------------------------------------------------------------------
+volatile uint32_t chainTick;            // [PWM periods] Local time, counted by the FOC interrupt
+int32_t chainOffset;                    // [PWM periods] Master time - local time (0 on the master)
+uint8_t chainSynced = (CHAIN_ADDRESS == 1);     // [-] Time reference and setpoints received (always 1 on the master)
+uint8_t chainNbEsc = CHAIN_ESC_MAX;     // [-] ESCs on the chain, from the display Number_of_ESC
+uint32_t chainFrames;                   // [-] Valid frames received on the chain
+uint32_t chainLost;                     // [-] Slave: setpoint timeouts. Master: slave status timeouts
+uint32_t chainForwardDropped;           // [-] Master: display frames replaced before being forwarded
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define CHAIN_MASTER        (CHAIN_ADDRESS == 1)
+#define CHAIN_FRAME         sizeof(SerialFromDisplayToEsc)     // [bytes] Length of all the chain frames
+#define CHAIN_ERR_LOST      0x8000                  // [-] Error bit: a slave does not answer
+#define CHAIN_SYNC_JUMP     4                       // [PWM periods] Offset deviation resetting the time reference
+#define CHAIN_LINE_TICKS(bytes)     ((((uint32_t) (bytes) * 10 * PWM_FREQ * 256) / CHAIN_BAUD + 128) >> 8)   // [PWM periods]
+
+typedef struct {
+	int32_t current;                    // [mA]
+	int16_t temperature;                // [°C]
+	uint16_t errors;
+	uint16_t age;                       // [ms] Time since the last status
+} chainEsc_t;
+
+static uint8_t txBuf[2 * CHAIN_FRAME];  // Master: forwarded frame + command. Slave: status
+static uint8_t fwdBuf[CHAIN_FRAME];     // Master: display frame waiting to be forwarded
+static volatile uint8_t fwdPending;
+static uint8_t seq;
+static uint8_t pollAddr;
+static chainEsc_t esc[CHAIN_ESC_MAX];   // Master: status of the slaves, by address - 1
+
+static volatile int16_t applied;        // [-] Setpoint applied by the FOC interrupt
+static volatile int16_t pendingTarget;  // [-] Next setpoint
+static volatile uint32_t pendingTick;   // [PWM periods] Master time at which pendingTarget is applied
+static volatile uint8_t pendingValid;
+static volatile uint16_t cmdAge = CHAIN_TIMEOUT;   // [ms] Slave: time since the last setpoint
+static int16_t devFilt;                 // [PWM periods] Filtered offset deviation, fixdt(1,16,8)
+
+/* =========================== Local Functions =========================== */
+
+static void chain_post(int16_t target, uint32_t applyTick) {
+	pendingTarget = target;
+	pendingTick = applyTick;
+	pendingValid = 1;
+}
+
+#if !CHAIN_MASTER
+/*
+ * Time reference from a command frame completed at the IDLE event stamped at local time idleTick
+ */
+static void chain_sync(const SerialChainCmd *c, uint32_t idleTick) {
+	int32_t offset, dev;
+
+	offset = (int32_t) (protocol_get32(c->Tx_tick) - idleTick) + (int32_t) CHAIN_LINE_TICKS(c->Lead_bytes + CHAIN_FRAME + 1);
+	dev = offset - chainOffset;
+	if (!chainSynced || ABS(dev) > CHAIN_SYNC_JUMP) {
+		chainOffset = offset;
+		devFilt = 0;
+		chainSynced = 1;
+		return;
+	}
+	devFilt += (int16_t) (((dev << 8) - devFilt) >> 3);
+	if (devFilt >= 192) {
+		chainOffset++;
+		devFilt -= 256;
+	} else if (devFilt <= -192) {
+		chainOffset--;
+		devFilt += 256;
+	}
+}
+
+static void chain_reply(uint8_t cmdSeq) {
+	SerialChainStatus *s = (SerialChainStatus*) txBuf;
+
+	s->Seq = cmdSeq;
+	protocol_seal(s, sizeof(*s));
+	HAL_UART_Transmit_DMA(&huart1, txBuf, sizeof(*s));
+}
+#endif
+
+/* =========================== Initialization Functions =========================== */
+
+/*
+ * USART1 at CHAIN_BAUD (APB2 clock), single wire from MX_USART1_UART_Init, circular receive DMA and interrupt
+ * for the IDLE events. The reception is started by Input_Init().
+ */
+void chain_init(void) {
+	uint8_t i;
+
+	__HAL_UART_DISABLE(&huart1);
+	huart1.Init.BaudRate = CHAIN_BAUD;
+	huart1.Instance->BRR = UART_BRR_SAMPLING16(HAL_RCC_GetPCLK2Freq(), CHAIN_BAUD);
+	__HAL_UART_ENABLE(&huart1);
+
+	hdma_usart1_rx.Init.Mode = DMA_CIRCULAR;
+	HAL_DMA_Init(&hdma_usart1_rx);
+
+	HAL_NVIC_SetPriority(USART1_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(USART1_IRQn);
+
+	for (i = 0; i < CHAIN_ESC_MAX; i++) {
+		esc[i].age = CHAIN_TIMEOUT;
+	}
+	chainOffset = 0;
+	pendingValid = 0;
+	applied = 0;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Display command frame received on USART3 (USART interrupt). Master: forwarded to the slaves it addresses.
+ * Output: 1 if the frame is also for this ESC
+ */
+uint8_t chain_forward(const SerialFromDisplayToEsc *frame) {
+#if CHAIN_MASTER
+	if (frame->Number_of_ESC >= 1 && frame->Number_of_ESC <= CHAIN_ESC_MAX) {
+		chainNbEsc = frame->Number_of_ESC;
+	}
+	if (frame->Destination == CHAIN_ADDRESS) {
+		return 1;
+	}
+	if (frame->ESC_Jumps < CHAIN_ESC_MAX) {
+		if (fwdPending) {
+			chainForwardDropped++;
+		}
+		memcpy(fwdBuf, frame, CHAIN_FRAME);
+		((SerialFromDisplayToEsc*) fwdBuf)->ESC_Jumps++;
+		protocol_seal(fwdBuf, CHAIN_FRAME);
+		fwdPending = 1;
+	}
+	return frame->Destination == 0;
+#else
+	(void) frame;
+	return 1;
+#endif
+}
+
+/*
+ * Valid frame received on USART1 (USART interrupt)
+ * Input:  buf = frame, stamp = chainTick at the receive event, idle = 1 if the event is the IDLE line detection
+ * Output: 1 if the frame is a display frame for this ESC, to be processed as a command
+ */
+uint8_t chain_rxFrame(const uint8_t *buf, uint32_t stamp, uint8_t idle) {
+	const SerialFromDisplayToEsc *frame = (const SerialFromDisplayToEsc*) buf;
+
+	chainFrames++;
+#if CHAIN_MASTER
+	(void) stamp;
+	(void) idle;
+	if (frame->Type == SERIAL_TYPE_CHAIN_STATUS) {
+		const SerialChainStatus *s = (const SerialChainStatus*) buf;
+		if (s->Address >= 2 && s->Address <= CHAIN_ESC_MAX) {
+			chainEsc_t *e = &esc[s->Address - 1];
+			e->current = (int16_t) protocol_get16(s->Current);
+			e->temperature = (int8_t) s->Temperature;
+			e->errors = protocol_get16(s->Errors);
+			e->age = 0;
+		}
+	}
+	return 0;                           // own frames read back
+#else
+	const SerialChainCmd *c = (const SerialChainCmd*) buf;
+
+	switch (frame->Type) {
+	case SERIAL_TYPE_CHAIN_CMD:
+		if (idle) {
+			chain_sync(c, stamp);           // the line time is only known from the IDLE event
+		}
+		if (chainSynced) {
+			chain_post((int16_t) protocol_get16(c->Target), protocol_get32(c->Apply_tick));
+			cmdAge = 0;
+		}
+		if (idle && c->Poll == CHAIN_ADDRESS && huart1.gState == HAL_UART_STATE_READY) {
+			chain_reply(c->Seq);
+		}
+		return 0;
+	case SERIAL_TYPE_CHAIN_STATUS:          // other slaves
+		return 0;
+	default:
+		return frame->Destination == 0 || frame->Destination == CHAIN_ADDRESS;
+	}
+#endif
+}
+
+/*
+ * To be called on every main loop tick
+ * Input: target = setpoint computed by this ESC, sent to the chain by the master
+ */
+void chain_update(int16_t target) {
+#if CHAIN_MASTER
+	SerialChainCmd *c;
+	uint32_t now;
+	uint16_t len = 0;
+	uint8_t i;
+
+	for (i = 1; i < CHAIN_ESC_MAX; i++) {
+		if (esc[i].age < CHAIN_TIMEOUT && (esc[i].age += DELAY_IN_MAIN_LOOP) >= CHAIN_TIMEOUT) {
+			chainLost++;
+		}
+	}
+
+	if (huart1.gState != HAL_UART_STATE_READY) {   // previous transmission still in flight: local setpoint only
+		__disable_irq();
+		chain_post(target, chainTick + CHAIN_LEAD);
+		__enable_irq();
+		return;
+	}
+
+	__disable_irq();
+	if (fwdPending) {
+		memcpy(txBuf, fwdBuf, CHAIN_FRAME);
+		len = CHAIN_FRAME;
+		fwdPending = 0;
+	}
+	__enable_irq();
+
+	c = (SerialChainCmd*) &txBuf[len];
+	memset(c, 0, sizeof(*c));
+	c->Frame_start = SERIAL_START_FRAME_DISPLAY_TO_ESC;
+	c->Type = SERIAL_TYPE_CHAIN_CMD;
+	c->Seq = ++seq;
+	if (chainNbEsc < 2) {
+		pollAddr = 0;                   // alone
+	} else if (++pollAddr < 2 || pollAddr > chainNbEsc) {
+		pollAddr = 2;                   // slaves in turn
+	}
+	c->Poll = pollAddr;
+	protocol_put16(c->Target, (uint16_t) target);
+	c->Lead_bytes = (uint8_t) len;
+	len += sizeof(*c);
+
+	__disable_irq();                    // the transmission starts in the PWM period given by Tx_tick
+	now = chainTick;
+	protocol_put32(c->Tx_tick, now);
+	protocol_put32(c->Apply_tick, now + CHAIN_LEAD);
+	protocol_seal(c, sizeof(*c));
+	chain_post(target, now + CHAIN_LEAD);
+	HAL_UART_Transmit_DMA(&huart1, txBuf, len);
+	__enable_irq();
+#else
+	SerialChainStatus *s = (SerialChainStatus*) txBuf;
+
+	(void) target;
+	__disable_irq();
+	if (cmdAge < CHAIN_TIMEOUT && (cmdAge += DELAY_IN_MAIN_LOOP) >= CHAIN_TIMEOUT) {
+		pendingValid = 0;               // master lost: no torque
+		applied = 0;
+		chainSynced = 0;
+		chainLost++;
+	}
+	__enable_irq();
+
+	if (huart1.gState == HAL_UART_STATE_READY) {   // status for the next poll
+		__disable_irq();
+		s->Frame_start = SERIAL_START_FRAME_DISPLAY_TO_ESC;
+		s->Type = SERIAL_TYPE_CHAIN_STATUS;
+		s->Address = CHAIN_ADDRESS;
+		protocol_put16(s->Voltage, (uint16_t) ((batVoltage * BAT_CALIB_REAL_VOLTAGE) / BAT_CALIB_ADC));
+		protocol_put16(s->Current, (uint16_t) analog.curr_dc);
+		protocol_put16(s->Speed, (uint16_t) rtY_Motor.n_mot);
+		s->Temperature = (uint8_t) (board_temp_deg_c / 10);
+		protocol_put16(s->Errors, rtY_Motor.z_errCode);
+		__enable_irq();
+	}
+#endif
+}
+
+/*
+ * To be called by the FOC interrupt on every PWM period
+ * Output: setpoint applied in this period
+ */
+int16_t chain_target(void) {
+	uint32_t now = ++chainTick + (uint32_t) chainOffset;   // master time
+
+	if (pendingValid && (int32_t) (now - pendingTick) >= 0) {
+		applied = pendingTarget;
+		pendingValid = 0;
+	}
+	return applied;
+}
+
+/*
+ * Aggregation of the slave status for the display (master). Input: the value of this ESC.
+ */
+int32_t chain_current(int32_t local) {
+	uint8_t i;
+
+	for (i = 1; i < chainNbEsc; i++) {
+		if (esc[i].age < CHAIN_TIMEOUT) {
+			local += esc[i].current;
+		}
+	}
+	return local;
+}
+
+int16_t chain_temperature(int16_t local) {
+	uint8_t i;
+
+	for (i = 1; i < chainNbEsc; i++) {
+		if (esc[i].age < CHAIN_TIMEOUT) {
+			local = MAX(local, esc[i].temperature);
+		}
+	}
+	return local;
+}
+
+uint16_t chain_errors(uint16_t local) {
+#if CHAIN_MASTER
+	uint8_t i;
+
+	for (i = 1; i < chainNbEsc; i++) {
+		local |= (esc[i].age < CHAIN_TIMEOUT) ? esc[i].errors : CHAIN_ERR_LOST;
+	}
+#endif
+	return local;
+}
+
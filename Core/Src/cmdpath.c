@@ -0,0 +1,265 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Low latency command path from the USART3 frame to the FOC interrupt.
+ *
+ * Slow path (default): IDLE irq -> command -> readCommand() on the next 5 ms tick -> shaping -> pwm -> FOC irq
+ * Fast path:           IDLE irq -> curves evaluated in the USART irq -> cmdpath_post() -> FOC irq (next PWM period)
+ * On the fast path the rise / fall limits of the active ride mode are applied in the FOC interrupt,
+ * with the per tick steps converted to per PWM period steps. The main loop keeps computing pwm, which is
+ * used again as soon as the fast path is disabled (serial timeout, test modes).
+ *
+ * The latency instrumentation works for both paths: a frame is stamped with the DWT cycle counter at IDLE
+ * detection and the latency is recorded when the FOC interrupt writes the first CCR values computed from it.
+ * Note that the CCR registers are preloaded: the new duty cycle is output at the next PWM update event.
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "curve.h"
+#include "cmdpath.h"
+
+//------------------------------------------------------------------------
+// Global variables set here in cmdpath.c
+//------------------------------------------------------------------------
+cmdLatency_t cmdLatency;
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define CMDPATH_PERIODS_PER_TICK    (PWM_FREQ * DELAY_IN_MAIN_LOOP / 1000)    // [-] PWM periods per control tick
+#define CMDPATH_NO_LIMIT            0x7FFFFFFF
+
+static volatile uint8_t fastEnable;     // [-] 1 = the FOC interrupt follows the fast path target
+static uint8_t fastActive;              // [-] fast path state seen by the FOC interrupt
+
+// Targets posted by the USART interrupt, fixdt(1,32,16)
+static int32_t throttleTarget;
+static int32_t brakeTarget;
+static int32_t throttleRise, throttleFall;  // [-/period] fixdt(0,32,16) steps
+static int32_t brakeRise, brakeFall;
+static int16_t outMin, outMax;
+
+// Shaped outputs, fixdt(1,32,16)
+static int32_t throttleFixdt;
+static int32_t brakeFixdt;
+
+// Latency measurement
+enum { STAGE_IDLE = 0, STAGE_RECEIVED, STAGE_POSTED };
+static volatile uint8_t frameStage;
+static uint32_t idleStamp;              // [cycles] last IDLE line detection
+static uint32_t frameStamp;             // [cycles] IDLE detection of the frame being measured
+static uint32_t latencyHist[CMDPATH_HIST_BINS];
+static uint32_t latencyMax;             // [us]
+
+/* =========================== Local Functions =========================== */
+
+static int32_t cmdpath_rateStep(uint8_t rate) {
+	if (rate == 0) {
+		return CMDPATH_NO_LIMIT;
+	}
+	return ((int32_t) rate << 16) / CMDPATH_PERIODS_PER_TICK;
+}
+
+static int32_t cmdpath_rate(int32_t y, int32_t target, int32_t rise, int32_t fall) {
+	int32_t step = (ABS(target) > ABS(y)) ? rise : fall;
+	if (y < target) {
+		return (target - y > step) ? y + step : target;
+	}
+	return (y - target > step) ? y - step : target;
+}
+
+/*
+ * Histogram bin: exact below 8 us, then 4 bins per octave
+ */
+static uint8_t cmdpath_bin(uint32_t us) {
+	uint32_t msb;
+	uint32_t bin;
+
+	if (us < 4) {
+		return (uint8_t) us;
+	}
+	msb = 31U - __CLZ(us);
+	bin = (msb - 1U) * 4U + ((us >> (msb - 2U)) & 3U);
+	return (uint8_t) MIN(bin, CMDPATH_HIST_BINS - 1U);
+}
+
+/*
+ * Upper bound [us] of a histogram bin
+ */
+static uint32_t cmdpath_binLimit(uint8_t bin) {
+	uint32_t msb;
+
+	bin++;                              // lower bound of the next bin, minus one
+	if (bin < 4) {
+		return bin - 1U;
+	}
+	msb = bin / 4U + 1U;
+	return ((4U + (bin & 3U)) << (msb - 2U)) - 1U;
+}
+
+static uint32_t cmdpath_percentile(uint32_t count, uint32_t permille) {
+	uint32_t threshold = (uint32_t) (((uint64_t) count * permille + 999U) / 1000U);
+	uint32_t sum = 0;
+	uint8_t i;
+
+	for (i = 0; i < CMDPATH_HIST_BINS; i++) {
+		sum += latencyHist[i];
+		if (sum >= threshold) {
+			return MIN(cmdpath_binLimit(i), latencyMax);
+		}
+	}
+	return latencyMax;
+}
+
+/* =========================== Fast path =========================== */
+
+/*
+ * Allow or forbid the fast path. Called by the main loop on every control tick.
+ */
+void cmdpath_setEnable(uint8_t ena) {
+	fastEnable = ena;
+}
+
+/*
+ * Post a new target from the USART interrupt
+ * Input: throttle / brake torque requests from the response curves, min / max output limits
+ */
+void cmdpath_post(int16_t throttle, int16_t brake, int16_t min, int16_t max) {
+	const curveMode_t *m = curve_getMode();
+
+	throttleTarget = (int32_t) throttle << 16;
+	brakeTarget = (int32_t) brake << 16;
+	throttleRise = cmdpath_rateStep(m->throttle.rateRise);
+	throttleFall = cmdpath_rateStep(m->throttle.rateFall);
+	brakeRise = cmdpath_rateStep(m->brake.rateRise);
+	brakeFall = cmdpath_rateStep(m->brake.rateFall);
+	outMin = min;
+	outMax = max;
+
+	if (fastEnable && frameStage == STAGE_RECEIVED) {
+		frameStage = STAGE_POSTED;
+	}
+}
+
+/*
+ * Motor target for this PWM period. To be called by the FOC interrupt.
+ * Input:  pwmSlow = target computed by the main loop
+ * Output: target to apply
+ */
+int16_t cmdpath_step(int16_t pwmSlow) {
+	int32_t out;
+
+	if (!fastEnable) {
+		fastActive = 0;
+		return pwmSlow;
+	}
+	if (!fastActive) {                  // bumpless transfer from the main loop target
+		fastActive = 1;
+		throttleFixdt = (int32_t) pwmSlow << 16;
+		brakeFixdt = 0;
+		throttleTarget = throttleFixdt;
+		brakeTarget = 0;
+		outMin = outMax = pwmSlow;
+	}
+
+	throttleFixdt = cmdpath_rate(throttleFixdt, throttleTarget, throttleRise, throttleFall);
+	brakeFixdt = cmdpath_rate(brakeFixdt, brakeTarget, brakeRise, brakeFall);
+
+	out = (throttleFixdt - brakeFixdt) >> 16;
+	return (int16_t) CLAMP(out, outMin, outMax);
+}
+
+/* =========================== Latency instrumentation =========================== */
+
+/*
+ * USART IDLE line detected: stamp the data being checked
+ */
+void cmdpath_idle(void) {
+	idleStamp = DWT->CYCCNT;
+}
+
+/*
+ * The data of the last IDLE detection is a valid command frame. A frame still in flight is replaced.
+ */
+void cmdpath_frameRx(void) {
+	frameStamp = idleStamp;
+	frameStage = STAGE_RECEIVED;
+}
+
+/*
+ * Slow path: the main loop wrote pwm from the last received command
+ */
+void cmdpath_pwmSet(void) {
+	if (frameStage == STAGE_RECEIVED) {
+		frameStage = STAGE_POSTED;
+	}
+}
+
+/*
+ * FOC interrupt: the CCR registers were written. Record the latency of the frame if it reached this period.
+ */
+void cmdpath_ccrApplied(void) {
+	uint32_t us;
+
+	if (frameStage != STAGE_POSTED) {
+		return;
+	}
+	frameStage = STAGE_IDLE;
+
+	us = (DWT->CYCCNT - frameStamp) / (SystemCoreClock / 1000000U);
+	latencyHist[cmdpath_bin(us)]++;
+	if (us > latencyMax) {
+		latencyMax = us;
+	}
+}
+
+/*
+ * Refresh cmdLatency from the histogram (main loop)
+ */
+void cmdpath_updateStats(void) {
+	uint32_t count = 0;
+	uint8_t i;
+
+	for (i = 0; i < CMDPATH_HIST_BINS; i++) {
+		count += latencyHist[i];
+	}
+	cmdLatency.count = count;
+	if (count == 0) {
+		return;
+	}
+	cmdLatency.p50 = cmdpath_percentile(count, 500);
+	cmdLatency.p90 = cmdpath_percentile(count, 900);
+	cmdLatency.p99 = cmdpath_percentile(count, 990);
+	cmdLatency.max = latencyMax;
+}
+
+void cmdpath_resetStats(void) {
+	uint8_t i;
+
+	__disable_irq();
+	for (i = 0; i < CMDPATH_HIST_BINS; i++) {
+		latencyHist[i] = 0;
+	}
+	latencyMax = 0;
+	__enable_irq();
+	cmdLatency.count = cmdLatency.p50 = cmdLatency.p90 = cmdLatency.p99 = cmdLatency.max = 0;
+}
+
@@ -0,0 +1,268 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throttle / brake response curves.
+ * Each ride mode owns three piecewise-linear tables:
+ * - throttle: throttle input -> torque request
+ * - brake:    brake input    -> braking torque request
+ * - speed:    speed          -> scale applied to the throttle torque request
+ * The throttle and brake outputs are then rate limited with separate rise and fall steps.
+ *
+ * Tables are stored as uint8 points so that a full table fits in one serial frame. Inputs and outputs are
+ * handled with 2 extra fractional bits (x4), so the torque request covers [0, 1020].
+ * Evaluation cost is bounded: at most CURVE_NB_POINTS compares and one multiplication per table.
+ *
+ * Uploads may arrive from the USART interrupt: they are written to a pending slot and applied by
+ * curve_shape() at the start of the next control tick, so a table never changes in the middle of an evaluation.
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "curve.h"
+
+//------------------------------------------------------------------------
+// Global variables set here in curve.c
+//------------------------------------------------------------------------
+uint8_t curveMode = CURVE_DEFAULT_MODE;    // [-] Active ride mode
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+static curveMode_t curveModes[CURVE_NB_MODES];
+
+static int16_t throttleShaped;          // [-] Rate limited throttle torque request
+static int16_t brakeShaped;             // [-] Rate limited braking torque request
+
+static volatile uint8_t pendingValid;   // [-] 1 = an upload is waiting to be applied
+static uint8_t pendingMode;
+static uint8_t pendingTable;
+static curve_t pendingCurve;
+static volatile uint8_t pendingSelect = 0xFF;  // [-] Ride mode selection waiting to be applied, 0xFF = none
+
+// Default tables: {rateRise, rateFall, x[], y[]}. The number of points is given by the increasing part of x.
+// The brake tables reproduce the former STEER_COEFFICIENT mixer gain (768 / 16384 = 0.047)
+static const uint8_t curveDefaults[CURVE_NB_MODES][3][2 + 2 * CURVE_NB_POINTS] = {
+	{   // 0: Eco - soft start, limited top speed torque
+		{ 15, 30,  0, 64, 160, 255, 0, 0, 0, 0,   0, 24,  96, 180, 0, 0, 0, 0 },
+		{ 15, 30,  0, 255, 0, 0, 0, 0, 0, 0,      0, 12,   0,   0, 0, 0, 0, 0 },
+		{  0,  0,  0, 30,  60, 0, 0, 0, 0, 0,   128, 128, 90,   0, 0, 0, 0, 0 },
+	},
+	{   // 1: Normal - linear with the RATE step, without the FILTER low-pass stage
+		{ 30, 30,  0, 255, 0, 0, 0, 0, 0, 0,      0, 255,  0,   0, 0, 0, 0, 0 },
+		{ 30, 30,  0, 255, 0, 0, 0, 0, 0, 0,      0, 12,   0,   0, 0, 0, 0, 0 },
+		{  0,  0,  0, 255, 0, 0, 0, 0, 0, 0,    128, 128,  0,   0, 0, 0, 0, 0 },
+	},
+	{   // 2: Sport - progressive start, fast rise
+		{ 60, 60,  0, 96, 255, 0, 0, 0, 0, 0,     0, 160, 255,  0, 0, 0, 0, 0 },
+		{ 60, 60,  0, 255, 0, 0, 0, 0, 0, 0,      0, 12,   0,   0, 0, 0, 0, 0 },
+		{  0,  0,  0, 255, 0, 0, 0, 0, 0, 0,    128, 128,  0,   0, 0, 0, 0, 0 },
+	},
+};
+
+/* =========================== Local Functions =========================== */
+
+/*
+ * Validate the breakpoints and precompute the segment slopes.
+ * The number of points is given by the strictly increasing part of x.
+ * Output: 0 = OK, 1 = table rejected (less than 2 points)
+ */
+static uint8_t curve_build(curve_t *c, const uint8_t *x, const uint8_t *y, uint8_t rateRise, uint8_t rateFall) {
+	uint8_t i, n;
+
+	n = 1;
+	while (n < CURVE_NB_POINTS && x[n] > x[n - 1]) {
+		n++;
+	}
+	if (n < 2) {
+		return 1;
+	}
+
+	c->nbPoints = n;
+	c->rateRise = rateRise;
+	c->rateFall = rateFall;
+	for (i = 0; i < CURVE_NB_POINTS; i++) {
+		c->x[i] = (i < n) ? x[i] : x[n - 1];
+		c->y[i] = (i < n) ? y[i] : y[n - 1];
+		c->slope[i] = 0;
+	}
+	for (i = 0; i < n - 1; i++) {
+		c->slope[i] = (((int32_t) c->y[i + 1] - c->y[i]) << 8) / (c->x[i + 1] - c->x[i]);
+	}
+	return 0;
+}
+
+/*
+ * Evaluate a table
+ * Input:  u in x units with 2 fractional bits (x * 4)
+ * Output: y with 2 fractional bits (y * 4)
+ */
+static int16_t curve_eval(const curve_t *c, int32_t u) {
+	uint8_t i;
+	int32_t x0;
+
+	if (u <= ((int32_t) c->x[0] << 2)) {
+		return (int16_t) (c->y[0] << 2);
+	}
+	for (i = 1; i < c->nbPoints; i++) {
+		if (u < ((int32_t) c->x[i] << 2)) {
+			break;
+		}
+	}
+	if (i >= c->nbPoints) {
+		return (int16_t) (c->y[c->nbPoints - 1] << 2);
+	}
+	i--;
+	x0 = (int32_t) c->x[i] << 2;
+	return (int16_t) (((int32_t) c->y[i] << 2) + ((c->slope[i] * (u - x0)) >> 8));
+}
+
+/*
+ * Rate limiter with separate steps for increasing and decreasing magnitude. A step of 0 means no limitation.
+ */
+static int16_t curve_rate(int16_t prev, int16_t target, uint8_t rateRise, uint8_t rateFall) {
+	uint8_t rate = (ABS(target) > ABS(prev)) ? rateRise : rateFall;
+	if (rate == 0) {
+		return target;
+	}
+	return (int16_t) STEP(prev, target, rate);
+}
+
+static void curve_applyPending(void) {
+	curve_t *dst;
+
+	if (pendingValid) {
+		if (pendingTable == CURVE_TBL_THROTTLE) {
+			dst = &curveModes[pendingMode].throttle;
+		} else if (pendingTable == CURVE_TBL_BRAKE) {
+			dst = &curveModes[pendingMode].brake;
+		} else {
+			dst = &curveModes[pendingMode].speed;
+		}
+		__disable_irq();                // the fast command path evaluates the tables in the USART interrupt
+		*dst = pendingCurve;
+		__enable_irq();
+		pendingValid = 0;
+	}
+	if (pendingSelect < CURVE_NB_MODES) {
+		curveMode = pendingSelect;
+		pendingSelect = 0xFF;
+	}
+}
+
+/* =========================== Initialization Functions =========================== */
+
+void curve_init(void) {
+	uint8_t m;
+	const uint8_t *t;
+
+	for (m = 0; m < CURVE_NB_MODES; m++) {
+		t = curveDefaults[m][CURVE_TBL_THROTTLE];
+		curve_build(&curveModes[m].throttle, &t[2], &t[2 + CURVE_NB_POINTS], t[0], t[1]);
+		t = curveDefaults[m][CURVE_TBL_BRAKE];
+		curve_build(&curveModes[m].brake, &t[2], &t[2 + CURVE_NB_POINTS], t[0], t[1]);
+		t = curveDefaults[m][CURVE_TBL_SPEED];
+		curve_build(&curveModes[m].speed, &t[2], &t[2 + CURVE_NB_POINTS], t[0], t[1]);
+	}
+	curveMode = CURVE_DEFAULT_MODE;
+	curve_reset();
+}
+
+/*
+ * Reset the rate limiter states (e.g. on motor enable)
+ */
+void curve_reset(void) {
+	throttleShaped = 0;
+	brakeShaped = 0;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Queue a table upload or a ride mode selection (table = CURVE_TBL_SELECT). Safe to call from an interrupt.
+ * Output: 0 = accepted, 1 = rejected
+ */
+uint8_t curve_upload(uint8_t mode, uint8_t table, const uint8_t *x, const uint8_t *y,
+		uint8_t rateRise, uint8_t rateFall) {
+	if (mode >= CURVE_NB_MODES) {
+		return 1;
+	}
+	if (table == CURVE_TBL_SELECT) {
+		pendingSelect = mode;
+		return 0;
+	}
+	if (table > CURVE_TBL_SPEED || pendingValid) {
+		return 1;                       // unknown table or previous upload not applied yet
+	}
+	if (curve_build(&pendingCurve, x, y, rateRise, rateFall)) {
+		return 1;
+	}
+	pendingMode = mode;
+	pendingTable = table;
+	pendingValid = 1;
+	return 0;
+}
+
+/*
+ * Throttle torque request before rate limiting
+ * Input: throttleIn [-1000, 1000], speedAbs [rpm]
+ */
+int16_t curve_evalThrottle(int16_t throttleIn, int16_t speedAbs) {
+	const curveMode_t *m = &curveModes[curveMode];
+	int32_t torque, scale;
+
+	torque = curve_eval(&m->throttle, ABS(throttleIn));
+	scale = curve_eval(&m->speed, ((int32_t) speedAbs * 2) / 5);   // [rpm] -> [10 rpm] x4
+	torque = (torque * scale) >> 9;                                // scale is fixdt(0,8,7) x4
+	return (int16_t) ((throttleIn < 0) ? -torque : torque);
+}
+
+/*
+ * Braking torque request before rate limiting. The sign of the input is kept.
+ * Input: brakeIn [-1000, 1000]
+ */
+int16_t curve_evalBrake(int16_t brakeIn) {
+	int16_t torque = curve_eval(&curveModes[curveMode].brake, ABS(brakeIn));
+	return (brakeIn < 0) ? -torque : torque;
+}
+
+/*
+ * Shape the pedal commands of one control tick: pending uploads, curves, speed scaling and rise/fall limits.
+ * Output: throttle torque request and braking torque request (same sign convention as brakeIn)
+ */
+void curve_shape(int16_t throttleIn, int16_t brakeIn, int16_t speedAbs,
+		int16_t *throttleOut, int16_t *brakeOut) {
+	const curveMode_t *m;
+
+	curve_applyPending();
+	m = &curveModes[curveMode];
+
+	throttleShaped = curve_rate(throttleShaped, curve_evalThrottle(throttleIn, speedAbs),
+			m->throttle.rateRise, m->throttle.rateFall);
+	brakeShaped = curve_rate(brakeShaped, curve_evalBrake(brakeIn),
+			m->brake.rateRise, m->brake.rateFall);
+
+	*throttleOut = throttleShaped;
+	*brakeOut = brakeShaped;
+}
+
+const curveMode_t *curve_getMode(void) {
+	return &curveModes[curveMode];
+}
+
@@ -0,0 +1,277 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Display link transmit queue (USART3) and half-duplex single-wire mode.
+ *
+ * With HALF_DUPLEX_ENABLE the USART runs in single-wire mode (HDSEL): PB10 is the only data line, open drain.
+ * The display is the master, the ESC only talks in the slot right after a valid frame from the display:
+ *
+ *   display  |== command ==|                                |== command ==| ...
+ *   line                    <1 char idle> |== reply ==|
+ *   ESC                     IDLE irq: start the DMA transmission of the queued frame
+ *
+ * - The main loop queues its frames with duplex_send() (see the transmit queue below), they wait for the next slot.
+ * - The slot opens on the IDLE line event following a valid frame: the display has released the line for one
+ *   character time, which is its turnaround time.
+ * - The receiver stays enabled during the transmission and reads the frame back. The echo is compared byte by
+ *   byte and kept away from the receive parser. A difference means that somebody else drove the line: the
+ *   transmission is aborted and counted in duplexCollisions, the next slot sends fresh data.
+ *
+ * Round trip: command + 1 idle character + reply, at most (23 + 1 + 59) * 10 bits, 7.2 ms at 115200 baud.
+ * config.h checks that it fits in HALF_DUPLEX_CMD_PERIOD. The baud negotiation only raises the rate.
+ *
+ * Transmit queue, both modes: duplex_send() copies the frame, so the caller may rebuild its frame at once.
+ * - one queued frame per priority (DUPLEX_PRIO_xxx); a newer frame of the same priority replaces the queued one
+ *   and is counted in duplexReplaced. A fault frame carries the full state: it also replaces a queued periodic frame
+ * - the highest priority queued frame is sent first
+ * - DUPLEX_NB_PRIO + 1 buffers: one per queued frame and the one in transmission, so a buffer is always free and a
+ *   transmission never reads a buffer being filled
+ * - full-duplex: the transmission starts at once on an idle link, the next frame is chained from the transmit
+ *   complete interrupt (duplex_txCplt). Half-duplex: one frame per reply slot.
+ * - frames refused (too long, DMA start error) or lost on the line are counted in duplexDropped
+ */
+
+// Includes
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "protocol.h"
+#include "duplex.h"
+
+//------------------------------------------------------------------------
+// Global variables set externally
+//------------------------------------------------------------------------
+extern UART_HandleTypeDef huart3;
+
+//------------------------------------------------------------------------
+// Global variables set here in duplex.c
+//------------------------------------------------------------------------
+uint32_t duplexFrames;                  // [-] Frames sent
+uint32_t duplexCollisions;              // [-] Frames corrupted on the line (echo mismatch or missing)
+uint32_t duplexReplaced;                // [-] Queued frames replaced by a newer one before their transmission
+uint32_t duplexDropped;                 // [-] Frames refused or lost, collisions included
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define DUPLEX_TX_MAX   sizeof(SerialFromEscToDisplay)     // [bytes] Largest frame sent to the display
+
+#define DUPLEX_NB_BUF   (DUPLEX_NB_PRIO + 1)
+#define DUPLEX_NONE     0xFF
+
+static uint8_t txBuf[DUPLEX_NB_BUF][DUPLEX_TX_MAX];
+static uint16_t txLen[DUPLEX_NB_BUF];   // [bytes]
+static volatile uint8_t activeBuf = DUPLEX_NONE;   // [-] Buffer in transmission (read back until the IDLE event in half-duplex)
+static volatile uint8_t pendingBuf[DUPLEX_NB_PRIO];    // [-] Queued buffer per priority, DUPLEX_NONE = none
+static volatile uint16_t echoLen;       // [bytes] Frame in transmission length, 0 = none
+static volatile uint16_t echoPos;       // [bytes] Bytes of the frame read back
+static volatile uint8_t slotOpen;       // [-] Valid frame received, reply allowed at the next IDLE
+
+/* =========================== Local Functions =========================== */
+
+/*
+ * Buffer neither queued nor in transmission, with the interrupts disabled
+ */
+static uint8_t duplex_freeBuf(void) {
+	uint8_t b, p;
+
+	for (b = 0; b < DUPLEX_NB_BUF; b++) {
+		for (p = 0; p < DUPLEX_NB_PRIO && pendingBuf[p] != b; p++);
+		if (b != activeBuf && p == DUPLEX_NB_PRIO) {
+			break;
+		}
+	}
+	return b;
+}
+
+/*
+ * Start the transmission of the highest priority queued frame, from an interrupt or with the interrupts disabled
+ * Output: 1 if a transmission has been started
+ */
+static uint8_t duplex_start(void) {
+	uint8_t p, b;
+
+	if (activeBuf != DUPLEX_NONE || huart3.gState != HAL_UART_STATE_READY) {
+		return 0;
+	}
+	for (p = 0; p < DUPLEX_NB_PRIO && pendingBuf[p] == DUPLEX_NONE; p++);
+	if (p == DUPLEX_NB_PRIO) {
+		return 0;
+	}
+	b = pendingBuf[p];
+	pendingBuf[p] = DUPLEX_NONE;
+	if (HAL_UART_Transmit_DMA(&huart3, txBuf[b], txLen[b]) != HAL_OK) {
+		duplexDropped++;
+		return 0;
+	}
+	activeBuf = b;
+	echoPos = 0;
+	echoLen = txLen[b];
+	duplexFrames++;
+	return 1;
+}
+
+/* =========================== Initialization Functions =========================== */
+
+void duplex_init(void) {
+#ifdef HALF_DUPLEX_ENABLE
+	GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+	__HAL_UART_DISABLE(&huart3);
+	CLEAR_BIT(huart3.Instance->CR2, (USART_CR2_LINEN | USART_CR2_CLKEN));
+	CLEAR_BIT(huart3.Instance->CR3, (USART_CR3_IREN | USART_CR3_SCEN));
+	SET_BIT(huart3.Instance->CR3, USART_CR3_HDSEL);    // TX and RX on PB10, the receiver reads the echo
+	__HAL_UART_ENABLE(&huart3);
+
+	GPIO_InitStruct.Pin = GPIO_PIN_10;                 // Open drain: the line is released between the frames
+	GPIO_InitStruct.Mode = GPIO_MODE_AF_OD;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+#endif
+	memset((uint8_t*) pendingBuf, DUPLEX_NONE, sizeof(pendingBuf));
+	activeBuf = DUPLEX_NONE;
+	echoLen = 0;
+	echoPos = 0;
+	slotOpen = 0;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Frame to the display (main loop only): copied and queued with its priority, replacing a queued frame
+ * of the same priority. Full-duplex: sent at once on an idle link. Half-duplex: sent in the next reply slot.
+ * Output: 1 if the frame is queued or sent
+ */
+uint8_t duplex_send(const uint8_t *data, uint16_t len, uint8_t prio) {
+	uint8_t b;
+
+	if (len > DUPLEX_TX_MAX || prio >= DUPLEX_NB_PRIO) {
+		duplexDropped++;
+		return 0;
+	}
+	__disable_irq();
+	if (prio == DUPLEX_PRIO_FAULT && pendingBuf[DUPLEX_PRIO_PERIODIC] != DUPLEX_NONE) {
+		pendingBuf[DUPLEX_PRIO_PERIODIC] = DUPLEX_NONE;    // older state than the fault frame
+		duplexReplaced++;
+	}
+	b = pendingBuf[prio];
+	if (b != DUPLEX_NONE) {
+		pendingBuf[prio] = DUPLEX_NONE; // the transmission cannot take the buffer while it is filled
+		duplexReplaced++;
+	} else {
+		b = duplex_freeBuf();
+	}
+	__enable_irq();
+
+	memcpy(txBuf[b], data, len);
+	txLen[b] = len;
+	pendingBuf[prio] = b;
+
+#ifndef HALF_DUPLEX_ENABLE
+	__disable_irq();
+	duplex_start();                     // idle link, else chained by duplex_txCplt
+	__enable_irq();
+#endif
+	return 1;
+}
+
+/*
+ * Output: 1 if a frame of this priority is queued and not yet in transmission
+ */
+uint8_t duplex_pending(uint8_t prio) {
+	return pendingBuf[prio] != DUPLEX_NONE;
+}
+
+/*
+ * Output: 1 when nothing is queued or in transmission, the last stop bit included
+ */
+uint8_t duplex_txDone(void) {
+	uint8_t p;
+
+	for (p = 0; p < DUPLEX_NB_PRIO; p++) {
+		if (pendingBuf[p] != DUPLEX_NONE) {
+			return 0;
+		}
+	}
+	return huart3.gState == HAL_UART_STATE_READY && __HAL_UART_GET_FLAG(&huart3, UART_FLAG_TC);
+}
+
+/*
+ * Transmission complete (USART interrupt): full-duplex, the next queued frame follows at once.
+ * Half-duplex, the buffer is released at the IDLE event, once the echo has been read back.
+ */
+void duplex_txCplt(void) {
+#ifndef HALF_DUPLEX_ENABLE
+	activeBuf = DUPLEX_NONE;
+	echoLen = 0;
+	duplex_start();
+#endif
+}
+
+/*
+ * Received byte (USART interrupt), before the parser
+ * Output: 1 if the byte is the echo of the transmission and must not be parsed
+ */
+uint8_t duplex_echo(uint8_t byte) {
+	if (echoPos >= echoLen) {
+		return 0;
+	}
+	if (byte != txBuf[activeBuf][echoPos]) {    // bus collision
+		HAL_UART_AbortTransmit(&huart3);
+		duplexCollisions++;
+		duplexDropped++;
+		activeBuf = DUPLEX_NONE;
+		echoLen = 0;
+		echoPos = 0;
+		return 1;                           // garbled byte
+	}
+	echoPos++;
+	return 1;
+}
+
+/*
+ * Valid frame received from the display (USART interrupt): the reply slot opens at the next IDLE event
+ */
+void duplex_frameRx(void) {
+	slotOpen = 1;
+}
+
+/*
+ * IDLE line event (USART interrupt), after the received bytes have been processed
+ */
+void duplex_idle(void) {
+	if (echoLen) {
+		if (huart3.gState != HAL_UART_STATE_READY) {
+			return;                         // gap within the own transmission
+		}
+		if (echoPos < echoLen) {            // bytes lost on the line
+			duplexCollisions++;
+			duplexDropped++;
+		}
+		activeBuf = DUPLEX_NONE;
+		echoLen = 0;
+		echoPos = 0;
+	}
+	if (!slotOpen) {
+		return;
+	}
+	slotOpen = 0;
+	duplex_start();
+}
+
@@ -53,6 +53,19 @@ uint16_t DataVar = 0;
 /* Virtual address defined by the user: 0xFFFF value is prohibited */
 extern uint16_t VirtAddVarTab[NB_OF_VAR];
 
+/* RAM index of the VirtAddVarTab variables, valid when EE_FreeAddress is not 0:
+   - EE_Hash: open addressing table of the virtual addresses, VirtAddVarTab index + 1, 0 = empty
+   - EE_Value / EE_State: latest value of each variable, stored in flash or pending in a batch
+   - EE_FreeAddress: first erased slot of the valid page, the next write goes there */
+#define EE_STORED             ((uint8_t)0x01)        /* Variable has a value */
+#define EE_DIRTY              ((uint8_t)0x02)        /* Value not programmed yet */
+#define EE_NONE               ((uint16_t)0xFFFF)     /* Not indexed */
+static uint8_t EE_Hash[EE_INDEX_SIZE];
+static uint16_t EE_Value[NB_OF_VAR];
+static uint8_t EE_State[NB_OF_VAR];
+static uint32_t EE_FreeAddress = 0;
+static uint8_t EE_Batch = 0;
+
 /* Private function prototypes -----------------------------------------------*/
 /* Private functions ---------------------------------------------------------*/
 static HAL_StatusTypeDef EE_Format(void);
@@ -60,15 +73,44 @@ static uint16_t EE_FindValidPage(uint8_t Operation);
 static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress, uint16_t Data);
 static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data);
 static uint16_t EE_VerifyPageFullyErased(uint32_t Address);
+static uint16_t EE_RestorePages(void);
+static uint16_t EE_IndexFind(uint16_t VirtAddress);
+static void EE_IndexBuild(void);
+static uint16_t EE_Commit(void);
+static uint16_t EE_PageTransferIndex(void);
 
 /**
   * @brief  Restore the pages to a known good state in case of page's status
-  *   corruption after a power loss.
+  *   corruption after a power loss, then build the RAM index of the variables
+  *   with a single scan of the valid page. VirtAddVarTab must be filled before.
   * @param  None.
   * @retval - Flash error code: on write Flash error
   *         - FLASH_COMPLETE: on success
   */
 uint16_t EE_Init(void)
+{
+  uint16_t status;
+
+  /* The repair reads and writes the pages directly */
+  EE_FreeAddress = 0;
+  EE_Batch = 0;
+
+  status = EE_RestorePages();
+  if (status == HAL_OK)
+  {
+    EE_IndexBuild();
+  }
+  return status;
+}
+
+/**
+  * @brief  Restore the pages to a known good state in case of page's status
+  *   corruption after a power loss.
+  * @param  None.
+  * @retval - Flash error code: on write Flash error
+  *         - FLASH_COMPLETE: on success
+  */
+static uint16_t EE_RestorePages(void)
 {
   uint16_t pagestatus0 = 6, pagestatus1 = 6;
   uint16_t varidx = 0;
@@ -325,9 +367,10 @@ uint16_t EE_VerifyPageFullyErased(uint32_t Address)
 {
   uint32_t readstatus = 1;
   uint16_t addressvalue = 0x5555;
+  uint32_t endaddress = Address + (PAGE_SIZE - 1);
 
   /* Check each active page address starting from end */
-  while (Address <= PAGE0_END_ADDRESS)
+  while (Address <= endaddress)
   {
     /* Get the current location content to be compared with virtual address */
     addressvalue = (*(__IO uint16_t*)Address);
@@ -364,6 +407,18 @@ uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data)
   uint16_t validpage = PAGE0;
   uint16_t addressvalue = 0x5555, readstatus = 1;
   uint32_t address = EEPROM_START_ADDRESS, PageStartAddress = EEPROM_START_ADDRESS;
+  uint16_t varidx = EE_IndexFind(VirtAddress);
+
+  /* Indexed variable: latest value from RAM */
+  if (varidx != EE_NONE)
+  {
+    if (!(EE_State[varidx] & EE_STORED))
+    {
+      return 1;
+    }
+    *Data = EE_Value[varidx];
+    return 0;
+  }
 
   /* Get active Page for read operation */
   validpage = EE_FindValidPage(READ_FROM_VALID_PAGE);
@@ -410,6 +465,8 @@ uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data)
 
 /**
   * @brief  Writes/upadtes variable data in EEPROM.
+  *   An indexed variable is only programmed if its value changed, and only at
+  *   EE_BatchEnd() inside a batch.
   * @param  VirtAddress: Variable virtual address
   * @param  Data: 16 bit data to be written
   * @retval Success or error status:
@@ -421,6 +478,18 @@ uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data)
 uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data)
 {
   uint16_t Status = 0;
+  uint16_t varidx = EE_IndexFind(VirtAddress);
+
+  if (varidx != EE_NONE)
+  {
+    if ((EE_State[varidx] & EE_STORED) && EE_Value[varidx] == Data)
+    {
+      return HAL_OK;            /* Unchanged */
+    }
+    EE_Value[varidx] = Data;
+    EE_State[varidx] = EE_STORED | EE_DIRTY;
+    return EE_Batch ? HAL_OK : EE_Commit();
+  }
 
   /* Write the variable virtual address and value in the EEPROM */
   Status = EE_VerifyPageFullWriteVariable(VirtAddress, Data);
@@ -432,10 +501,45 @@ uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data)
     Status = EE_PageTransfer(VirtAddress, Data);
   }
 
+  /* Not indexed: the valid page changed under the index, scan it again */
+  if (EE_FreeAddress != 0)
+  {
+    EE_IndexBuild();
+  }
+
   /* Return last operation status */
   return Status;
 }
 
+/**
+  * @brief  Start a batch: the following EE_WriteVariable calls of indexed
+  *   variables are programmed together by EE_BatchEnd.
+  *   A batch is not atomic: each changed variable is still one word programmed
+  *   on its own, and a power loss during EE_BatchEnd leaves the variables
+  *   programmed before it with their new value and the others with their old
+  *   value. The batch only saves the page full check and the page transfer of
+  *   each write. A caller that needs a consistent set writes a marker variable
+  *   after EE_BatchEnd and checks it before reading the set (see param_save).
+  * @param  None
+  * @retval None
+  */
+void EE_BatchBegin(void)
+{
+  EE_Batch = 1;
+}
+
+/**
+  * @brief  Program the variables changed since EE_BatchBegin, in one pass over
+  *   the free slots of the valid page, or with one page transfer if they do not fit.
+  * @param  None
+  * @retval Success or error status, as EE_WriteVariable
+  */
+uint16_t EE_BatchEnd(void)
+{
+  EE_Batch = 0;
+  return EE_Commit();
+}
+
 /**
   * @brief  Erases PAGE and PAGE1 and writes VALID_PAGE header to PAGE
   * @param  None
@@ -723,6 +827,237 @@ static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data)
   return flashstatus;
 }
 
+/**
+  * @brief  Index of a variable in VirtAddVarTab from its virtual address, O(1)
+  * @param  VirtAddress: 16 bit virtual address of the variable
+  * @retval VirtAddVarTab index, EE_NONE if not indexed or no index
+  */
+static uint16_t EE_IndexFind(uint16_t VirtAddress)
+{
+  uint16_t slot = (uint16_t)(VirtAddress * 40503U) >> 10;   /* Fibonacci hashing, 6 bits */
+  uint16_t probe, varidx;
+
+  if (EE_FreeAddress == 0)
+  {
+    return EE_NONE;
+  }
+  for (probe = 0; probe < EE_INDEX_SIZE; probe++)
+  {
+    varidx = EE_Hash[(slot + probe) & (EE_INDEX_SIZE - 1)];
+    if (varidx == 0)
+    {
+      return EE_NONE;
+    }
+    if (VirtAddVarTab[varidx - 1] == VirtAddress)
+    {
+      return varidx - 1;
+    }
+  }
+  return EE_NONE;
+}
+
+/**
+  * @brief  Build the RAM index: hash the VirtAddVarTab entries, then scan the
+  *   valid page once from its start, the last record of a variable is its value.
+  *   The scan stops at the first erased slot, as the writes fill the page in order.
+  * @param  None
+  * @retval None
+  */
+static void EE_IndexBuild(void)
+{
+  uint16_t validpage, varidx, slot;
+  uint32_t address, pageendaddress, record;
+
+  EE_FreeAddress = 0;
+  for (slot = 0; slot < EE_INDEX_SIZE; slot++)
+  {
+    EE_Hash[slot] = 0;
+  }
+
+  validpage = EE_FindValidPage(READ_FROM_VALID_PAGE);
+  if (validpage == NO_VALID_PAGE)
+  {
+    return;
+  }
+  address = (uint32_t)(EEPROM_START_ADDRESS + (uint32_t)(validpage * PAGE_SIZE));
+  pageendaddress = address + PAGE_SIZE;
+
+  /* EE_IndexFind is active once EE_FreeAddress is set */
+  EE_FreeAddress = address;
+  for (varidx = 0; varidx < NB_OF_VAR; varidx++)
+  {
+    EE_State[varidx] = 0;
+    if (VirtAddVarTab[varidx] == ERASED || EE_IndexFind(VirtAddVarTab[varidx]) != EE_NONE)
+    {
+      continue;                 /* Prohibited or duplicate virtual address */
+    }
+    slot = (uint16_t)(VirtAddVarTab[varidx] * 40503U) >> 10;
+    while (EE_Hash[slot] != 0)
+    {
+      slot = (slot + 1) & (EE_INDEX_SIZE - 1);
+    }
+    EE_Hash[slot] = varidx + 1;
+  }
+
+  /* Records after the page header: value, then virtual address */
+  for (address += 4; address < pageendaddress; address += 4)
+  {
+    record = (*(__IO uint32_t*)address);
+    if (record == 0xFFFFFFFF)
+    {
+      break;
+    }
+    varidx = EE_IndexFind((uint16_t)(record >> 16));
+    if (varidx != EE_NONE)
+    {
+      EE_Value[varidx] = (uint16_t)record;
+      EE_State[varidx] = EE_STORED;
+    }
+  }
+  EE_FreeAddress = address;
+}
+
+/**
+  * @brief  Program the changed indexed variables in the free slots of the valid
+  *   page, each as one word (value, then virtual address), or transfer the page.
+  * @param  None
+  * @retval Success or error status, as EE_WriteVariable
+  */
+static uint16_t EE_Commit(void)
+{
+  HAL_StatusTypeDef flashstatus = HAL_OK;
+  uint32_t pageendaddress;
+  uint16_t varidx, dirty = 0;
+
+  if (EE_FreeAddress == 0)
+  {
+    return NO_VALID_PAGE;
+  }
+  for (varidx = 0; varidx < NB_OF_VAR; varidx++)
+  {
+    if (EE_State[varidx] & EE_DIRTY)
+    {
+      dirty++;
+    }
+  }
+  if (dirty == 0)
+  {
+    return HAL_OK;
+  }
+
+  /* End of the valid page, EE_FreeAddress is inside it */
+  pageendaddress = EEPROM_START_ADDRESS + ((EE_FreeAddress - 1 - EEPROM_START_ADDRESS) / PAGE_SIZE + 1) * PAGE_SIZE;
+  if (EE_FreeAddress + 4 * (uint32_t)dirty > pageendaddress)
+  {
+    flashstatus = EE_PageTransferIndex();
+    if (flashstatus != HAL_OK)
+    {
+      EE_FreeAddress = 0;       /* Pages left to EE_Init, back to the flash scans */
+    }
+    return flashstatus;
+  }
+
+  for (varidx = 0; varidx < NB_OF_VAR; varidx++)
+  {
+    if (EE_State[varidx] & EE_DIRTY)
+    {
+      flashstatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, EE_FreeAddress,
+                                      EE_Value[varidx] | ((uint32_t)VirtAddVarTab[varidx] << 16));
+      /* A failed slot is not erased any more: skip it, the variable stays dirty */
+      EE_FreeAddress += 4;
+      if (flashstatus != HAL_OK)
+      {
+        return flashstatus;
+      }
+      EE_State[varidx] = EE_STORED;
+    }
+  }
+  return HAL_OK;
+}
+
+/**
+  * @brief  Transfer the indexed variables from RAM to the erased page, with the
+  *   page status sequence of EE_PageTransfer. The unchanged variables are written
+  *   first: after a power loss before the erase, EE_Init restores the previous values.
+  * @param  None
+  * @retval Success or error status, as EE_WriteVariable
+  */
+static uint16_t EE_PageTransferIndex(void)
+{
+  HAL_StatusTypeDef flashstatus = HAL_OK;
+  uint32_t newpageaddress, address, oldpageid;
+  uint32_t page_error = 0;
+  FLASH_EraseInitTypeDef s_eraseinit;
+  uint16_t validpage, varidx;
+  uint8_t pass;
+
+  validpage = EE_FindValidPage(READ_FROM_VALID_PAGE);
+  if (validpage == PAGE1)
+  {
+    newpageaddress = PAGE0_BASE_ADDRESS;
+    oldpageid = PAGE1_ID;
+  }
+  else if (validpage == PAGE0)
+  {
+    newpageaddress = PAGE1_BASE_ADDRESS;
+    oldpageid = PAGE0_ID;
+  }
+  else
+  {
+    return NO_VALID_PAGE;
+  }
+
+  /* Set the new Page status to RECEIVE_DATA status */
+  flashstatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, newpageaddress, RECEIVE_DATA);
+  if (flashstatus != HAL_OK)
+  {
+    return flashstatus;
+  }
+
+  /* Pass 0: unchanged variables, pass 1: changed ones */
+  address = newpageaddress + 4;
+  for (pass = 0; pass < 2; pass++)
+  {
+    for (varidx = 0; varidx < NB_OF_VAR; varidx++)
+    {
+      if ((EE_State[varidx] & EE_STORED) && ((EE_State[varidx] & EE_DIRTY) ? 1 : 0) == pass)
+      {
+        flashstatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address,
+                                        EE_Value[varidx] | ((uint32_t)VirtAddVarTab[varidx] << 16));
+        if (flashstatus != HAL_OK)
+        {
+          return flashstatus;
+        }
+        address += 4;
+      }
+    }
+  }
+
+  /* Erase the old Page: Set old Page status to ERASED status */
+  s_eraseinit.TypeErase   = FLASH_TYPEERASE_PAGES;
+  s_eraseinit.PageAddress = oldpageid;
+  s_eraseinit.NbPages     = 1;
+  flashstatus = HAL_FLASHEx_Erase(&s_eraseinit, &page_error);
+  if (flashstatus != HAL_OK)
+  {
+    return flashstatus;
+  }
+
+  /* Set new Page status to VALID_PAGE status */
+  flashstatus = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, newpageaddress, VALID_PAGE);
+  if (flashstatus != HAL_OK)
+  {
+    return flashstatus;
+  }
+
+  for (varidx = 0; varidx < NB_OF_VAR; varidx++)
+  {
+    EE_State[varidx] &= (uint8_t)~EE_DIRTY;
+  }
+  EE_FreeAddress = address;
+  return HAL_OK;
+}
+
 /**
   * @}
   */
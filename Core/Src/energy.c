@@ -0,0 +1,153 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Energy, charge and distance accounting.
+ * The FOC interrupt integrates the DC current and the battery power on every PWM period in 64-bit accumulators,
+ * so no sample is lost between two telemetry frames. The battery current is the estimate of the FOC interrupt
+ * (phase current times the modulation, see bldc.c): positive = drive, negative = regen.
+ * The distance is counted from the hall transitions: 6 transitions per electrical revolution.
+ * The conversion to physical units is done in the main loop (energy_update).
+ *
+ * Lifetime counters = lifetime base (given at init, e.g. from the flash) + current trip.
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "BLDC_controller.h"
+#include "energy.h"
+
+//------------------------------------------------------------------------
+// Global variables set here in energy.c
+//------------------------------------------------------------------------
+energyReport_t energyTrip;
+energyReport_t energyLifetime;
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+extern P rtP_Left;
+
+#define ENERGY_PERIODS_PER_HOUR     ((uint64_t) PWM_FREQ * 3600U)
+
+static energyAcc_t tripAcc;             // written by the FOC interrupt
+static energyAcc_t lifeBase;            // lifetime counters before the current trip
+static uint8_t hallPrev = 0xFF;         // [-] 0xFF = no hall code yet
+
+/* =========================== Local Functions =========================== */
+
+static void energy_add(energyAcc_t *dst, const energyAcc_t *src) {
+	dst->driveCharge += src->driveCharge;
+	dst->regenCharge += src->regenCharge;
+	dst->driveEnergy += src->driveEnergy;
+	dst->regenEnergy += src->regenEnergy;
+	dst->hallCnt += src->hallCnt;
+}
+
+static void energy_convert(const energyAcc_t *acc, energyReport_t *report) {
+	report->driveMah = (uint32_t) (acc->driveCharge / ENERGY_PERIODS_PER_HOUR);
+	report->regenMah = (uint32_t) (acc->regenCharge / ENERGY_PERIODS_PER_HOUR);
+	report->driveMwh = (uint32_t) ((acc->driveEnergy / ENERGY_PERIODS_PER_HOUR) * BAT_CALIB_REAL_VOLTAGE
+			/ (BAT_CALIB_ADC * 100U));
+	report->regenMwh = (uint32_t) ((acc->regenEnergy / ENERGY_PERIODS_PER_HOUR) * BAT_CALIB_REAL_VOLTAGE
+			/ (BAT_CALIB_ADC * 100U));
+	report->distance = (uint32_t) (((uint64_t) acc->hallCnt * WHEEL_CIRCUMFERENCE)
+			/ (6U * rtP_Left.n_polePairs * 1000U));
+}
+
+static void energy_snapshot(energyAcc_t *acc) {
+	__disable_irq();                    // 64-bit accumulators are not written atomically by the FOC interrupt
+	*acc = tripAcc;
+	__enable_irq();
+}
+
+/* =========================== Initialization Functions =========================== */
+
+/*
+ * Input: lifetimeBase = lifetime counters restored from storage, NULL to start from 0
+ */
+void energy_init(const energyAcc_t *lifetimeBase) {
+	if (lifetimeBase != NULL) {
+		lifeBase = *lifetimeBase;
+	}
+	energy_update();
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * To be called by the FOC interrupt on every PWM period
+ * Input: currBat = battery current [mA] (< 0 in regen), vbat [ADC count], hall = hall sensors code
+ */
+void energy_step(int32_t currBat, int16_t vbat, uint8_t hall) {
+	uint32_t charge = (uint32_t) ABS(currBat);
+	uint32_t energy = charge * (uint32_t) vbat;
+
+	if (currBat >= 0) {
+		tripAcc.driveCharge += charge;
+		tripAcc.driveEnergy += energy;
+	} else {
+		tripAcc.regenCharge += charge;
+		tripAcc.regenEnergy += energy;
+	}
+
+	if (hall != hallPrev) {
+		if (hallPrev != 0xFF) {
+			tripAcc.hallCnt++;
+		}
+		hallPrev = hall;
+	}
+}
+
+/*
+ * Refresh energyTrip and energyLifetime (main loop)
+ */
+void energy_update(void) {
+	energyAcc_t acc;
+
+	energy_snapshot(&acc);
+	energy_convert(&acc, &energyTrip);
+	energy_add(&acc, &lifeBase);
+	energy_convert(&acc, &energyLifetime);
+}
+
+/*
+ * Start a new trip: the trip counters are moved to the lifetime base
+ */
+void energy_resetTrip(void) {
+	energyAcc_t acc;
+
+	__disable_irq();
+	acc = tripAcc;
+	tripAcc.driveCharge = tripAcc.regenCharge = 0;
+	tripAcc.driveEnergy = tripAcc.regenEnergy = 0;
+	tripAcc.hallCnt = 0;
+	__enable_irq();
+	energy_add(&lifeBase, &acc);
+	energy_update();
+}
+
+/*
+ * Raw lifetime accumulators, e.g. to be saved in the flash
+ */
+void energy_getLifetime(energyAcc_t *acc) {
+	energy_snapshot(acc);
+	energy_add(acc, &lifeBase);
+}
+
@@ -0,0 +1,344 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Event log: the fault and timeout transitions with the uptime, odometer, speed, current, voltage and board
+ * temperature, in a ring of two flash pages from EVENTLOG_PAGE_FIRST. The error code otherwise only lives in
+ * errCodeLeft until the poweroff.
+ *
+ * - eventlog_update (main loop task) compares rtY_Motor.z_errCode, timeoutFlagSerial and timeoutFlagADC with
+ *   their previous values and stages an entry per change in RAM, with the values of the moment
+ * - the staged entries are written one per call, only below EVENTLOG_FLUSH_SPEED: programming a half-word stalls
+ *   the CPU, the FOC interrupt included, for about 50 us, and a page erase for about 20 ms. poweroff() flushes
+ *   the stage before releasing the power latch
+ * - flash: entries of 12 half-words written in order, the check last: a cut write fails the check and is
+ *   skipped. When the page in use is full, the other page is erased and used: the oldest entries are lost
+ * - the display reads the entries by index (0 = oldest) and clears the log with SERIAL_TYPE_LOG frames, handled
+ *   like the parameter requests: copied by the USART interrupt, answered from eventlog_update
+ */
+
+// Includes
+#include <stddef.h>
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "BLDC_controller.h"
+#include "energy.h"
+#include "duplex.h"
+#include "eventlog.h"
+
+//------------------------------------------------------------------------
+// Global variables set externally
+//------------------------------------------------------------------------
+extern ExtY rtY_Motor;
+extern int16_t batVoltage;
+extern int16_t board_temp_deg_c;
+extern int16_t speedAvg;
+extern int16_t speedAvgAbs;
+extern uint8_t timeoutFlagSerial;
+extern uint8_t timeoutFlagADC;
+
+//------------------------------------------------------------------------
+// Global variables set here in eventlog.c
+//------------------------------------------------------------------------
+uint16_t eventlogCount;                 // [-] Entries in flash
+uint32_t eventlogDropped;               // [-] Events lost with the RAM stage full
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define EVENTLOG_BASE           (FLASH_BASE + EVENTLOG_PAGE_FIRST * FLASH_PAGE_SIZE)
+#define EVENTLOG_SLOTS          (FLASH_PAGE_SIZE / sizeof(eventlogEntry_t))    // [-] Entries per page
+#define EVENTLOG_SLOT(page, slot) \
+	((const eventlogEntry_t*) (EVENTLOG_BASE + (uint32_t) (page) * FLASH_PAGE_SIZE + (slot) * sizeof(eventlogEntry_t)))
+#define EVENTLOG_FREE           0xFFFFFFFF  // seq of an erased slot
+
+_Static_assert(sizeof(eventlogEntry_t) == 24, "eventlogEntry_t must be packed, 12 half-words");
+
+static eventlogEntry_t stage[EVENTLOG_STAGE];   // Entries waiting for the flash write
+static uint8_t stageHead;
+static uint8_t stageLen;
+
+static uint8_t logPage;                 // Page written
+static uint16_t logSlot;                // Next slot of logPage, EVENTLOG_SLOTS when full
+static uint32_t logSeq;                 // seq of the next entry
+
+static uint8_t lastErrCode;
+static uint8_t lastTimeoutSerial;
+static uint8_t lastTimeoutADC;
+
+static SerialLogFromDisplayToEsc req;
+static volatile uint8_t reqValid;       // [-] Request copied by the USART interrupt
+static SerialLogFromEscToDisplay reply;
+
+/* =========================== Local Functions =========================== */
+
+static uint16_t eventlog_crc(const void *data, uint16_t len) {
+	const uint8_t *p = (const uint8_t*) data;
+	uint16_t crc = 0xFFFF;
+	uint8_t bit;
+
+	while (len--) {
+		crc ^= (uint16_t) *p++ << 8;
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static uint8_t eventlog_valid(const eventlogEntry_t *e) {
+	return e->seq != EVENTLOG_FREE && e->check == eventlog_crc(e, offsetof(eventlogEntry_t, check));
+}
+
+/*
+ * Page written, next slot, next seq and entry count from the flash content
+ */
+static void eventlog_scan(void) {
+	uint32_t newest[2] = { 0, 0 };
+	uint16_t used[2], slot;
+	uint8_t page, found[2] = { 0, 0 };
+	const eventlogEntry_t *e;
+
+	eventlogCount = 0;
+	for (page = 0; page < 2; page++) {
+		for (slot = 0; slot < EVENTLOG_SLOTS && (e = EVENTLOG_SLOT(page, slot))->seq != EVENTLOG_FREE; slot++) {
+			if (eventlog_valid(e)) {
+				eventlogCount++;
+				if (!found[page] || e->seq > newest[page]) {
+					newest[page] = e->seq;
+				}
+				found[page] = 1;
+			}
+		}
+		used[page] = slot;
+	}
+	logPage = (found[1] && (!found[0] || newest[1] > newest[0])) ? 1 : 0;
+	logSlot = used[logPage];
+	if (found[logPage] && newest[logPage] + 1 > logSeq) {
+		logSeq = newest[logPage] + 1;
+	}
+}
+
+static uint8_t eventlog_erase(uint8_t page) {
+	FLASH_EraseInitTypeDef erase;
+	uint32_t error;
+
+	erase.TypeErase = FLASH_TYPEERASE_PAGES;
+	erase.Banks = FLASH_BANK_1;
+	erase.PageAddress = (uint32_t) EVENTLOG_SLOT(page, 0);
+	erase.NbPages = 1;
+	return (HAL_FLASHEx_Erase(&erase, &error) == HAL_OK) ? EVENTLOG_OK : EVENTLOG_ERR_FLASH;
+}
+
+/*
+ * Write the oldest staged entry, erasing the other page first if the page written is full
+ */
+static void eventlog_write(void) {
+	eventlogEntry_t *e = &stage[stageHead];
+	const uint16_t *hw = (const uint16_t*) e;
+	uint32_t addr;
+	uint8_t i, status = EVENTLOG_OK;
+
+	HAL_FLASH_Unlock();
+	if (logSlot == EVENTLOG_SLOTS) {
+		status = eventlog_erase(logPage ^ 1);
+		eventlog_scan();                // entries of the erased page gone, written page unchanged if the erase failed
+		if (status == EVENTLOG_OK) {
+			logPage ^= 1;
+			logSlot = 0;
+		}
+	}
+	if (status == EVENTLOG_OK) {
+		e->seq = logSeq++;
+		e->check = eventlog_crc(e, offsetof(eventlogEntry_t, check));
+		addr = (uint32_t) EVENTLOG_SLOT(logPage, logSlot++);
+		for (i = 0; i < sizeof(*e) / 2 && status == EVENTLOG_OK; i++) {
+			status = (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, addr + 2 * i, hw[i]) == HAL_OK) ? EVENTLOG_OK : EVENTLOG_ERR_FLASH;
+		}
+		eventlogCount += (status == EVENTLOG_OK);
+	}
+	HAL_FLASH_Lock();
+
+	if (status != EVENTLOG_OK) {
+		eventlogDropped++;              // not retried: a flash error would block the stage
+	}
+	stageHead = (stageHead + 1) % EVENTLOG_STAGE;
+	stageLen--;
+}
+
+static void eventlog_stage(uint8_t event, uint8_t code) {
+	eventlogEntry_t *e;
+
+	if (stageLen == EVENTLOG_STAGE) {
+		eventlogDropped++;
+		return;
+	}
+	e = &stage[(stageHead + stageLen) % EVENTLOG_STAGE];
+	e->uptime = HAL_GetTick();
+#ifdef ENERGY_ACCOUNTING_ENABLE
+	energy_update();
+	e->odometer = energyLifetime.distance;
+#else
+	e->odometer = 0;
+#endif
+	e->event = event;
+	e->code = code;
+	e->speed = speedAvg;
+	e->current = (int16_t) analog.curr_dc;
+	e->voltage = (uint16_t) (batVoltage * BAT_CALIB_REAL_VOLTAGE / BAT_CALIB_ADC);
+	e->temperature = board_temp_deg_c;
+	stageLen++;
+}
+
+static uint8_t eventlog_clear(void) {
+	uint8_t status;
+
+	HAL_FLASH_Unlock();
+	status = eventlog_erase(0);
+	if (status == EVENTLOG_OK) {
+		status = eventlog_erase(1);
+	}
+	HAL_FLASH_Lock();
+	eventlog_scan();                    // seq goes on after a clear
+	return status;
+}
+
+/*
+ * Check and execute the request, fill the reply
+ */
+static void eventlog_process(const SerialLogFromDisplayToEsc *r) {
+	eventlogEntry_t e;
+	uint8_t status;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.Frame_start = SERIAL_START_FRAME_ESC_TO_DISPLAY;
+	reply.Type = SERIAL_TYPE_LOG;
+	reply.Cmd = r->Cmd;
+	reply.Index[0] = r->Index[0];
+	reply.Index[1] = r->Index[1];
+
+	switch (r->Cmd) {
+	case EVENTLOG_CMD_READ:
+		status = eventlog_read(protocol_get16(r->Index), &e);
+		if (status == EVENTLOG_OK) {
+			protocol_put32(reply.Seq, e.seq);
+			protocol_put32(reply.Uptime, e.uptime);
+			protocol_put32(reply.Odometer, e.odometer);
+			reply.Event = e.event;
+			reply.Code = e.code;
+			protocol_put16(reply.Speed, (uint16_t) e.speed);
+			protocol_put16(reply.Current, (uint16_t) e.current);
+			protocol_put16(reply.Voltage, e.voltage);
+			protocol_put16(reply.Temperature, (uint16_t) e.temperature);
+		}
+		break;
+	case EVENTLOG_CMD_CLEAR:
+		status = (speedAvgAbs > EVENTLOG_FLUSH_SPEED) ? EVENTLOG_ERR_LOCKED : eventlog_clear();
+		break;
+	default:
+		status = EVENTLOG_ERR_UNKNOWN;
+		break;
+	}
+
+	protocol_put16(reply.Count, eventlogCount);
+	reply.Status = status;
+	protocol_seal(&reply, sizeof(reply));
+}
+
+/* =========================== Initialization Functions =========================== */
+
+void eventlog_init(void) {
+	logSeq = 0;
+	eventlog_scan();
+	stageHead = 0;
+	stageLen = 0;
+	lastErrCode = 0;                    // a fault or timeout present at boot is logged
+	lastTimeoutSerial = 0;
+	lastTimeoutADC = 0;
+	reqValid = 0;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Request received (USART interrupt), answered by eventlog_update. Dropped while one is waiting.
+ */
+void eventlog_request(const SerialLogFromDisplayToEsc *r) {
+	if (!reqValid) {
+		req = *r;
+		reqValid = 1;
+	}
+}
+
+/*
+ * To be called periodically from the main loop: capture, display request, one flash write
+ */
+void eventlog_update(void) {
+	if (rtY_Motor.z_errCode != lastErrCode) {
+		lastErrCode = rtY_Motor.z_errCode;
+		eventlog_stage(EVENTLOG_FAULT, lastErrCode);
+	}
+	if (timeoutFlagSerial != lastTimeoutSerial) {
+		lastTimeoutSerial = timeoutFlagSerial;
+		eventlog_stage(EVENTLOG_TIMEOUT_SERIAL, lastTimeoutSerial);
+	}
+	if (timeoutFlagADC != lastTimeoutADC) {
+		lastTimeoutADC = timeoutFlagADC;
+		eventlog_stage(EVENTLOG_TIMEOUT_ADC, lastTimeoutADC);
+	}
+
+	if (reqValid) {
+		eventlog_process(&req);
+		reqValid = 0;
+		duplex_send((uint8_t*) &reply, sizeof(reply), DUPLEX_PRIO_REPLY);
+	}
+
+	if (stageLen && speedAvgAbs <= EVENTLOG_FLUSH_SPEED) {
+		eventlog_write();
+	}
+}
+
+/*
+ * Write all the staged entries, e.g. before the poweroff
+ */
+void eventlog_flush(void) {
+	while (stageLen) {
+		eventlog_write();
+	}
+}
+
+/*
+ * Entry at index, 0 = oldest
+ */
+uint8_t eventlog_read(uint16_t index, eventlogEntry_t *entry) {
+	const eventlogEntry_t *e;
+	uint16_t slot;
+	uint8_t i, page;
+
+	for (i = 0; i < 2; i++) {
+		page = i ? logPage : logPage ^ 1;
+		for (slot = 0; slot < EVENTLOG_SLOTS && (e = EVENTLOG_SLOT(page, slot))->seq != EVENTLOG_FREE; slot++) {
+			if (eventlog_valid(e) && index-- == 0) {
+				*entry = *e;
+				return EVENTLOG_OK;
+			}
+		}
+	}
+	return EVENTLOG_ERR_UNKNOWN;
+}
@@ -0,0 +1,216 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USART3 display link speed negotiation.
+ *
+ * The link always starts at USART3_BAUD. Handshake, with SERIAL_TYPE_BAUD frames in both directions:
+ *   1. display -> ESC: request with a baud code, at the present rate
+ *   2. ESC -> display: ACK (or NACK for an unsupported code), at the present rate. Once sent, the ESC switches.
+ *   3. display -> ESC: the same request again, at the new rate. This confirms the new rate.
+ *   4. ESC -> display: CONFIRMED, at the new rate
+ * Without confirmation within LINK_CONFIRM_TIMEOUT the ESC falls back to USART3_BAUD, so does the display when
+ * it does not receive CONFIRMED. Once running above USART3_BAUD, the ESC also falls back when more than
+ * LINK_ERROR_MAX receive errors (frame, noise, overrun or check byte) are counted within LINK_ERROR_WINDOW,
+ * or on a serial timeout.
+ *
+ * The requests arrive in the USART interrupt. The state machine runs in the main loop, where the feedback
+ * frames are sent: link_txAllowed() holds them during the switch.
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "protocol.h"
+#include "duplex.h"
+#include "link.h"
+
+//------------------------------------------------------------------------
+// Global variables set externally
+//------------------------------------------------------------------------
+extern UART_HandleTypeDef huart3;
+extern protocolParser_t serialRxParser;
+
+//------------------------------------------------------------------------
+// Global variables set here in link.c
+//------------------------------------------------------------------------
+uint32_t linkBaud = USART3_BAUD;        // [baud] Present USART3 baud rate
+uint32_t linkRxErrors;                  // [-] USART3 receive errors (frame, noise, overrun)
+uint32_t linkFallbackCnt;               // [-] Number of fallbacks to USART3_BAUD
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define LINK_STATUS_NACK        0       // [-] Requested rate not supported, the rate is unchanged
+#define LINK_STATUS_ACK         1       // [-] Switching to the requested rate
+#define LINK_STATUS_CONFIRMED   2       // [-] Running at the requested rate
+
+typedef enum {
+	LINK_IDLE = 0,
+	LINK_REPLY,                         // Reply to send at the present rate
+	LINK_SWITCH,                        // Wait for the end of the reply transmission
+	LINK_TRIAL                          // New rate, waiting for the confirmation
+} linkState_t;
+
+// Rates by baud code. APB1 is 32 MHz: 2 Mbaud is the maximum with 16x oversampling.
+static const uint32_t baudTable[] = { 115200, 230400, 460800, 921600, 1000000, 2000000 };
+
+static linkState_t linkState;
+static volatile uint8_t reqPending;     // [-] Request received by the USART interrupt
+static volatile uint8_t reqCode;        // [-] Requested baud code
+static uint8_t trialCode;               // [-] Baud code on trial
+static uint8_t replyCode;               // [-] Baud code of the reply
+static uint8_t replyStatus;             // [-] LINK_STATUS_xxx
+static uint16_t trialTime;              // [ms] Time spent waiting for the confirmation
+static uint16_t windowTime;             // [ms] Error window time
+static uint32_t windowErrors;           // [-] Total error count at the start of the window
+static SerialBaudFromEscToDisplay reply;
+
+/* =========================== Local Functions =========================== */
+
+static void link_setBaud(uint32_t baud) {
+	__HAL_UART_DISABLE(&huart3);
+	huart3.Init.BaudRate = baud;
+	huart3.Instance->BRR = UART_BRR_SAMPLING16(HAL_RCC_GetPCLK1Freq(), baud);
+	__HAL_UART_ENABLE(&huart3);
+	protocol_parserReset(&serialRxParser);  // drop a frame started at the previous rate
+	linkBaud = baud;
+}
+
+static void link_fallback(void) {
+	if (linkBaud != USART3_BAUD) {
+		link_setBaud(USART3_BAUD);
+		linkFallbackCnt++;
+	}
+	linkState = LINK_IDLE;
+}
+
+static uint8_t link_sendReply(uint8_t code, uint8_t status) {
+	reply.Frame_start = SERIAL_START_FRAME_ESC_TO_DISPLAY;
+	reply.Type = SERIAL_TYPE_BAUD;
+	reply.Baud_code = code;
+	reply.Status = status;
+	protocol_seal(&reply, sizeof(reply));
+	return duplex_send((uint8_t*) &reply, sizeof(reply), DUPLEX_PRIO_REPLY);
+}
+
+/* =========================== Initialization Functions =========================== */
+
+void link_init(void) {
+	link_setBaud(USART3_BAUD);
+	linkState = LINK_IDLE;
+	reqPending = 0;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Baud rate request or confirmation received (USART interrupt)
+ */
+void link_request(uint8_t baudCode) {
+	reqCode = baudCode;
+	reqPending = 1;
+}
+
+/*
+ * Receive error flags, from the USART status register latched in the USART interrupt before the IDLE flag clear
+ * (status then data register read), which also clears them
+ */
+void link_rxStatus(uint32_t sr) {
+	if (sr & (USART_SR_FE | USART_SR_NE | USART_SR_ORE)) {
+		linkRxErrors++;
+	}
+}
+
+/*
+ * To be called on every main loop tick
+ * Input: timeoutFlag = serial timeout flag, crcErrors = check byte errors of the receive parser
+ */
+void link_update(uint8_t timeoutFlag, uint32_t crcErrors) {
+	uint8_t pending, code;
+
+	__disable_irq();
+	pending = reqPending;
+	code = reqCode;
+	reqPending = 0;
+	__enable_irq();
+
+	switch (linkState) {
+	case LINK_IDLE:
+		if (pending) {
+			replyCode = code;
+			if (code < ARRAY_LEN(baudTable) && baudTable[code] <= LINK_BAUD_MAX) {
+				trialCode = code;
+				replyStatus = LINK_STATUS_ACK;
+			} else {
+				replyStatus = LINK_STATUS_NACK;
+			}
+			linkState = LINK_REPLY;
+			break;
+		}
+		if (linkBaud == USART3_BAUD) {
+			break;
+		}
+		if (timeoutFlag) {
+			link_fallback();
+			break;
+		}
+		windowTime += DELAY_IN_MAIN_LOOP;
+		if (linkRxErrors + crcErrors - windowErrors > LINK_ERROR_MAX) {
+			link_fallback();
+		} else if (windowTime >= LINK_ERROR_WINDOW) {
+			windowTime = 0;
+			windowErrors = linkRxErrors + crcErrors;
+		}
+		break;
+
+	case LINK_REPLY:
+		if (link_sendReply(replyCode, replyStatus)) {
+			linkState = (replyStatus == LINK_STATUS_ACK) ? LINK_SWITCH : LINK_IDLE;
+		}
+		break;
+
+	case LINK_SWITCH:
+		if (duplex_txDone()) {                  // reply sent, a queued one included (half-duplex)
+			link_setBaud(baudTable[trialCode]);
+			trialTime = 0;
+			linkState = LINK_TRIAL;
+		}
+		break;
+
+	case LINK_TRIAL:
+	default:
+		if (pending && code == trialCode) {
+			replyStatus = LINK_STATUS_CONFIRMED;
+			windowTime = 0;
+			windowErrors = linkRxErrors + crcErrors;
+			linkState = LINK_REPLY;                 // CONFIRMED at the new rate, then LINK_IDLE
+		} else if ((trialTime += DELAY_IN_MAIN_LOOP) >= LINK_CONFIRM_TIMEOUT) {
+			link_fallback();
+		}
+		break;
+	}
+}
+
+/*
+ * Output: 1 if the feedback frames can be sent
+ */
+uint8_t link_txAllowed(void) {
+	return linkState == LINK_IDLE;
+}
+
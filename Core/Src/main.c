@@ -32,6 +32,23 @@
 #include "bldc.h"
 #include "debug.h"
 #include "ntc.h"
+#include "scheduler.h"
+#include "curve.h"
+#include "cmdpath.h"
+#include "energy.h"
+#include "thermal.h"
+#include "battery.h"
+#include "regen.h"
+#include "link.h"
+#include "duplex.h"
+#include "telemetry.h"
+#include "scope.h"
+#include "chain.h"
+#include "bms.h"
+#include "param.h"
+#include "store.h"
+#include "eventlog.h"
+#include "powerfail.h"
 
 /* USER CODE END Includes */
 
@@ -115,6 +132,7 @@ extern int16_t speedAvg;                // Average measured speed
 extern int16_t speedAvgAbs;             // Average measured speed in absolute
 extern uint8_t timeoutFlagADC; // Timeout Flag for for ADC Protection: 0 = OK, 1 = Problem detected (line disconnected or wrong ADC data)
 extern uint8_t timeoutFlagSerial; // Timeout Flag for Rx Serial command: 0 = OK, 1 = Problem detected (line disconnected or wrong Rx data)
+extern protocolParser_t serialRxParser; // USART3 receive parser
 
 extern volatile int pwm;         // global variable for pwm left. -1000 to 1000
 
@@ -152,12 +170,366 @@ int32_t board_temp_adcFixdt; // Fixed-point filter output initialized with curre
 int16_t board_temp_adcFilt;
 int16_t board_temp_deg_c;
 
+int16_t iMaxNominal;                        // Motor current limit before derating, fixdt(1,16,4)
+
 #define ADC_OFFSET_READ 580
 uint32_t tim2_ccr2 = ADC_OFFSET_READ;
 uint32_t old_tim2_ccr2 = ADC_OFFSET_READ;
 
 uint16_t spinValue = 0;
 
+uint16_t cmdRate = RATE;                    // Command rate limit, fixdt(1,16,4)
+uint16_t cmdFilter = FILTER;                // Command low-pass filter coefficient, fixdt(0,16,16)
+
+/* =========================== Main loop tasks =========================== */
+
+/*
+ * Control task: read the command, shape the inputs and compute the motor target
+ */
+static void task_control(void) {
+
+#if TEST_READ_UART_COMMANDS
+	readCommand();                        // Read Command: cmd1, cmd2
+#endif
+
+#if TEST_SHORT_SPIN
+#define INCREMENT 10
+	if (spinValue > 2000) {
+		cmdThrottle = 1000 - (spinValue - 2000);
+		spinValue = spinValue - INCREMENT;
+	}
+	else if (spinValue > 1000) {
+		cmdThrottle = 1000;
+		spinValue = spinValue - INCREMENT;
+	}
+	else if (spinValue > 0) {
+		cmdThrottle = spinValue;
+		spinValue = spinValue - INCREMENT;
+	}
+#endif
+
+#if TEST_AUTOSTART
+	if (main_loop_counter < 500) {
+		cmdThrottle = main_loop_counter;
+	}
+	else
+	{
+		cmdThrottle =  500;
+	}
+#endif
+
+#if TEST_LOOP
+
+	if (main_loop_counter % LOOP_INC < LOOP_INC / 3) {
+		cmdThrottle++;
+	} else if (main_loop_counter % LOOP_INC < LOOP_INC * 2 / 3) {
+
+	} else {
+		cmdThrottle--;
+	}
+#endif
+
+#ifdef FAST_CMD_PATH_ENABLE
+	// The fast path drives the motor from the USART interrupt as long as valid frames are received and no test mode is running
+	cmdpath_setEnable(TEST_READ_UART_COMMANDS && !TEST_AUTOSTART && !TEST_LOOP && spinValue == 0 && !timeoutFlagSerial);
+#endif
+
+	calcAvgSpeed(); // Calculate average measured speed: speedAvg, speedAvgAbs
+
+	// ####### MOTOR ENABLING: Only if the initial input is very small (for SAFETY) #######
+	if (enable == 0 && (!rtY_Motor.z_errCode)
+			&& (cmdBrake > -50 && cmdBrake < 50)) {
+		brakeFixdt = speedFixdt = 0;      // reset filters
+#ifdef CURVE_ENGINE_ENABLE
+		curve_reset();
+#endif
+		enable = 1;                       // enable motors
+	}
+
+	speedBlend = (uint16_t) (((CLAMP(speedAvgAbs,10,60) - 10) << 15) / 50); // speedBlend [0,1] is within [10 rpm, 60rpm]
+
+#ifdef STANDSTILL_HOLD_ENABLE
+	standstillHold(); // Apply Standstill Hold functionality. Only available and makes sense for VOLTAGE or TORQUE Mode
+#endif
+
+	if (cmdBrake > 30) { // If Brake pedal (cmd1) is pressed, bring to 0 also the Throttle pedal (cmd2) to avoid "Double pedal" driving
+		cmdThrottle = (int16_t) ((cmdThrottle * speedBlend) >> 15);
+		cruiseControl((uint8_t) rtP_Left.b_cruiseCtrlEna); // Cruise control deactivated by Brake pedal if it was active
+	}
+
+#ifdef ELECTRIC_BRAKE_ENABLE
+	electricBrake(speedBlend); // Apply Electric Brake. Only available and makes sense for TORQUE Mode
+#endif
+
+	if (speedAvg > 0) { // Make sure the Brake pedal is opposite to the direction of motion AND it goes to 0 as we reach standstill (to avoid Reverse driving by Brake pedal)
+		cmdBrake = (int16_t) ((cmdBrake * speedBlend) >> 15);
+	} else {
+		cmdBrake = (int16_t) ((-cmdBrake * speedBlend) >> 15);
+	}
+
+#ifdef CURVE_ENGINE_ENABLE
+	// ####### RESPONSE CURVES #######
+	curve_shape(cmdThrottle, cmdBrake, speedAvgAbs, &throttle, &brake);
+
+	// ####### MIXER: the brake gain is part of the brake curve, only the limits are applied #######
+	mixerFcn((throttle - brake) << 4, 0, &speedMotor);
+#else
+	// ####### LOW-PASS FILTER #######
+	rateLimiter16(cmdBrake, cmdRate, &brakeRateFixdt);
+	rateLimiter16(cmdThrottle, cmdRate, &speedRateFixdt);
+	filtLowPass32(brakeRateFixdt >> 4, cmdFilter, &brakeFixdt);
+	filtLowPass32(speedRateFixdt >> 4, cmdFilter, &speedFixdt);
+	brake = (int16_t) (brakeFixdt >> 16);  // convert fixed-point to integer
+	throttle = (int16_t) (speedFixdt >> 16); // convert fixed-point to integer
+
+	// ####### MIXER for electric braking #######
+	mixerFcn(throttle << 4, brake << 4, &speedMotor); // This function implements the equations above
+#endif
+
+#ifdef REGEN_ENABLE
+	// ####### REGENERATIVE BRAKING: the brake term is a braking torque, limited in the FOC interrupt #######
+	mixerFcn(throttle << 4, 0, &speedMotor);
+	speedMotor = CLAMP(speedMotor - regen_request(cmdBrake, speedAvgAbs), -1000, 1000);
+#endif
+
+	// ####### SET OUTPUTS (if the target change is less than +/- 100) #######
+	if (speedMotor > lastSpeedMotor - 100
+			&& speedMotor < lastSpeedMotor + 100) {
+		pwm = speedMotor;
+#ifdef CMD_LATENCY_MEASURE
+		cmdpath_pwmSet();
+#endif
+	}
+
+#if KX
+    // ####### BEEP AND EMERGENCY POWEROFF #######
+    if ((TEMP_POWEROFF_ENABLE && board_temp_deg_c >= TEMP_POWEROFF && speedAvgAbs < 20) || (batVoltage < BAT_DEAD && speedAvgAbs < 20)) {  // poweroff before mainboard burns OR low bat 3
+      poweroff();
+    } else if (rtY_Motor.z_errCode || rtY_Right.z_errCode) {                                           // 1 beep (low pitch): Motor error, disable motors
+      enable = 0;
+      beepCount(1, 24, 1);
+    } else if (timeoutFlagADC) {                                                                      // 2 beeps (low pitch): ADC timeout
+      beepCount(2, 24, 1);
+    } else if (timeoutFlagSerial) {                                                                   // 3 beeps (low pitch): Serial timeout
+      beepCount(3, 24, 1);
+    } else if (timeoutCnt > TIMEOUT) {                                                                // 4 beeps (low pitch): General timeout (PPM, PWM, Nunchuck)
+      beepCount(4, 24, 1);
+    } else if (TEMP_WARNING_ENABLE && board_temp_deg_c >= TEMP_WARNING) {                             // 5 beeps (low pitch): Mainboard temperature warning
+      beepCount(5, 24, 1);
+    } else if (BAT_LVL1_ENABLE && batVoltage < BAT_LVL1) {                                            // 1 beep fast (medium pitch): Low bat 1
+      beepCount(0, 10, 6);
+    } else if (BAT_LVL2_ENABLE && batVoltage < BAT_LVL2) {                                            // 1 beep slow (medium pitch): Low bat 2
+      beepCount(0, 10, 30);
+    } else if (BEEPS_BACKWARD && ((throttle < -50 && speedAvg < 0) || MultipleTapBrake.b_multipleTap)) { // 1 beep fast (high pitch): Backward spinning motors
+      beepCount(0, 5, 1);
+      backwardDrive = 1;
+    } else {  // do not beep
+      beepCount(0, 0, 0);
+      backwardDrive = 0;
+    }
+
+
+    // ####### INACTIVITY TIMEOUT #######
+    if (abs(speedMotor) > 50 || abs(speedR) > 50) {
+      inactivity_timeout_counter = 0;
+    } else {
+      inactivity_timeout_counter++;
+    }
+    if (inactivity_timeout_counter > (INACTIVITY_TIMEOUT * 60 * 1000) / (DELAY_IN_MAIN_LOOP + 1)) {  // rest of main loop needs maybe 1ms
+      poweroff();
+    }
+#endif
+
+#if DEBUG_LED == MAIN_LOOP
+	HAL_GPIO_WritePin(LED_GPIO_Port, LED_Pin, main_loop_counter % 100 > 50);
+#endif
+
+	if (tim2_ccr2 != old_tim2_ccr2) {
+		TIM2->CCR2 = tim2_ccr2;
+		old_tim2_ccr2 = tim2_ccr2;
+	}
+
+	// Update main loop states
+	lastSpeedMotor = speedMotor;
+	main_loop_counter++;
+	timeoutCnt++;
+}
+
+/*
+ * Board temperature task
+ */
+static void task_temperature(void) {
+	// ####### CALC BOARD TEMPERATURE #######
+	filtLowPass32(adc_buffer.temp, TEMP_FILT_COEF, &board_temp_adcFixdt);
+	board_temp_adcFilt = (int16_t) (board_temp_adcFixdt >> 16); // convert fixed-point to integer
+	board_temp_deg_c = NTC_ADC2Temperature(board_temp_adcFilt);
+}
+
+#if defined(THERMAL_DERATING_ENABLE) || defined(BATTERY_MODEL_ENABLE) || defined(BMS_ENABLE)
+/*
+ * Motor current limit: nominal limit derated by the temperatures, the battery voltage floor and the weakest cell
+ */
+static void task_currentLimit(void) {
+	int16_t iMax = iMaxNominal;
+
+#ifdef THERMAL_DERATING_ENABLE
+	// ####### THERMAL DERATING #######
+	thermal_setNominal(iMaxNominal);      // may be changed by the parameter table
+	iMax = thermal_update(board_temp_deg_c, rtY_Motor.iq);
+#endif
+
+#ifdef BATTERY_MODEL_ENABLE
+	// ####### BATTERY VOLTAGE FLOOR #######
+	battery_update(adc_buffer.vbat, analog.curr_bat);
+	iMax = battery_limit(iMax);
+#endif
+
+#ifdef BMS_ENABLE
+	// ####### WEAKEST CELL #######
+	iMax = bms_limit(iMax);
+#endif
+
+	rtP_Left.i_max = iMax;
+}
+#endif
+
+#ifdef TELEMETRY_TLV_ENABLE
+  #define TELEMETRY_PERIOD      DELAY_IN_MAIN_LOOP          // [ms] Compact telemetry frames
+#else
+  #define TELEMETRY_PERIOD      (4 * DELAY_IN_MAIN_LOOP)    // [ms] 59-byte feedback frames
+#endif
+
+/*
+ * Feedback serial out to display
+ */
+static void task_telemetry(void) {
+#ifdef BAUD_NEGOTIATION_ENABLE
+	if (!link_txAllowed()) {  // Baud rate switch in progress
+		return;
+	}
+#endif
+#ifdef TELEMETRY_TLV_ENABLE
+	if (duplex_pending(DUPLEX_PRIO_PERIODIC)) {   // Previous frame still queued: keep it, the compact telemetry sends deltas
+		return;
+	}
+#endif
+#ifdef TRIP_FRAME_ENABLE
+	static uint16_t frameCnt;
+	if (++frameCnt >= (TRIP_FRAME_PERIOD * 4 * DELAY_IN_MAIN_LOOP) / TELEMETRY_PERIOD) {   // same trip rate for both formats
+		frameCnt = 0;
+		usart_send_trip_to_display();
+		return;
+	}
+#endif
+#ifdef TELEMETRY_TLV_ENABLE
+	telemetry_send();
+#else
+	usart_send_from_esc_to_display();
+#endif
+}
+
+#ifdef BAUD_NEGOTIATION_ENABLE
+/*
+ * Display link baud rate negotiation and fallback
+ */
+static void task_link(void) {
+	link_update(timeoutFlagSerial, serialRxParser.crcErrors);
+}
+#endif
+
+#ifdef CHAIN_ENABLE
+/*
+ * ESC chain: setpoint and time reference to the slaves (master), setpoint timeout and status (slave)
+ */
+static void task_chain(void) {
+	chain_update(pwm);
+}
+#endif
+
+#ifdef BMS_ENABLE
+/*
+ * BMS polling client
+ */
+static void task_bms(void) {
+	bms_update();
+}
+#endif
+
+#ifdef PARAM_ENABLE
+/*
+ * Runtime parameter requests
+ */
+static void task_param(void) {
+	param_update();
+}
+#endif
+
+#ifdef EVENTLOG_ENABLE
+/*
+ * Fault and timeout events: capture, display requests, flash write
+ */
+static void task_eventlog(void) {
+	eventlog_update();
+}
+#endif
+
+#ifdef POWERFAIL_ENABLE
+/*
+ * Power-fail record serialization
+ */
+static void task_powerfail(void) {
+	powerfail_update();
+}
+#endif
+
+/*
+ * Poweroff by power-button
+ */
+static void task_powerButton(void) {
+	poweroffPressCheck();
+}
+
+#ifdef CMD_LATENCY_MEASURE
+/*
+ * Command latency percentiles, for inspection with the debugger
+ */
+static void task_latencyStats(void) {
+	cmdpath_updateStats();
+}
+#endif
+
+// Main loop task table: function, period [ms], deadline [ms], priority (0 = highest)
+static schedTask_t tasks[] = {
+	SCHED_TASK(task_control,     DELAY_IN_MAIN_LOOP,     DELAY_IN_MAIN_LOOP,     0),
+#ifdef CHAIN_ENABLE
+	SCHED_TASK(task_chain,       DELAY_IN_MAIN_LOOP,     DELAY_IN_MAIN_LOOP,     0),  // Right after task_control: new setpoint
+#endif
+	SCHED_TASK(task_powerButton, DELAY_IN_MAIN_LOOP,     DELAY_IN_MAIN_LOOP,     1),
+	SCHED_TASK(task_temperature, DELAY_IN_MAIN_LOOP,     4 * DELAY_IN_MAIN_LOOP, 2),
+#if defined(THERMAL_DERATING_ENABLE) || defined(BATTERY_MODEL_ENABLE) || defined(BMS_ENABLE)
+	SCHED_TASK(task_currentLimit, DELAY_IN_MAIN_LOOP,    4 * DELAY_IN_MAIN_LOOP, 2),
+#endif
+#ifdef BAUD_NEGOTIATION_ENABLE
+	SCHED_TASK(task_link,        DELAY_IN_MAIN_LOOP,     4 * DELAY_IN_MAIN_LOOP, 3),
+#endif
+#ifdef BMS_ENABLE
+	SCHED_TASK(task_bms,         BMS_PERIOD,             BMS_PERIOD,             3),
+#endif
+#ifdef PARAM_ENABLE
+	SCHED_TASK(task_param,       DELAY_IN_MAIN_LOOP,     4 * DELAY_IN_MAIN_LOOP, 3),
+#endif
+#ifdef EVENTLOG_ENABLE
+	SCHED_TASK(task_eventlog,    DELAY_IN_MAIN_LOOP,     4 * DELAY_IN_MAIN_LOOP, 3),
+#endif
+#ifdef POWERFAIL_ENABLE
+	SCHED_TASK(task_powerfail,   POWERFAIL_PERIOD,       POWERFAIL_PERIOD,       3),
+#endif
+	SCHED_TASK(task_telemetry,   TELEMETRY_PERIOD,       TELEMETRY_PERIOD,       3),  // Send data periodically every 20 ms (5 ms compact)
+#ifdef CMD_LATENCY_MEASURE
+	SCHED_TASK(task_latencyStats, 1000,                  1000,                   4),
+#endif
+};
+
 /* USER CODE END 0 */
 
 /**
@@ -227,7 +599,33 @@ int main(void)
 #endif
 
 	Input_Lim_Init();   // Input Limitations Init
+#ifdef BAUD_NEGOTIATION_ENABLE
+	link_init();        // Display link at USART3_BAUD
+#endif
+#ifdef HALF_DUPLEX_ENABLE
+	duplex_init();      // Single-wire display link
+#endif
+#ifdef TELEMETRY_TLV_ENABLE
+	telemetry_init();   // Compact telemetry Init
+#endif
+#ifdef SCOPE_ENABLE
+	scope_init();       // Oscilloscope stream on USART1
+#endif
+#ifdef CHAIN_ENABLE
+	chain_init();       // ESC chain on USART1
+#endif
+#ifdef BMS_ENABLE
+	bms_init();         // BMS client on USART1
+#endif
 	Input_Init();       // Input Init
+#ifdef CURVE_ENGINE_ENABLE
+	curve_init();       // Response curves Init
+#endif
+#if defined(POWERFAIL_ENABLE)
+	powerfail_init();   // Energy accounting Init from the last power-fail record
+#elif defined(ENERGY_ACCOUNTING_ENABLE)
+	energy_init(NULL);  // Energy accounting Init
+#endif
 
 	HAL_ADC_Start(&hadc1);
 	HAL_ADC_Start(&hadc2);
@@ -240,169 +638,32 @@ int main(void)
 	board_temp_adcFixdt = adc_buffer.temp << 16; // Fixed-point filter output initialized with current ADC converted to fixed-point
 	board_temp_adcFilt = adc_buffer.temp;
 
-  /* USER CODE END 2 */
-
-  /* Infinite loop */
-  /* USER CODE BEGIN WHILE */
-	while (1) {
-
-		HAL_Delay(DELAY_IN_MAIN_LOOP);        //delay in ms
-
-#if TEST_READ_UART_COMMANDS
-		readCommand();                        // Read Command: cmd1, cmd2
-#endif
-
-#if TEST_SHORT_SPIN
-#define INCREMENT 10
-		if (spinValue > 2000) {
-			cmdThrottle = 1000 - (spinValue - 2000);
-			spinValue = spinValue - INCREMENT;
-		}
-		else if (spinValue > 1000) {
-			cmdThrottle = 1000;
-			spinValue = spinValue - INCREMENT;
-		}
-		else if (spinValue > 0) {
-			cmdThrottle = spinValue;
-			spinValue = spinValue - INCREMENT;
-		}
-#endif
-
-#if TEST_AUTOSTART
-		if (main_loop_counter < 500) {
-			cmdThrottle = main_loop_counter;
-		}
-		else
-		{
-			cmdThrottle =  500;
-		}
+	iMaxNominal = rtP_Left.i_max;
+#ifdef STORE_ENABLE
+	store_init();       // Calibration store index
 #endif
-
-#if TEST_LOOP
-
-		if (main_loop_counter % LOOP_INC < LOOP_INC / 3) {
-			cmdThrottle++;
-		} else if (main_loop_counter % LOOP_INC < LOOP_INC * 2 / 3) {
-
-		} else {
-			cmdThrottle--;
-		}
+#ifdef PARAM_ENABLE
+	param_init();       // Saved runtime parameters
 #endif
-
-		calcAvgSpeed(); // Calculate average measured speed: speedAvg, speedAvgAbs
-
-		// ####### MOTOR ENABLING: Only if the initial input is very small (for SAFETY) #######
-		if (enable == 0 && (!rtY_Motor.z_errCode)
-				&& (cmdBrake > -50 && cmdBrake < 50)) {
-			brakeFixdt = speedFixdt = 0;      // reset filters
-			enable = 1;                       // enable motors
-		}
-
-		speedBlend = (uint16_t) (((CLAMP(speedAvgAbs,10,60) - 10) << 15) / 50); // speedBlend [0,1] is within [10 rpm, 60rpm]
-
-#ifdef STANDSTILL_HOLD_ENABLE
-		standstillHold(); // Apply Standstill Hold functionality. Only available and makes sense for VOLTAGE or TORQUE Mode
+#ifdef EVENTLOG_ENABLE
+	eventlog_init();    // Event log position in flash
 #endif
-
-		if (cmdBrake > 30) { // If Brake pedal (cmd1) is pressed, bring to 0 also the Throttle pedal (cmd2) to avoid "Double pedal" driving
-			cmdThrottle = (int16_t) ((cmdThrottle * speedBlend) >> 15);
-			cruiseControl((uint8_t) rtP_Left.b_cruiseCtrlEna); // Cruise control deactivated by Brake pedal if it was active
-		}
-
-#ifdef ELECTRIC_BRAKE_ENABLE
-		electricBrake(speedBlend); // Apply Electric Brake. Only available and makes sense for TORQUE Mode
+#ifdef THERMAL_DERATING_ENABLE
+	thermal_init(iMaxNominal, NTC_ADC2Temperature(board_temp_adcFilt));
 #endif
-
-		if (speedAvg > 0) { // Make sure the Brake pedal is opposite to the direction of motion AND it goes to 0 as we reach standstill (to avoid Reverse driving by Brake pedal)
-			cmdBrake = (int16_t) ((cmdBrake * speedBlend) >> 15);
-		} else {
-			cmdBrake = (int16_t) ((-cmdBrake * speedBlend) >> 15);
-		}
-
-		// ####### LOW-PASS FILTER #######
-		rateLimiter16(cmdBrake, RATE, &brakeRateFixdt);
-		rateLimiter16(cmdThrottle, RATE, &speedRateFixdt);
-		filtLowPass32(brakeRateFixdt >> 4, FILTER, &brakeFixdt);
-		filtLowPass32(speedRateFixdt >> 4, FILTER, &speedFixdt);
-		brake = (int16_t) (brakeFixdt >> 16);  // convert fixed-point to integer
-		throttle = (int16_t) (speedFixdt >> 16); // convert fixed-point to integer
-
-		// ####### MIXER for electric braking #######
-		mixerFcn(throttle << 4, brake << 4, &speedMotor); // This function implements the equations above
-
-		// ####### SET OUTPUTS (if the target change is less than +/- 100) #######
-		if (speedMotor > lastSpeedMotor - 100
-				&& speedMotor < lastSpeedMotor + 100) {
-			pwm = speedMotor;
-		}
-
-		// ####### CALC BOARD TEMPERATURE #######
-		filtLowPass32(adc_buffer.temp, TEMP_FILT_COEF, &board_temp_adcFixdt);
-		board_temp_adcFilt = (int16_t) (board_temp_adcFixdt >> 16); // convert fixed-point to integer
-		board_temp_deg_c = NTC_ADC2Temperature(board_temp_adcFilt);
-
-		// ####### FEEDBACK SERIAL OUT TO DISPLAY #######
-		if (main_loop_counter % 4 == 0) {  // Send data periodically every 20 ms
-			usart_send_from_esc_to_display();
-		}
-
-	    // ####### POWEROFF BY POWER-BUTTON #######
-	    poweroffPressCheck();
-
-#if KX
-	    // ####### BEEP AND EMERGENCY POWEROFF #######
-	    if ((TEMP_POWEROFF_ENABLE && board_temp_deg_c >= TEMP_POWEROFF && speedAvgAbs < 20) || (batVoltage < BAT_DEAD && speedAvgAbs < 20)) {  // poweroff before mainboard burns OR low bat 3
-	      poweroff();
-	    } else if (rtY_Motor.z_errCode || rtY_Right.z_errCode) {                                           // 1 beep (low pitch): Motor error, disable motors
-	      enable = 0;
-	      beepCount(1, 24, 1);
-	    } else if (timeoutFlagADC) {                                                                      // 2 beeps (low pitch): ADC timeout
-	      beepCount(2, 24, 1);
-	    } else if (timeoutFlagSerial) {                                                                   // 3 beeps (low pitch): Serial timeout
-	      beepCount(3, 24, 1);
-	    } else if (timeoutCnt > TIMEOUT) {                                                                // 4 beeps (low pitch): General timeout (PPM, PWM, Nunchuck)
-	      beepCount(4, 24, 1);
-	    } else if (TEMP_WARNING_ENABLE && board_temp_deg_c >= TEMP_WARNING) {                             // 5 beeps (low pitch): Mainboard temperature warning
-	      beepCount(5, 24, 1);
-	    } else if (BAT_LVL1_ENABLE && batVoltage < BAT_LVL1) {                                            // 1 beep fast (medium pitch): Low bat 1
-	      beepCount(0, 10, 6);
-	    } else if (BAT_LVL2_ENABLE && batVoltage < BAT_LVL2) {                                            // 1 beep slow (medium pitch): Low bat 2
-	      beepCount(0, 10, 30);
-	    } else if (BEEPS_BACKWARD && ((throttle < -50 && speedAvg < 0) || MultipleTapBrake.b_multipleTap)) { // 1 beep fast (high pitch): Backward spinning motors
-	      beepCount(0, 5, 1);
-	      backwardDrive = 1;
-	    } else {  // do not beep
-	      beepCount(0, 0, 0);
-	      backwardDrive = 0;
-	    }
-
-
-	    // ####### INACTIVITY TIMEOUT #######
-	    if (abs(speedMotor) > 50 || abs(speedR) > 50) {
-	      inactivity_timeout_counter = 0;
-	    } else {
-	      inactivity_timeout_counter++;
-	    }
-	    if (inactivity_timeout_counter > (INACTIVITY_TIMEOUT * 60 * 1000) / (DELAY_IN_MAIN_LOOP + 1)) {  // rest of main loop needs maybe 1ms
-	      poweroff();
-	    }
+#ifdef BATTERY_MODEL_ENABLE
+	battery_init(adc_buffer.vbat);
 #endif
 
-#if DEBUG_LED == MAIN_LOOP
-		HAL_GPIO_WritePin(LED_GPIO_Port, LED_Pin, main_loop_counter % 100 > 50);
-#endif
+  /* USER CODE END 2 */
 
-		if (tim2_ccr2 != old_tim2_ccr2) {
-			TIM2->CCR2 = tim2_ccr2;
-			old_tim2_ccr2 = tim2_ccr2;
-		}
+  /* Infinite loop */
+  /* USER CODE BEGIN WHILE */
+	sched_init(tasks, ARRAY_LEN(tasks));
 
-		// Update main loop states
-		lastSpeedMotor = speedMotor;
-		main_loop_counter++;
-		timeoutCnt++;
+	while (1) {
 
-		//HAL_GPIO_WritePin(LED_GPIO_Port, LED_Pin,				(main_loop_counter % 400 > 200));
+		sched_dispatch();    // Run the released main loop tasks
 
     /* USER CODE END WHILE */
 
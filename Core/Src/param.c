@@ -0,0 +1,400 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runtime parameter table: typed access by ID to the controller gains and limits, the PWM margin, the ADC
+ * trigger and the command filters, from SERIAL_TYPE_PARAM frames on USART3. It replaces the gdb pokes of
+ * tests_scripts/gdb_set_*.bat and the rebuilds for a new config.h value.
+ *
+ * Each entry gives the variable, its format (size and signedness), the number of fractional bits of its
+ * fixed-point value, the accepted range and flags. The IDs are stable: a host keeps them across firmware versions.
+ *
+ * Request handling:
+ * - the USART interrupt copies the request (param_request), the main loop task checks it and queues the reply
+ *   (param_update)
+ * - a set stages the value; the staged values are written by the FOC interrupt at the start of its next step
+ *   (param_apply), so the controller never runs with half of a related group of values. A set with Hold keeps
+ *   the value staged until the next set without Hold, e.g. to change a Kp / Ki pair together
+ * - a save writes the PARAM_F_SAVE values into the EEPROM emulation, only below PARAM_SAVE_SPEED: a flash page
+ *   transfer erases a page and stalls the CPU, the FOC interrupt included, for about 20 ms. The PARAM_F_STOP
+ *   values (control type) are also set only below PARAM_SAVE_SPEED
+ * - at boot, param_init restores the saved values that are still in range, if the layout key matches. The key is
+ *   written after the values, so an interrupted save is ignored as a whole
+ * The saved values are 16-bit: the ranges of the 32-bit variables are kept within 16 bits.
+ */
+
+// Includes
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "BLDC_controller.h"
+#include "eeprom.h"
+#include "duplex.h"
+#include "param.h"
+
+//------------------------------------------------------------------------
+// Global variables set externally
+//------------------------------------------------------------------------
+extern P rtP_Left;
+extern int16_t speedAvgAbs;
+extern int16_t pwm_margin;
+extern int32_t curDC_max;
+extern uint32_t tim2_ccr2;
+extern uint16_t cmdRate;
+extern uint16_t cmdFilter;
+extern uint16_t VirtAddVarTab[NB_OF_VAR];
+#if defined(THERMAL_DERATING_ENABLE) || defined(BATTERY_MODEL_ENABLE) || defined(BMS_ENABLE)
+extern int16_t iMaxNominal;
+  #define PARAM_I_MAX   iMaxNominal         // derated into rtP_Left.i_max by task_currentLimit
+#else
+  #define PARAM_I_MAX   rtP_Left.i_max
+#endif
+
+//------------------------------------------------------------------------
+// Global variables set here in param.c
+//------------------------------------------------------------------------
+uint32_t paramApplied;                  // [-] Values applied by the FOC loop
+uint32_t paramRejected;                 // [-] Requests answered with an error
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define PARAM_LAYOUT        1           // [-] Change when an ID changes meaning: the saved values are then ignored
+#define PARAM_EE_KEY        (0x5A00 | PARAM_LAYOUT)
+#define PARAM_EE_KEY_NONE   0           // [-] Layout key during a save: the saved values are incomplete
+
+// X(id, variable, format, fractional bits, min, max, flags)
+#define PARAM_TABLE(X) \
+	/* Limits, fixdt(1,16,4) */ \
+	X(0x01, PARAM_I_MAX,               PARAM_I16, 4,  0, (I_MOT_MAX * A2BIT_CONV) << 4,  PARAM_F_SAVE)  /* [A * A2BIT_CONV] motor current */ \
+	X(0x02, rtP_Left.n_max,            PARAM_I16, 4,  0, N_MOT_MAX << 4,                  PARAM_F_SAVE)  /* [rpm] motor speed */ \
+	X(0x03, curDC_max,                 PARAM_I32, 0,  0, 32767,                           PARAM_F_SAVE)  /* [1/340 A] DC link current cut-off */ \
+	/* Field weakening / phase advance */ \
+	X(0x08, rtP_Left.b_fieldWeakEna,   PARAM_U8,  0,  0, 1,                               PARAM_F_SAVE) \
+	X(0x09, rtP_Left.id_fieldWeakMax,  PARAM_I16, 4,  0, (I_MOT_MAX * A2BIT_CONV) << 4,  PARAM_F_SAVE)  /* [A * A2BIT_CONV] */ \
+	X(0x0A, rtP_Left.a_phaAdvMax,      PARAM_I16, 4,  0, 60 << 4,                         PARAM_F_SAVE)  /* [deg] */ \
+	X(0x0B, rtP_Left.r_fieldWeakHi,    PARAM_I16, 4,  0, 1000 << 4,                       PARAM_F_SAVE)  /* [-] input target */ \
+	X(0x0C, rtP_Left.r_fieldWeakLo,    PARAM_I16, 4,  0, 1000 << 4,                       PARAM_F_SAVE)  /* [-] input target */ \
+	/* Controller gains and current filter */ \
+	X(0x10, rtP_Left.cf_idKp,          PARAM_U16, 10, 0, 65535,                           PARAM_F_SAVE) \
+	X(0x11, rtP_Left.cf_idKi,          PARAM_U16, 16, 0, 65535,                           PARAM_F_SAVE)  /* [-] per FOC step */ \
+	X(0x12, rtP_Left.cf_iqKp,          PARAM_U16, 10, 0, 65535,                           PARAM_F_SAVE) \
+	X(0x13, rtP_Left.cf_iqKi,          PARAM_U16, 16, 0, 65535,                           PARAM_F_SAVE)  /* [-] per FOC step */ \
+	X(0x14, rtP_Left.cf_nKp,           PARAM_U16, 12, 0, 65535,                           PARAM_F_SAVE) \
+	X(0x15, rtP_Left.cf_nKi,           PARAM_U16, 16, 0, 65535,                           PARAM_F_SAVE)  /* [-] per FOC step */ \
+	X(0x16, rtP_Left.cf_currFilt,      PARAM_U16, 16, 1, 65535,                           PARAM_F_SAVE)  /* [-] filter coefficient */ \
+	X(0x17, rtP_Left.z_ctrlTypSel,     PARAM_U8,  0,  0, 2,                PARAM_F_SAVE | PARAM_F_STOP)  /* [-] 0 = COM, 1 = SIN, 2 = FOC */ \
+	/* PWM and ADC */ \
+	X(0x20, pwm_margin,                PARAM_I16, 0,  0, 500,                             PARAM_F_SAVE)  /* [timer counts] out of 2000 */ \
+	X(0x21, tim2_ccr2,                 PARAM_U32, 0,  1, 1999,                            PARAM_F_SAVE)  /* [timer counts] ADC trigger */ \
+	/* Command shaping without the response curves */ \
+	X(0x28, cmdRate,                   PARAM_U16, 4,  1, 32767,                           PARAM_F_SAVE)  /* [-/tick] RATE */ \
+	X(0x29, cmdFilter,                 PARAM_U16, 16, 1, 65535,                           PARAM_F_SAVE)  /* [-] FILTER */
+
+typedef struct {
+	uint8_t id;
+	uint8_t format;                     // PARAM_U8 ... PARAM_U32
+	uint8_t frac;                       // [bits] Fractional bits
+	uint8_t flags;                      // PARAM_F_xxx
+	void *var;
+	int32_t min;
+	int32_t max;
+} param_t;
+
+#define PARAM_SIZE(format)      ((format) == PARAM_U8 ? 1 : (format) <= PARAM_U16 ? 2 : 4)
+#define PARAM_ENTRY(id, var, format, frac, min, max, flags) \
+	{ id, format, frac, flags, (void*) &(var), min, max },
+#define PARAM_CHECK(id, var, format, frac, min, max, flags) \
+	_Static_assert(sizeof(var) == PARAM_SIZE(format), #var " does not have the size of its format"); \
+	_Static_assert((min) >= -32768 && (max) <= 65535 && ((max) <= 32767 || (format) == PARAM_U16 || (format) == PARAM_U32), \
+			#var " range does not fit the 16-bit saved value");
+
+PARAM_TABLE(PARAM_CHECK)
+
+static const param_t paramTable[] = {
+	PARAM_TABLE(PARAM_ENTRY)
+};
+
+#define PARAM_COUNT     ARRAY_LEN(paramTable)
+
+_Static_assert(PARAM_EE_FIRST + PARAM_EE_NB_VAR == NB_OF_VAR, "NB_OF_VAR must cover the parameter table");
+_Static_assert(PARAM_COUNT + 1 <= PARAM_EE_NB_VAR, "PARAM_EE_NB_VAR too small for the parameter table");
+
+typedef struct {
+	const param_t *p;
+	int32_t value;
+} paramStage_t;
+
+static paramStage_t stage[PARAM_STAGE_MAX];     // Values waiting for the FOC loop
+static uint8_t stageLen;
+static volatile uint8_t stageCommit;    // [-] 1 = stage complete, to be applied by the FOC interrupt
+
+static SerialParamFromDisplayToEsc req;
+static volatile uint8_t reqValid;       // [-] Request copied by the USART interrupt
+static SerialParamFromEscToDisplay reply;
+
+/* =========================== Local Functions =========================== */
+
+static const param_t* param_find(uint8_t id) {
+	uint8_t i;
+
+	for (i = 0; i < PARAM_COUNT; i++) {
+		if (paramTable[i].id == id) {
+			return &paramTable[i];
+		}
+	}
+	return NULL;
+}
+
+static int32_t param_read(const param_t *p) {
+	switch (p->format) {
+	case PARAM_U8:
+		return *(uint8_t*) p->var;
+	case PARAM_I16:
+		return *(int16_t*) p->var;
+	case PARAM_U16:
+		return *(uint16_t*) p->var;
+	default:
+		return *(int32_t*) p->var;  // PARAM_U32 values stay below 2^31
+	}
+}
+
+static void param_write(const param_t *p, int32_t value) {
+	switch (p->format) {
+	case PARAM_U8:
+		*(uint8_t*) p->var = (uint8_t) value;
+		break;
+	case PARAM_I16:
+	case PARAM_U16:
+		*(uint16_t*) p->var = (uint16_t) value;
+		break;
+	default:
+		*(int32_t*) p->var = value;
+		break;
+	}
+}
+
+/*
+ * 16-bit saved value back to the parameter value
+ */
+static int32_t param_fromSaved(const param_t *p, uint16_t saved) {
+	if (p->format == PARAM_I16 || p->format == PARAM_I32) {
+		return (int16_t) saved;
+	}
+	return saved;
+}
+
+static uint8_t param_staged(const param_t *p, int32_t value) {
+	uint8_t i;
+
+	if (stageCommit) {
+		return PARAM_ERR_BUSY;          // previous stage not applied yet (next FOC step)
+	}
+	for (i = 0; i < stageLen && stage[i].p != p; i++);
+	if (i == PARAM_STAGE_MAX) {
+		return PARAM_ERR_BUSY;
+	}
+	stage[i].p = p;
+	stage[i].value = value;
+	if (i == stageLen) {
+		stageLen++;
+	}
+	return PARAM_OK;
+}
+
+/*
+ * One EEPROM batch: only the changed values are programmed, in a single pass.
+ * The batch is not atomic, so the layout key is cleared before it and written after it: a power loss in the middle
+ * leaves no key, and param_init keeps the defaults instead of a mix of old and new values.
+ */
+static uint8_t param_save(void) {
+	uint16_t saved;
+	uint16_t status;
+	uint8_t i, changed;
+
+	changed = (EE_ReadVariable(PARAM_EE_ADDR, &saved) != 0 || saved != PARAM_EE_KEY);
+	for (i = 0; i < PARAM_COUNT && !changed; i++) {
+		if (paramTable[i].flags & PARAM_F_SAVE) {
+			changed = (EE_ReadVariable(PARAM_EE_ADDR + paramTable[i].id, &saved) != 0
+					|| saved != (uint16_t) param_read(&paramTable[i]));
+		}
+	}
+	if (!changed) {
+		return PARAM_OK;                // no key cleared and written again for nothing
+	}
+
+	HAL_FLASH_Unlock();
+	status = EE_WriteVariable(PARAM_EE_ADDR, PARAM_EE_KEY_NONE);
+	if (status == HAL_OK) {
+		EE_BatchBegin();
+		for (i = 0; i < PARAM_COUNT; i++) {
+			if (paramTable[i].flags & PARAM_F_SAVE) {
+				EE_WriteVariable(PARAM_EE_ADDR + paramTable[i].id, (uint16_t) param_read(&paramTable[i]));
+			}
+		}
+		status = EE_BatchEnd();
+	}
+	if (status == HAL_OK) {
+		status = EE_WriteVariable(PARAM_EE_ADDR, PARAM_EE_KEY);
+	}
+	HAL_FLASH_Lock();
+	return (status == HAL_OK) ? PARAM_OK : PARAM_ERR_FLASH;
+}
+
+/*
+ * Check and execute the request, fill the reply
+ */
+static void param_process(const SerialParamFromDisplayToEsc *r) {
+	const param_t *p = NULL;
+	uint8_t status = PARAM_OK;
+	int32_t value;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.Frame_start = SERIAL_START_FRAME_ESC_TO_DISPLAY;
+	reply.Type = SERIAL_TYPE_PARAM;
+	reply.Cmd = r->Cmd;
+	reply.Id = r->Id;
+	reply.Count = PARAM_COUNT;
+
+	switch (r->Cmd) {
+	case PARAM_CMD_GET:
+		p = param_find(r->Id);
+		status = p ? PARAM_OK : PARAM_ERR_UNKNOWN;
+		break;
+	case PARAM_CMD_LIST:
+		p = (r->Id < PARAM_COUNT) ? &paramTable[r->Id] : NULL;
+		status = p ? PARAM_OK : PARAM_ERR_UNKNOWN;
+		break;
+	case PARAM_CMD_SET:
+		p = param_find(r->Id);
+		value = (int32_t) protocol_get32(r->Value);
+		if (p == NULL) {
+			status = PARAM_ERR_UNKNOWN;
+		} else if (value < p->min || value > p->max) {
+			status = PARAM_ERR_RANGE;
+		} else if ((p->flags & PARAM_F_STOP) && speedAvgAbs > PARAM_SAVE_SPEED) {
+			status = PARAM_ERR_LOCKED;
+		} else {
+			status = param_staged(p, value);
+		}
+		if (status == PARAM_OK && !r->Hold) {
+			__DMB();                    // stage written before the FOC interrupt can see the commit
+			stageCommit = 1;
+		}
+		break;
+	case PARAM_CMD_SAVE:
+		status = (speedAvgAbs > PARAM_SAVE_SPEED) ? PARAM_ERR_LOCKED : param_save();
+		break;
+	default:
+		status = PARAM_ERR_UNKNOWN;
+		break;
+	}
+
+	if (p != NULL) {
+		reply.Id = p->id;
+		reply.Index = (uint8_t) (p - paramTable);
+		reply.Format = p->format;
+		reply.Frac = p->frac;
+		reply.Flags = p->flags;
+		value = (r->Cmd == PARAM_CMD_SET && status == PARAM_OK) ? (int32_t) protocol_get32(r->Value) : param_read(p);
+		protocol_put32(reply.Value, (uint32_t) value);
+		protocol_put32(reply.Min, (uint32_t) p->min);
+		protocol_put32(reply.Max, (uint32_t) p->max);
+	}
+	if (status != PARAM_OK) {
+		paramRejected++;
+	}
+	reply.Status = status;
+	protocol_seal(&reply, sizeof(reply));
+}
+
+/* =========================== Initialization Functions =========================== */
+
+/*
+ * Restore the saved values. To be called once the defaults are set (BLDC_Init, iMaxNominal).
+ */
+void param_init(void) {
+	uint16_t saved;
+	int32_t value;
+	uint8_t i;
+
+	for (i = 0; i < PARAM_EE_NB_VAR; i++) {
+		VirtAddVarTab[PARAM_EE_FIRST + i] = (i < PARAM_COUNT + 1) ? (PARAM_EE_ADDR + (i ? paramTable[i - 1].id : 0)) : 0;
+	}
+
+	HAL_FLASH_Unlock();
+	EE_Init();
+	if (EE_ReadVariable(PARAM_EE_ADDR, &saved) == 0 && saved == PARAM_EE_KEY) {
+		for (i = 0; i < PARAM_COUNT; i++) {
+			if ((paramTable[i].flags & PARAM_F_SAVE) && EE_ReadVariable(PARAM_EE_ADDR + paramTable[i].id, &saved) == 0) {
+				value = param_fromSaved(&paramTable[i], saved);
+				if (value >= paramTable[i].min && value <= paramTable[i].max) {
+					__disable_irq();    // the FOC interrupt is already running
+					param_write(&paramTable[i], value);
+					__enable_irq();
+				}
+			}
+		}
+	}
+	HAL_FLASH_Lock();
+
+	stageLen = 0;
+	stageCommit = 0;
+	reqValid = 0;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Request received (USART interrupt), checked and answered by param_update. Dropped while one is waiting.
+ */
+void param_request(const SerialParamFromDisplayToEsc *r) {
+	if (!reqValid) {
+		req = *r;
+		reqValid = 1;
+	}
+}
+
+/*
+ * To be called periodically from the main loop
+ */
+void param_update(void) {
+	if (reqValid) {
+		param_process(&req);
+		reqValid = 0;
+		duplex_send((uint8_t*) &reply, sizeof(reply), DUPLEX_PRIO_REPLY);
+	}
+}
+
+/*
+ * Write the staged values, at the start of the FOC step (FOC interrupt)
+ */
+void param_apply(void) {
+	uint8_t i;
+
+	if (!stageCommit) {
+		return;
+	}
+	for (i = 0; i < stageLen; i++) {
+		param_write(stage[i].p, stage[i].value);
+	}
+	paramApplied += stageLen;
+	stageLen = 0;
+	stageCommit = 0;
+}
+
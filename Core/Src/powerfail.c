@@ -0,0 +1,299 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Power-fail save: the lifetime energy and distance counters are written to the flash when the battery is
+ * unplugged or cut by the BMS, on the charge left in the DC link capacitors, and restored at boot. Without it
+ * energyLifetime restarts from 0 at each power on.
+ *
+ * - powerfail_update (main loop task, every POWERFAIL_PERIOD) serializes the record in RAM, CRC included, in
+ *   the image the interrupt does not point to: the commit only copies half-words
+ * - powerfail_step (FOC interrupt, every PWM period) compares the raw bus voltage sample with its average over
+ *   64 ms: POWERFAIL_SAMPLES consecutive samples POWERFAIL_DROP % below trip the save. The average is frozen
+ *   while the samples are low, so a collapse does not drag it down
+ * - trip: PWM outputs off, so the capacitors only supply the logic, interrupts off, then the record is written
+ *   to the pre-erased slot, the commit half-word 0x0000 last: a cut write is invalid and the previous record
+ *   stays the latest. The flash registers are driven directly: the interrupt may have cut a HAL flash call of
+ *   the main loop, whose lock and timeouts would fail or block
+ * - measure: the CPU then writes a time stamp [us since the commit start] every POWERFAIL_STAMP_US in the rest
+ *   of the slot until the supply dies. At boot the first stamp gives the commit duration, the last one the
+ *   hold-up time (powerfailCommitUs, powerfailHoldupUs). If the CPU survives the whole slot (voltage dip), it is
+ *   reset and restarts from the record just written
+ * - slots of 256 bytes, 4 per page, in two pages from POWERFAIL_PAGE_FIRST. powerfail_init restores the record
+ *   with the highest seq and prepares the next slot: the first blank one after it, else the first of the other
+ *   page, erased at boot, when the motor is still off
+ * poweroff() writes the record too, before releasing the power latch.
+ *
+ * Worst-case commit: 25 + 1 half-words * 70 us (tPROG max, datasheet) = 1.8 ms after the detection (+ 250 us
+ * of POWERFAIL_SAMPLES). A page erase of the main loop (EEPROM transfer, calibration store, event log) blocks
+ * the flash for up to 40 ms (tERASE max), which is waited for first: those only run at standstill, when the
+ * DC link supplies the logic only and holds up longest.
+ */
+
+// Includes
+#include <stddef.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "energy.h"
+#include "powerfail.h"
+
+//------------------------------------------------------------------------
+// Global variables set externally
+//------------------------------------------------------------------------
+extern uint8_t enable;
+
+//------------------------------------------------------------------------
+// Global variables set here in powerfail.c
+//------------------------------------------------------------------------
+uint32_t powerfailCount;                // [-] Records written, the last one restored at boot
+uint16_t powerfailCommitUs;             // [us] Last record: commit duration, 0 = unknown
+uint16_t powerfailHoldupUs;             // [us] Last record: time the CPU ran after the commit start, at least
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+typedef struct {
+	uint16_t magic;                     // POWERFAIL_MAGIC
+	uint16_t reserved;
+	uint32_t seq;                       // [-] powerfailCount of the record
+	energyAcc_t lifetime;               // energy_getLifetime
+	uint16_t crc;                       // CRC-16/CCITT of the fields above
+	uint16_t commit;                    // 0x0000, written last
+} powerfailRecord_t;
+
+#define POWERFAIL_BASE          (FLASH_BASE + POWERFAIL_PAGE_FIRST * FLASH_PAGE_SIZE)
+#define POWERFAIL_SLOT_SIZE     256U                                            // [bytes] Record + time stamps
+#define POWERFAIL_SLOTS         (FLASH_PAGE_SIZE / POWERFAIL_SLOT_SIZE)         // [-] Slots per page
+#define POWERFAIL_ADDR(slot)    (POWERFAIL_BASE + (uint32_t) (slot) * POWERFAIL_SLOT_SIZE)  // slot 0 .. 2 * POWERFAIL_SLOTS - 1
+#define POWERFAIL_STAMPS        ((POWERFAIL_SLOT_SIZE - sizeof(powerfailRecord_t)) / 2)    // [-] Time stamps after the record
+#define POWERFAIL_MAGIC         0x5046
+#define POWERFAIL_AVG_SHIFT     10      // [-] Bus voltage average over 1024 PWM periods
+
+static powerfailRecord_t image[2];
+static const powerfailRecord_t *volatile imageReady;   // Record to commit, NULL = none yet
+static uint32_t slotAddr;               // Pre-erased slot, 0 = none
+static uint32_t vbatAvg;                // [ADC << POWERFAIL_AVG_SHIFT]
+static uint8_t lowCnt;                  // [-] Consecutive samples below the level
+static volatile uint8_t done;           // 1 = record written, 2 = time stamps written
+static uint32_t commitStamp;            // [cycles] DWT at the commit start
+
+/* =========================== Local Functions =========================== */
+
+static uint16_t powerfail_crc(const void *data, uint16_t len) {
+	const uint8_t *p = (const uint8_t*) data;
+	uint16_t crc = 0xFFFF;
+	uint8_t bit;
+
+	while (len--) {
+		crc ^= (uint16_t) *p++ << 8;
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static uint8_t powerfail_valid(const powerfailRecord_t *r) {
+	return r->magic == POWERFAIL_MAGIC && r->commit == 0x0000
+			&& r->crc == powerfail_crc(r, offsetof(powerfailRecord_t, crc));
+}
+
+static uint8_t powerfail_blank(uint8_t slot) {
+	const uint32_t *w = (const uint32_t*) POWERFAIL_ADDR(slot);
+	uint16_t i;
+
+	for (i = 0; i < POWERFAIL_SLOT_SIZE / 4; i++) {
+		if (w[i] != 0xFFFFFFFF) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static uint8_t powerfail_erase(uint8_t page) {
+	FLASH_EraseInitTypeDef erase;
+	uint32_t error;
+	HAL_StatusTypeDef status;
+
+	erase.TypeErase = FLASH_TYPEERASE_PAGES;
+	erase.Banks = FLASH_BANK_1;
+	erase.PageAddress = POWERFAIL_ADDR(page * POWERFAIL_SLOTS);
+	erase.NbPages = 1;
+	HAL_FLASH_Unlock();
+	status = HAL_FLASHEx_Erase(&erase, &error);
+	HAL_FLASH_Lock();
+	return status == HAL_OK;
+}
+
+/*
+ * Flash ready for programming, whatever the main loop was doing with it
+ */
+static void powerfail_unlock(void) {
+	while (FLASH->SR & FLASH_SR_BSY) {  // program or erase of the main loop
+	}
+	if (FLASH->CR & FLASH_CR_LOCK) {
+		FLASH->KEYR = FLASH_KEY1;
+		FLASH->KEYR = FLASH_KEY2;
+	}
+	FLASH->CR &= ~(FLASH_CR_PER | FLASH_CR_MER);
+	FLASH->CR |= FLASH_CR_PG;
+}
+
+static void powerfail_program(uint32_t addr, uint16_t data) {
+	*(volatile uint16_t*) addr = data;
+	while (FLASH->SR & FLASH_SR_BSY) {
+	}
+	FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+}
+
+/* =========================== Initialization Functions =========================== */
+
+/*
+ * Restore the energy counters of the last record (energy accounting Init) and prepare the next slot
+ */
+void powerfail_init(void) {
+	const powerfailRecord_t *r, *last = NULL;
+	const uint16_t *stamp;
+	uint8_t slot, lastSlot = 0, page;
+	uint16_t i;
+
+	for (slot = 0; slot < 2 * POWERFAIL_SLOTS; slot++) {
+		r = (const powerfailRecord_t*) POWERFAIL_ADDR(slot);
+		if (powerfail_valid(r) && (last == NULL || r->seq > last->seq)) {
+			last = r;
+			lastSlot = slot;
+		}
+	}
+	if (last != NULL) {
+		energy_init(&last->lifetime);
+		powerfailCount = last->seq;
+		stamp = (const uint16_t*) (last + 1);
+		for (i = 0; i < POWERFAIL_STAMPS && stamp[i] != 0xFFFF; i++) {
+		}
+		powerfailCommitUs = i ? stamp[0] : 0;
+		powerfailHoldupUs = i ? stamp[i - 1] : 0;
+	} else {
+		energy_init(NULL);
+	}
+
+	// Next slot: first blank one after the last record, else the first of the other page, erased
+	for (i = 1; i <= 2 * POWERFAIL_SLOTS && !powerfail_blank((lastSlot + i) % (2 * POWERFAIL_SLOTS)); i++) {
+	}
+	slot = (lastSlot + i) % (2 * POWERFAIL_SLOTS);
+	if (i > 2 * POWERFAIL_SLOTS) {
+		page = (last != NULL) ? (lastSlot / POWERFAIL_SLOTS) ^ 1 : 0;
+		slot = page * POWERFAIL_SLOTS;
+		if (!powerfail_erase(page)) {
+			return;                     // slotAddr = 0: no save
+		}
+	}
+	slotAddr = POWERFAIL_ADDR(slot);
+
+	// Time stamps of the measurement
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	powerfail_update();
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Bus collapse detection, to be called by the FOC interrupt on every PWM period
+ * Input: vbat = raw ADC sample of the bus voltage
+ */
+void powerfail_step(uint16_t vbat) {
+	uint32_t avg = vbatAvg >> POWERFAIL_AVG_SHIFT;
+
+	if (vbatAvg == 0) {
+		vbatAvg = (uint32_t) vbat << POWERFAIL_AVG_SHIFT;
+		return;
+	}
+	if ((uint32_t) vbat * 100U < avg * (100U - POWERFAIL_DROP)) {
+		if (++lowCnt < POWERFAIL_SAMPLES) {
+			return;                     // average frozen until confirmed
+		}
+		if (avg >= POWERFAIL_VBAT_MIN && imageReady != NULL && slotAddr != 0 && !done) {
+			enable = 0;
+			powerfail_commit();
+			powerfail_measure();
+			NVIC_SystemReset();         // Still running: voltage dip, restart from the record just written
+		}
+	}
+	lowCnt = 0;
+	vbatAvg += vbat;
+	vbatAvg -= avg;
+}
+
+/*
+ * Serialize the record for the next commit (main loop, every POWERFAIL_PERIOD)
+ */
+void powerfail_update(void) {
+	powerfailRecord_t *r = (imageReady == &image[0]) ? &image[1] : &image[0];
+
+	r->magic = POWERFAIL_MAGIC;
+	r->reserved = 0;
+	r->seq = powerfailCount + 1;
+	energy_getLifetime(&r->lifetime);
+	r->crc = powerfail_crc(r, offsetof(powerfailRecord_t, crc));
+	r->commit = 0xFFFF;
+	imageReady = r;                     // single store: the interrupt sees either complete image
+}
+
+/*
+ * Write the serialized record. PWM outputs and interrupts are left off: to be followed by a reset or the poweroff
+ */
+void powerfail_commit(void) {
+	const uint16_t *hw;
+	uint8_t i;
+
+	TIM1->BDTR &= ~TIM_BDTR_MOE;        // the FOC interrupt stops updating the duty cycles
+	__disable_irq();
+	commitStamp = DWT->CYCCNT;
+	if (done || slotAddr == 0 || imageReady == NULL) {
+		return;
+	}
+	hw = (const uint16_t*) imageReady;
+	powerfail_unlock();
+	for (i = 0; i < offsetof(powerfailRecord_t, commit) / 2; i++) {
+		powerfail_program(slotAddr + 2 * i, hw[i]);
+	}
+	powerfail_program(slotAddr + offsetof(powerfailRecord_t, commit), 0x0000);
+	done = 1;
+}
+
+/*
+ * Time stamps after the record written by powerfail_commit, until the supply dies or the slot is full
+ */
+void powerfail_measure(void) {
+	uint32_t cyclesPerUs = SystemCoreClock / 1000000U;
+	uint32_t stamp, us;
+	uint16_t i;
+
+	if (done != 1) {
+		return;
+	}
+	done = 2;
+	for (i = 0; i < POWERFAIL_STAMPS; i++) {
+		stamp = DWT->CYCCNT;
+		us = (stamp - commitStamp) / cyclesPerUs;
+		powerfail_program(slotAddr + sizeof(powerfailRecord_t) + 2 * i, (uint16_t) MIN(us, 0xFFFE));
+		while (DWT->CYCCNT - stamp < POWERFAIL_STAMP_US * cyclesPerUs) {
+		}
+	}
+}
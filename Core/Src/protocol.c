@@ -0,0 +1,197 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Display protocol helpers: receive stream parser, frame check byte and little-endian field access.
+ * The frame layouts are generated from the schema in protocol.h.
+ *
+ * Receive parser: the bytes are fed one by one from the USART DMA circular buffer, independently of the IDLE
+ * events. A frame starts with SERIAL_START_FRAME_DISPLAY_TO_ESC, its length is given by the Type byte and it
+ * ends with the check byte. On a check byte error, the parser restarts from the next start frame byte already
+ * received, so a noise byte or a truncated frame only loses that frame. Any Type is accepted: the original
+ * displays do not set the Type of the command frame, so an unassigned Type is a command frame.
+ * All the received frames have the same length, so a restarted frame can never be complete yet.
+ *
+ * Check byte (SERIAL_CRC_TYPE):
+ * - 0: XOR of all the bytes, as expected by the original displays
+ * - 1: CRC-8 (polynomial 0x07, init 0x00), table driven. Detects all burst errors up to 8 bits, unlike the XOR.
+ * Both cost one table or XOR operation per byte. The STM32F1 CRC unit only computes a CRC-32 over 32-bit words,
+ * which does not fit the byte-oriented frames and the single check byte. There is no CRC-16: it would need a second
+ * check byte, changing the length of every frame that the original displays send and expect.
+ */
+
+// Includes
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "protocol.h"
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#if SERIAL_CRC_TYPE == 1
+static const uint8_t crc8Table[256] = {
+		0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+		0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+		0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5, 0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+		0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85, 0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+		0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2, 0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+		0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2, 0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+		0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32, 0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+		0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42, 0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+		0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C, 0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+		0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC, 0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+		0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C, 0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+		0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C, 0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+		0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B, 0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+		0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B, 0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+		0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB, 0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+		0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB, 0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3
+};
+#endif
+
+/* =========================== Local Functions =========================== */
+
+/*
+ * Drop the first byte and restart from the next start frame in the buffer
+ */
+static void protocol_resync(protocolParser_t *p) {
+	uint8_t i;
+
+	for (i = 1; i < p->len && p->buf[i] != SERIAL_START_FRAME_DISPLAY_TO_ESC; i++);
+	p->skipped += i;
+	p->len -= i;
+	memmove(p->buf, &p->buf[i], p->len);
+	p->need = (p->len >= 2) ? protocol_rxLength(p->buf[1]) : 0;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Length of a received frame from its Type [bytes], the command frame for an unassigned Type. At most PROTOCOL_RX_MAX.
+ */
+uint8_t protocol_rxLength(uint8_t type) {
+	switch (type) {
+	case SERIAL_TYPE_CURVE:
+		return sizeof(SerialCurveFromDisplayToEsc);
+	case SERIAL_TYPE_BAUD:
+		return sizeof(SerialBaudFromDisplayToEsc);
+	case SERIAL_TYPE_PARAM:
+		return sizeof(SerialParamFromDisplayToEsc);
+	case SERIAL_TYPE_LOG:
+		return sizeof(SerialLogFromDisplayToEsc);
+	case SERIAL_TYPE_CHAIN_CMD:
+		return sizeof(SerialChainCmd);
+	case SERIAL_TYPE_CHAIN_STATUS:
+		return sizeof(SerialChainStatus);
+	default:
+		return sizeof(SerialFromDisplayToEsc);     // command frame, the display Type is not checked
+	}
+}
+
+void protocol_parserReset(protocolParser_t *p) {
+	p->len = 0;
+	p->need = 0;
+}
+
+/*
+ * Feed one received byte
+ * Output: 1 when p->buf holds a complete frame with a valid check byte, until the next call
+ */
+uint8_t protocol_parse(protocolParser_t *p, uint8_t byte) {
+	if (p->len == 0 && byte != SERIAL_START_FRAME_DISPLAY_TO_ESC) {
+		p->skipped++;
+		return 0;
+	}
+	p->buf[p->len++] = byte;
+
+	if (p->len == 2) {
+		p->need = protocol_rxLength(byte);
+	}
+	if (p->len < 2 || p->len < p->need) {
+		return 0;
+	}
+
+	if (protocol_check(p->buf, p->need)) {
+		p->frames++;
+		p->len = 0;
+		p->need = 0;
+		return 1;
+	}
+	p->crcErrors++;
+	protocol_resync(p);
+	return 0;
+}
+
+/*
+ * Check byte over len bytes
+ */
+uint8_t protocol_crc(const void *data, uint16_t len) {
+	return protocol_crcUpdate(0, data, len);
+}
+
+/*
+ * Check byte continued over len more bytes, for data produced in pieces
+ */
+uint8_t protocol_crcUpdate(uint8_t crc, const void *data, uint16_t len) {
+	const uint8_t *ptr = (const uint8_t*) data;
+
+	while (len--) {
+#if SERIAL_CRC_TYPE == 1
+		crc = crc8Table[crc ^ *ptr++];
+#else
+		crc ^= *ptr++;
+#endif
+	}
+	return crc;
+}
+
+/*
+ * Write the check byte of a frame (last byte)
+ */
+void protocol_seal(void *frame, uint16_t size) {
+	((uint8_t*) frame)[size - 1] = protocol_crc(frame, size - 1);
+}
+
+/*
+ * Output: 1 if the check byte of the frame is correct
+ */
+uint8_t protocol_check(const void *frame, uint16_t size) {
+	return ((const uint8_t*) frame)[size - 1] == protocol_crc(frame, size - 1);
+}
+
+void protocol_put16(uint8_t *dst, uint16_t val) {
+	dst[0] = val & 0xff;
+	dst[1] = (val >> 8) & 0xff;
+}
+
+void protocol_put32(uint8_t *dst, uint32_t val) {
+	dst[0] = val & 0xff;
+	dst[1] = (val >> 8) & 0xff;
+	dst[2] = (val >> 16) & 0xff;
+	dst[3] = (val >> 24) & 0xff;
+}
+
+uint16_t protocol_get16(const uint8_t *src) {
+	return (uint16_t) (src[0] | (src[1] << 8));
+}
+
+uint32_t protocol_get32(const uint8_t *src) {
+	return (uint32_t) src[0] | ((uint32_t) src[1] << 8) | ((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24);
+}
+
@@ -0,0 +1,115 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regenerative braking (TORQUE mode).
+ *
+ * Main loop (regen_request): the brake pedal requests a braking torque up to the display Brake_torque
+ * (percent of full torque, REGEN_TORQUE_MAX when the display sends 0). The request is rate limited and faded
+ * out between REGEN_SPEED_FULL and REGEN_SPEED_MIN, so that the friction brake takes over at standstill.
+ *
+ * FOC interrupt (regen_step): when the torque target opposes the motion, it is scaled down as long as
+ * - the bus voltage is above the REGEN_CELL_V_MAX ceiling (full battery), or
+ * - the battery charge current is above REGEN_I_BAT_MAX.
+ * The battery current is estimated from the phase current and the modulation, approximated by the ratio of the
+ * speed to the no-load speed at the present bus voltage: I_bat = I_phase * n / (MOTOR_KV * V_bat).
+ * The phase current is the controller iq of the previous period (analog.curr_dc is filtered over ~0.2 s, too slow
+ * for this loop). The scale drops in ~20 ms and recovers in ~500 ms.
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "regen.h"
+
+//------------------------------------------------------------------------
+// Global variables set here in regen.c
+//------------------------------------------------------------------------
+int32_t regenCurrent;                   // [mA] Estimated battery charge current
+uint16_t regenScale = 32768;            // [-] Regen torque scale from the battery limits, fixdt(0,16,15)
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define REGEN_SCALE_ONE     32768                                       // [-] 1.0 in fixdt(0,16,15)
+#define REGEN_SCALE_DROP    (REGEN_SCALE_ONE / (PWM_FREQ / 50))         // [-/period] 1.0 to 0 in 20 ms
+#define REGEN_SCALE_RISE    (REGEN_SCALE_ONE / (PWM_FREQ / 2))          // [-/period] 0 to 1.0 in 500 ms
+#define REGEN_IQ_TO_MA(iq)  (((int32_t) (iq) * 1000) / (A2BIT_CONV * 16))  // [mA] from iq, fixdt(1,16,4)
+#define REGEN_V_CEIL_ADC    (((REGEN_CELL_V_MAX / 10) * BAT_CELLS * BAT_CALIB_ADC) / BAT_CALIB_REAL_VOLTAGE)   // [ADC count]
+
+static int16_t regenMax = REGEN_TORQUE_MAX;     // [-] Braking torque at full brake [0, 1000]
+static int16_t regenReq;                // [-] Rate limited braking torque request (magnitude)
+static int32_t vbatFilt;                // [ADC count] fixdt(1,32,4)
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Braking torque from the display [%]. 0 selects REGEN_TORQUE_MAX.
+ */
+void regen_setMax(uint8_t brakeTorque) {
+	regenMax = brakeTorque ? MIN(brakeTorque, 100) * 10 : REGEN_TORQUE_MAX;
+}
+
+/*
+ * Input:  brakeIn = brake request [-1000, 1000], already signed against the motion, speedAbs [rpm]
+ * Output: braking torque request, same sign as brakeIn
+ */
+int16_t regen_request(int16_t brakeIn, int16_t speedAbs) {
+	int32_t req;
+
+	req = ((int32_t) ABS(brakeIn) * regenMax) / 1000;
+	if (speedAbs <= REGEN_SPEED_MIN) {
+		req = 0;
+	} else if (speedAbs < REGEN_SPEED_FULL) {
+		req = (req * (speedAbs - REGEN_SPEED_MIN)) / (REGEN_SPEED_FULL - REGEN_SPEED_MIN);
+	}
+	regenReq = (int16_t) ((req > regenReq) ? MIN(regenReq + REGEN_RATE, req) : req);   // release at once
+
+	return (brakeIn < 0) ? -regenReq : regenReq;
+}
+
+/*
+ * To be called by the FOC interrupt on every PWM period
+ * Input:  target = torque target, speed [rpm], vbat = battery ADC value (not filtered), iq from the controller
+ * Output: torque target with the regen limits applied
+ */
+int16_t regen_step(int16_t target, int16_t speed, int16_t vbat, int16_t iq) {
+	int32_t nNoLoad;
+	uint8_t over;
+
+	vbatFilt += (((int32_t) vbat << 4) - vbatFilt) >> 4;    // ~1 ms
+
+	if (target == 0 || speed == 0 || (target > 0) == (speed > 0)) {    // not braking
+		regenCurrent = 0;
+		regenScale = MIN(regenScale + REGEN_SCALE_RISE, REGEN_SCALE_ONE);
+		return target;
+	}
+
+	nNoLoad = MAX(((vbatFilt >> 4) * BAT_CALIB_REAL_VOLTAGE * MOTOR_KV) / (BAT_CALIB_ADC * 100), 1);   // [rpm]
+	regenCurrent = (REGEN_IQ_TO_MA(ABS(iq)) * ABS(speed)) / nNoLoad;
+	over = (vbatFilt >> 4) > REGEN_V_CEIL_ADC || regenCurrent > REGEN_I_BAT_MAX;
+
+	if (over) {
+		regenScale = MAX(regenScale - REGEN_SCALE_DROP, 0);
+	} else {
+		regenScale = MIN(regenScale + REGEN_SCALE_RISE, REGEN_SCALE_ONE);
+	}
+
+	return (int16_t) (((int32_t) target * regenScale) >> 15);
+}
+
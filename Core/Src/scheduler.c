@@ -0,0 +1,177 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Static cooperative scheduler for the main loop.
+ * - tasks are declared once in a table (period, deadline, priority) and never added at runtime
+ * - on each dispatch the highest priority released task is executed, then the table is scanned again
+ * - execution time is measured with the DWT cycle counter, response time from the task release tick
+ * The FOC loop is NOT scheduled here: it runs in the ADC DMA interrupt and preempts every task.
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "scheduler.h"
+
+//------------------------------------------------------------------------
+// Global variables set here in scheduler.c
+//------------------------------------------------------------------------
+uint16_t schedLoad;                     // [0.1 %] CPU load of the main loop tasks over the last second
+uint16_t schedLoadMax;                  // [0.1 %] Highest measured load
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+static schedTask_t *schedTasks;
+static uint8_t schedNbTasks;
+
+static uint32_t cyclesPerUs;
+static uint32_t loadBusyCycles;         // [cycles] Busy cycles accumulated in the current load window
+static uint32_t loadWindowStart;        // [cycles] Start of the current load window
+
+#define SCHED_LOAD_WINDOW_MS    1000    // [ms] Load measurement window
+
+/* =========================== Initialization Functions =========================== */
+
+/*
+ * Initialize the scheduler with a static task table.
+ * The table is sorted by priority in place so the dispatcher only needs a linear scan.
+ */
+void sched_init(schedTask_t *tasks, uint8_t nbTasks) {
+	uint8_t i, j;
+	schedTask_t tmp;
+	uint32_t now;
+
+	// Insertion sort by priority (stable, table is small)
+	for (i = 1; i < nbTasks; i++) {
+		tmp = tasks[i];
+		j = i;
+		while (j > 0 && tasks[j - 1].priority > tmp.priority) {
+			tasks[j] = tasks[j - 1];
+			j--;
+		}
+		tasks[j] = tmp;
+	}
+
+	// Enable the DWT cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	cyclesPerUs = SystemCoreClock / 1000000U;
+
+	now = HAL_GetTick();
+	for (i = 0; i < nbTasks; i++) {
+		tasks[i].release = now;
+	}
+
+	schedTasks = tasks;
+	schedNbTasks = nbTasks;
+	sched_resetStats();
+}
+
+/*
+ * Clear the runtime statistics of all tasks
+ */
+void sched_resetStats(void) {
+	uint8_t i;
+	for (i = 0; i < schedNbTasks; i++) {
+		schedTasks[i].runCnt = 0;
+		schedTasks[i].cyclesLast = 0;
+		schedTasks[i].cyclesMax = 0;
+		schedTasks[i].cyclesAvg = 0;
+		schedTasks[i].responseMax = 0;
+		schedTasks[i].deadlineMiss = 0;
+		schedTasks[i].releaseSkip = 0;
+	}
+	schedLoad = schedLoadMax = 0;
+	loadBusyCycles = 0;
+	loadWindowStart = DWT->CYCCNT;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Current value of the free running cycle counter (wraps every ~67 s at 64 MHz)
+ */
+uint32_t sched_cycles(void) {
+	return DWT->CYCCNT;
+}
+
+/*
+ * Execute one task and update its statistics
+ */
+static void sched_execute(schedTask_t *task, uint32_t now) {
+	uint32_t lateMs = now - task->release;
+	uint32_t start, cycles, response;
+
+	// Next release. If the task is late by more than one period, drop the lost releases but keep the phase.
+	task->release += task->period;
+	while ((int32_t) (now - task->release) >= 0) {
+		task->release += task->period;
+		task->releaseSkip++;
+	}
+
+	start = DWT->CYCCNT;
+	task->fcn();
+	cycles = DWT->CYCCNT - start;
+
+	task->runCnt++;
+	task->cyclesLast = cycles;
+	if (cycles > task->cyclesMax) {
+		task->cyclesMax = cycles;
+	}
+	task->cyclesAvg = task->cyclesAvg - (task->cyclesAvg >> 4) + cycles; // 16 samples moving average, fixdt(0,32,4)
+
+	response = lateMs * 1000U + cycles / cyclesPerUs;
+	if (response > task->responseMax) {
+		task->responseMax = response;
+	}
+	if (response > (uint32_t) task->deadline * 1000U) {
+		task->deadlineMiss++;
+	}
+
+	loadBusyCycles += cycles;
+}
+
+/*
+ * Dispatcher: to be called continuously from the main loop.
+ * Runs every released task in priority order. After each task the scan restarts from the highest priority,
+ * so a high priority task released meanwhile is not delayed by lower priority ones.
+ */
+void sched_dispatch(void) {
+	uint8_t i;
+	uint32_t now, window;
+
+	for (i = 0; i < schedNbTasks; i++) {
+		now = HAL_GetTick();
+		if ((int32_t) (now - schedTasks[i].release) >= 0) {
+			sched_execute(&schedTasks[i], now);
+			i = 0xFF;                   // restart the scan (wraps to 0)
+		}
+	}
+
+	// CPU load over the measurement window
+	window = DWT->CYCCNT - loadWindowStart;
+	if (window >= SCHED_LOAD_WINDOW_MS * 1000U * cyclesPerUs) {
+		schedLoad = (uint16_t) (((uint64_t) loadBusyCycles * 1000U) / window);
+		schedLoadMax = MAX(schedLoadMax, schedLoad);
+		loadBusyCycles = 0;
+		loadWindowStart += window;
+	}
+}
+
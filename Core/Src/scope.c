@@ -0,0 +1,196 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Oscilloscope stream on USART1 (PB6, TX only), for waveform capture without a debugger.
+ *
+ * The FOC interrupt appends the selected signals (SCOPE_SIGNALS bit mask, int16 each) to a packet every
+ * SCOPE_DECIMATION PWM periods. A full packet is handed to the USART1 TX DMA and the next samples go to the
+ * other buffer (ping-pong). If the DMA is still sending the other buffer, the full packet is dropped and its
+ * sequence number is lost: the host sees the gap.
+ *
+ * Packet, little endian:
+ *   0xAA 0x55 | seq (u16) | tick (u32) | signals (u16) | decimation (u8) | samples (u8) | samples x signals (i16) | check (u8)
+ * tick counts PWM periods (1 / PWM_FREQ) at the first sample. The check byte is the protocol.c check byte over all
+ * the previous bytes, updated with each sample to keep the interrupt time constant.
+ * A host decoder is in tests_scripts/scope_decode.py.
+ *
+ * The DMA channel is driven with registers: the USART1 interrupt is not enabled, so the HAL UART transmit state
+ * would never return to ready.
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "BLDC_controller.h"
+#include "protocol.h"
+#include "scope.h"
+
+//------------------------------------------------------------------------
+// Global variables set externally
+//------------------------------------------------------------------------
+extern UART_HandleTypeDef huart1;
+extern volatile adc_buf_t adc_buffer;
+extern ExtU rtU_Motor;
+extern ExtY rtY_Motor;
+
+//------------------------------------------------------------------------
+// Global variables set here in scope.c
+//------------------------------------------------------------------------
+uint16_t scopeSignals = SCOPE_SIGNALS;          // [-] Streamed signals, SCOPE_SIGNALS bit mask
+uint8_t scopeDecimation = SCOPE_DECIMATION;     // [-] One sample every scopeDecimation PWM periods
+uint32_t scopeDropped;                          // [-] Packets dropped because the previous one was still in transmission
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define SCOPE_HEADER        12                  // [bytes]
+#define SCOPE_PAYLOAD       240                 // [bytes] Sample space per packet
+#define SCOPE_PACKET_MAX    (SCOPE_HEADER + SCOPE_PAYLOAD + 1)
+#define SCOPE_DMA           DMA1_Channel4       // USART1_TX
+
+// Signal sources, in SCOPE_SIGNALS bit order
+static const volatile int16_t *const scopeSrc[] = {
+	&analog.curr_a_cnt,                         // bit 0: phase A current [ADC count]
+	&analog.curr_b_cnt,                         // bit 1: phase B current [ADC count]
+	&rtY_Motor.iq,                              // bit 2: iq, fixdt(1,16,4)
+	&rtY_Motor.id,                              // bit 3: id, fixdt(1,16,4)
+	&rtY_Motor.a_elecAngle,                     // bit 4: electrical angle, fixdt(1,16,4) [deg]
+	&rtY_Motor.DC_phaA,                         // bit 5: phase A duty
+	&rtY_Motor.DC_phaB,                         // bit 6: phase B duty
+	&rtY_Motor.DC_phaC,                         // bit 7: phase C duty
+	&rtY_Motor.n_mot,                           // bit 8: speed [rpm]
+	&rtU_Motor.r_inpTgt,                        // bit 9: controller target
+	(const volatile int16_t*) &adc_buffer.vbat, // bit 10: battery voltage [ADC count]
+};
+
+static uint8_t packet[2][SCOPE_PACKET_MAX] __attribute__((aligned(4)));
+static uint8_t fillIdx;                 // [-] Buffer being filled
+static uint16_t fillPos;                // [bytes] Write position in the buffer being filled
+static uint16_t packetLen;              // [bytes] Length of the packet being filled, check byte included
+static uint8_t nbSignals;               // [-] Signals of the packet being filled
+static uint16_t signals;                // [-] Signal mask of the packet being filled
+static uint8_t crc;                     // [-] Check byte of the packet being filled
+static uint16_t seq;
+static uint32_t tick;                   // [PWM periods]
+static uint8_t decimCnt;
+
+/* =========================== Local Functions =========================== */
+
+static uint8_t scope_dmaBusy(void) {
+	return (SCOPE_DMA->CCR & DMA_CCR_EN) && SCOPE_DMA->CNDTR != 0;
+}
+
+static void scope_dmaStart(const uint8_t *buf, uint16_t len) {
+	SCOPE_DMA->CCR &= ~DMA_CCR_EN;
+	DMA1->IFCR = DMA_IFCR_CGIF4;
+	SCOPE_DMA->CPAR = (uint32_t) &huart1.Instance->DR;
+	SCOPE_DMA->CMAR = (uint32_t) buf;
+	SCOPE_DMA->CNDTR = len;
+	SCOPE_DMA->CCR |= DMA_CCR_EN;
+}
+
+/*
+ * Start a packet in the fill buffer, with the present signal selection
+ */
+static void scope_packetStart(void) {
+	uint8_t *p = packet[fillIdx];
+	uint8_t i, samples;
+
+	signals = scopeSignals & ((1U << ARRAY_LEN(scopeSrc)) - 1);
+	for (nbSignals = 0, i = 0; i < ARRAY_LEN(scopeSrc); i++) {
+		nbSignals += (signals >> i) & 1;
+	}
+	samples = (nbSignals > 0) ? SCOPE_PAYLOAD / (2 * nbSignals) : 0;
+
+	p[0] = 0xAA;
+	p[1] = 0x55;
+	protocol_put16(&p[2], seq);
+	protocol_put32(&p[4], tick);
+	protocol_put16(&p[8], signals);
+	p[10] = scopeDecimation;
+	p[11] = samples;
+	fillPos = SCOPE_HEADER;
+	packetLen = SCOPE_HEADER + 2 * nbSignals * samples + 1;
+	seq++;
+}
+
+/* =========================== Initialization Functions =========================== */
+
+/*
+ * USART1 at SCOPE_BAUD (APB2 clock), TX DMA requests enabled
+ */
+void scope_init(void) {
+	__HAL_UART_DISABLE(&huart1);
+	huart1.Init.BaudRate = SCOPE_BAUD;
+	huart1.Instance->BRR = UART_BRR_SAMPLING16(HAL_RCC_GetPCLK2Freq(), SCOPE_BAUD);
+	SET_BIT(huart1.Instance->CR3, USART_CR3_DMAT);
+	__HAL_UART_ENABLE(&huart1);
+
+	fillIdx = 0;
+	scope_packetStart();
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * To be called by the FOC interrupt on every PWM period, after the controller step
+ */
+void scope_sample(void) {
+	uint8_t *p;
+	uint8_t i;
+
+	tick++;
+	if (nbSignals == 0) {
+		if (scopeSignals != signals) {
+			scope_packetStart();        // new signal selection
+		}
+		return;
+	}
+	if (++decimCnt < scopeDecimation) {
+		return;
+	}
+	decimCnt = 0;
+
+	p = packet[fillIdx];
+	if (fillPos == SCOPE_HEADER) {
+		protocol_put32(&p[4], tick);    // time of the first sample
+		crc = protocol_crc(p, SCOPE_HEADER);
+	}
+	for (i = 0; i < ARRAY_LEN(scopeSrc); i++) {
+		if (signals & (1U << i)) {
+			*(int16_t*) &p[fillPos] = *scopeSrc[i];
+			crc = protocol_crcUpdate(crc, &p[fillPos], 2);
+			fillPos += 2;
+		}
+	}
+	if (fillPos < packetLen - 1) {
+		return;
+	}
+
+	// Packet complete
+	p[fillPos] = crc;
+	if (scope_dmaBusy()) {
+		scopeDropped++;                 // overwrite it, the sequence gap shows the loss
+	} else {
+		scope_dmaStart(p, packetLen);
+		fillIdx ^= 1;
+	}
+	scope_packetStart();
+}
+
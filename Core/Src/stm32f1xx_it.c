@@ -24,6 +24,9 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "util.h"
+#include "config.h"
+#include "duplex.h"
+#include "link.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -53,6 +56,7 @@
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
+extern UART_HandleTypeDef huart1;
 extern UART_HandleTypeDef huart2;
 extern UART_HandleTypeDef huart3;
 /* USER CODE END 0 */
@@ -305,14 +309,22 @@ void TIM4_IRQHandler(void)
 void USART3_IRQHandler(void)
 {
   /* USER CODE BEGIN USART3_IRQn 0 */
-
+#ifdef BAUD_NEGOTIATION_ENABLE
+  uint32_t sr = huart3.Instance->SR;                              // Receive error flags, cleared with the IDLE flag below
+#endif
   /* USER CODE END USART3_IRQn 0 */
   HAL_UART_IRQHandler(&huart3);
   /* USER CODE BEGIN USART3_IRQn 1 */
 
   if(RESET != __HAL_UART_GET_IT_SOURCE(&huart3, UART_IT_IDLE)) {  // Check for IDLE line interrupt
+#ifdef BAUD_NEGOTIATION_ENABLE
+      link_rxStatus(sr);                                          // Count the receive errors (error interrupts are disabled)
+#endif
       __HAL_UART_CLEAR_IDLEFLAG(&huart3);                         // Clear IDLE line flag (otherwise it will continue to enter interrupt)
       usart3_rx_check();                                          // Check for data to process
+#ifdef HALF_DUPLEX_ENABLE
+      duplex_idle();                                              // Reply slot after a display frame
+#endif
   }
 
   /* USER CODE END USART3_IRQn 1 */
@@ -320,5 +332,20 @@ void USART3_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+#ifdef CHAIN_ENABLE
+/**
+  * @brief This function handles USART1 global interrupt (ESC chain).
+  */
+void USART1_IRQHandler(void)
+{
+  HAL_UART_IRQHandler(&huart1);
+
+  if(RESET != __HAL_UART_GET_IT_SOURCE(&huart1, UART_IT_IDLE)) {  // Check for IDLE line interrupt
+      __HAL_UART_CLEAR_IDLEFLAG(&huart1);                         // Clear IDLE line flag (otherwise it will continue to enter interrupt)
+      usart1_rx_check(1);                                         // Check for data to process, IDLE time stamp
+  }
+}
+#endif
+
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,356 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Calibration store: log of versioned records protected by a CRC, in STORE_NB_PAGES flash pages from
+ * STORE_PAGE_FIRST, after the two pages of the EEPROM emulation. A record holds a whole config struct (ADC
+ * offsets, hall table, motor R / L / flux, gains, curves) of up to a page, where the EEPROM emulation holds
+ * 16-bit variables.
+ *
+ * Page: header of 4 half-words, then the records
+ *   | seq low | seq high | check | STORE_MAGIC |     seq: position of the page in the log, check = low ^ high ^ magic
+ * Record: header of 4 half-words, then the data padded to a half-word
+ *   | size | id + (version << 8) | CRC | commit |   size in bytes, CRC-16/CCITT of size, id, version and data
+ *
+ * - write: the record is appended to the head page, size first (from then on the space is used, even if the
+ *   write is cut), the commit half-word 0x0000 last. A record is valid with its commit and a matching CRC, so
+ *   after a power loss the previous record of the ID stays the latest. A write of the version and data of the
+ *   latest record is skipped
+ * - page change and garbage collection: one page is always erased. When the head page is full, the erased page
+ *   becomes the head with the next seq, the records of the oldest page that are still the latest of their ID
+ *   are copied to it, then the oldest page is erased. The erases go round the pages, and the live records of a
+ *   page always fit in an empty page
+ * - boot (store_init): the pages are scanned in seq order into a RAM index of the latest valid record of each
+ *   ID, store_read is a direct lookup. A page with an invalid header that is not fully erased (page change or
+ *   erase cut) is erased, and a cut garbage collection (no erased page left) is finished
+ * store_write stalls the CPU, the FOC interrupt included, while the flash is programmed (about 50 us per
+ * half-word) and for about 20 ms per page erase: write with the motor stopped.
+ * tests_scripts/store_sim.c runs this file on the host against a model of the flash, with power losses.
+ */
+
+// Includes
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "store.h"
+
+//------------------------------------------------------------------------
+// Global variables set here in store.c
+//------------------------------------------------------------------------
+uint32_t storeErases;                   // [-] Page erases since boot
+uint32_t storeSeq;                      // [-] Sequence number of the head page, incremented at each page change
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define STORE_BASE          (FLASH_BASE + STORE_PAGE_FIRST * FLASH_PAGE_SIZE)
+#define STORE_PAGE(page)    (STORE_BASE + (uint32_t) (page) * FLASH_PAGE_SIZE)
+#define STORE_HW(addr)      (*(__IO uint16_t*) (addr))
+#define STORE_MAGIC         0x5354      // "ST"
+#define STORE_HEADER        8           // [bytes] Page and record headers
+#define STORE_SPAN(size)    (STORE_HEADER + (((uint32_t) (size) + 1) & ~1U))   // [bytes] Record and its header
+#define STORE_SEQ_ERASED    0xFFFFFFFF
+#define STORE_NONE          0           // storeIndex of an ID without record: offset of the first page header
+
+static uint32_t storePageSeq[STORE_NB_PAGES];   // Sequence number of each page, STORE_SEQ_ERASED if erased
+static uint16_t storeIndex[STORE_NB_ID];        // [bytes] Latest record of each ID, offset from STORE_BASE
+static uint8_t storeHead;                       // Page appended to
+static uint16_t storeFree;                      // [bytes] Offset of the free space in the head page
+
+_Static_assert(STORE_NB_PAGES >= 2, "STORE_NB_PAGES: one page is kept erased");
+_Static_assert(STORE_NB_PAGES * FLASH_PAGE_SIZE <= 0x10000, "storeIndex offsets are 16-bit");
+_Static_assert(STORE_NB_ID <= 256, "the ID is stored in 8 bits");
+
+/* =========================== Flash access =========================== */
+
+static uint16_t store_crc(uint16_t crc, const uint8_t *data, uint32_t len) {
+	uint8_t bit;
+
+	while (len--) {
+		crc ^= (uint16_t) *data++ << 8;
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static uint16_t store_recordCrc(uint16_t size, uint16_t tag, const uint8_t *data) {
+	uint8_t head[4] = { size, size >> 8, tag, tag >> 8 };
+
+	return store_crc(store_crc(0xFFFF, head, sizeof(head)), data, size);
+}
+
+static uint8_t store_program(uint32_t addr, uint16_t value) {
+	if (value == 0xFFFF) {
+		return STORE_OK;                // already erased
+	}
+	return (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, addr, value) == HAL_OK) ? STORE_OK : STORE_ERR_FLASH;
+}
+
+static uint8_t store_erase(uint8_t page) {
+	FLASH_EraseInitTypeDef erase;
+	uint32_t error;
+
+	erase.TypeErase = FLASH_TYPEERASE_PAGES;
+	erase.Banks = FLASH_BANK_1;
+	erase.PageAddress = STORE_PAGE(page);
+	erase.NbPages = 1;
+	storePageSeq[page] = STORE_SEQ_ERASED;
+	storeErases++;
+	return (HAL_FLASHEx_Erase(&erase, &error) == HAL_OK) ? STORE_OK : STORE_ERR_FLASH;
+}
+
+/*
+ * First erased page, STORE_NB_PAGES if none
+ */
+static uint8_t store_erased(void) {
+	uint8_t page;
+
+	for (page = 0; page < STORE_NB_PAGES && storePageSeq[page] != STORE_SEQ_ERASED; page++);
+	return page;
+}
+
+/*
+ * Makes an erased page the head page: seq first, magic last
+ */
+static uint8_t store_open(uint8_t page, uint32_t seq) {
+	uint32_t base = STORE_PAGE(page);
+	uint8_t status;
+
+	status = store_program(base, (uint16_t) seq);
+	if (status == STORE_OK) {
+		status = store_program(base + 2, (uint16_t) (seq >> 16));
+	}
+	if (status == STORE_OK) {
+		status = store_program(base + 4, (uint16_t) seq ^ (uint16_t) (seq >> 16) ^ STORE_MAGIC);
+	}
+	if (status == STORE_OK) {
+		status = store_program(base + 6, STORE_MAGIC);
+	}
+	if (status != STORE_OK) {
+		store_erase(page);
+		return status;
+	}
+	storePageSeq[page] = seq;
+	storeSeq = seq;
+	storeHead = page;
+	storeFree = STORE_HEADER;
+	return STORE_OK;
+}
+
+/*
+ * Scans the records of a page, adding the valid ones to the index if 'index'
+ * Output: offset of the free space, FLASH_PAGE_SIZE if full
+ */
+static uint16_t store_scan(uint8_t page, uint8_t index) {
+	uint32_t base = STORE_PAGE(page);
+	uint32_t off = STORE_HEADER;
+	uint16_t size, tag;
+
+	while (off + STORE_HEADER <= FLASH_PAGE_SIZE && (size = STORE_HW(base + off)) != 0xFFFF) {
+		if (off + STORE_SPAN(size) > FLASH_PAGE_SIZE) {
+			return FLASH_PAGE_SIZE;     // size cut while programmed
+		}
+		tag = STORE_HW(base + off + 2);
+		if (index && STORE_HW(base + off + 6) == 0x0000 && (tag & 0xFF) < STORE_NB_ID
+				&& STORE_HW(base + off + 4) == store_recordCrc(size, tag, (const uint8_t*) (base + off + STORE_HEADER))) {
+			storeIndex[tag & 0xFF] = page * FLASH_PAGE_SIZE + off;
+		}
+		off += STORE_SPAN(size);
+	}
+	return off;
+}
+
+/*
+ * Appends a record to the head page, room checked by the caller. The index points to it once committed
+ */
+static uint8_t store_append(uint16_t size, uint16_t tag, const uint8_t *data) {
+	uint32_t addr = STORE_PAGE(storeHead) + storeFree;
+	uint16_t head[3] = { size, tag, store_recordCrc(size, tag, data) };
+	uint16_t i;
+	uint8_t status = STORE_OK;
+
+	storeFree += STORE_SPAN(size);      // used from the first half-word on
+	for (i = 0; i < 3 && status == STORE_OK; i++) {
+		status = store_program(addr + 2 * i, head[i]);
+	}
+	for (i = 0; i < size && status == STORE_OK; i += 2) {
+		status = store_program(addr + STORE_HEADER + i, data[i] | ((i + 1 < size) ? data[i + 1] << 8 : 0xFF00));
+	}
+	if (status == STORE_OK) {
+		status = store_program(addr + 6, 0x0000);  // commit
+	}
+	if (status == STORE_OK) {
+		storeIndex[tag & 0xFF] = addr - STORE_BASE;
+	}
+	return status;
+}
+
+/*
+ * Garbage collection: copies the latest records of the oldest page to the head page, then erases it
+ */
+static uint8_t store_collect(void) {
+	uint8_t oldest = storeHead, page, id;
+	uint8_t status = STORE_OK;
+	uint32_t addr;
+
+	for (page = 0; page < STORE_NB_PAGES; page++) {
+		if (storePageSeq[page] < storePageSeq[oldest]) {
+			oldest = page;
+		}
+	}
+	if (oldest == storeHead) {
+		return STORE_ERR_FULL;
+	}
+	for (id = 0; id < STORE_NB_ID && status == STORE_OK; id++) {
+		if (storeIndex[id] != STORE_NONE && storeIndex[id] / FLASH_PAGE_SIZE == oldest) {
+			addr = STORE_BASE + storeIndex[id];
+			if (storeFree + STORE_SPAN(STORE_HW(addr)) > FLASH_PAGE_SIZE) {
+				status = STORE_ERR_FULL;
+			} else {
+				status = store_append(STORE_HW(addr), STORE_HW(addr + 2), (const uint8_t*) (addr + STORE_HEADER));
+			}
+		}
+	}
+	if (status == STORE_OK) {
+		status = store_erase(oldest);
+	}
+	return status;
+}
+
+/*
+ * Page change: the erased page becomes the head page, then the oldest page is collected if no page is left erased
+ */
+static uint8_t store_next(void) {
+	uint8_t page = store_erased();
+	uint8_t status;
+
+	if (page == STORE_NB_PAGES) {
+		return STORE_ERR_FULL;
+	}
+	status = store_open(page, storeSeq + 1);
+	if (status == STORE_OK && store_erased() == STORE_NB_PAGES) {
+		status = store_collect();
+	}
+	return status;
+}
+
+/* =========================== Interface =========================== */
+
+void store_init(void) {
+	uint8_t order[STORE_NB_PAGES];      // Valid pages by seq
+	uint8_t page, i, n = 0;
+	uint32_t base, k;
+
+	memset(storeIndex, 0, sizeof(storeIndex));
+	HAL_FLASH_Unlock();
+	for (page = 0; page < STORE_NB_PAGES; page++) {
+		base = STORE_PAGE(page);
+		storePageSeq[page] = STORE_SEQ_ERASED;
+		if (STORE_HW(base + 6) == STORE_MAGIC && (STORE_HW(base) ^ STORE_HW(base + 2) ^ STORE_MAGIC) == STORE_HW(base + 4)) {
+			storePageSeq[page] = STORE_HW(base) | ((uint32_t) STORE_HW(base + 2) << 16);
+			for (i = n++; i > 0 && storePageSeq[order[i - 1]] > storePageSeq[page]; i--) {
+				order[i] = order[i - 1];
+			}
+			order[i] = page;
+		} else {
+			for (k = 0; k < FLASH_PAGE_SIZE && *(__IO uint32_t*) (base + k) == 0xFFFFFFFF; k += 4);
+			if (k < FLASH_PAGE_SIZE) {
+				store_erase(page);      // page change or erase cut
+			}
+		}
+	}
+
+	if (n == 0) {
+		storeSeq = 0;
+		store_open(0, 1);
+	} else {
+		for (i = 0; i < n; i++) {
+			storeFree = store_scan(order[i], 1);
+		}
+		storeHead = order[n - 1];
+		storeSeq = storePageSeq[storeHead];
+		if (store_erased() == STORE_NB_PAGES) {
+			store_collect();            // garbage collection cut
+		}
+	}
+	HAL_FLASH_Lock();
+}
+
+/*
+ * Version and size of the latest record of an ID, e.g. to convert a struct of a previous version
+ */
+uint8_t store_info(uint8_t id, uint8_t *version, uint16_t *size) {
+	uint32_t addr;
+
+	if (id >= STORE_NB_ID) {
+		return STORE_ERR_ID;
+	}
+	if (storeIndex[id] == STORE_NONE) {
+		return STORE_ERR_NONE;
+	}
+	addr = STORE_BASE + storeIndex[id];
+	*size = STORE_HW(addr);
+	*version = STORE_HW(addr + 2) >> 8;
+	return STORE_OK;
+}
+
+uint8_t store_read(uint8_t id, uint8_t version, void *data, uint16_t size) {
+	uint8_t stored;
+	uint16_t storedSize;
+	uint8_t status = store_info(id, &stored, &storedSize);
+
+	if (status == STORE_OK && stored != version) {
+		status = STORE_ERR_VERSION;
+	} else if (status == STORE_OK && storedSize != size) {
+		status = STORE_ERR_SIZE;
+	} else if (status == STORE_OK) {
+		memcpy(data, (const void*) (STORE_BASE + storeIndex[id] + STORE_HEADER), size);
+	}
+	return status;
+}
+
+uint8_t store_write(uint8_t id, uint8_t version, const void *data, uint16_t size) {
+	uint16_t tag = id | ((uint16_t) version << 8);
+	uint32_t addr;
+	uint8_t status = STORE_OK, tries;
+
+	if (id >= STORE_NB_ID) {
+		return STORE_ERR_ID;
+	}
+	if (STORE_SPAN(size) > FLASH_PAGE_SIZE - STORE_HEADER) {
+		return STORE_ERR_SIZE;
+	}
+	if (storeIndex[id] != STORE_NONE) {
+		addr = STORE_BASE + storeIndex[id];
+		if (STORE_HW(addr) == size && STORE_HW(addr + 2) == tag && memcmp((const void*) (addr + STORE_HEADER), data, size) == 0) {
+			return STORE_OK;            // unchanged
+		}
+	}
+
+	HAL_FLASH_Unlock();
+	for (tries = 0; status == STORE_OK && storeFree + STORE_SPAN(size) > FLASH_PAGE_SIZE; tries++) {
+		status = (tries < STORE_NB_PAGES) ? store_next() : STORE_ERR_FULL;
+	}
+	if (status == STORE_OK) {
+		status = store_append(size, tag, (const uint8_t*) data);
+	}
+	HAL_FLASH_Lock();
+	return status;
+}
@@ -0,0 +1,257 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compact telemetry to the display (SERIAL_TYPE_TELEMETRY), replacing the fixed SerialFromEscToDisplay frame.
+ *
+ * A frame carries tag / value records for the present fields only (see SERIAL_TELEMETRY_FIELDS in protocol.h):
+ * - fast fields (speed, current, voltage, commands) are sent when their value changed, and at least every
+ *   TELEMETRY_REFRESH frames,
+ * - slow fields rotate across the frames, TELEMETRY_SLOW_PER_FRAME per frame. A changed slow field is sent first.
+ * A typical frame is 10 - 20 bytes instead of 59, so it can be sent every DELAY_IN_MAIN_LOOP instead of every
+ * 4 * DELAY_IN_MAIN_LOOP. A frame is only built when the previous one is sent, and the sent values are only
+ * recorded when the transmission starts.
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "BLDC_controller.h"
+#include "protocol.h"
+#include "thermal.h"
+#include "battery.h"
+#include "curve.h"
+#include "duplex.h"
+#include "chain.h"
+#include "bms.h"
+#include "telemetry.h"
+
+//------------------------------------------------------------------------
+// Global variables set externally
+//------------------------------------------------------------------------
+extern UART_HandleTypeDef huart3;
+extern ExtY rtY_Motor;
+extern int16_t batVoltage;
+extern int16_t board_temp_deg_c;
+extern int16_t cmdThrottle;
+extern int16_t cmdBrake;
+
+//------------------------------------------------------------------------
+// Global variables set here in telemetry.c
+//------------------------------------------------------------------------
+uint32_t telemetryFrames;               // [-] Telemetry frames sent
+uint32_t telemetryBytes;                // [bytes] Telemetry bytes sent
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define TLM_FAST                0
+#define TLM_SLOW                1
+#define TELEMETRY_VERSION       0x0100  // [-] Major 0x00, minor 0x01, as in the feedback frame
+
+#define TLM_ENUM(name, tag, size, cls)      name,
+#define TLM_TAG(name, tag, size, cls)       tag,
+#define TLM_SIZE(name, tag, size, cls)      size,
+#define TLM_CLASS(name, tag, size, cls)     cls,
+
+enum {
+	SERIAL_TELEMETRY_FIELDS(TLM_ENUM)
+	TLM_COUNT
+};
+
+static const uint8_t tlmTag[TLM_COUNT] = { SERIAL_TELEMETRY_FIELDS(TLM_TAG) };
+static const uint8_t tlmSize[TLM_COUNT] = { SERIAL_TELEMETRY_FIELDS(TLM_SIZE) };
+static const uint8_t tlmClass[TLM_COUNT] = { SERIAL_TELEMETRY_FIELDS(TLM_CLASS) };
+
+static uint8_t frame[SERIAL_TELEMETRY_HEADER + TELEMETRY_PAYLOAD_MAX + 1];
+static int32_t lastSent[TLM_COUNT];     // [-] Last value sent per field
+static uint8_t age[TLM_COUNT];          // [frames] Frames since the field was sent
+static uint8_t slowIdx;                 // [-] Next slow field of the rotation
+
+/* =========================== Local Functions =========================== */
+
+/*
+ * Output: 1 if the field is present, its value in *val
+ */
+static uint8_t telemetry_value(uint8_t idx, int32_t *val) {
+	switch (idx) {
+	case TLM_SPEED:
+		*val = rtY_Motor.n_mot;
+		return 1;
+	case TLM_CURRENT:
+#ifdef CHAIN_ENABLE
+		*val = chain_current(analog.curr_dc);  // all the ESCs of the chain
+#else
+		*val = analog.curr_dc;
+#endif
+		return 1;
+	case TLM_VOLTAGE:
+		*val = (batVoltage * BAT_CALIB_REAL_VOLTAGE) / BAT_CALIB_ADC;
+		return 1;
+	case TLM_THROTTLE:
+		*val = cmdThrottle >> 2;
+		return 1;
+	case TLM_BRAKE:
+		*val = cmdBrake >> 2;
+		return 1;
+	case TLM_TEMP_BOARD:
+#ifdef CHAIN_ENABLE
+		*val = chain_temperature(board_temp_deg_c / 10);
+#else
+		*val = board_temp_deg_c / 10;
+#endif
+		return 1;
+#ifdef THERMAL_DERATING_ENABLE
+	case TLM_TEMP_MOTOR:
+		*val = motorTempEst / 10;
+		return 1;
+#endif
+	case TLM_ERRORS:
+#ifdef CHAIN_ENABLE
+		*val = chain_errors(rtY_Motor.z_errCode);
+#else
+		*val = rtY_Motor.z_errCode;
+#endif
+		return 1;
+#ifdef BATTERY_MODEL_ENABLE
+	case TLM_SOC:
+		*val = batterySoc;
+		return 1;
+#endif
+#if defined(THERMAL_DERATING_ENABLE) && defined(BATTERY_MODEL_ENABLE)
+	case TLM_LIMIT:
+		*val = (MIN(thermalScale, batteryScale) * 100) >> 15;
+		return 1;
+#elif defined(THERMAL_DERATING_ENABLE)
+	case TLM_LIMIT:
+		*val = (thermalScale * 100) >> 15;
+		return 1;
+#elif defined(BATTERY_MODEL_ENABLE)
+	case TLM_LIMIT:
+		*val = (batteryScale * 100) >> 15;
+		return 1;
+#endif
+#ifdef CURVE_ENGINE_ENABLE
+	case TLM_RIDE_MODE:
+		*val = curveMode;
+		return 1;
+#endif
+	case TLM_VERSION:
+		*val = TELEMETRY_VERSION;
+		return 1;
+#ifdef BMS_ENABLE
+	case TLM_CELL_MIN:
+		*val = bmsData.cellMin;
+		return bmsData.valid && bmsData.cellMin != 0xFFFF;
+#endif
+	default:
+		return 0;
+	}
+}
+
+/* =========================== Initialization Functions =========================== */
+
+void telemetry_init(void) {
+	uint8_t i;
+
+	for (i = 0; i < TLM_COUNT; i++) {
+		age[i] = TELEMETRY_REFRESH;     // send everything once
+	}
+	slowIdx = 0;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Build and send one telemetry frame
+ */
+void telemetry_send(void) {
+	int32_t val[TLM_COUNT];
+	uint8_t present[TLM_COUNT];
+	uint8_t picked[TLM_COUNT];
+	uint8_t sel[TLM_COUNT];
+	uint8_t nSel = 0, nSlow = 0;
+	uint8_t len = 0;
+	uint8_t i, k, b;
+
+	if (huart3.gState != HAL_UART_STATE_READY) {   // previous frame still in flight
+		return;
+	}
+
+	for (i = 0; i < TLM_COUNT; i++) {
+		present[i] = telemetry_value(i, &val[i]);
+		picked[i] = 0;
+	}
+
+	// Fast fields: changed or refresh due
+	for (i = 0; i < TLM_COUNT; i++) {
+		if (tlmClass[i] == TLM_FAST && present[i] && (val[i] != lastSent[i] || age[i] >= TELEMETRY_REFRESH)
+				&& len + 1 + tlmSize[i] <= TELEMETRY_PAYLOAD_MAX) {
+			picked[i] = 1;
+			sel[nSel++] = i;
+			len += 1 + tlmSize[i];
+		}
+	}
+
+	// Slow fields: the changed ones first (pass 0), then the rotation (pass 1)
+	for (b = 0; b < 2; b++) {
+		for (k = 0; k < TLM_COUNT && nSlow < TELEMETRY_SLOW_PER_FRAME; k++) {
+			i = (slowIdx + k) % TLM_COUNT;
+			if (tlmClass[i] != TLM_SLOW || !present[i] || picked[i] || (b == 0 && val[i] == lastSent[i])
+					|| len + 1 + tlmSize[i] > TELEMETRY_PAYLOAD_MAX) {
+				continue;
+			}
+			picked[i] = 1;
+			sel[nSel++] = i;
+			len += 1 + tlmSize[i];
+			nSlow++;
+			if (b == 1) {
+				slowIdx = (i + 1) % TLM_COUNT;
+			}
+		}
+	}
+
+	// Frame
+	frame[0] = SERIAL_START_FRAME_ESC_TO_DISPLAY;
+	frame[1] = SERIAL_TYPE_TELEMETRY;
+	frame[2] = len;
+	len = SERIAL_TELEMETRY_HEADER;
+	for (k = 0; k < nSel; k++) {
+		i = sel[k];
+		frame[len++] = tlmTag[i];
+		for (b = 0; b < tlmSize[i]; b++) {
+			frame[len++] = (uint8_t) (val[i] >> (8 * b));
+		}
+	}
+	len++;                              // check byte
+	protocol_seal(frame, len);
+
+	if (!duplex_send(frame, len, DUPLEX_PRIO_PERIODIC)) {
+		return;
+	}
+	telemetryFrames++;
+	telemetryBytes += len;
+	for (i = 0; i < TLM_COUNT; i++) {
+		age[i] = (age[i] < 255) ? age[i] + 1 : 255;
+	}
+	for (k = 0; k < nSel; k++) {
+		lastSent[sel[k]] = val[sel[k]];
+		age[sel[k]] = 0;
+	}
+}
+
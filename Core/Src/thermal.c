@@ -0,0 +1,147 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Thermal derating of the motor current limit.
+ * Two temperatures are supervised:
+ * - the board (MOSFET) NTC, filtered in the main loop, only with THERMAL_BOARD_ENABLE (the NTC must be calibrated).
+ *   Limits from the display (Max_temperature_reduce / Max_temperature_shutdown) or TEMP_REDUCE / TEMP_SHUTDOWN
+ *   when the display sends 0.
+ * - the motor winding, estimated with a first-order I2t model driven by the measured iq:
+ *     rise[k+1] = rise[k] + (MOTOR_TEMP_RISE * (I / MOTOR_I_CONT)^2 - rise[k]) / MOTOR_TAU    (1 s steps)
+ *   The ambient temperature is the board temperature at power on (conservative after a warm restart), or
+ *   MOTOR_TEMP_AMBIENT without THERMAL_BOARD_ENABLE.
+ * Each temperature gives a scale: 1.0 below its reduce limit, linear down to 0 at its shutdown limit.
+ * The lowest scale is applied to the nominal i_max through a rate limiter, so the current limit moves smoothly.
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "thermal.h"
+
+//------------------------------------------------------------------------
+// Global variables set here in thermal.c
+//------------------------------------------------------------------------
+int16_t motorTempEst;                   // [0.1 °C] Estimated motor winding temperature
+uint16_t thermalScale = 32768;          // [-] Current limit scale applied to i_max, fixdt(0,16,15)
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+#define THERMAL_SCALE_ONE       32768                               // [-] 1.0 in fixdt(0,16,15)
+#define THERMAL_SCALE_STEP      (THERMAL_SCALE_ONE / (2000 / DELAY_IN_MAIN_LOOP))   // [-/tick] 0 to 1.0 in 2 s
+#define THERMAL_MODEL_SAMPLES   (1000 / DELAY_IN_MAIN_LOOP)         // [-] Samples per model step (1 s)
+#define THERMAL_I_CONT          (MOTOR_I_CONT * A2BIT_CONV * 16)    // [-] Continuous current in iq units, fixdt(1,16,4)
+
+static int16_t iMaxNom;                 // [-] Nominal i_max, fixdt(1,16,4)
+static int16_t ambient;                 // [0.1 °C]
+static int32_t motorRise;               // [0.1 °C] Winding temperature rise, fixdt(1,32,16)
+static uint64_t loadAcc;                // [-] Sum of (I / MOTOR_I_CONT)^2, fixdt(0,64,16)
+static uint16_t loadCnt;
+static int16_t boardReduce = TEMP_REDUCE * 10;      // [0.1 °C]
+static int16_t boardShutdown = TEMP_SHUTDOWN * 10;  // [0.1 °C]
+
+/* =========================== Local Functions =========================== */
+
+static uint16_t thermal_derate(int16_t temp, int16_t reduce, int16_t shutdown) {
+	if (temp <= reduce) {
+		return THERMAL_SCALE_ONE;
+	}
+	if (temp >= shutdown) {
+		return 0;
+	}
+	return (uint16_t) (((int32_t) (shutdown - temp) << 15) / (shutdown - reduce));
+}
+
+static void thermal_model(int16_t iq) {
+	int64_t target;
+
+	loadAcc += ((uint64_t) ((int32_t) iq * iq) << 16) / ((uint32_t) THERMAL_I_CONT * THERMAL_I_CONT);
+	if (++loadCnt < THERMAL_MODEL_SAMPLES) {
+		return;
+	}
+
+	target = (int64_t) (MOTOR_TEMP_RISE * 10) * (int64_t) (loadAcc / loadCnt);    // [0.1 °C] fixdt(1,64,16)
+	target = MIN(target, (int64_t) 3000 << 16);                                 // keep the state in range
+	motorRise += (int32_t) ((target - motorRise) / MOTOR_TAU);
+	loadAcc = 0;
+	loadCnt = 0;
+}
+
+/* =========================== Initialization Functions =========================== */
+
+/*
+ * Input: iMaxNominal = i_max without derating, boardTemp = board temperature [0.1 °C] used as ambient
+ */
+void thermal_init(int16_t iMaxNominal, int16_t boardTemp) {
+	iMaxNom = iMaxNominal;
+#ifdef THERMAL_BOARD_ENABLE
+	ambient = boardTemp;
+#else
+	(void) boardTemp;
+	ambient = MOTOR_TEMP_AMBIENT * 10;
+#endif
+	motorRise = 0;
+	motorTempEst = ambient;
+	thermalScale = THERMAL_SCALE_ONE;
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * New nominal current limit, e.g. after a limits update
+ */
+void thermal_setNominal(int16_t iMaxNominal) {
+	iMaxNom = iMaxNominal;
+}
+
+/*
+ * Board limits from the display [°C]. 0 or inconsistent values select the config.h limits.
+ */
+void thermal_setLimits(uint8_t reduce, uint8_t shutdown) {
+	if (reduce == 0 || shutdown <= reduce) {
+		reduce = TEMP_REDUCE;
+		shutdown = TEMP_SHUTDOWN;
+	}
+	boardReduce = reduce * 10;
+	boardShutdown = shutdown * 10;
+}
+
+/*
+ * To be called on every main loop tick
+ * Input:  boardTemp [0.1 °C], iq from the controller
+ * Output: derated i_max, fixdt(1,16,4)
+ */
+int16_t thermal_update(int16_t boardTemp, int16_t iq) {
+	uint16_t scale;
+
+	thermal_model(iq);
+	motorTempEst = ambient + (int16_t) (motorRise >> 16);
+
+	scale = thermal_derate(motorTempEst, MOTOR_TEMP_REDUCE * 10, MOTOR_TEMP_SHUTDOWN * 10);
+#ifdef THERMAL_BOARD_ENABLE
+	scale = MIN(scale, thermal_derate(boardTemp, boardReduce, boardShutdown));
+#else
+	(void) boardTemp;
+#endif
+	thermalScale = (uint16_t) STEP(thermalScale, scale, THERMAL_SCALE_STEP);
+
+	return (int16_t) (((int32_t) iMaxNom * thermalScale) >> 15);
+}
+
@@ -0,0 +1,179 @@
+/**
+ * This file is part of the SmartESC project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Traction control, executed in the FOC interrupt (TORQUE mode only).
+ *
+ * The hall speed of the controller (fixdt(1,16,4), updated on every hall transition) is sampled every 1 ms and
+ * differentiated over a sliding window. On the ground, the wheel acceleration cannot exceed what the commanded
+ * torque can give to the vehicle mass:
+ *     a_max [rad/s^2] = T / (m * r^2)
+ * A wheel accelerating (or decelerating under braking) faster than TRACTION_SLIP_GAIN * a_max + TRACTION_SLIP_MARGIN
+ * for TRACTION_SLIP_CONFIRM ms has lost grip: the torque is cut to TRACTION_CUT_LEVEL, held while the slip lasts
+ * plus TRACTION_HOLD ms, then restored linearly over TRACTION_RESTORE ms.
+ * The hall speed comes from the hall period counted in PWM periods: its quantization step grows with the square of
+ * the speed, and its derivative over the window with it. That noise is added to the limit, and below
+ * TRACTION_SPEED_MIN (a few hall transitions per window) there is no detection.
+ * The thresholds are tuned with tests_scripts/traction_sim.c (wheel and road friction model).
+ *
+ *   IDLE --slip confirmed--> CUT --no slip for TRACTION_HOLD--> RESTORE --scale back to 1.0--> IDLE
+ *                             ^                                    |
+ *                             +---------------slip-----------------+
+ */
+
+// Includes
+#include "stm32f1xx_hal.h"
+#include "defines.h"
+#include "config.h"
+#include "BLDC_controller.h"
+#include "traction.h"
+
+//------------------------------------------------------------------------
+// Global variables set here in traction.c
+//------------------------------------------------------------------------
+int32_t tractionAccel;                  // [rpm/s] Measured wheel acceleration
+int32_t tractionAccelMax;               // [rpm/s] Acceleration limit for the current torque request
+uint16_t tractionScale = 32768;         // [-] Torque scale applied by the traction control, fixdt(0,16,15)
+uint32_t tractionSlipCnt;               // [-] Number of detected slip events
+
+//------------------------------------------------------------------------
+// Local variables
+//------------------------------------------------------------------------
+extern P rtP_Left;
+
+#define TRACTION_SUBSAMPLE      (PWM_FREQ / 1000)   // [-] FOC periods per speed sample (1 ms)
+#define TRACTION_WINDOW         8                   // [ms] Derivative window, power of 2
+#define TRACTION_SCALE_ONE      32768               // [-] 1.0 in fixdt(0,16,15)
+#define TRACTION_SCALE_CUT      ((TRACTION_CUT_LEVEL * TRACTION_SCALE_ONE) / 100)
+#define TRACTION_RESTORE_STEP   ((TRACTION_SCALE_ONE - TRACTION_SCALE_CUT) / TRACTION_RESTORE)   // [-/ms]
+
+// Wheel acceleration at full torque request [rpm/s] = T * 60 / (2 * pi * m * r^2), with T in [0.1 Nm] and r in [mm]
+#define TRACTION_ACCEL_FULL     ((int32_t) (((int64_t) TRACTION_TORQUE_MAX * 60 * 1000000 * 100) \
+                                / (10LL * 628 * TRACTION_MASS * TRACTION_WHEEL_RADIUS * TRACTION_WHEEL_RADIUS)))
+
+typedef enum {
+	TC_IDLE = 0,
+	TC_CUT,
+	TC_RESTORE
+} tcState_t;
+
+static tcState_t tcState;
+static int16_t speedHist[TRACTION_WINDOW];  // [rpm] fixdt(1,16,4) speed samples
+static uint8_t histIdx;
+static uint8_t histFill;
+static uint8_t subCnt;
+static uint8_t slipConfirm;             // [ms] Consecutive samples over the limit
+static uint16_t holdCnt;                // [ms] Remaining cut time
+
+/* =========================== Local Functions =========================== */
+
+/*
+ * 1 ms sample: acceleration, slip detection and torque profile
+ */
+static void traction_sample(int16_t target, int16_t speedFixdt) {
+	int16_t speedOld;
+	int32_t accel, noise;
+	uint32_t speed;
+	uint8_t slip;
+
+	speedOld = speedHist[histIdx];
+	speedHist[histIdx] = speedFixdt;
+	histIdx = (histIdx + 1) & (TRACTION_WINDOW - 1);
+	if (histFill < TRACTION_WINDOW) {
+		histFill++;
+		return;
+	}
+
+	// Acceleration in the direction of the torque request
+	accel = ((int32_t) (speedFixdt - speedOld) * (1000 / TRACTION_WINDOW)) >> 4;
+	tractionAccel = accel;
+	if (target < 0) {
+		accel = -accel;
+	}
+	// Speed quantization [rpm] = speed^2 * hall transitions per revolution / (60 * PWM_FREQ), over the window
+	speed = (uint32_t) ABS(speedFixdt) >> 4;
+	noise = (int32_t) ((speed * speed * 6U * rtP_Left.n_polePairs) / (60U * PWM_FREQ)) * (1000 / TRACTION_WINDOW);
+	tractionAccelMax = ((TRACTION_ACCEL_FULL * ABS(target)) / 1000) * TRACTION_SLIP_GAIN + TRACTION_SLIP_MARGIN
+			+ TRACTION_NOISE_GAIN * noise;
+	slip = (target != 0 && speed >= TRACTION_SPEED_MIN && accel > tractionAccelMax);
+
+	switch (tcState) {
+	case TC_IDLE:
+		slipConfirm = slip ? slipConfirm + 1 : 0;
+		if (slipConfirm >= TRACTION_SLIP_CONFIRM) {
+			slipConfirm = 0;
+			tractionSlipCnt++;
+			tractionScale = TRACTION_SCALE_CUT;
+			holdCnt = TRACTION_HOLD;
+			tcState = TC_CUT;
+		}
+		break;
+
+	case TC_CUT:
+		if (slip) {
+			holdCnt = TRACTION_HOLD;
+		} else if (holdCnt == 0 || --holdCnt == 0) {
+			tcState = TC_RESTORE;
+		}
+		break;
+
+	case TC_RESTORE:
+	default:
+		if (slip) {
+			tractionSlipCnt++;
+			tractionScale = TRACTION_SCALE_CUT;
+			holdCnt = TRACTION_HOLD;
+			tcState = TC_CUT;
+		} else if (tractionScale >= TRACTION_SCALE_ONE - TRACTION_RESTORE_STEP) {
+			tractionScale = TRACTION_SCALE_ONE;
+			tcState = TC_IDLE;
+		} else {
+			tractionScale += TRACTION_RESTORE_STEP;
+		}
+		break;
+	}
+}
+
+/* =========================== General Functions =========================== */
+
+/*
+ * Clear the detector, e.g. when the motor is disabled or not in TORQUE mode
+ */
+void traction_reset(void) {
+	tcState = TC_IDLE;
+	tractionScale = TRACTION_SCALE_ONE;
+	histFill = 0;
+	subCnt = 0;
+	slipConfirm = 0;
+}
+
+/*
+ * To be called by the FOC interrupt on every PWM period
+ * Input:  target = torque request, speedFixdt = hall speed in fixdt(1,16,4) [rpm]
+ * Output: torque request after traction control
+ */
+int16_t traction_step(int16_t target, int16_t speedFixdt) {
+	if (++subCnt >= TRACTION_SUBSAMPLE) {
+		subCnt = 0;
+		traction_sample(target, speedFixdt);
+	}
+	if (tractionScale >= TRACTION_SCALE_ONE) {
+		return target;
+	}
+	return (int16_t) (((int32_t) target * tractionScale) >> 15);
+}
+
@@ -25,6 +25,19 @@
 #include "config.h"
 #include "eeprom.h"
 #include "util.h"
+#include "button.h"
+#include "curve.h"
+#include "cmdpath.h"
+#include "energy.h"
+#include "thermal.h"
+#include "regen.h"
+#include "link.h"
+#include "duplex.h"
+#include "chain.h"
+#include "bms.h"
+#include "param.h"
+#include "eventlog.h"
+#include "powerfail.h"
 #include "main.h"
 #include "BLDC_controller.h"
 #include "rtwtypes.h"
@@ -35,6 +48,7 @@
 // Global variables set externally
 //------------------------------------------------------------------------
 extern volatile adc_buf_t adc_buffer;
+extern UART_HandleTypeDef huart1;
 extern UART_HandleTypeDef huart3;
 
 extern uint8_t enable;                  // global variable for motor enable
@@ -58,6 +72,8 @@ int16_t speedAvgAbs;                   // average measured speed in absolute
 uint8_t timeoutFlagADC = 0; // Timeout Flag for ADC Protection:    0 = OK, 1 = Problem detected (line disconnected or wrong ADC data)
 uint8_t timeoutFlagSerial = 0; // Timeout Flag for Rx Serial command: 0 = OK, 1 = Problem detected (line disconnected or wrong Rx data)
 
+protocolParser_t serialRxParser;        // USART3 receive parser and its frame / drop counters
+
 uint8_t ctrlModReqRaw = CTRL_MOD_REQ;
 uint8_t ctrlModReq = CTRL_MOD_REQ;  // Final control mode request
 
@@ -75,20 +91,27 @@ static uint8_t inp_cal_valid = 0;
 
 static uint8_t rx_buffer_R[SERIAL_BUFFER_SIZE]; // USART Rx DMA circular buffer
 static uint32_t rx_buffer_R_len = ARRAY_LEN(rx_buffer_R);
+#ifdef CHAIN_ENABLE
+static uint8_t rx_buffer_C[SERIAL_BUFFER_SIZE]; // USART1 Rx DMA circular buffer, ESC chain
+static protocolParser_t chainRxParser;          // USART1 receive parser
+#endif
 
 static uint16_t timeoutCntSerial_R = 0; // Timeout counter for Rx Serial command
 static uint8_t timeoutFlagSerial_R = 0; // Timeout Flag for Rx Serial command: 0 = OK, 1 = Problem detected (line disconnected or wrong Rx data)
 
 static SerialFromEscToDisplay feedback;
+#ifdef TRIP_FRAME_ENABLE
+static SerialTripFromEscToDisplay feedbackTrip;
+#endif
 static SerialFromDisplayToEsc command;
-static SerialFromDisplayToEsc command_raw;
-static uint32_t command_len = sizeof(command);
 
 static uint8_t brakePressed;
 
 static uint8_t cruiseCtrlAcv = 0;
 static uint8_t standstillAcv = 0;
 
+static button_t pwrButton;
+
 // Matlab defines - from auto-code generation
 //---------------
 extern RT_MODEL *const rtM_Motor;
@@ -113,6 +136,12 @@ void Input_Init(void) {
 
 	HAL_UART_Receive_DMA(&huart3, (uint8_t*) rx_buffer_R, sizeof(rx_buffer_R));
 	UART_DisableRxErrors(&huart3);
+#ifdef CHAIN_ENABLE
+	HAL_UART_Receive_DMA(&huart1, (uint8_t*) rx_buffer_C, sizeof(rx_buffer_C));
+	UART_DisableRxErrors(&huart1);
+#endif
+
+	button_init(&pwrButton);
 
 #if KX
   #if !defined(VARIANT_HOVERBOARD) && !defined(VARIANT_TRANSPOTTER)
@@ -223,6 +252,9 @@ void updateCurSpdLim(void) {
   if (INPUT1_TYP_CAL != 0){
     // Update current limit
     rtP_Left.i_max = rtP_Right.i_max  = (int16_t)((I_MOT_MAX * A2BIT_CONV * cur_factor) >> 12);    // fixdt(0,16,16) to fixdt(1,16,4)
+    #ifdef THERMAL_DERATING_ENABLE
+    thermal_setNominal(rtP_Left.i_max);
+    #endif
     cur_spd_valid   = 1;  // Mark update to be saved in Flash at shutdown
   }
 
@@ -254,9 +286,11 @@ void updateCurSpdLim(void) {
 void saveConfig() {
 	if (inp_cal_valid || cur_spd_valid) {
 		HAL_FLASH_Unlock();
+		EE_BatchBegin();
 		EE_WriteVariable(VirtAddVarTab[0], FLASH_WRITE_KEY);
 		EE_WriteVariable(VirtAddVarTab[1], rtP_Left.i_max);
 		EE_WriteVariable(VirtAddVarTab[2], rtP_Left.n_max);
+		EE_BatchEnd();
 		HAL_FLASH_Lock();
 	}
 }
@@ -355,34 +389,37 @@ void cruiseControl(uint8_t button) {
 
 void poweroff(void) {
   enable = 0;
+#ifdef EVENTLOG_ENABLE
+  eventlog_flush();       // staged events
+#endif
+#ifdef POWERFAIL_ENABLE
+  powerfail_update();     // energy counters of the moment
+  powerfail_commit();
+#endif
   HAL_GPIO_WritePin(TPS_ENA_GPIO_Port, TPS_ENA_Pin, GPIO_PIN_RESET);
+#ifdef POWERFAIL_ENABLE
+  powerfail_measure();    // hold-up time of the logic supply
+#endif
 	while (1) {
 	}
 }
 
+/*
+ * Power button check, called periodically by the scheduler.
+ * The button state machine is non-blocking: the control loop and the serial link keep running while the button is held.
+ */
 void poweroffPressCheck(void) {
-    if(HAL_GPIO_ReadPin(PWR_BTN_GPIO_Port, PWR_BTN_Pin)) {
-      enable = 0;
-      uint16_t cnt_press = 0;
-      while(HAL_GPIO_ReadPin(PWR_BTN_GPIO_Port, PWR_BTN_Pin)) {
-        HAL_Delay(10);
-        cnt_press++;
-      }
-      if (cnt_press >= 2 * 100) {                         // Check if press is more than 5 sec
-#if KX
-        HAL_Delay(1000);
-        if (HAL_GPIO_ReadPin(PWR_BTN_GPIO_Port, PWR_BTN_Pin)) {  // Double press: Adjust Max Current, Max Speed
-          while(HAL_GPIO_ReadPin(PWR_BTN_GPIO_Port, PWR_BTN_Pin)) { HAL_Delay(10); }
-          updateCurSpdLim();
-        } else {                                          // Long press: Calibrate ADC Limits
-          adcCalibLim();
-        }
-      } else {
-#endif
-    	  // Short press: power off
-        poweroff();
-      }
-    }
+	switch (button_update(&pwrButton,
+			HAL_GPIO_ReadPin(PWR_BTN_GPIO_Port, PWR_BTN_Pin), HAL_GetTick())) {
+	case BTN_EVT_LONG:        // Long press: power off
+		poweroff();
+		break;
+	case BTN_EVT_DOUBLE:      // Double press: toggle the light
+		HAL_GPIO_TogglePin(LIGHT_GPIO_Port, LIGHT_Pin);
+		break;
+	default:
+		break;
+	}
 }
 
 /* =========================== Read Functions =========================== */
@@ -401,6 +438,21 @@ void readInput(void) {
 	if (speed_limit > 0)
 		rtP_Left.n_max = (speed_limit * 10) << 4;
 
+#ifdef THERMAL_DERATING_ENABLE
+	// temperature limits
+	thermal_setLimits(command.Max_temperature_reduce, command.Max_temperature_shutdown);
+#endif
+
+#ifdef REGEN_ENABLE
+	// braking torque
+	regen_setMax(command.Brake_torque);
+#endif
+
+#ifdef BMS_ENABLE
+	// BMS protocol
+	bms_setProtocol(command.BMS_protocol);
+#endif
+
 	// WARNING -- NOT final usage -- test only
 	if (command.Ligth_power == 1)
 		ctrlModReq = VLT_MODE;
@@ -455,81 +507,194 @@ void readCommand(void) {
 
 /*
  * Check for new data received on USART3 with DMA: refactored function from https://github.com/MaJerle/stm32-usart-uart-dma-rx-tx
- * - this function is called for every USART IDLE line detection, in the USART interrupt handler
+ * - this function is called for every USART IDLE line detection, in the USART interrupt handler,
+ *   and on the DMA half / full buffer events
  */
 void usart3_rx_check(void) {
 
 	static uint32_t old_pos;
 	uint32_t pos;
+	uint8_t byte;
+#ifdef CMD_LATENCY_MEASURE
+	cmdpath_idle();                                       // Stamp the frame for the latency measurement
+#endif
 	pos = rx_buffer_R_len - __HAL_DMA_GET_COUNTER(huart3.hdmarx); // Calculate current position in buffer
 
-	uint8_t *ptr;
-	if (pos != old_pos) {                       // Check change in received data
-		ptr = (uint8_t*) &command_raw; // Initialize the pointer with command_raw address
-		if (pos > old_pos && (pos - old_pos) == command_len) { // "Linear" buffer mode: check if current position is over previous one AND data length equals expected length
-			memcpy(ptr, &rx_buffer_R[old_pos], command_len); // Copy data. This is possible only if command_raw is contiguous! (meaning all the structure members have the same size)
-			usart_process_command(&command_raw, &command, 3);    // Process data
-		} else if ((rx_buffer_R_len - old_pos + pos) == command_len) { // "Overflow" buffer mode: check if data length equals expected length
-			memcpy(ptr, &rx_buffer_R[old_pos], rx_buffer_R_len - old_pos); // First copy data from the end of buffer
-			if (pos > 0) {        // Check and continue with beginning of buffer
-				ptr += rx_buffer_R_len - old_pos; // Move to correct position in command_raw
-				memcpy(ptr, &rx_buffer_R[0], pos);        // Copy remaining data
-			}
-			usart_process_command(&command_raw, &command, 3);    // Process data
+	while (old_pos != pos) {                              // Feed the new bytes to the parser, any number of frames
+		byte = rx_buffer_R[old_pos];
+		if (++old_pos == rx_buffer_R_len) {                 // Wrap around at the end of the circular buffer
+			old_pos = 0;
+		}
+#ifdef HALF_DUPLEX_ENABLE
+		if (duplex_echo(byte)) {                            // Own transmission read back on the single wire
+			continue;
+		}
+#endif
+		if (protocol_parse(&serialRxParser, byte)) {
+#ifdef HALF_DUPLEX_ENABLE
+			duplex_frameRx();                                 // Reply slot at the next IDLE event
+#endif
+			usart_process_command((SerialFromDisplayToEsc*) serialRxParser.buf, &command, 3);    // Process data
+		}
+	}
+
+}
+
+/*
+ * DMA half / full buffer events: drain the Rx buffer before it is overwritten when no IDLE line is seen
+ */
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart) {
+	if (huart == &huart3) {
+		usart3_rx_check();
+	}
+#ifdef CHAIN_ENABLE
+	if (huart == &huart1) {
+		usart1_rx_check(0);
+	}
+#endif
+}
+
+/*
+ * DMA transmission complete, last stop bit included: chain the next queued frame
+ */
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+	if (huart == &huart3) {
+		duplex_txCplt();
+	}
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
+	if (huart == &huart3) {
+		usart3_rx_check();
+	}
+#ifdef CHAIN_ENABLE
+	if (huart == &huart1) {
+		usart1_rx_check(0);
+	}
+#endif
+}
+
+#ifdef CHAIN_ENABLE
+/*
+ * Check for new data received on USART1 (ESC chain), same as usart3_rx_check
+ * Input: idle = 1 when called on the IDLE line detection, the event stamps the time reference of the chain
+ */
+void usart1_rx_check(uint8_t idle) {
+
+	static uint32_t old_pos;
+	uint32_t pos;
+	uint32_t stamp = chainTick;
+	uint8_t byte;
+
+	pos = ARRAY_LEN(rx_buffer_C) - __HAL_DMA_GET_COUNTER(huart1.hdmarx);
+
+	while (old_pos != pos) {
+		byte = rx_buffer_C[old_pos];
+		if (++old_pos == ARRAY_LEN(rx_buffer_C)) {
+			old_pos = 0;
+		}
+		if (protocol_parse(&chainRxParser, byte)
+				&& chain_rxFrame(chainRxParser.buf, stamp, idle && old_pos == pos)) {
+			usart_process_command((SerialFromDisplayToEsc*) chainRxParser.buf, &command, 1);    // Display frame forwarded by the master
 		}
 	}
 
-	old_pos = pos;                                        // Update old position
-	if (old_pos == rx_buffer_R_len) { // Check and manually update if we reached end of buffer
-		old_pos = 0;
+}
+#endif
+
+#ifdef FAST_CMD_PATH_ENABLE
+/*
+ * Fast command path: same input conditioning as the main loop (double pedal, brake against the motion and
+ * faded out at standstill), then the response curves. The result is handed to the FOC interrupt.
+ */
+static void usart_fast_command(const SerialFromDisplayToEsc *command_in) {
+	int16_t throttle = command_in->Throttle << 2;
+	int16_t brake = command_in->Brake << 2;
+	uint16_t blend = (uint16_t) (((CLAMP(speedAvgAbs,10,60) - 10) << 15) / 50); // same as speedBlend in main.c
+
+	if (brake > 30) {
+		throttle = (int16_t) ((throttle * blend) >> 15);
+	}
+	if (speedAvg > 0) {
+		brake = (int16_t) ((brake * blend) >> 15);
+	} else {
+		brake = (int16_t) ((-brake * blend) >> 15);
 	}
 
+	cmdpath_post(curve_evalThrottle(throttle, speedAvgAbs), curve_evalBrake(brake), inputMin, inputMax);
 }
+#endif
 
 /*
  * Process command Rx data
- * - if the command_in data is valid (correct START_FRAME and checksum) copy the command_in to command_out
+ * - command_in is a frame accepted by protocol_parse (start frame and check byte already verified)
+ * - a command frame is copied to command_out, the other frame types are dispatched to their module
  */
 void usart_process_command(SerialFromDisplayToEsc *command_in,
 		SerialFromDisplayToEsc *command_out, uint8_t usart_idx) {
 
-	uint8_t checksum;
+#ifdef CURVE_ENGINE_ENABLE
+	if (command_in->Frame_start == SERIAL_START_FRAME_DISPLAY_TO_ESC && command_in->Type == SERIAL_TYPE_CURVE) {
+		usart_process_curve((SerialCurveFromDisplayToEsc*) command_in);
+		return;
+	}
+#endif
+	if (command_in->Frame_start == SERIAL_START_FRAME_DISPLAY_TO_ESC && command_in->Type == SERIAL_TYPE_PARAM) {
+#ifdef PARAM_ENABLE
+		if (usart_idx == 3) {
+			param_request((SerialParamFromDisplayToEsc*) command_in);
+		}
+#endif
+		return;
+	}
+	if (command_in->Frame_start == SERIAL_START_FRAME_DISPLAY_TO_ESC && command_in->Type == SERIAL_TYPE_LOG) {
+#ifdef EVENTLOG_ENABLE
+		if (usart_idx == 3) {
+			eventlog_request((SerialLogFromDisplayToEsc*) command_in);
+		}
+#endif
+		return;
+	}
+	if (command_in->Frame_start == SERIAL_START_FRAME_DISPLAY_TO_ESC && command_in->Type == SERIAL_TYPE_BAUD) {
+#ifdef BAUD_NEGOTIATION_ENABLE
+		link_request(((SerialBaudFromDisplayToEsc*) command_in)->Baud_code);
+#endif
+		return;
+	}
 	if (command_in->Frame_start == SERIAL_START_FRAME_DISPLAY_TO_ESC) {
-		checksum = (uint16_t) (command_in->Frame_start //
-		//
-				^ command_in->Type                        //
-				^ command_in->Destination                 //
-				^ command_in->Number_of_ESC               //
-				^ command_in->BMS_protocol                //
-				^ command_in->ESC_Jumps                   //
-				^ command_in->Display_Version_Maj         //
-				^ command_in->Display_Version_Main        //
-				^ command_in->Power_ON                    //
-				^ command_in->Throttle                    //
-				^ command_in->Brake                       //
-				^ command_in->Torque                      //
-				^ command_in->Brake_torque                //
-				^ command_in->Lock                        //
-				^ command_in->Regulator                   //
-				^ command_in->Motor_direction             //
-				^ command_in->Hall_sensors_direction      //
-				^ command_in->Ligth_power                 //
-				^ command_in->Max_temperature_reduce      //
-				^ command_in->Max_temperature_shutdown    //
-				^ command_in->Speed_limit                 //
-				^ command_in->Motor_start_speed           //
-		);
-		if (command_in->CRC8 == checksum) {
-			*command_out = *command_in;
-			if (usart_idx == 3) {      // Sideboard USART3
-				timeoutCntSerial_R = 0;        // Reset timeout counter
-				timeoutFlagSerial_R = 0;        // Clear timeout flag
-			}
+#ifdef CHAIN_ENABLE
+		if (usart_idx == 3 && !chain_forward(command_in)) {
+			return;                    // Frame for other ESCs of the chain
+		}
+#endif
+		*command_out = *command_in;
+		if (usart_idx == 3 || usart_idx == 1) {      // Display on USART3, or through the ESC chain on USART1
+			timeoutCntSerial_R = 0;        // Reset timeout counter
+			timeoutFlagSerial_R = 0;        // Clear timeout flag
+#ifdef CMD_LATENCY_MEASURE
+			cmdpath_frameRx();
+#endif
+#ifdef FAST_CMD_PATH_ENABLE
+			usart_fast_command(command_out);
+#endif
 		}
 	}
 }
 
+#ifdef CURVE_ENGINE_ENABLE
+/*
+ * Process a response curve upload: the table is checked and queued, it is applied on the next control tick.
+ * The check byte was verified by protocol_parse.
+ */
+void usart_process_curve(SerialCurveFromDisplayToEsc *curve_in) {
+	curve_upload(curve_in->Ride_mode, curve_in->Table, curve_in->X, curve_in->Y,
+			curve_in->Rate_rise, curve_in->Rate_fall);
+}
+#endif
+
 void usart_send_from_esc_to_display() {
+	static uint16_t lastErrors;
+	uint16_t errors;
 	/*
 	 feedback.start = (uint16_t) SERIAL_START_FRAME_ESC_TO_DISPLAY;
 	 feedback.cmd1 = (int16_t) cmd1;
@@ -548,98 +713,79 @@ void usart_send_from_esc_to_display() {
 	uint16_t rpm = rtY_Motor.n_mot;
 
 	feedback.Frame_start = (uint16_t) SERIAL_START_FRAME_ESC_TO_DISPLAY;
-	feedback.Type = 0x01;
+	feedback.Type = SERIAL_TYPE_FEEDBACK;
 	feedback.ESC_Version_Maj = 0x00;
 	feedback.ESC_Version_Min = 0x01;
 	feedback.Throttle = cmdThrottle >> 2;
 	feedback.Brake = cmdBrake >> 2;
-	feedback.Controller_Voltage_LSB = batVoltageMillivolts & 0xff;
-	feedback.Controller_Voltage_MSB = (batVoltageMillivolts >> 8) & 0xff;
-	feedback.Controller_Current_LSB = analog.curr_dc & 0xff;
-	feedback.Controller_Current_MSB = (analog.curr_dc >> 8) & 0xff;
+	protocol_put16(feedback.Controller_Voltage, batVoltageMillivolts);
+#ifdef CHAIN_ENABLE
+	protocol_put16(feedback.Controller_Current, chain_current(analog.curr_dc));   // All the ESCs of the chain
+	feedback.MOSFET_temperature = chain_temperature(board_temp_deg_c / 10);
+	protocol_put16(feedback.Errors, chain_errors(rtY_Motor.z_errCode));
+#else
+	protocol_put16(feedback.Controller_Current, analog.curr_dc);
 	feedback.MOSFET_temperature = board_temp_deg_c / 10;
-	feedback.ERPM_LSB = rpm & 0xff;
-	feedback.ERPM_MSB = (rpm >> 8) & 0xff;
+#endif
+	protocol_put16(feedback.ERPM, rpm);
 	//feedback.Lock_status                                  ;
 	//feedback.Ligth_status                                 ;
 	//feedback.Regulator_status                             ;
-	//feedback.Phase_1_current_max_LSB                      ;
-	//feedback.Phase_1_current_max_MSB                      ;
-	//feedback.Phase_1_voltage_max_LSB                      ;
-	//feedback.Phase_1_voltage_max_MSB                      ;
-	//feedback.BMS_Version_Maj                              ;
-	//feedback.BMS_Version_Min                              ;
-	//feedback.BMS_voltage_LSB                              ;
-	//feedback.BMS_voltage_MSB                              ;
-	//feedback.BMS_Current_LSB                              ;
-	//feedback.BMS_Current_MSB                              ;
-
-	//if (__HAL_DMA_GET_COUNTER(huart3.hdmatx) == 0) {
-
-	feedback.CRC8 = (uint8_t) (
-	//
-			feedback.Frame_start	//
-			^ feedback.Type	//
-					^ feedback.ESC_Version_Maj	//
-					^ feedback.ESC_Version_Min	//
-					^ feedback.Throttle	//
-					^ feedback.Brake	//
-					^ feedback.Controller_Voltage_LSB	//
-					^ feedback.Controller_Voltage_MSB	//
-					^ feedback.Controller_Current_LSB	//
-					^ feedback.Controller_Current_MSB	//
-					^ feedback.MOSFET_temperature	//
-					^ feedback.ERPM_LSB	//
-					^ feedback.ERPM_MSB	//
-					^ feedback.Lock_status	//
-					^ feedback.Ligth_status	//
-					^ feedback.Regulator_status	//
-					^ feedback.Phase_1_current_max_LSB	//
-					^ feedback.Phase_1_current_max_MSB	//
-					^ feedback.Phase_1_voltage_max_LSB	//
-					^ feedback.Phase_1_voltage_max_MSB	//
-					^ feedback.BMS_Version_Maj	//
-					^ feedback.BMS_Version_Min	//
-					^ feedback.BMS_voltage_LSB	//
-					^ feedback.BMS_voltage_MSB	//
-					^ feedback.BMS_Current_LSB	//
-					^ feedback.BMS_Current_MSB	//
-					^ feedback.BMS_Cells_status_group_1	//
-					^ feedback.BMS_Cells_status_group_2	//
-					^ feedback.BMS_Cells_status_group_3	//
-					^ feedback.BMS_Cells_status_group_4	//
-					^ feedback.BMS_Cells_status_group_5	//
-					^ feedback.BMS_Cells_status_group_6	//
-					^ feedback.BMS_Cells_status_group_7	//
-					^ feedback.BMS_Cells_status_group_8	//
-					^ feedback.BMS_Cells_status_group_9	//
-					^ feedback.BMS_Cells_status_group_10	//
-					^ feedback.BMS_Cells_status_group_11	//
-					^ feedback.BMS_Cells_status_group_12	//
-					^ feedback.BMS_Cells_status_group_13	//
-					^ feedback.BMS_Cells_status_group_14	//
-					^ feedback.BMS_Cells_status_group_15	//
-					^ feedback.BMS_Cells_status_group_16	//
-					^ feedback.BMS_Cells_status_group_17	//
-					^ feedback.BMS_Cells_status_group_18	//
-					^ feedback.BMS_Cells_status_group_19	//
-					^ feedback.BMS_Cells_status_group_20	//
-					^ feedback.BMS_Cells_status_group_21	//
-					^ feedback.BMS_Cells_status_group_22	//
-					^ feedback.BMS_Cells_status_group_23	//
-					^ feedback.BMS_Cells_status_group_24	//
-					^ feedback.BMS_Battery_tempature_1	//
-					^ feedback.BMS_Battery_tempature_2	//
-					^ feedback.BMS_Charge_cycles_full_LSB	//
-					^ feedback.BMS_Charge_cycles_full_MSB	//
-					^ feedback.BMS_Charge_cycles_partial_LSB	//
-					^ feedback.BMS_Charge_cycles_partial_MSB	//
-					^ feedback.Errors_LSB	//
-					^ feedback.Errors_MSB	//
-			);
-
-	HAL_UART_Transmit_DMA(&huart3, (uint8_t*) &feedback, sizeof(feedback));
+	//feedback.Phase_1_current_max                          ;
+	//feedback.Phase_1_voltage_max                          ;
+#ifdef BMS_ENABLE
+	if (bmsData.valid) {
+		feedback.BMS_Version_Maj = (uint8_t) (bmsData.version >> 8);
+		feedback.BMS_Version_Min = (uint8_t) bmsData.version;
+		protocol_put16(feedback.BMS_voltage, bmsData.voltage);
+		protocol_put16(feedback.BMS_Current, (uint16_t) bmsData.current);
+		for (uint8_t i = 0; i < BAT_CELLS; i++) {
+			feedback.BMS_Cells_status[i] = (uint8_t) CLAMP((bmsData.cell[i] - 2000) / 10, 0, 255);
+		}
+		feedback.BMS_Battery_tempature_1 = (uint8_t) bmsData.temperature[0];
+		feedback.BMS_Battery_tempature_2 = (uint8_t) bmsData.temperature[1];
+		protocol_put16(feedback.BMS_Charge_cycles_full, bmsData.cyclesFull);
+		protocol_put16(feedback.BMS_Charge_cycles_partial, bmsData.cyclesPartial);
+	} else {
+		memset(feedback.BMS_Cells_status, 0, sizeof(feedback.BMS_Cells_status));
+		protocol_put16(feedback.BMS_voltage, 0);
+		protocol_put16(feedback.BMS_Current, 0);
+	}
+#endif
+
+	protocol_seal(&feedback, sizeof(feedback));
+
+	// A new error code goes ahead of the queued frames
+	errors = protocol_get16(feedback.Errors);
+	duplex_send((uint8_t*) &feedback, sizeof(feedback), (errors != lastErrors) ? DUPLEX_PRIO_FAULT : DUPLEX_PRIO_PERIODIC);
+	lastErrors = errors;
+}
+
+#ifdef TRIP_FRAME_ENABLE
+/*
+ * Trip and lifetime counters feedback, sent in place of a regular feedback frame
+ */
+void usart_send_trip_to_display(void) {
+	energy_update();
+
+	feedbackTrip.Frame_start = SERIAL_START_FRAME_ESC_TO_DISPLAY;
+	feedbackTrip.Type = SERIAL_TYPE_TRIP;
+	protocol_put32(feedbackTrip.Trip_distance, energyTrip.distance);
+	protocol_put32(feedbackTrip.Trip_drive_mAh, energyTrip.driveMah);
+	protocol_put32(feedbackTrip.Trip_regen_mAh, energyTrip.regenMah);
+	protocol_put32(feedbackTrip.Trip_drive_mWh, energyTrip.driveMwh);
+	protocol_put32(feedbackTrip.Trip_regen_mWh, energyTrip.regenMwh);
+	protocol_put32(feedbackTrip.Total_distance, energyLifetime.distance);
+	protocol_put32(feedbackTrip.Total_drive_mAh, energyLifetime.driveMah);
+	protocol_put32(feedbackTrip.Total_regen_mAh, energyLifetime.regenMah);
+	protocol_put32(feedbackTrip.Total_drive_mWh, energyLifetime.driveMwh);
+	protocol_put32(feedbackTrip.Total_regen_mWh, energyLifetime.regenMwh);
+
+	protocol_seal(&feedbackTrip, sizeof(feedbackTrip));
+
+	duplex_send((uint8_t*) &feedbackTrip, sizeof(feedbackTrip), DUPLEX_PRIO_PERIODIC);
 }
+#endif
 
 /* =========================== Filtering Functions =========================== */
 
@@ -0,0 +1,228 @@
+/*
+ * Host simulation of the anti-lock (Core/Src/antilock.c) against a wheel / road friction model, under braking.
+ *
+ * The firmware antilock.c is included as is, after config.h: an ANTILOCK_xxx tuning value can be overridden with
+ * -DSIM_ANTILOCK_xxx=value to compare settings without editing config.h. antilock_step is called at PWM_FREQ with
+ * the braking request and the hall speed, as in the FOC interrupt.
+ *
+ * Model (hub motor scooter, braking on the motor wheel, the friction brake on the other wheel):
+ * - braking torque: request / 1000 * TRACTION_TORQUE_MAX, first order lag of the current loop (2 ms)
+ * - wheel: inertia 0.015 kg.m^2, radius TRACTION_WHEEL_RADIUS, load 60 % of TRACTION_MASS
+ * - tyre: longitudinal force N * mu * sin(1.6 * atan(10 * slip)), peak at 15 % slip, 70 % of the peak when
+ *   locked. Slip = (wheel speed - vehicle speed) / max(|wheel speed|, |vehicle speed|, 1 m/s)
+ * - vehicle: TRACTION_MASS, rolling resistance 1 %, aero drag 0.3 m^2, optional friction brake deceleration
+ * - hall speed as the controller output Divide11: 6 * 15 pole pairs edges per revolution, period counted in PWM
+ *   periods and saturated at z_maxCntRst, mean of the last 4 periods out of the speed transitions, and held between
+ *   the edges (a locked wheel keeps its last speed). The hall state passed to antilock_step changes on each edge
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -DUSE_HAL_DRIVER -DSTM32F103xB -ICore/Inc -IDrivers/STM32F1xx_HAL_Driver/Inc \
+ *       -IDrivers/CMSIS/Device/ST/STM32F1xx/Include -IDrivers/CMSIS/Include \
+ *       tests_scripts/antilock_sim.c -lm -o antilock_sim
+ *   ./antilock_sim [scenario]
+ *
+ * Each scenario brakes at full request from its initial speed, without and with the anti-lock. Reports: stopping
+ * distance (distance at the end and no time if not stopped), time to stop, time with the wheel locked (slip below -30 % on the ground),
+ * wheel locks detected. On a dry road the anti-lock must not release (false release = longer stop); on low grip
+ * it must keep the wheel turning without losing much braking distance.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "config.h"
+
+#ifdef SIM_ANTILOCK_DECEL_MAX
+#undef ANTILOCK_DECEL_MAX
+#define ANTILOCK_DECEL_MAX SIM_ANTILOCK_DECEL_MAX
+#endif
+#ifdef SIM_ANTILOCK_LOCK_RATIO
+#undef ANTILOCK_LOCK_RATIO
+#define ANTILOCK_LOCK_RATIO SIM_ANTILOCK_LOCK_RATIO
+#endif
+#ifdef SIM_ANTILOCK_SPEED_MIN
+#undef ANTILOCK_SPEED_MIN
+#define ANTILOCK_SPEED_MIN SIM_ANTILOCK_SPEED_MIN
+#endif
+#ifdef SIM_ANTILOCK_RELEASE
+#undef ANTILOCK_RELEASE
+#define ANTILOCK_RELEASE SIM_ANTILOCK_RELEASE
+#endif
+#ifdef SIM_ANTILOCK_REAPPLY
+#undef ANTILOCK_REAPPLY
+#define ANTILOCK_REAPPLY SIM_ANTILOCK_REAPPLY
+#endif
+
+#ifdef SIM_ANTILOCK_REAPPLY_LEVEL
+#undef ANTILOCK_REAPPLY_LEVEL
+#define ANTILOCK_REAPPLY_LEVEL SIM_ANTILOCK_REAPPLY_LEVEL
+#endif
+
+#include "../Core/Src/antilock.c"
+
+P rtP_Left;                             // cf_speedCoef only
+
+#define SIM_DT          (1.0 / PWM_FREQ)    // [s] FOC period
+#define SIM_SUBSTEPS    10                  // [-] Tyre integration steps per FOC period
+#define SIM_G           9.81
+#define SIM_J_WHEEL     0.015               // [kg.m^2]
+#define SIM_LOAD        0.6                 // [-] Share of the weight on the braked wheel
+#define SIM_TAU_TORQUE  0.002               // [s] Current loop
+#define SIM_POLE_PAIRS  15
+#define SIM_EDGES       (6 * SIM_POLE_PAIRS)
+#define SIM_SPEED_COEF  10667               // [-] cf_speedCoef (BLDC_controller_data.c): rpm * PWM periods per edge
+#define SIM_CNT_MAX     2000                // [-] z_maxCntRst
+#define SIM_TRNS_HI     40                  // [-] dz_cntTrnsDetHi
+#define SIM_TRNS_LO     20                  // [-] dz_cntTrnsDetLo
+
+typedef struct {
+	const char *name;
+	double duration;                    // [s]
+	double v0;                          // [km/h] Initial speed, wheel rolling without slip
+	double friction;                    // [m/s^2] Friction brake deceleration on the other wheel
+	double (*mu)(double t, double x);   // [-] Peak friction at time t and position x
+	double (*load)(double t);           // [-] Normal load factor (0 = wheel in the air)
+} scenario_t;
+
+typedef struct {
+	double x, tStop, lockTime;
+	uint32_t events;
+} result_t;
+
+/* =========================== Roads =========================== */
+
+static double muDry(double t, double x) { (void) t; (void) x; return 1.0; }
+static double muWet(double t, double x) { (void) t; (void) x; return 0.5; }
+static double muGravel(double t, double x) { (void) t; (void) x; return 0.3; }
+static double muLeaves(double t, double x) { (void) t; (void) x; return 0.2; }
+static double muIce(double t, double x) { (void) t; (void) x; return 0.1; }
+static double muIcePatch(double t, double x) { (void) t; return (x > 2.0 && x < 5.0) ? 0.1 : 1.0; }
+static double loadFull(double t) { (void) t; return 1.0; }
+static double loadJump(double t) { return (t > 0.3 && t < 0.38) ? 0.0 : 1.0; }
+static double loadBumps(double t) { return 1.0 + 0.5 * sin(2 * M_PI * 12 * t); }
+
+static const scenario_t scenarios[] = {
+	{ "dry",                    8.0, 25, 0, muDry,      loadFull  },
+	{ "dry, friction brake",    8.0, 25, 4, muDry,      loadFull  },
+	{ "dry, wheel in the air",  8.0, 25, 0, muDry,      loadJump  },
+	{ "wet",                    8.0, 25, 0, muWet,      loadFull  },
+	{ "gravel",                 8.0, 25, 0, muGravel,   loadFull  },
+	{ "gravel, bumps",          8.0, 25, 0, muGravel,   loadBumps },
+	{ "wet leaves",             8.0, 25, 0, muLeaves,   loadFull  },
+	{ "wet leaves, brake",      8.0, 25, 2, muLeaves,   loadFull  },
+	{ "ice",                   30.0, 20, 0, muIce,      loadFull  },
+	{ "ice patch",              8.0, 25, 0, muIcePatch, loadFull  },
+};
+
+/* =========================== Model =========================== */
+
+static double tyreForce(double slip, double mu, double load) {
+	return load * mu * sin(1.6 * atan(10.0 * slip));
+}
+
+static result_t run(const scenario_t *sc, int alEnable) {
+	const double r = TRACTION_WHEEL_RADIUS / 1000.0;
+	const double edge = 2 * M_PI / SIM_EDGES;
+	double v = sc->v0 / 3.6, w = v / r, x = 0, torque = 0, angle = 0;
+	double t, slip, ref, force, n;
+	int32_t cnt = 0, cntPrev[4], cntSum, i;
+	int64_t edgeIdx = 0;
+	int16_t hall, cmd;
+	uint8_t trns = 0;
+	int k;
+	result_t res = { 0 };
+
+	// Hall speed of the initial rolling speed, already settled
+	for (i = 0; i < 4; i++) {
+		cntPrev[i] = MIN(SIM_CNT_MAX, (int32_t) lround(SIM_SPEED_COEF / (w * 60 / (2 * M_PI))));
+	}
+	hall = (int16_t) ((SIM_SPEED_COEF << 4) / cntPrev[0]);
+
+	antilock_reset();
+	antilockCnt = 0;
+	res.tStop = -1;
+	for (t = 0; t < sc->duration; t += SIM_DT) {
+		cmd = alEnable ? antilock_step(-1000, hall, (uint8_t) (edgeIdx % 6)) : -1000;
+		torque += (cmd / 1000.0 * TRACTION_TORQUE_MAX / 10.0 - torque) * SIM_DT / SIM_TAU_TORQUE;
+
+		n = TRACTION_MASS * SIM_G * SIM_LOAD * sc->load(t);
+		for (k = 0; k < SIM_SUBSTEPS; k++) {
+			ref = fmax(fmax(fabs(w * r), fabs(v)), 1.0);
+			slip = (w * r - v) / ref;
+			force = tyreForce(slip, sc->mu(t, x), n);
+			// The braking torque cannot turn the wheel backwards: it stops it
+			w += ((w > 0 ? torque : fmax(torque, 0)) - force * r) / SIM_J_WHEEL * SIM_DT / SIM_SUBSTEPS;
+			v += (force - (v > 0 ? 1 : 0) * (0.01 * TRACTION_MASS * SIM_G + 0.5 * 1.2 * 0.3 * v * v
+					+ TRACTION_MASS * sc->friction)) / TRACTION_MASS * SIM_DT / SIM_SUBSTEPS;
+			v = fmax(v, 0);
+			w = fmax(w, 0);
+			x += v * SIM_DT / SIM_SUBSTEPS;
+		}
+
+		// Hall edges: period counter in PWM periods, speed updated on the edges only (Divide11)
+		angle += w * SIM_DT;
+		cnt = MIN(cnt + 1, SIM_CNT_MAX);
+		while (floor(angle / edge) > edgeIdx) {
+			edgeIdx++;
+			if (ABS(cnt - cntPrev[0]) >= SIM_TRNS_HI) {
+				trns = 1;
+			} else if (ABS(cnt - cntPrev[0]) <= SIM_TRNS_LO) {
+				trns = 0;
+			}
+			memmove(&cntPrev[1], &cntPrev[0], 3 * sizeof(cntPrev[0]));
+			cntPrev[0] = cnt;
+			cntSum = cntPrev[0] + cntPrev[1] + cntPrev[2] + cntPrev[3];
+			hall = (int16_t) (trns ? (SIM_SPEED_COEF << 4) / cnt : ((SIM_SPEED_COEF << 2) << 4) / cntSum);
+			cnt = 0;
+		}
+
+		slip = (w * r - v) / fmax(fmax(fabs(w * r), fabs(v)), 1.0);
+		if (slip < -0.3 && sc->load(t) > 0 && v > 0) {
+			res.lockTime += SIM_DT;
+		}
+		if (v <= 0 && res.tStop < 0) {
+			res.tStop = t;
+			break;
+		}
+	}
+	res.x = x;
+	res.events = antilockCnt;
+	return res;
+}
+
+static void show(result_t *r) {
+	if (r->tStop >= 0) {
+		printf(" %6.2f %6.2f %7.0fms", r->x, r->tStop, r->lockTime * 1000);
+	} else {
+		printf(" %6.2f %6s %7.0fms", r->x, "-", r->lockTime * 1000);
+	}
+}
+
+int main(int argc, char **argv) {
+	unsigned i, only = (argc > 1) ? (unsigned) atoi(argv[1]) : 0;
+	result_t off, on;
+
+	rtP_Left.cf_speedCoef = SIM_SPEED_COEF;
+
+	printf("ANTILOCK_DECEL_MAX %d rpm/s, LOCK_RATIO %d %%, SPEED_MIN %d rpm, RELEASE %d ms, REAPPLY %d ms, LEVEL %d %%\n",
+			ANTILOCK_DECEL_MAX, ANTILOCK_LOCK_RATIO, ANTILOCK_SPEED_MIN, ANTILOCK_RELEASE, ANTILOCK_REAPPLY,
+			ANTILOCK_REAPPLY_LEVEL);
+	printf("%-22s | %-24s | %-31s\n", "", "without anti-lock", "with anti-lock");
+	printf("%-22s | %6s %6s %9s | %6s %6s %9s %6s\n", "scenario", "stop m", "s", "locked",
+			"stop m", "s", "locked", "events");
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		if (only && only != i + 1) {
+			continue;
+		}
+		off = run(&scenarios[i], 0);
+		on = run(&scenarios[i], 1);
+		printf("%-22s |", scenarios[i].name);
+		show(&off);
+		printf(" |");
+		show(&on);
+		printf(" %6u\n", (unsigned) on.events);
+	}
+	return 0;
+}
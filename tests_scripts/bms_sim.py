@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""
+Xiaomi / Ninebot BMS emulator for bench tests of the SmartESC BMS client (USART1, see Core/Src/bms.c).
+
+Answers the read requests  55 AA 03 22 01 reg len ck ck  with  55 AA len+2 25 01 reg data ck ck
+from a register map of 16-bit little endian words. The request bytes read back on a single wire are ignored.
+
+Examples:
+  bms_sim.py /dev/ttyUSB0 -b 115200 --cells 10 --cell-mv 3900
+  bms_sim.py /dev/ttyUSB0 --weak 3:3150          (cell 3 at 3.15 V, the ESC must reduce its current)
+  bms_sim.py --pty                               (virtual port, prints its name)
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+
+ADDR_REQ = 0x22
+ADDR_REPLY = 0x25
+CMD_READ = 0x01
+
+
+def checksum(data):
+    return (sum(data) & 0xFFFF) ^ 0xFFFF
+
+
+def frame(addr, cmd, reg, data):
+    body = bytes([len(data) + 2, addr, cmd, reg]) + bytes(data)
+    return b"\x55\xaa" + body + struct.pack("<H", checksum(body))
+
+
+class Bms:
+    def __init__(self, args):
+        self.regs = {}
+        self.set16(0x17, args.version)
+        self.set16(0x1B, args.cycles_full)
+        self.set16(0x1C, args.cycles_partial)
+        self.set16(0x31, args.capacity)
+        self.set16(0x32, args.soc)
+        self.set16(0x33, int(args.current * 100) & 0xFFFF)
+        cells = [args.cell_mv] * args.cells
+        for weak in args.weak:
+            index, mv = (int(v) for v in weak.split(":"))
+            cells[index] = mv
+        self.set16(0x34, sum(cells) // 10)
+        self.regs[0x35 * 2] = (args.temp1 + 20) & 0xFF
+        self.regs[0x35 * 2 + 1] = (args.temp2 + 20) & 0xFF
+        for i, mv in enumerate(cells):
+            self.set16(0x40 + i, mv)
+
+    def set16(self, reg, value):
+        self.regs[reg * 2] = value & 0xFF
+        self.regs[reg * 2 + 1] = (value >> 8) & 0xFF
+
+    def read(self, reg, length):
+        return bytes(self.regs.get(reg * 2 + i, 0) for i in range(length))
+
+
+def requests(buf, stats):
+    """Extract the complete frames from buf, yields (addr, cmd, reg, data)"""
+    while True:
+        start = buf.find(b"\x55\xaa")
+        if start < 0:
+            del buf[:max(len(buf) - 1, 0)]
+            return
+        del buf[:start]
+        if len(buf) < 3:
+            return
+        length = buf[2] + 6
+        if len(buf) < length:
+            return
+        body = bytes(buf[2:length - 2])
+        ck = struct.unpack_from("<H", buf, length - 2)[0]
+        if ck != checksum(body):
+            stats["bad"] += 1
+            del buf[:1]
+            continue
+        del buf[:length]
+        yield body[1], body[2], body[3], body[4:]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Xiaomi BMS emulator")
+    parser.add_argument("port", nargs="?", help="serial port (e.g. /dev/ttyUSB0)")
+    parser.add_argument("-b", "--baud", type=int, default=115200, help="serial baud rate (BMS_BAUD)")
+    parser.add_argument("--pty", action="store_true", help="create a virtual serial port instead")
+    parser.add_argument("--cells", type=int, default=10, help="number of cells (BAT_CELLS)")
+    parser.add_argument("--cell-mv", type=int, default=3900, help="[mV] cell voltage")
+    parser.add_argument("--weak", action="append", default=[], help="index:mV, weak cell (repeatable)")
+    parser.add_argument("--current", type=float, default=5.0, help="[A] discharge current")
+    parser.add_argument("--soc", type=int, default=80, help="[%%] state of charge")
+    parser.add_argument("--capacity", type=int, default=6000, help="[mAh] remaining capacity")
+    parser.add_argument("--temp1", type=int, default=25, help="[degC] temperature 1")
+    parser.add_argument("--temp2", type=int, default=26, help="[degC] temperature 2")
+    parser.add_argument("--version", type=lambda v: int(v, 0), default=0x0115, help="firmware version")
+    parser.add_argument("--cycles-full", type=int, default=42)
+    parser.add_argument("--cycles-partial", type=int, default=137)
+    parser.add_argument("--silent", type=float, default=0, help="[s] stop replying after this time (timeout test)")
+    args = parser.parse_args()
+
+    bms = Bms(args)
+    if args.pty:
+        master, slave = os.openpty()
+        print("BMS on %s" % os.ttyname(slave), file=sys.stderr)
+        read = lambda: os.read(master, 256)
+        write = lambda data: os.write(master, data)
+    elif args.port:
+        import serial
+        port = serial.Serial(args.port, args.baud, timeout=0.05)
+        read = lambda: port.read(256)
+        write = port.write
+    else:
+        parser.error("a port or --pty is required")
+
+    stats = {"requests": 0, "bad": 0}
+    buf = bytearray()
+    t0 = time.monotonic()
+    try:
+        while True:
+            buf += read()
+            for addr, cmd, reg, data in requests(buf, stats):
+                if addr != ADDR_REQ or cmd != CMD_READ or len(data) != 1:
+                    continue                # own replies read back, other devices
+                stats["requests"] += 1
+                if args.silent and time.monotonic() - t0 > args.silent:
+                    continue
+                write(frame(ADDR_REPLY, CMD_READ, reg, bms.read(reg, data[0])))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        print("requests %(requests)d, bad %(bad)d" % stats, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
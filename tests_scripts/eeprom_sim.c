@@ -0,0 +1,339 @@
+/*
+ * Host simulation of the EEPROM emulation (Core/Src/eeprom.c) on two 1 KB flash pages.
+ *
+ * The firmware eeprom.c is compiled as is. The flash pages are mapped at EEPROM_START_ADDRESS and the HAL
+ * flash functions are replaced by a model of the STM32F1 flash: a half-word is programmed if erased, or to
+ * 0x0000 (page status VALID_PAGE), erase sets a page to 0xFF, and a power loss can be injected before any half-word or page operation.
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -DUSE_HAL_DRIVER -DSTM32F103xB -ICore/Inc -IDrivers/STM32F1xx_HAL_Driver/Inc \
+ *       -IDrivers/CMSIS/Device/ST/STM32F1xx/Include -IDrivers/CMSIS/Include \
+ *       tests_scripts/eeprom_sim.c Core/Src/eeprom.c -o eeprom_sim
+ *   ./eeprom_sim [saves] [changed per save] [power loss trials]
+ *
+ * Reports:
+ * - boot: flash words read by EE_Init (one scan) against the backward scan per EE_ReadVariable of the previous
+ *   implementation, for the reads of Input_Init and param_init, with a page filled by the save workload,
+ * - writes: half-words programmed, program calls and page erases for parameter saves (param_save: all the
+ *   table written, a few values changed), batched and unbatched. Write amplification is the programmed
+ *   half-words per changed value half-word,
+ * - power loss: after a loss at a random point of a save, EE_Init must give each variable its old or its
+ *   new value. A batch is not atomic: a save cut in the middle has no layout key and is discarded by param_init.
+ *   With the key, the values must be all old or all new (no partly applied save). The exit code is 1 otherwise.
+ */
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "eeprom.h"
+
+#define NB_INPUT        11              // Input calibration variables (util.c)
+#define NB_PARAM        (NB_OF_VAR - NB_INPUT - 1)
+#define PARAM_KEY_ADDR  0x1400          // PARAM_EE_ADDR
+#define PARAM_KEY       0x5A01          // PARAM_EE_KEY
+
+uint16_t VirtAddVarTab[NB_OF_VAR];
+
+static struct {
+	uint32_t programCalls;
+	uint32_t halfwords;
+	uint32_t erases;
+	uint32_t errors;                    // Programming of a half-word not erased
+	int32_t budget;                     // Operations before the power loss, -1 = none
+} sim;
+static jmp_buf powerLoss;
+static uint16_t *flash;
+
+/* =========================== Flash model =========================== */
+
+static void sim_op(void) {
+	if (sim.budget >= 0 && sim.budget-- == 0) {
+		longjmp(powerLoss, 1);
+	}
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data) {
+	uint32_t n = (TypeProgram == FLASH_TYPEPROGRAM_WORD) ? 2 : (TypeProgram == FLASH_TYPEPROGRAM_HALFWORD) ? 1 : 4;
+	uint32_t i, k;
+
+	sim.programCalls++;
+	for (i = 0; i < n; i++) {
+		if (Address + 2 * i < EEPROM_START_ADDRESS || Address + 2 * i >= EEPROM_START_ADDRESS + 2 * PAGE_SIZE) {
+			sim.errors++;
+			return HAL_ERROR;
+		}
+		sim_op();
+		k = (Address + 2 * i - EEPROM_START_ADDRESS) / 2;
+		if (flash[k] != 0xFFFF && (uint16_t) (Data >> (16 * i)) != 0) {
+			sim.errors++;                           // PGERR: not erased, only 0x0000 can be written over
+			return HAL_ERROR;
+		}
+		flash[k] = (uint16_t) (Data >> (16 * i));
+		sim.halfwords++;
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError) {
+	uint32_t page = pEraseInit->PageAddress;
+
+	*PageError = 0xFFFFFFFF;
+	if (page != PAGE0_BASE_ADDRESS && page != PAGE1_BASE_ADDRESS) {
+		sim.errors++;
+		*PageError = page;
+		return HAL_ERROR;
+	}
+	sim_op();
+	memset(&flash[(page - EEPROM_START_ADDRESS) / 2], 0xFF, PAGE_SIZE);
+	sim.erases++;
+	return HAL_OK;
+}
+
+/* =========================== Helpers =========================== */
+
+/*
+ * Flash words read by the previous EE_ReadVariable: backward scan of the valid page down to the last record
+ */
+static uint32_t legacyReadCost(uint16_t virtAddress) {
+	uint32_t base = (flash[0] == VALID_PAGE) ? 0 : PAGE_SIZE / 2;
+	uint32_t k, reads = 0;
+
+	for (k = base + PAGE_SIZE / 2 - 1; k > base + 1; k -= 2) {
+		reads++;
+		if (flash[k] == virtAddress) {
+			break;
+		}
+	}
+	return reads;
+}
+
+static uint32_t usedSlots(void) {
+	uint32_t base = (flash[0] == VALID_PAGE) ? 0 : PAGE_SIZE / 2;
+	uint32_t k;
+
+	for (k = base + 2; k < base + PAGE_SIZE / 2 && (flash[k] != 0xFFFF || flash[k + 1] != 0xFFFF); k += 2);
+	return (k - base - 2) / 2;
+}
+
+static void format(void) {
+	memset(flash, 0xFF, 2 * PAGE_SIZE);
+	memset(&sim, 0, sizeof(sim));
+	sim.budget = -1;
+	EE_Init();
+}
+
+/*
+ * param_save: if a value or the key differs, key cleared, all the parameters written, then the key.
+ * 'changed' of the parameters get a new value.
+ * Output: values actually changed
+ */
+static uint32_t save(uint16_t *values, uint32_t changed, int batched, uint32_t *seed) {
+	uint32_t i, k, n = 0;
+	uint16_t read;
+	int dirty;
+
+	for (i = 0; i < changed; i++) {
+		*seed = *seed * 1103515245 + 12345;
+		k = (*seed >> 16) % NB_PARAM;
+		n += (values[k] != (uint16_t) (*seed >> 8));
+		values[k] = (uint16_t) (*seed >> 8);
+	}
+	dirty = (EE_ReadVariable(PARAM_KEY_ADDR, &read) != 0 || read != PARAM_KEY);
+	for (i = 0; i < NB_PARAM && !dirty; i++) {
+		dirty = (EE_ReadVariable(PARAM_KEY_ADDR + 1 + i, &read) != 0 || read != values[i]);
+	}
+	if (!dirty) {
+		return n;
+	}
+	EE_WriteVariable(PARAM_KEY_ADDR, 0);
+	if (batched) {
+		EE_BatchBegin();
+	}
+	for (i = 0; i < NB_PARAM; i++) {
+		EE_WriteVariable(PARAM_KEY_ADDR + 1 + i, values[i]);
+	}
+	if (batched) {
+		EE_BatchEnd();
+	}
+	EE_WriteVariable(PARAM_KEY_ADDR, PARAM_KEY);
+	return n;
+}
+
+static double now(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* =========================== Scenarios =========================== */
+
+static void writes(uint32_t saves, uint32_t changed, int batched) {
+	uint16_t values[NB_PARAM] = { 0 };
+	uint32_t seed = 1, nChanged = 0, i;
+
+	format();
+	save(values, NB_PARAM, batched, &seed);
+	memset(&sim, 0, sizeof(sim));
+	sim.budget = -1;
+	for (i = 0; i < saves; i++) {
+		nChanged += save(values, changed, batched, &seed);
+	}
+	printf("%-10s %6u saves: %8u half-words %7u program calls %5u erases %u errors, amplification %.2f\n",
+			batched ? "batched" : "unbatched", (unsigned) saves, (unsigned) sim.halfwords, (unsigned) sim.programCalls,
+			(unsigned) sim.erases, (unsigned) sim.errors, sim.halfwords / (2.0 * nChanged));
+}
+
+static void boot(uint32_t saves, uint32_t changed) {
+	uint16_t values[NB_PARAM] = { 0 }, data;
+	uint32_t seed = 1, legacy = 0, i, runs;
+	double t0, tInit, tRead;
+
+	format();
+	for (i = 0; i < saves % 40 + 20; i++) {
+		save(values, changed, 1, &seed);
+	}
+
+	// Input_Init: key, i_max, n_max. param_init: key, then the saved parameters
+	for (i = 0; i < 3; i++) {
+		legacy += legacyReadCost(VirtAddVarTab[i]);
+	}
+	for (i = 0; i <= NB_PARAM; i++) {
+		legacy += legacyReadCost(PARAM_KEY_ADDR + i);
+	}
+
+	runs = 20000;
+	t0 = now();
+	for (i = 0; i < runs; i++) {
+		EE_Init();
+	}
+	tInit = (now() - t0) / runs;
+	t0 = now();
+	for (i = 0; i < runs * (NB_PARAM + 4); i++) {
+		EE_ReadVariable(PARAM_KEY_ADDR + i % (NB_PARAM + 1), &data);
+	}
+	tRead = (now() - t0) / (runs * (NB_PARAM + 4));
+
+	printf("boot: %u of %u slots used, EE_Init scan %u words x 2 calls, previous reads %u words\n",
+			(unsigned) usedSlots(), (unsigned) (PAGE_SIZE / 4 - 1), (unsigned) usedSlots() + 1, (unsigned) legacy);
+	printf("      host: EE_Init %.0f ns, EE_ReadVariable %.1f ns\n", tInit * 1e9, tRead * 1e9);
+}
+
+/*
+ * Output: 1 if a save is partly applied or a value is corrupted
+ */
+static int powerLossTrials(uint32_t trials, uint32_t changed) {
+	uint16_t before[NB_PARAM], after[NB_PARAM], read;
+	uint16_t image[PAGE_SIZE];
+	static uint32_t bad, reverted, applied, discarded, mixed, transfers, t;   // kept across the longjmp
+	uint32_t seed = 7, i, ops, erases, s, nOld, nNew;
+
+	for (t = 0; t < trials; t++) {
+		format();
+		memset(before, 0, sizeof(before));
+		seed = seed * 1103515245 + 12345;
+		for (i = (seed >> 16) % 100; i < 100; i++) {         // random page fill, full after ~80 saves
+			save(before, changed, 1, &seed);
+		}
+
+		// Operations of the next save, then the same save cut at a random point
+		memcpy(after, before, sizeof(after));
+		memcpy(image, flash, 2 * PAGE_SIZE);
+		s = seed;
+		ops = sim.halfwords + sim.erases;
+		erases = sim.erases;
+		save(after, changed, 1, &s);
+		ops = sim.halfwords + sim.erases - ops;
+		transfers += (sim.erases != erases);
+		memcpy(flash, image, 2 * PAGE_SIZE);
+		EE_Init();
+		if (ops == 0) {
+			continue;
+		}
+		memcpy(after, before, sizeof(after));
+		seed = seed * 1103515245 + 12345;
+		sim.budget = (int32_t) ((seed >> 8) % ops);
+		if (setjmp(powerLoss) == 0) {
+			save(after, changed, 1, &seed);
+		}
+		sim.budget = -1;
+
+		EE_Init();                                          // reboot
+		if (EE_ReadVariable(PARAM_KEY_ADDR, &read) != 0 || read != PARAM_KEY) {
+			discarded++;                                    // param_init keeps the defaults
+			continue;
+		}
+		nOld = nNew = 0;
+		for (i = 0; i < NB_PARAM; i++) {
+			if (EE_ReadVariable(PARAM_KEY_ADDR + 1 + i, &read) != 0) {
+				bad++;
+				break;
+			}
+			if (read == before[i] && read == after[i]) {
+				continue;
+			}
+			if (read == before[i]) {
+				nOld++;
+			} else if (read == after[i]) {
+				nNew++;
+			} else {
+				bad++;
+				break;
+			}
+		}
+		if (nOld && nNew) {
+			mixed++;
+		} else if (nNew) {
+			applied++;
+		} else {
+			reverted++;
+		}
+	}
+	printf("power loss: %u trials (%u with a page transfer): %u reverted, %u applied, %u discarded (no key), "
+			"%u partly applied, %u corrupted\n", (unsigned) trials, (unsigned) transfers, (unsigned) reverted,
+			(unsigned) applied, (unsigned) discarded, (unsigned) mixed, (unsigned) bad);
+	return mixed != 0 || bad != 0;
+}
+
+int main(int argc, char **argv) {
+	uint32_t saves = (argc > 1) ? (uint32_t) atoi(argv[1]) : 1000;
+	uint32_t changed = (argc > 2) ? (uint32_t) atoi(argv[2]) : 3;
+	uint32_t trials = (argc > 3) ? (uint32_t) atoi(argv[3]) : 20000;
+	uint32_t i;
+
+	flash = mmap((void*) (uintptr_t) EEPROM_START_ADDRESS, 2 * PAGE_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (flash != (uint16_t*) (uintptr_t) EEPROM_START_ADDRESS) {
+		perror("mmap at EEPROM_START_ADDRESS");
+		return 1;
+	}
+	if (changed == 0 || changed > NB_PARAM) {
+		fprintf(stderr, "changed per save: 1..%d\n", NB_PARAM);
+		return 1;
+	}
+
+	// VirtAddVarTab as filled by util.c and param_init
+	for (i = 0; i < NB_INPUT; i++) {
+		VirtAddVarTab[i] = i ? 1300 + i : 0x1300;
+	}
+	for (i = 0; i <= NB_PARAM; i++) {
+		VirtAddVarTab[NB_INPUT + i] = PARAM_KEY_ADDR + i;
+	}
+
+	printf("%u parameters, %u changed per save\n", (unsigned) NB_PARAM, (unsigned) changed);
+	boot(saves, changed);
+	writes(saves, changed, 0);
+	writes(saves, changed, 1);
+	return powerLossTrials(trials, changed);
+}
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""
+Event log access of the SmartESC (USART3, SERIAL_TYPE_LOG frames, see Core/Src/eventlog.c).
+
+Examples:
+  eventlog_tool.py /dev/ttyUSB0 dump
+  eventlog_tool.py /dev/ttyUSB0 dump --csv > log.csv
+  eventlog_tool.py /dev/ttyUSB0 clear                  (wheel stopped)
+Entries are listed oldest first. Code 0 is the clearing of the fault or timeout.
+"""
+
+import argparse
+import struct
+import sys
+
+import serial
+
+START_TO_ESC = 0xA5
+START_FROM_ESC = 0x5A
+TYPE_LOG = 0x13
+REPLY = struct.Struct("<BBBBHHIIIBBhhHh")  # Frame_start .. Temperature, the check byte follows
+
+CMD_READ, CMD_CLEAR = range(2)
+STATUS = ["ok", "no entry", "locked (speed)", "flash error"]
+EVENTS = {1: "fault", 2: "timeout serial", 3: "timeout adc"}
+
+
+def crc8(data):
+    c = 0
+    for b in data:
+        c ^= b
+        for _ in range(8):
+            c = ((c << 1) ^ 0x07) & 0xFF if c & 0x80 else (c << 1) & 0xFF
+    return c
+
+
+def xor(data):
+    c = 0
+    for b in data:
+        c ^= b
+    return c
+
+
+class Esc:
+    def __init__(self, port, baud, use_crc8):
+        self.port = serial.Serial(port, baud, timeout=0.5)
+        self.check = crc8 if use_crc8 else xor
+
+    def request(self, cmd, index=0):
+        frame = bytes([START_TO_ESC, TYPE_LOG, cmd]) + struct.pack("<H", index) + bytes(17)
+        self.port.reset_input_buffer()
+        self.port.write(frame + bytes([self.check(frame)]))
+        return self.reply(cmd)
+
+    def reply(self, cmd):
+        """Skip the feedback / telemetry frames until the log reply"""
+        buf = bytearray()
+        size = REPLY.size + 1
+        while True:
+            chunk = self.port.read(64)
+            if not chunk:
+                raise TimeoutError("no reply")
+            buf += chunk
+            while len(buf) >= 2:
+                start = buf.find(bytes([START_FROM_ESC, TYPE_LOG]))
+                if start < 0:
+                    del buf[:-1]
+                    break
+                del buf[:start]
+                if len(buf) < size:
+                    break
+                if self.check(buf[:size - 1]) == buf[size - 1] and buf[2] == cmd:
+                    return REPLY.unpack_from(buf)
+                del buf[:1]
+
+
+def show(r, csv):
+    _, _, _, status, index, count, seq, uptime, odometer, event, code, speed, current, voltage, temp = r
+    if csv:
+        return "%d,%d,%.3f,%d,%s,%d,%d,%d,%.2f,%.1f" % (
+            index, seq, uptime / 1000, odometer, EVENTS.get(event, event), code, speed, current,
+            voltage / 100, temp / 10)
+    return "[%3d/%d] #%-6d %10.3f s %8d m  %-14s code %3d  %5d rpm  current %5d  %6.2f V  %5.1f C" % (
+        index, count, seq, uptime / 1000, odometer, EVENTS.get(event, event), code, speed, current,
+        voltage / 100, temp / 10)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="SmartESC event log")
+    parser.add_argument("port")
+    parser.add_argument("command", choices=["dump", "clear"])
+    parser.add_argument("-b", "--baud", type=int, default=115200, help="USART3 baud rate")
+    parser.add_argument("--csv", action="store_true", help="comma separated output")
+    parser.add_argument("--crc8", action="store_true", help="firmware built with SERIAL_CRC_TYPE 1")
+    args = parser.parse_args()
+
+    esc = Esc(args.port, args.baud, args.crc8)
+    if args.command == "dump":
+        if args.csv:
+            print("index,seq,uptime_s,odometer_m,event,code,speed_rpm,current,voltage_v,temperature_c")
+        index, count = 0, 1
+        while index < count:
+            r = esc.request(CMD_READ, index)
+            count = r[5]
+            if r[3]:
+                if count:
+                    print("entry %d: %s" % (index, STATUS[r[3]] if r[3] < len(STATUS) else r[3]), file=sys.stderr)
+                break
+            print(show(r, args.csv))
+            index += 1
+        if not count:
+            print("log empty", file=sys.stderr)
+    else:
+        r = esc.request(CMD_CLEAR)
+        print("clear: %s" % (STATUS[r[3]] if r[3] < len(STATUS) else r[3]))
+        sys.exit(r[3] != 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""
+Runtime parameter access of the SmartESC (USART3, SERIAL_TYPE_PARAM frames, see Core/Src/param.c).
+Replaces the gdb pokes of gdb_set_spin.bat / gdb_set_tim2.bat for the parameters of the table.
+
+Examples:
+  param_tool.py /dev/ttyUSB0 list
+  param_tool.py /dev/ttyUSB0 get 0x21
+  param_tool.py /dev/ttyUSB0 set 0x21 600
+  param_tool.py /dev/ttyUSB0 set 0x12 1300 --hold      (staged, applied with the next set)
+  param_tool.py /dev/ttyUSB0 set 0x13 1250
+  param_tool.py /dev/ttyUSB0 save
+Values are raw fixed-point integers; list shows them scaled by their fractional bits too.
+"""
+
+import argparse
+import struct
+import sys
+
+import serial
+
+START_TO_ESC = 0xA5
+START_FROM_ESC = 0x5A
+TYPE_PARAM = 0x12
+RX_FRAME = 23                           # display to ESC frame length
+REPLY = struct.Struct("<BBBBBBBBBBiii")  # Frame_start .. Max, the check byte follows
+
+CMD_GET, CMD_SET, CMD_LIST, CMD_SAVE = range(4)
+STATUS = ["ok", "unknown", "out of range", "busy", "locked (speed)", "flash error"]
+FORMATS = ["u8", "i16", "u16", "i32", "u32"]
+
+
+def crc8(data):
+    c = 0
+    for b in data:
+        c ^= b
+        for _ in range(8):
+            c = ((c << 1) ^ 0x07) & 0xFF if c & 0x80 else (c << 1) & 0xFF
+    return c
+
+
+def xor(data):
+    c = 0
+    for b in data:
+        c ^= b
+    return c
+
+
+class Esc:
+    def __init__(self, port, baud, use_crc8):
+        self.port = serial.Serial(port, baud, timeout=0.5)
+        self.check = crc8 if use_crc8 else xor
+
+    def request(self, cmd, pid=0, value=0, hold=0):
+        frame = bytes([START_TO_ESC, TYPE_PARAM, cmd, pid]) + struct.pack("<i", value) + bytes([hold]) + bytes(13)
+        self.port.reset_input_buffer()
+        self.port.write(frame + bytes([self.check(frame)]))
+        return self.reply(cmd)
+
+    def reply(self, cmd):
+        """Skip the feedback / telemetry frames until the parameter reply"""
+        buf = bytearray()
+        size = REPLY.size + 1
+        while True:
+            chunk = self.port.read(64)
+            if not chunk:
+                raise TimeoutError("no reply")
+            buf += chunk
+            while len(buf) >= 2:
+                start = buf.find(bytes([START_FROM_ESC, TYPE_PARAM]))
+                if start < 0:
+                    del buf[:-1]
+                    break
+                del buf[:start]
+                if len(buf) < size:
+                    break
+                if self.check(buf[:size - 1]) == buf[size - 1] and buf[2] == cmd:
+                    return REPLY.unpack_from(buf)
+                del buf[:1]
+
+
+def show(r):
+    _, _, _, status, pid, index, count, fmt, frac, flags, value, vmin, vmax = r
+    if status:
+        return "id 0x%02X: %s" % (pid, STATUS[status] if status < len(STATUS) else status)
+    scaled = ("  (%g)" % (value / (1 << frac))) if frac else ""
+    return "[%2d/%d] id 0x%02X %-3s frac %2d %s%s  value %d%s  range [%d, %d]" % (
+        index, count, pid, FORMATS[fmt], frac, "S" if flags & 1 else "-", "T" if flags & 2 else "-",
+        value, scaled, vmin, vmax)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="SmartESC runtime parameters")
+    parser.add_argument("port")
+    parser.add_argument("command", choices=["get", "set", "list", "save"])
+    parser.add_argument("id", nargs="?", type=lambda v: int(v, 0))
+    parser.add_argument("value", nargs="?", type=lambda v: int(v, 0))
+    parser.add_argument("-b", "--baud", type=int, default=115200, help="USART3 baud rate")
+    parser.add_argument("--hold", action="store_true", help="keep the value staged until the next set")
+    parser.add_argument("--crc8", action="store_true", help="firmware built with SERIAL_CRC_TYPE 1")
+    args = parser.parse_args()
+
+    esc = Esc(args.port, args.baud, args.crc8)
+    if args.command == "list":
+        index, count = 0, 1
+        while index < count:
+            r = esc.request(CMD_LIST, index)
+            print(show(r))
+            count = r[6]
+            index += 1
+    elif args.command == "get":
+        print(show(esc.request(CMD_GET, args.id)))
+    elif args.command == "set":
+        if args.id is None or args.value is None:
+            parser.error("set needs an id and a value")
+        print(show(esc.request(CMD_SET, args.id, args.value, int(args.hold))))
+    else:
+        r = esc.request(CMD_SAVE)
+        print("save: %s" % STATUS[r[3]])
+        sys.exit(r[3] != 0)
+
+
+if __name__ == "__main__":
+    main()
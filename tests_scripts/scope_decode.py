@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""
+Decoder of the SmartESC oscilloscope stream (USART1, see Core/Src/scope.c).
+
+Reads the packets from a serial port (pyserial) or from a raw capture file, checks them and writes
+either a CSV file (one line per sample) or a binary file (int16 little endian, one record per sample:
+tick as uint32 followed by the signals).
+
+Examples:
+  scope_decode.py /dev/ttyUSB0 -b 2000000 -o capture.csv
+  scope_decode.py capture.raw -o capture.bin --binary
+  scope_decode.py /dev/ttyUSB0 --raw capture.raw        (store the stream, decode later)
+"""
+
+import argparse
+import struct
+import sys
+
+SYNC = b"\xaa\x55"
+HEADER = struct.Struct("<2sHIHBB")  # sync, seq, tick, signals, decimation, samples
+SIGNAL_NAMES = ["ia", "ib", "iq", "id", "angle", "duty_a", "duty_b", "duty_c", "speed", "target", "vbat"]
+
+
+def crc8_table():
+    table = []
+    for i in range(256):
+        c = i
+        for _ in range(8):
+            c = ((c << 1) ^ 0x07) & 0xFF if c & 0x80 else (c << 1) & 0xFF
+        table.append(c)
+    return table
+
+
+CRC8_TABLE = crc8_table()
+
+
+def check_byte(data, crc8):
+    """Check byte of protocol.c: XOR (SERIAL_CRC_TYPE 0) or CRC-8 poly 0x07 (SERIAL_CRC_TYPE 1)"""
+    c = 0
+    if crc8:
+        for b in data:
+            c = CRC8_TABLE[c ^ b]
+    else:
+        for b in data:
+            c ^= b
+    return c
+
+
+def packets(read, crc8, stats):
+    """Generator of (seq, tick, signals, decimation, samples) from a byte stream, with resynchronization"""
+    buf = bytearray()
+    while True:
+        chunk = read(4096)
+        if not chunk:
+            return
+        buf += chunk
+        while True:
+            start = buf.find(SYNC)
+            if start < 0:
+                stats["skipped"] += max(len(buf) - 1, 0)
+                del buf[:max(len(buf) - 1, 0)]
+                break
+            if start:
+                stats["skipped"] += start
+                del buf[:start]
+            if len(buf) < HEADER.size:
+                break
+            _, seq, tick, signals, decimation, nb_samples = HEADER.unpack_from(buf)
+            nb_signals = bin(signals).count("1")
+            length = HEADER.size + 2 * nb_signals * nb_samples + 1
+            if len(buf) < length:
+                break
+            if nb_signals == 0 or check_byte(buf[:length - 1], crc8) != buf[length - 1]:
+                stats["bad"] += 1
+                del buf[:1]
+                continue
+            values = struct.unpack_from("<%dh" % (nb_signals * nb_samples), buf, HEADER.size)
+            del buf[:length]
+            samples = [values[i:i + nb_signals] for i in range(0, len(values), nb_signals)]
+            yield seq, tick, signals, decimation, samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description="SmartESC scope stream decoder")
+    parser.add_argument("input", help="serial port (e.g. /dev/ttyUSB0) or raw capture file")
+    parser.add_argument("-b", "--baud", type=int, default=2000000, help="serial baud rate (SCOPE_BAUD)")
+    parser.add_argument("-o", "--output", help="decoded output file (CSV, or binary with --binary)")
+    parser.add_argument("--binary", action="store_true", help="write uint32 tick + int16 signals records")
+    parser.add_argument("--raw", help="store the undecoded stream in this file")
+    parser.add_argument("--crc8", action="store_true", help="firmware built with SERIAL_CRC_TYPE 1")
+    parser.add_argument("-n", "--packets", type=int, default=0, help="stop after this many packets")
+    args = parser.parse_args()
+
+    if args.input.startswith("/dev/") or args.input.upper().startswith("COM"):
+        import serial
+        port = serial.Serial(args.input, args.baud, timeout=1)
+        source_read = port.read
+    else:
+        source = open(args.input, "rb")
+        source_read = source.read
+
+    raw = open(args.raw, "wb") if args.raw else None
+
+    def read(size):
+        data = source_read(size)
+        if raw:
+            raw.write(data)
+        return data
+
+    out = None
+    if args.output:
+        out = open(args.output, "wb" if args.binary else "w")
+
+    stats = {"packets": 0, "lost": 0, "bad": 0, "skipped": 0}
+    last_seq = None
+    header_signals = None
+    try:
+        for seq, tick, signals, decimation, samples in packets(read, args.crc8, stats):
+            stats["packets"] += 1
+            if last_seq is not None and seq != (last_seq + 1) & 0xFFFF:
+                lost = (seq - last_seq - 1) & 0xFFFF
+                stats["lost"] += lost
+                print("gap: %d packet(s) lost before seq %d" % (lost, seq), file=sys.stderr)
+            last_seq = seq
+
+            if out and not args.binary and signals != header_signals:
+                names = [SIGNAL_NAMES[i] for i in range(len(SIGNAL_NAMES)) if signals & (1 << i)]
+                out.write("tick," + ",".join(names) + "\n")
+                header_signals = signals
+            for k, sample in enumerate(samples):
+                t = (tick + k * decimation) & 0xFFFFFFFF
+                if out and args.binary:
+                    out.write(struct.pack("<I%dh" % len(sample), t, *sample))
+                elif out:
+                    out.write("%d,%s\n" % (t, ",".join(str(v) for v in sample)))
+            if args.packets and stats["packets"] >= args.packets:
+                break
+    except KeyboardInterrupt:
+        pass
+    finally:
+        print("packets %(packets)d, lost %(lost)d, bad %(bad)d, skipped bytes %(skipped)d" % stats, file=sys.stderr)
+        if out:
+            out.close()
+        if raw:
+            raw.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,344 @@
+/*
+ * Host simulation of the calibration store (Core/Src/store.c) on STORE_NB_PAGES flash pages.
+ *
+ * The firmware store.c is compiled as is. The flash pages are mapped at their address and the HAL flash functions
+ * are replaced by a model of the STM32F1 flash: a half-word is programmed if erased, erase sets a page to 0xFF.
+ * A power loss can be injected at any half-word or page operation: the half-word is then partly programmed
+ * (some of its 0 bits not cleared) and the page partly erased (random half-words erased, the others with bits set).
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -DUSE_HAL_DRIVER -DSTM32F103xB -ICore/Inc -IDrivers/STM32F1xx_HAL_Driver/Inc \
+ *       -IDrivers/CMSIS/Device/ST/STM32F1xx/Include -IDrivers/CMSIS/Include \
+ *       tests_scripts/store_sim.c Core/Src/store.c -o store_sim
+ *   ./store_sim [writes] [power loss trials]
+ *
+ * Reports:
+ * - writes: random updates of calibration structs of various sizes, each one read back, with a reboot every
+ *   100 writes. Half-words programmed per write, erases of each page (wear levelling), host time of store_read
+ *   and store_init,
+ * - power loss: a write cut at a random point, and the recovery at the next boot cut once more in half of the
+ *   trials. After the final boot, the written ID must have its old or its new value, the other IDs their value,
+ *   and the store must accept new writes.
+ */
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "stm32f1xx_hal.h"
+#include "store.h"
+
+#define STORE_BASE      (FLASH_BASE + STORE_PAGE_FIRST * FLASH_PAGE_SIZE)
+#define STORE_SIZE      (STORE_NB_PAGES * FLASH_PAGE_SIZE)
+#define MAP_BASE        (STORE_BASE & ~0xFFFU)
+#define MAP_SIZE        ((STORE_BASE + STORE_SIZE - MAP_BASE + 0xFFF) & ~0xFFFU)
+#define NB_STRUCT       6
+
+// Calibration structs: ADC offsets, hall table, motor R / L / flux, gains, throttle curve, spare
+static const uint16_t structSize[NB_STRUCT] = { 8, 12, 12, 24, 130, 251 };
+
+static struct {
+	uint32_t halfwords;
+	uint32_t erases[STORE_NB_PAGES];
+	uint32_t errors;                    // Programming of a half-word not erased
+	int32_t budget;                     // Operations before the power loss, -1 = none
+	uint32_t seed;
+} sim;
+static jmp_buf powerLoss;
+static uint16_t *flash;
+
+/* =========================== Flash model =========================== */
+
+static uint32_t sim_rand(void) {
+	sim.seed = sim.seed * 1103515245 + 12345;
+	return sim.seed >> 8;
+}
+
+/*
+ * Output: 1 if the power is lost at this operation
+ */
+static int sim_op(void) {
+	return sim.budget >= 0 && sim.budget-- == 0;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data) {
+	uint32_t k = (Address - STORE_BASE) / 2;
+
+	if (TypeProgram != FLASH_TYPEPROGRAM_HALFWORD || Address < STORE_BASE || Address >= STORE_BASE + STORE_SIZE
+			|| (Address & 1)) {
+		sim.errors++;
+		return HAL_ERROR;
+	}
+	if (flash[k] != 0xFFFF) {
+		sim.errors++;                               // PGERR: not erased
+		return HAL_ERROR;
+	}
+	if (sim_op()) {
+		flash[k] &= (uint16_t) Data | (uint16_t) sim_rand();
+		longjmp(powerLoss, 1);
+	}
+	flash[k] = (uint16_t) Data;
+	sim.halfwords++;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError) {
+	uint32_t page = (pEraseInit->PageAddress - STORE_BASE) / FLASH_PAGE_SIZE;
+	uint16_t *p = &flash[page * FLASH_PAGE_SIZE / 2];
+	uint32_t k;
+
+	*PageError = 0xFFFFFFFF;
+	if (pEraseInit->PageAddress < STORE_BASE || page >= STORE_NB_PAGES || pEraseInit->NbPages != 1) {
+		sim.errors++;
+		*PageError = pEraseInit->PageAddress;
+		return HAL_ERROR;
+	}
+	if (sim_op()) {
+		for (k = 0; k < FLASH_PAGE_SIZE / 2; k++) {
+			p[k] = (sim_rand() & 1) ? 0xFFFF : p[k] | (uint16_t) sim_rand();
+		}
+		longjmp(powerLoss, 1);
+	}
+	memset(p, 0xFF, FLASH_PAGE_SIZE);
+	sim.erases[page]++;
+	return HAL_OK;
+}
+
+/* =========================== Helpers =========================== */
+
+static uint8_t model[NB_STRUCT][256];   // Latest value written of each struct
+static uint8_t modelVersion[NB_STRUCT];
+
+/*
+ * Output: half-words programmed and pages erased so far
+ */
+static uint32_t operations(void) {
+	uint32_t page, n = sim.halfwords;
+
+	for (page = 0; page < STORE_NB_PAGES; page++) {
+		n += sim.erases[page];
+	}
+	return n;
+}
+
+static void format(void) {
+	uint32_t i;
+
+	memset(flash, 0xFF, STORE_SIZE);
+	memset(model, 0, sizeof(model));
+	memset(modelVersion, 0, sizeof(modelVersion));
+	sim.budget = -1;
+	store_init();
+	for (i = 0; i < NB_STRUCT; i++) {
+		store_write(i, 0, model[i], structSize[i]);
+	}
+}
+
+/*
+ * A calibration update: a few bytes of a struct changed, sometimes a new version
+ */
+static uint8_t update(uint8_t *id, uint8_t *version, uint8_t *data) {
+	uint32_t i, n;
+
+	*id = sim_rand() % NB_STRUCT;
+	*version = modelVersion[*id] + ((sim_rand() % 50) == 0);
+	memcpy(data, model[*id], structSize[*id]);
+	for (i = 0, n = 1 + sim_rand() % 4; i < n; i++) {
+		data[sim_rand() % structSize[*id]] = (uint8_t) sim_rand();
+	}
+	return store_write(*id, *version, data, structSize[*id]);
+}
+
+/*
+ * Output: number of structs not read back with the model value
+ */
+static uint32_t verify(void) {
+	uint8_t data[256];
+	uint32_t id, bad = 0;
+
+	for (id = 0; id < NB_STRUCT; id++) {
+		if (store_read(id, modelVersion[id], data, structSize[id]) != STORE_OK
+				|| memcmp(data, model[id], structSize[id]) != 0) {
+			bad++;
+		}
+	}
+	return bad;
+}
+
+static void fill(void) {
+	uint8_t id, version, data[256];
+	uint32_t i;
+
+	for (i = sim_rand() % 200; i > 0; i--) {
+		if (update(&id, &version, data) == STORE_OK) {
+			memcpy(model[id], data, structSize[id]);
+			modelVersion[id] = version;
+		}
+	}
+}
+
+static double now(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* =========================== Scenarios =========================== */
+
+static void writes(uint32_t n) {
+	uint8_t id, version, data[256];
+	uint32_t i, bad = 0, failed = 0, runs = 100000, live = 0;
+	double t0, tRead, tInit;
+
+	sim.seed = 1;
+	format();
+	memset(&sim.erases, 0, sizeof(sim.erases));
+	sim.halfwords = 0;
+	for (i = 0; i < n; i++) {
+		if (update(&id, &version, data) != STORE_OK) {
+			failed++;
+			continue;
+		}
+		memcpy(model[id], data, structSize[id]);
+		modelVersion[id] = version;
+		if (i % 100 == 99) {
+			store_init();                   // reboot
+		}
+		bad += (verify() != 0);
+	}
+	for (i = 0; i < NB_STRUCT; i++) {
+		live += 8 + ((structSize[i] + 1) & ~1U);
+	}
+	printf("writes: %u writes of %u structs (%u bytes live), %u failed, %u read back wrong, %u program errors\n",
+			(unsigned) n, NB_STRUCT, (unsigned) live, (unsigned) failed, (unsigned) bad, (unsigned) sim.errors);
+	printf("        %.1f half-words per write, erases per page:", (double) sim.halfwords / n);
+	for (i = 0; i < STORE_NB_PAGES; i++) {
+		printf(" %u", (unsigned) sim.erases[i]);
+	}
+	printf("\n");
+
+	t0 = now();
+	for (i = 0; i < runs; i++) {
+		store_read(i % NB_STRUCT, modelVersion[i % NB_STRUCT], data, structSize[i % NB_STRUCT]);
+	}
+	tRead = (now() - t0) / runs;
+	t0 = now();
+	for (i = 0; i < runs / 100; i++) {
+		store_init();
+	}
+	tInit = (now() - t0) / (runs / 100);
+	printf("        host: store_read %.1f ns, store_init %.1f us\n", tRead * 1e9, tInit * 1e6);
+}
+
+static void powerLossTrials(uint32_t trials) {
+	static uint8_t before[NB_STRUCT][256], beforeVersion[NB_STRUCT];
+	static uint32_t bad, reverted, applied, stuck, collections, recutTrials, t;      // kept across the longjmp
+	static uint8_t id, version, data[256];
+	static uint16_t image[STORE_SIZE / 2];
+	uint8_t read[256];
+	uint32_t i, ops, seq;
+
+	for (t = 0; t < trials; t++) {
+		sim.seed = t * 7919 + 3;
+		format();
+		fill();
+		memcpy(before, model, sizeof(before));
+		memcpy(beforeVersion, modelVersion, sizeof(beforeVersion));
+
+		// Operations of the next write, then the same write cut at a random point
+		seq = sim.seed;
+		memcpy(image, flash, STORE_SIZE);
+		ops = operations();
+		i = storeErases;
+		update(&id, &version, data);
+		ops = operations() - ops;
+		collections += (storeErases != i);
+		memcpy(flash, image, STORE_SIZE);
+		store_init();
+		if (ops == 0) {
+			continue;
+		}
+		sim.seed = seq;
+		sim.budget = (int32_t) (((seq * 2654435761U) >> 8) % ops);
+		if (setjmp(powerLoss) == 0) {
+			update(&id, &version, data);
+		}
+
+		// Reboot, cut once more in half of the trials, then a clean reboot
+		sim.budget = (t & 1) ? (int32_t) (sim_rand() % 4) : -1;
+		if (setjmp(powerLoss) == 0) {
+			store_init();
+		} else {
+			recutTrials++;
+		}
+		sim.budget = -1;
+		store_init();
+
+		for (i = 0; i < NB_STRUCT; i++) {
+			if (i == id && store_read(i, version, read, structSize[i]) == STORE_OK
+					&& memcmp(read, data, structSize[i]) == 0) {
+				continue;
+			}
+			if (store_read(i, beforeVersion[i], read, structSize[i]) != STORE_OK
+					|| memcmp(read, before[i], structSize[i]) != 0) {
+				break;
+			}
+		}
+		if (i < NB_STRUCT) {
+			bad++;
+			continue;
+		}
+		if (store_read(id, version, read, structSize[id]) == STORE_OK && memcmp(read, data, structSize[id]) == 0
+				&& (version != beforeVersion[id] || memcmp(data, before[id], structSize[id]) != 0)) {
+			applied++;
+			memcpy(model[id], data, structSize[id]);
+			modelVersion[id] = version;
+		} else {
+			reverted++;
+			memcpy(model, before, sizeof(model));
+			memcpy(modelVersion, beforeVersion, sizeof(modelVersion));
+		}
+
+		// The store goes on
+		for (i = 0; i < 100; i++) {
+			if (update(&id, &version, data) == STORE_OK) {
+				memcpy(model[id], data, structSize[id]);
+				modelVersion[id] = version;
+			}
+		}
+		store_init();
+		stuck += (verify() != 0);
+	}
+	printf("power loss: %u trials (%u in a page change, %u recovery cut): %u reverted, %u applied, %u corrupted, "
+			"%u failing after\n", (unsigned) trials, (unsigned) collections, (unsigned) recutTrials,
+			(unsigned) reverted, (unsigned) applied, (unsigned) bad, (unsigned) stuck);
+}
+
+int main(int argc, char **argv) {
+	uint32_t n = (argc > 1) ? (uint32_t) atoi(argv[1]) : 20000;
+	uint32_t trials = (argc > 2) ? (uint32_t) atoi(argv[2]) : 20000;
+
+	flash = mmap((void*) (uintptr_t) MAP_BASE, MAP_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (flash != (uint16_t*) (uintptr_t) MAP_BASE) {
+		perror("mmap at the store address");
+		return 1;
+	}
+	flash += (STORE_BASE - MAP_BASE) / 2;
+
+	printf("%u pages of %u bytes\n", STORE_NB_PAGES, (unsigned) FLASH_PAGE_SIZE);
+	writes(n);
+	powerLossTrials(trials);
+	return 0;
+}
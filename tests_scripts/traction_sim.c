@@ -0,0 +1,225 @@
+/*
+ * Host simulation of the traction control (Core/Src/traction.c) against a wheel / road friction model.
+ *
+ * The firmware traction.c is included as is, after config.h: a TRACTION_xxx tuning value can be overridden with
+ * -DSIM_TRACTION_xxx=value to compare settings without editing config.h. traction_step is called at PWM_FREQ
+ * with the torque request and the hall speed, as in the FOC interrupt.
+ *
+ * Model (hub motor scooter, one driven wheel):
+ * - torque: request / 1000 * TRACTION_TORQUE_MAX, first order lag of the current loop (2 ms)
+ * - wheel: inertia 0.015 kg.m^2, radius TRACTION_WHEEL_RADIUS, load 60 % of TRACTION_MASS
+ * - tyre: longitudinal force N * mu * sin(1.6 * atan(10 * slip)), peak at 15 % slip, 70 % of the peak when
+ *   sliding. Slip = (wheel speed - vehicle speed) / max(|wheel speed|, |vehicle speed|, 1 m/s)
+ * - vehicle: TRACTION_MASS, rolling resistance 1 %, aero drag 0.3 m^2
+ * - hall speed as the controller output Divide11: 6 * 15 pole pairs edges per revolution, period counted in PWM
+ *   periods and saturated at z_maxCntRst, mean of the last 4 periods out of the speed transitions, and held between
+ *   the edges
+ *
+ * Build and run from the repository root:
+ *   gcc -O2 -DUSE_HAL_DRIVER -DSTM32F103xB -ICore/Inc -IDrivers/STM32F1xx_HAL_Driver/Inc \
+ *       -IDrivers/CMSIS/Device/ST/STM32F1xx/Include -IDrivers/CMSIS/Include \
+ *       tests_scripts/traction_sim.c -lm -o traction_sim
+ *   ./traction_sim [scenario]
+ *
+ * Each scenario runs without and with the traction control. Reports: speed at the end, distance, peak slip,
+ * time above 30 % slip (wheel spinning or locked), slip events of the detector. On a dry road the detector must
+ * not fire (false cut = lost acceleration); on low grip it must keep the slip low and the acceleration close to
+ * the grip limit.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "config.h"
+
+#ifdef SIM_TRACTION_SLIP_GAIN
+#undef TRACTION_SLIP_GAIN
+#define TRACTION_SLIP_GAIN SIM_TRACTION_SLIP_GAIN
+#endif
+#ifdef SIM_TRACTION_SLIP_MARGIN
+#undef TRACTION_SLIP_MARGIN
+#define TRACTION_SLIP_MARGIN SIM_TRACTION_SLIP_MARGIN
+#endif
+#ifdef SIM_TRACTION_NOISE_GAIN
+#undef TRACTION_NOISE_GAIN
+#define TRACTION_NOISE_GAIN SIM_TRACTION_NOISE_GAIN
+#endif
+#ifdef SIM_TRACTION_SPEED_MIN
+#undef TRACTION_SPEED_MIN
+#define TRACTION_SPEED_MIN SIM_TRACTION_SPEED_MIN
+#endif
+#ifdef SIM_TRACTION_SLIP_CONFIRM
+#undef TRACTION_SLIP_CONFIRM
+#define TRACTION_SLIP_CONFIRM SIM_TRACTION_SLIP_CONFIRM
+#endif
+#ifdef SIM_TRACTION_CUT_LEVEL
+#undef TRACTION_CUT_LEVEL
+#define TRACTION_CUT_LEVEL SIM_TRACTION_CUT_LEVEL
+#endif
+#ifdef SIM_TRACTION_HOLD
+#undef TRACTION_HOLD
+#define TRACTION_HOLD SIM_TRACTION_HOLD
+#endif
+#ifdef SIM_TRACTION_RESTORE
+#undef TRACTION_RESTORE
+#define TRACTION_RESTORE SIM_TRACTION_RESTORE
+#endif
+
+#include "../Core/Src/traction.c"
+
+P rtP_Left;                             // n_polePairs only
+
+#define SIM_DT          (1.0 / PWM_FREQ)    // [s] FOC period
+#define SIM_SUBSTEPS    10                  // [-] Tyre integration steps per FOC period
+#define SIM_G           9.81
+#define SIM_J_WHEEL     0.015               // [kg.m^2]
+#define SIM_LOAD        0.6                 // [-] Share of the weight on the driven wheel
+#define SIM_TAU_TORQUE  0.002               // [s] Current loop
+#define SIM_POLE_PAIRS  15
+#define SIM_EDGES       (6 * SIM_POLE_PAIRS)
+#define SIM_SPEED_COEF  10667               // [-] cf_speedCoef (BLDC_controller_data.c): rpm * PWM periods per edge
+#define SIM_CNT_MAX     2000                // [-] z_maxCntRst
+#define SIM_TRNS_HI     40                  // [-] dz_cntTrnsDetHi
+#define SIM_TRNS_LO     20                  // [-] dz_cntTrnsDetLo
+
+typedef struct {
+	const char *name;
+	double duration;                    // [s]
+	double v0;                          // [km/h] Initial speed, wheel rolling without slip
+	double (*mu)(double t, double x);   // [-] Peak friction at time t and position x
+	double (*load)(double t);           // [-] Normal load factor (0 = wheel in the air)
+	int16_t (*request)(double t);       // [-] Torque request -1000 .. 1000
+} scenario_t;
+
+typedef struct {
+	double v, x, maxSlip, slipTime;
+	uint32_t events;
+} result_t;
+
+/* =========================== Roads and riders =========================== */
+
+static double muDry(double t, double x) { (void) t; (void) x; return 1.0; }
+static double muWet(double t, double x) { (void) t; (void) x; return 0.5; }
+static double muGravel(double t, double x) { (void) t; (void) x; return 0.3; }
+static double muIce(double t, double x) { (void) t; (void) x; return 0.1; }
+static double muIcePatch(double t, double x) { (void) t; return (x > 6.0 && x < 10.0) ? 0.1 : 1.0; }
+static double loadFull(double t) { (void) t; return 1.0; }
+static double loadJump(double t) { return (t > 1.0 && t < 1.08) ? 0.0 : 1.0; }
+static double loadBumps(double t) { return 1.0 + 0.5 * sin(2 * M_PI * 12 * t); }
+static int16_t reqFull(double t) { (void) t; return 1000; }
+static int16_t reqRamp(double t) { return (int16_t) (t < 1.0 ? 1000 * t : 1000); }
+static int16_t reqPulses(double t) { return (fmod(t, 0.5) < 0.25) ? 1000 : 0; }
+static int16_t reqBrake(double t) { (void) t; return -1000; }
+
+static const scenario_t scenarios[] = {
+	{ "launch dry",             3.0, 0,  muDry,      loadFull,  reqFull },
+	{ "throttle ramp dry",      3.0, 0,  muDry,      loadFull,  reqRamp },
+	{ "throttle pulses dry",    3.0, 5,  muDry,      loadFull,  reqPulses },
+	{ "launch dry, bumps",      3.0, 0,  muDry,      loadBumps, reqFull },
+	{ "launch wet",             3.0, 0,  muWet,      loadFull,  reqFull },
+	{ "launch gravel",          3.0, 0,  muGravel,   loadFull,  reqFull },
+	{ "launch ice",             3.0, 0,  muIce,      loadFull,  reqFull },
+	{ "ice patch at speed",     3.0, 10, muIcePatch, loadFull,  reqFull },
+	{ "wheel in the air 80 ms", 2.0, 15, muDry,      loadJump,  reqFull },
+	{ "brake on ice",           1.5, 20, muIce,      loadFull,  reqBrake },
+};
+
+/* =========================== Model =========================== */
+
+static double tyreForce(double slip, double mu, double load) {
+	return load * mu * sin(1.6 * atan(10.0 * slip));
+}
+
+static result_t run(const scenario_t *sc, int tcEnable) {
+	const double r = TRACTION_WHEEL_RADIUS / 1000.0;
+	const double edge = 2 * M_PI / SIM_EDGES;
+	double v = sc->v0 / 3.6, w = v / r, x = 0, torque = 0, angle = 0;
+	double t, slip, ref, force, n;
+	int32_t cnt = 0, cntPrev[4], cntSum, i;
+	int64_t edgeIdx = 0;
+	int16_t req, cmd, hall;
+	uint8_t trns = 0;
+	int k;
+	result_t res = { 0 };
+
+	// Hall speed of the initial rolling speed, already settled (counter saturated at standstill)
+	for (i = 0; i < 4; i++) {
+		cntPrev[i] = (w > 0) ? MIN(SIM_CNT_MAX, (int32_t) lround(SIM_SPEED_COEF / (w * 60 / (2 * M_PI)))) : SIM_CNT_MAX;
+	}
+	hall = (w > 0) ? (int16_t) ((SIM_SPEED_COEF << 4) / cntPrev[0]) : 0;
+
+	traction_reset();
+	tractionSlipCnt = 0;
+	for (t = 0; t < sc->duration; t += SIM_DT) {
+		req = sc->request(t);
+		cmd = tcEnable ? traction_step(req, hall) : req;
+		torque += (cmd / 1000.0 * TRACTION_TORQUE_MAX / 10.0 - torque) * SIM_DT / SIM_TAU_TORQUE;
+
+		n = TRACTION_MASS * SIM_G * SIM_LOAD * sc->load(t);
+		for (k = 0; k < SIM_SUBSTEPS; k++) {
+			ref = fmax(fmax(fabs(w * r), fabs(v)), 1.0);
+			slip = (w * r - v) / ref;
+			force = tyreForce(slip, sc->mu(t, x), n);
+			w += (torque - force * r) / SIM_J_WHEEL * SIM_DT / SIM_SUBSTEPS;
+			v += (force - (v > 0 ? 1 : -1) * (0.01 * TRACTION_MASS * SIM_G + 0.5 * 1.2 * 0.3 * v * v)) / TRACTION_MASS
+					* SIM_DT / SIM_SUBSTEPS;
+			v = fmax(v, 0);             // no reverse: the brake stops the wheel and the vehicle
+			w = fmax(w, 0);
+			x += v * SIM_DT / SIM_SUBSTEPS;
+		}
+
+		// Hall edges: period counter in PWM periods, speed updated on the edges only (Divide11)
+		angle += w * SIM_DT;
+		cnt = MIN(cnt + 1, SIM_CNT_MAX);
+		while (floor(angle / edge) > edgeIdx) {
+			edgeIdx++;
+			if (ABS(cnt - cntPrev[0]) >= SIM_TRNS_HI) {
+				trns = 1;
+			} else if (ABS(cnt - cntPrev[0]) <= SIM_TRNS_LO) {
+				trns = 0;
+			}
+			memmove(&cntPrev[1], &cntPrev[0], 3 * sizeof(cntPrev[0]));
+			cntPrev[0] = cnt;
+			cntSum = cntPrev[0] + cntPrev[1] + cntPrev[2] + cntPrev[3];
+			hall = (int16_t) (trns ? (SIM_SPEED_COEF << 4) / cnt : ((SIM_SPEED_COEF << 2) << 4) / cntSum);
+			cnt = 0;
+		}
+
+		slip = (w * r - v) / fmax(fmax(fabs(w * r), fabs(v)), 1.0);
+		res.maxSlip = fmax(res.maxSlip, fabs(slip));
+		if (fabs(slip) > 0.3 && sc->load(t) > 0) {
+			res.slipTime += SIM_DT;
+		}
+	}
+	res.v = v * 3.6;
+	res.x = x;
+	res.events = tractionSlipCnt;
+	return res;
+}
+
+int main(int argc, char **argv) {
+	unsigned i, only = (argc > 1) ? (unsigned) atoi(argv[1]) : 0;
+	result_t off, on;
+
+	rtP_Left.n_polePairs = SIM_POLE_PAIRS;
+
+	printf("TRACTION_SLIP_GAIN %d, SLIP_MARGIN %d rpm/s, NOISE_GAIN %d, SPEED_MIN %d rpm, SLIP_CONFIRM %d ms, CUT_LEVEL %d %%, "
+			"HOLD %d ms, RESTORE %d ms\n", TRACTION_SLIP_GAIN, TRACTION_SLIP_MARGIN, TRACTION_NOISE_GAIN, TRACTION_SPEED_MIN,
+			TRACTION_SLIP_CONFIRM, TRACTION_CUT_LEVEL, TRACTION_HOLD, TRACTION_RESTORE);
+	printf("%-24s | %-34s | %-42s\n", "", "without traction control", "with traction control");
+	printf("%-24s | %7s %6s %8s %9s | %7s %6s %8s %9s %6s\n", "scenario", "km/h", "m", "max slip", "slip>30%",
+			"km/h", "m", "max slip", "slip>30%", "events");
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		if (only && only != i + 1) {
+			continue;
+		}
+		off = run(&scenarios[i], 0);
+		on = run(&scenarios[i], 1);
+		printf("%-24s | %7.1f %6.1f %7.0f%% %7.0fms | %7.1f %6.1f %7.0f%% %7.0fms %6u\n", scenarios[i].name,
+				off.v, off.x, off.maxSlip * 100, off.slipTime * 1000, on.v, on.x, on.maxSlip * 100,
+				on.slipTime * 1000, (unsigned) on.events);
+	}
+	return 0;
+}